@@ -25,42 +25,363 @@
 //
 //------------------------------------------------------------------------------
 #include "stdafx.h"
+#include "PeVersion.h"
+#include "getopt.h"
+#include "smrthandle.h"
+#include "ThreadPool.h"
 
 //------------------------------------------------------------------------------
-int _tmain(int argc, _TCHAR* argv[])
+namespace
+{
+    // file of a batch
+    struct Entry
+    {
+        tstring             path;           // path as found
+        ULONGLONG           size;           // file size
+        PeVersion           version;        // version resource
+        bool                versioned;      // file has a version resource
+    };
+
+    typedef std::vector<Entry> Entries;
+}
+
+//------------------------------------------------------------------------------
+// Print usage
+//------------------------------------------------------------------------------
+static void usage()
+{
+    tcerr << _T("usage: getversion [VER] FILE") << std::endl
+          << _T("       getversion [-a] [-r] [-j JOBS] [-l LISTFILE] [-o MANIFEST] [PATH...]") << std::endl
+          << std::endl
+          << _T("-a --all              also list files without a version resource") << std::endl
+          << _T("-r --recurse          match wildcards in subdirectories, too") << std::endl
+          << _T("-j --jobs=JOBS        number of threads (default: one per logical processor)") << std::endl
+          << _T("-l --list=LISTFILE    read paths from LISTFILE, one per line in UTF-8 (\"-\": standard input)") << std::endl
+          << _T("-o --output=MANIFEST  write the manifest to MANIFEST (default: standard output)") << std::endl;
+}
+
+//------------------------------------------------------------------------------
+// Convert to UTF-8, for the manifest
+//------------------------------------------------------------------------------
+static std::string toUtf8(const tstring& text)
+{
+#ifdef _UNICODE
+    int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()), NULL, 0, NULL, NULL);
+    std::string utf8(len, '\0');
+    if (len > 0)
+        WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()), &utf8[0], len, NULL, NULL);
+    return utf8;
+#else
+    return text;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Convert from UTF-8, for list files
+//------------------------------------------------------------------------------
+static tstring fromUtf8(const std::string& text)
+{
+#ifdef _UNICODE
+    int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()), NULL, 0);
+    std::wstring wide(len, L'\0');
+    if (len > 0)
+        MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.length()), &wide[0], len);
+    return wide;
+#else
+    return text;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Add the files of dir matching pattern, and with recurse those of its
+// subdirectories (dir is empty or ends with a path separator)
+//------------------------------------------------------------------------------
+static void addFiles(const tstring& dir, const tstring& pattern, bool recurse, Entries& files)
+{
+    tstring findMask = dir + pattern;
+    WIN32_FIND_DATA ffd;
+    HANDLE hFirst = FindFirstFileEx(findMask.c_str(), FindExInfoBasic, &ffd, 
+                                    FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFirst != INVALID_HANDLE_VALUE)
+    {
+        SmrtFindHandle hFind(hFirst);
+        do
+        {
+            if ((ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+            {
+                Entry entry;
+                entry.path = dir + ffd.cFileName;
+                entry.size = (static_cast<ULONGLONG>(ffd.nFileSizeHigh) << 32) | ffd.nFileSizeLow;
+                entry.versioned = false;
+                files.push_back(entry);
+            }
+        } 
+        while (FindNextFile(hFind, &ffd));
+    }
+
+    if (!recurse)
+        return;
+
+    // subdirectories, except for junctions and links, which may form cycles
+    findMask = dir + _T("*");
+    hFirst = FindFirstFileEx(findMask.c_str(), FindExInfoBasic, &ffd, 
+                             FindExSearchLimitToDirectories, NULL, FIND_FIRST_EX_LARGE_FETCH);
+    if (hFirst != INVALID_HANDLE_VALUE)
+    {
+        SmrtFindHandle hFind(hFirst);
+        do
+        {
+            if ((ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0
+                && (ffd.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0
+                && _tcscmp(ffd.cFileName, _T(".")) != 0 && _tcscmp(ffd.cFileName, _T("..")) != 0)
+            {
+                addFiles(dir + ffd.cFileName + _T("\\"), pattern, true, files);
+            }
+        } 
+        while (FindNextFile(hFind, &ffd));
+    }
+}
+
+//------------------------------------------------------------------------------
+// Add a file, the files of a directory tree, or the files matching a
+// wildcard pattern (returns false if nothing was found)
+//------------------------------------------------------------------------------
+static bool addPath(const tstring& path, bool recurse, Entries& files)
+{
+    size_t count = files.size();
+    size_t sep = path.find_last_of(_T("\\/:"));
+    tstring name = sep == tstring::npos ? path : path.substr(sep + 1);
+
+    if (name.find_first_of(_T("*?")) != tstring::npos)
+    {
+        addFiles(path.substr(0, name.length() < path.length() ? sep + 1 : 0), name, recurse, files);
+        return files.size() > count;
+    }
+
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data))
+        return false;
+
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+    {
+        tstring dir = path;
+        if (dir.find_last_of(_T("\\/:")) != dir.length() - 1)
+            dir += _T("\\");
+
+        addFiles(dir, _T("*"), true, files);
+        return true;
+    }
+
+    Entry entry;
+    entry.path = path;
+    entry.size = (static_cast<ULONGLONG>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    entry.versioned = false;
+    files.push_back(entry);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Read the paths of a UTF-8 list file (empty lines and a byte order mark are ignored)
+//------------------------------------------------------------------------------
+static bool readList(const tstring& listPath, std::vector<tstring>& paths)
+{
+    std::ifstream file;
+    if (listPath != _T("-"))
+    {
+        file.open(listPath.c_str());
+        if (!file)
+            return false;
+    }
+
+    std::istream& in = listPath != _T("-") ? file : std::cin;
+    std::string line;
+    for (bool first = true; std::getline(in, line); first = false)
+    {
+        if (first && line.compare(0, 3, "\xEF\xBB\xBF") == 0)
+            line.erase(0, 3);
+        if (!line.empty() && line[line.length() - 1] == '\r')
+            line.erase(line.length() - 1);
+
+        if (!line.empty())
+            paths.push_back(fromUtf8(line));
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+//
+// Write a version manifest
+//
+// Collects the files given by paths, directories (scanned recursively),
+// wildcard patterns and list files, reads their version resources on a
+// thread pool and writes one tab separated line per file, in the order the
+// files were found: path, file version, product version, language and
+// size. Directories are listed with large fetches, so that the sizes come
+// with the listing, and each file is only mapped for the few pages of its
+// headers and version resource.
+//
+//------------------------------------------------------------------------------
+static int writeManifest(std::vector<tstring>& paths, const tstring& listPath, const tstring& outputPath,
+                         unsigned jobs, bool recurse, bool all)
 {
-    if (argc < 2 || argc > 3)
+    if (!listPath.empty() && !readList(listPath, paths))
+    {
+        tcerr << _T("Unable to read '") << listPath << _T("'") << std::endl;
         return -1;
+    }
 
-    _TCHAR* path = argv[1];
-    int a = 0, b = 0, c = 0, d = 0;
-    if (argc == 3)
+    int result = 0;
+    Entries files;
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        if (!addPath(paths[i], recurse, files))
+        {
+            tcerr << _T("No such file: '") << paths[i] << _T("'") << std::endl;
+            result = 1;
+        }
+    }
+
+    ThreadPool pool(jobs);
+    pool.forEach(files.size(), [&](size_t i)
+    {
+        files[i].versioned = readPeVersion(files[i].path, files[i].version);
+    });
+
+    std::ofstream file;
+    if (!outputPath.empty())
+    {
+        file.open(outputPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            tcerr << _T("Unable to write '") << outputPath << _T("'") << std::endl;
+            return -1;
+        }
+    }
+
+    std::ostream& out = outputPath.empty() ? std::cout : file;
+    out << "path\tfileversion\tproductversion\tlanguage\tsize\n";
+    for (Entries::const_iterator it = files.begin(); it != files.end(); ++it)
+    {
+        if (!it->versioned && !all)
+            continue;
+
+        out << toUtf8(it->path) << "\t";
+        if (it->versioned)
+        {
+            out << formatVersion(it->version.fileVersion) << "\t" 
+                << formatVersion(it->version.productVersion) << "\t" 
+                << it->version.language;
+        }
+        else
+        {
+            out << "\t\t";
+        }
+        out << "\t" << it->size << "\n";
+    }
+
+    out.flush();
+    if (!out)
+    {
+        tcerr << _T("Unable to write '") << (outputPath.empty() ? _T("standard output") : outputPath.c_str()) << _T("'") << std::endl;
+        return -1;
+    }
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+int _tmain(int argc, _TCHAR* argv[])
+{
+    // short option string (option letters followed by a colon ':' require an argument)
+    static const _TCHAR optstring[] = _T("arj:l:o:");
+
+    // mapping of long to short arguments
+    static const Option longopts[] = 
+    {
+        { _T("all"),                no_argument,        NULL,   _T('a') },
+        { _T("recurse"),            no_argument,        NULL,   _T('r') },
+        { _T("jobs"),               required_argument,  NULL,   _T('j') },
+        { _T("list"),               required_argument,  NULL,   _T('l') },
+        { _T("output"),             required_argument,  NULL,   _T('o') },
+        { NULL,                     0,                  NULL,   0       }
+    };
+
+    bool batch = false;
+    bool all = false;
+    bool recurse = false;
+    unsigned jobs = 0;
+    tstring listPath;
+    tstring outputPath;
+
+    int longIdx = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, optstring, longopts, &longIdx)) != -1) 
     {
-        if (_stscanf_s(argv[1], _T("%d.%d.%d.%d"), &a, &b, &c, &d) != 4)
+        batch = true;
+        switch (opt) 
+        {
+        case _T('a'):
+            all = true;
+            break;
+
+        case _T('r'):
+            recurse = true;
+            break;
+
+        case _T('j'):
+            jobs = _ttoi(optarg);
+            break;
+
+        case _T('l'):
+            listPath = optarg;
+            break;
+
+        case _T('o'):
+            outputPath = optarg;
+            break;
+
+        default:
+            usage();
             return -1;
+        }
+    }
 
-        path = argv[2];
+    std::vector<tstring> paths(argv + optind, argv + argc);
+    if (paths.empty() && listPath.empty())
+    {
+        usage();
+        return -1;
     }
 
-    DWORD dw; 
-    DWORD len = GetFileVersionInfoSize(path, &dw );
-    if (len == 0) return -1;
+    // a single file, optionally preceded by a version to add
+    int a = 0, b = 0, c = 0, d = 0;
+    size_t count = paths.size();
+    if (!batch && (count == 1 || (count == 2 && _stscanf_s(paths[0].c_str(), _T("%d.%d.%d.%d"), &a, &b, &c, &d) == 4)))
+    {
+        const tstring& path = paths[count - 1];
+        DWORD attributes = GetFileAttributes(path.c_str());
+        batch = (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+            || path.find_first_of(_T("*?")) != tstring::npos;
+    }
+    else
+    {
+        batch = true;
+    }
 
-    std::vector<_TCHAR> buf(len);
-    GetFileVersionInfo(path, 0, len, &buf[0]);
-    unsigned int vlen;
-    LPVOID lpvi;
-    VerQueryValue(&buf[0], _T("\\"), &lpvi, &vlen);
+    if (batch)
+        return writeManifest(paths, listPath, outputPath, jobs, recurse, all);
+
+    PeVersion version;
+    if (!readPeVersion(paths[count - 1], version))
+        return -1;
 
-    VS_FIXEDFILEINFO fileInfo;
-    fileInfo = *reinterpret_cast<VS_FIXEDFILEINFO*>(lpvi);
     tostringstream s;
-    s << a + (unsigned)HIWORD(fileInfo.dwFileVersionMS) << _T(".")
-      << b + (unsigned)LOWORD(fileInfo.dwFileVersionMS) << _T(".")
-      << c + (unsigned)HIWORD(fileInfo.dwFileVersionLS) << _T(".")
-      << d + (unsigned)LOWORD(fileInfo.dwFileVersionLS);
+    s << a + version.fileVersion[0] << _T(".")
+      << b + version.fileVersion[1] << _T(".")
+      << c + version.fileVersion[2] << _T(".")
+      << d + version.fileVersion[3];
 
     tcout << s.str() << std::endl;
     return 0;
 }
-
@@ -30,21 +30,7 @@
 #include <windows.h>
 #include <tchar.h>
 #include <iostream>
+#include <fstream>
 #include <vector>
-#include <sstream>
 #include <string.h>
-
-//------------------------------------------------------------------------------
-// Define UNICODE aware classes
-//------------------------------------------------------------------------------
-typedef std::basic_istringstream<_TCHAR> tistringstream;
-typedef std::basic_ostringstream<_TCHAR> tostringstream;
-typedef std::vector<_TCHAR> tcharvector;
-#ifdef UNICODE
-#define tcerr std::wcerr
-#define tcout std::wcout
-#else
-#define tcerr std::cerr
-#define tcout std::cout
-#endif
-
+#include "tstring.h"
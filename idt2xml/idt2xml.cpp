@@ -0,0 +1,1581 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "idt2xml.h"
+#include "Codepage.h"
+#include "Idt.h"
+#include "MsiWriter.h"
+#include "ScratchFile.h"
+#include "XmlReader.h"
+#include "XmlWriter.h"
+#include "base64.h"
+#include "getopt.h"
+#include "md5.h"
+#include <algorithm>
+#include <ctype.h>
+#include <errno.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+#include <time.h>
+#include <vector>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#define stat _stat
+#else
+#include <dirent.h>
+#include <strings.h>
+#define _stricmp strcasecmp
+#endif
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+// Binary stream chunk size and corresponding size of base64 encoded data
+//------------------------------------------------------------------------------
+#define CHUNK_BIN     54
+#define CHUNK_BASE64  (4 * CHUNK_BIN / 3 + 1)
+
+//------------------------------------------------------------------------------
+namespace
+{
+#ifdef _WIN32
+    const char          PATH_SEP            = '\\';
+#else
+    const char          PATH_SEP            = '/';
+#endif
+
+    // summary information tags, by property ID - 1
+    const char* const   SUMMARY_TAGS[19]    =
+    {
+        "codepage", 
+        "title", 
+        "subject",
+        "author", 
+        "keywords", 
+        "comments",
+        "template", 
+        "lastauthor", 
+        "revnumber",
+        "__unused__", 
+        "lastprinted", 
+        "createdtm",
+        "lastsavedtm", 
+        "pagecount", 
+        "wordcount",
+        "charcount", 
+        "__unused__", 
+        "appname",
+        "security"
+    };
+
+    // comment and document type declaration of msi2xml/template_dt.xml
+    const char          PROLOG[]            =
+        "<!--\n"
+        "      XML Dump of Windows Installer Database\n"
+        "      Created with idt2xml\n"
+        "-->\n"
+        "\n"
+        "<!DOCTYPE msi [\n"
+        "   <!ELEMENT msi   (summary,table*)>\n"
+        "   <!ATTLIST msi version    CDATA #REQUIRED\n"
+        "                 xmlns:dt   CDATA #IMPLIED\n"
+        "                 msm        (yes|no) \"no\"\n"
+        "                 codepage   CDATA #IMPLIED\n"
+        "                 compression CDATA \"LZX\">\n"
+        "   \n"
+        "   <!ELEMENT summary       (codepage?,title?,subject?,author?,keywords?,comments?,\n"
+        "                            template,lastauthor?,revnumber,lastprinted?,\n"
+        "                            createdtm?,lastsavedtm?,pagecount,wordcount,\n"
+        "                            charcount?,appname?,security?)>\n"
+        "                            \n"
+        "   <!ELEMENT codepage      (#PCDATA)>\n"
+        "   <!ELEMENT title         (#PCDATA)>\n"
+        "   <!ELEMENT subject       (#PCDATA)>\n"
+        "   <!ELEMENT author        (#PCDATA)>\n"
+        "   <!ELEMENT keywords      (#PCDATA)>\n"
+        "   <!ELEMENT comments      (#PCDATA)>\n"
+        "   <!ELEMENT template      (#PCDATA)>\n"
+        "   <!ELEMENT lastauthor    (#PCDATA)>\n"
+        "   <!ELEMENT revnumber     (#PCDATA)>\n"
+        "   <!ELEMENT lastprinted   (#PCDATA)>\n"
+        "   <!ELEMENT createdtm     (#PCDATA)>\n"
+        "   <!ELEMENT lastsavedtm   (#PCDATA)>\n"
+        "   <!ELEMENT pagecount     (#PCDATA)>\n"
+        "   <!ELEMENT wordcount     (#PCDATA)>\n"
+        "   <!ELEMENT charcount     (#PCDATA)>\n"
+        "   <!ELEMENT appname       (#PCDATA)>\n"
+        "   <!ELEMENT security      (#PCDATA)>\n"
+        "                                \n"
+        "   <!ELEMENT table         (col+,row*)>\n"
+        "   <!ATTLIST table\n"
+        "                name        CDATA #REQUIRED\n"
+        "                rows        CDATA #IMPLIED\n"
+        "                bytes       CDATA #IMPLIED>\n"
+        "\n"
+        "   <!ELEMENT col           (#PCDATA)>\n"
+        "   <!ATTLIST col\n"
+        "                 key       (yes|no) #IMPLIED\n"
+        "                 def       CDATA #IMPLIED>\n"
+        "                 \n"
+        "   <!ELEMENT row            (td+)>\n"
+        "   \n"
+        "   <!ELEMENT td             (#PCDATA)>\n"
+        "   <!ATTLIST td\n"
+        "                 href       CDATA #IMPLIED\n"
+        "                 dt:dt     (string|bin.base64) #IMPLIED\n"
+        "                 md5        CDATA #IMPLIED\n"
+        "                 size       CDATA #IMPLIED>\n"
+        "]>\n"
+        "\n";
+
+    //--------------------------------------------------------------------------
+    string joinPath(const string& dir, const string& name)
+    {
+        if (dir.empty() || dir[dir.size() - 1] == '\\' || dir[dir.size() - 1] == '/')
+            return dir + name;
+        return dir + PATH_SEP + name;
+    }
+
+    //--------------------------------------------------------------------------
+    // folder part of a path, including the trailing separator
+    string dirPart(const string& path)
+    {
+        size_t pos = path.find_last_of("\\/");
+        return pos == string::npos ? string() : path.substr(0, pos + 1);
+    }
+
+    //--------------------------------------------------------------------------
+    // file name part of a path, without extension
+    string baseName(string path)
+    {
+        while (!path.empty() && (path[path.size() - 1] == '\\' || path[path.size() - 1] == '/'))
+            path.erase(path.size() - 1);
+
+        path = path.substr(path.find_last_of("\\/") + 1);
+        size_t dot = path.rfind('.');
+        return dot == string::npos || dot == 0 ? path : path.substr(0, dot);
+    }
+
+    //--------------------------------------------------------------------------
+    bool isAbsolute(const string& path)
+    {
+        return (!path.empty() && (path[0] == '\\' || path[0] == '/'))
+            || (path.size() > 1 && path[1] == ':');
+    }
+
+    //--------------------------------------------------------------------------
+    bool isDirectory(const string& path)
+    {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IFDIR) != 0;
+    }
+
+    //--------------------------------------------------------------------------
+    void makeDir(const string& path)
+    {
+        if (!isDirectory(path) && mkdir(path.c_str(), 0777) != 0 && errno != EEXIST)
+            throw runtime_error("Cannot create folder \"" + path + "\"");
+    }
+
+    //--------------------------------------------------------------------------
+    // names of the .idt files of a folder
+    vector<string> listIdtFiles(const string& dir)
+    {
+        vector<string> files;
+#ifdef _WIN32
+        WIN32_FIND_DATAA data;
+        HANDLE hFind = FindFirstFileA(joinPath(dir, "*.idt").c_str(), &data);
+        if (hFind == INVALID_HANDLE_VALUE)
+            return files;
+
+        do
+        {
+            if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+                files.push_back(data.cFileName);
+        } while (FindNextFileA(hFind, &data));
+        FindClose(hFind);
+#else
+        DIR* d = opendir(dir.c_str());
+        if (d == 0)
+            throw runtime_error("Cannot open folder \"" + dir + "\"");
+
+        while (struct dirent* entry = readdir(d))
+        {
+            size_t len = strlen(entry->d_name);
+            if (len > 4 && _stricmp(entry->d_name + len - 4, ".idt") == 0
+                && !isDirectory(joinPath(dir, entry->d_name)))
+            {
+                files.push_back(entry->d_name);
+            }
+        }
+        closedir(d);
+#endif
+        return files;
+    }
+
+    //--------------------------------------------------------------------------
+    bool isSpace(const string& text)
+    {
+        for (string::const_iterator it = text.begin(); it != text.end(); ++it)
+        {
+            if (!isspace(static_cast<unsigned char>(*it)))
+                return false;
+        }
+        return true;
+    }
+
+    //--------------------------------------------------------------------------
+    string trim(const string& text)
+    {
+        size_t first = text.find_first_not_of(" \t\r\n");
+        if (first == string::npos)
+            return string();
+        return text.substr(first, text.find_last_not_of(" \t\r\n") - first + 1);
+    }
+
+    //--------------------------------------------------------------------------
+    string hexDigest(MD5_CTX& ctx)
+    {
+        static const char hex[] = "0123456789abcdef";
+        string digest;
+        for (int j = 0; j < 16; ++j)
+        {
+            digest += hex[ctx.digest[j] >> 4];
+            digest += hex[ctx.digest[j] & 0x0F];
+        }
+        return digest;
+    }
+
+    //--------------------------------------------------------------------------
+    // MD5 digest of a file, copied to dst unless empty, and to stream unless NULL
+    string copyFile(const string& src, const string& dst, ScratchFile* stream = 0)
+    {
+        FILE* in = fopen(src.c_str(), "rb");
+        if (in == 0)
+            throw runtime_error("Cannot open \"" + src + "\"");
+
+        FILE* out = 0;
+        if (!dst.empty() && (out = fopen(dst.c_str(), "wb")) == 0)
+        {
+            fclose(in);
+            throw runtime_error("Cannot create \"" + dst + "\"");
+        }
+
+        MD5_CTX ctx;
+        MD5Init(&ctx);
+
+        vector<char> buf(65536);
+        size_t len;
+        bool failed = false;
+        while ((len = fread(&buf[0], 1, buf.size(), in)) > 0)
+        {
+            MD5Update(&ctx, &buf[0], static_cast<unsigned int>(len));
+            if ((out && fwrite(&buf[0], 1, len, out) != len) || (stream && stream->write(&buf[0], len) != len))
+            {
+                failed = true;
+                break;
+            }
+        }
+
+        failed = ferror(in) != 0 || failed;
+        fclose(in);
+        if (out) failed = fclose(out) != 0 || failed;
+        if (failed)
+            throw runtime_error("Cannot copy \"" + src + "\" to \"" + dst + "\"");
+
+        MD5Final(&ctx);
+        return hexDigest(ctx);
+    }
+
+    //--------------------------------------------------------------------------
+    // true if the UTF-8 text contains only characters allowed in XML
+    bool validCharacters(const string& text)
+    {
+        for (size_t i = 0; i < text.size(); ++i)
+        {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            if (c < 0x20 && c != 0x09 && c != 0x0a && c != 0x0d)
+                return false;
+
+            // U+FFFE and U+FFFF
+            if (c == 0xEF && i + 2 < text.size()
+                && static_cast<unsigned char>(text[i + 1]) == 0xBF
+                && (static_cast<unsigned char>(text[i + 2]) & 0xFE) == 0xBE)
+                return false;
+        }
+        return true;
+    }
+
+    //--------------------------------------------------------------------------
+    // UTF-8 to UTF-16LE, the representation msi2xml encodes with Base64
+    string utf8ToUtf16(const string& text)
+    {
+        string result;
+        for (size_t i = 0; i < text.size(); )
+        {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            size_t len = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+            static const unsigned char mask[] = { 0, 0x7F, 0x1F, 0x0F, 0x07 };
+            unsigned long cp = c & mask[len];
+            for (size_t j = 1; j < len && i + j < text.size(); ++j)
+                cp = (cp << 6) | (static_cast<unsigned char>(text[i + j]) & 0x3F);
+            i += len;
+
+            if (cp >= 0x10000)
+            {
+                cp -= 0x10000;
+                unsigned long hi = 0xD800 + (cp >> 10), lo = 0xDC00 + (cp & 0x3FF);
+                result += static_cast<char>(hi & 0xFF);
+                result += static_cast<char>(hi >> 8);
+                cp = lo;
+            }
+            result += static_cast<char>(cp & 0xFF);
+            result += static_cast<char>(cp >> 8);
+        }
+        return result;
+    }
+
+    //--------------------------------------------------------------------------
+    // UTF-16LE to UTF-8
+    string utf16ToUtf8(const string& text)
+    {
+        string result;
+        for (size_t i = 0; i + 1 < text.size(); i += 2)
+        {
+            unsigned long cp = static_cast<unsigned char>(text[i]) 
+                             | (static_cast<unsigned char>(text[i + 1]) << 8);
+            if (cp >= 0xD800 && cp < 0xDC00 && i + 3 < text.size())
+            {
+                unsigned long lo = static_cast<unsigned char>(text[i + 2]) 
+                                 | (static_cast<unsigned char>(text[i + 3]) << 8);
+                if (lo >= 0xDC00 && lo < 0xE000)
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    i += 2;
+                }
+            }
+
+            if (cp < 0x80)
+                result += static_cast<char>(cp);
+            else if (cp < 0x800)
+            {
+                result += static_cast<char>(0xC0 | (cp >> 6));
+                result += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else if (cp < 0x10000)
+            {
+                result += static_cast<char>(0xE0 | (cp >> 12));
+                result += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                result += static_cast<char>(0xF0 | (cp >> 18));
+                result += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                result += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+        }
+        return result;
+    }
+
+    //--------------------------------------------------------------------------
+    // Base64 text in the layout of msi2xml: CHUNK_BIN bytes per line
+    string encodeBase64(const string& data)
+    {
+        string text = "\n";
+        char line[CHUNK_BASE64 + 1];
+        size_t pos = 0;
+        do
+        {
+            size_t len = min(data.size() - pos, static_cast<size_t>(CHUNK_BIN));
+            int chars = b64_ntop(reinterpret_cast<const u_char*>(data.data() + pos), len, line, sizeof(line));
+            if (chars < 0)
+                throw runtime_error("Base64 encoding failed");
+            text.append(line, chars);
+            text += '\n';
+            pos += len;
+        } while (pos < data.size());
+
+        return text + "\t\t\t";
+    }
+
+    //--------------------------------------------------------------------------
+    string decodeBase64(const string& text)
+    {
+        vector<u_char> buf(3 * text.size() / 4 + 3);
+        int len = b64_pton(text.c_str(), &buf[0], buf.size());
+        if (len < 0)
+            throw runtime_error("Invalid Base64 data");
+        return string(reinterpret_cast<const char*>(&buf[0]), len);
+    }
+
+    //--------------------------------------------------------------------------
+    // "yyyy/mm/dd hh:mm:ss" of IDT files to "mm/dd/yyyy hh:mm" of msi2xml
+    string xmlDate(const string& date)
+    {
+        int year, month, day, hour, minute, second = 0;
+        if (sscanf(date.c_str(), "%d/%d/%d %d:%d:%d", &year, &month, &day, &hour, &minute, &second) < 5)
+            return date;
+
+        char buf[32];
+        sprintf(buf, "%02d/%02d/%04d %02d:%02d", month, day, year, hour, minute);
+        return buf;
+    }
+
+    //--------------------------------------------------------------------------
+    // "mm/dd/yyyy hh:mm" of msi2xml to "yyyy/mm/dd hh:mm:ss" of IDT files
+    string idtDate(const string& date)
+    {
+        int year, month, day, hour, minute;
+        if (sscanf(date.c_str(), "%d/%d/%d %d:%d", &month, &day, &year, &hour, &minute) != 5)
+            return date;
+
+        char buf[32];
+        sprintf(buf, "%04d/%02d/%02d %02d:%02d:00", year, month, day, hour, minute);
+        return buf;
+    }
+
+    //--------------------------------------------------------------------------
+    // "mm/dd/yyyy hh:mm" of msi2xml, local time, to a FILETIME (false if invalid)
+    bool fileTime(const string& date, unsigned long long& value)
+    {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (sscanf(date.c_str(), "%d/%d/%d %d:%d", &tm.tm_mon, &tm.tm_mday, &tm.tm_year, &tm.tm_hour, &tm.tm_min) != 5)
+            return false;
+
+        tm.tm_mon -= 1;
+        tm.tm_year -= 1900;
+        tm.tm_isdst = -1;
+        time_t t = mktime(&tm);
+        if (t == static_cast<time_t>(-1))
+            return false;
+
+        // 100 ns intervals since 1601/01/01
+        value = (static_cast<unsigned long long>(t) + 11644473600ull) * 10000000ull;
+        return true;
+    }
+
+    //--------------------------------------------------------------------------
+    // type of a summary property in a database
+    MsiWriter::PropertyType propertyType(int pid)
+    {
+        switch (pid)
+        {
+        case 1:             return MsiWriter::propI2;
+        case 11: case 12:
+        case 13:            return MsiWriter::propFileTime;
+        case 14: case 15:
+        case 16: case 19:   return MsiWriter::propI4;
+        default:            return MsiWriter::propString;
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // true if path names a database (.msi or .msm)
+    bool isDatabasePath(const string& path)
+    {
+        return path.size() > 4 
+            && (_stricmp(path.c_str() + path.size() - 4, ".msi") == 0 
+                || _stricmp(path.c_str() + path.size() - 4, ".msm") == 0);
+    }
+
+    //--------------------------------------------------------------------------
+    // true for the summary properties holding a FILETIME
+    bool isDateProperty(int pid)
+    {
+        return pid == 11 || pid == 12 || pid == 13;
+    }
+
+    //--------------------------------------------------------------------------
+    // Decodes Base64 text, passed in chunks, into a file, or into stream unless NULL
+    class Base64Decoder
+    {
+    public:
+        Base64Decoder(const string& path, ScratchFile* stream) : m_path(path), m_file(0), m_stream(stream) { MD5Init(&m_ctx); }
+        ~Base64Decoder() { if (m_file) fclose(m_file); }
+
+        // decode a chunk of text
+        void feed(const string& text)
+        {
+            for (string::const_iterator it = text.begin(); it != text.end(); ++it)
+            {
+                if (!isspace(static_cast<unsigned char>(*it)))
+                    m_pending += *it;
+            }
+
+            if (m_pending.size() >= 4 * CHUNK_BIN * 1024)
+                decode(m_pending.size() & ~static_cast<size_t>(3));
+        }
+
+        // decode the remaining text, close the file and return its MD5 digest
+        string finish()
+        {
+            decode(m_pending.size());
+            if (m_stream == 0)
+            {
+                open();
+                bool failed = fclose(m_file) != 0;
+                m_file = 0;
+                if (failed)
+                    throw runtime_error("Cannot write \"" + m_path + "\"");
+            }
+
+            MD5Final(&m_ctx);
+            return hexDigest(m_ctx);
+        }
+
+        // true if no data was passed yet
+        bool empty() const { return m_file == 0 && m_pending.empty() && (m_stream == 0 || m_stream->size() == 0); }
+
+    private:
+        void open()
+        {
+            if (m_file == 0 && (m_file = fopen(m_path.c_str(), "wb")) == 0)
+                throw runtime_error("Cannot create \"" + m_path + "\"");
+        }
+
+        void decode(size_t len)
+        {
+            if (len == 0)
+                return;
+
+            string data = decodeBase64(m_pending.substr(0, len));
+            m_pending.erase(0, len);
+            MD5Update(&m_ctx, data.data(), static_cast<unsigned int>(data.size()));
+            if (m_stream != 0)
+            {
+                if (m_stream->write(data.data(), data.size()) != data.size())
+                    throw runtime_error("Cannot keep binary data in memory or in a temporary file");
+                return;
+            }
+
+            open();
+            if (fwrite(data.data(), 1, data.size(), m_file) != data.size())
+                throw runtime_error("Cannot write \"" + m_path + "\"");
+        }
+
+        string          m_path;         // output file path
+        FILE*           m_file;         // output file
+        ScratchFile*    m_stream;       // output stream (instead of the file)
+        string          m_pending;      // text not decoded yet
+        MD5_CTX         m_ctx;          // MD5 context
+    };
+}
+
+//------------------------------------------------------------------------------
+// Main entry point
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    try 
+    {
+        Idt2Xml idt2xml(argc, argv);
+        idt2xml.convert();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+Idt2Xml::Idt2Xml(int argc, char* argv[]) :
+    m_encoding("US-ASCII"),
+    m_currentRow(0),
+    m_currentCol(0),
+    m_codepage(0),
+    m_dumpStreams(false),
+    m_sortRows(true),
+    m_checkMD5(true),
+    m_quiet(false)
+{
+    parseCommandLine(argc, argv);
+}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+Idt2Xml::~Idt2Xml()
+{
+}
+
+//------------------------------------------------------------------------------
+// Convert a folder to XML, or an XML file to a folder or a database
+//------------------------------------------------------------------------------
+void Idt2Xml::convert()
+{
+    if (isDirectory(m_inputPath))
+    {
+        toXml();
+    }
+    else if (isDatabasePath(m_outputPath))
+    {
+        m_database.reset(new MsiWriter);
+        toIdt();
+        m_database->write(m_outputPath);
+    }
+    else
+    {
+        toIdt();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Write the IDT files of a folder to an XML document
+//------------------------------------------------------------------------------
+void Idt2Xml::toXml()
+{
+    // map table names to file names, sorted by table name
+    typedef std::map<string, string> Tables;
+    Tables tables;
+    string summaryFile;
+
+    vector<string> files = listIdtFiles(m_inputPath);
+    for (vector<string>::const_iterator it = files.begin(); it != files.end(); ++it)
+    {
+        IdtReader idt(m_inputPath, *it);
+        if (idt.codepage() != 0 && m_codepage == 0)
+            m_codepage = idt.codepage();
+
+        if (idt.table() == "_ForceCodepage")
+            m_codepage = idt.codepage();
+        else if (idt.table() == "_SummaryInformation")
+            summaryFile = *it;
+        else
+            tables[idt.table()] = *it;
+    }
+
+    if (tables.empty() && summaryFile.empty())
+        throw runtime_error("No IDT files found in \"" + m_inputPath + "\"");
+
+    if (m_dumpStreams)
+        makeDir(m_binDir);
+
+    // write prolog
+    XmlWriter xml(m_outputPath, m_encoding);
+    xml.raw("\n");
+    if (!m_styleSheet.empty())
+        xml.raw("<?xml-stylesheet type=\"text/xsl\" href=\"" + m_styleSheet + "\" ?>\n");
+    xml.raw(PROLOG);
+
+    // write root element
+    xml.startElement("msi");
+    xml.attribute("version", "2.0");
+    xml.attribute("xmlns:dt", "urn:schemas-microsoft-com:datatypes");
+    if (m_codepage != 0)
+    {
+        char buf[16];
+        sprintf(buf, "%u", m_codepage);
+        xml.attribute("codepage", buf);
+    }
+
+    writeSummary(xml, summaryFile);
+    xml.indent(1);
+
+    // write tables, _Streams last
+    Tables::iterator streams = tables.find("_Streams");
+    for (Tables::iterator it = tables.begin(); it != tables.end(); ++it) 
+    {
+        if (it != streams)
+            writeTable(xml, it->first, it->second);
+    }
+
+    writeTable(xml, "_Streams", streams != tables.end() ? streams->second : string());
+
+    xml.endElement();
+    xml.close();
+}
+
+//------------------------------------------------------------------------------
+// Write summary information
+//------------------------------------------------------------------------------
+void Idt2Xml::writeSummary(XmlWriter& xml, const string& fileName)
+{
+    // read property values
+    std::map<int, string> values;
+    if (!fileName.empty())
+    {
+        IdtReader idt(m_inputPath, fileName);
+        vector<string> fields;
+        while (idt.readRow(fields))
+        {
+            if (fields.size() >= 2)
+                values[atoi(fields[0].c_str())] = fields[1];
+        }
+    }
+
+    xml.indent(1);
+    xml.indent(1);
+    xml.startElement("summary");
+
+    for (int i = 0; i < 19; ++i) 
+    {
+        if (strcmp(SUMMARY_TAGS[i], "__unused__") == 0)
+            continue; // unused property IDs
+
+        xml.indent(2);
+        xml.startElement(SUMMARY_TAGS[i]);
+
+        std::map<int, string>::const_iterator it = values.find(i + 1);
+        if (it != values.end() && !it->second.empty())
+        {
+            if (isDateProperty(i + 1))
+                xml.text(xmlDate(it->second));
+            else
+                xml.text(Codepage::toUtf8(it->second, m_codepage));
+        }
+
+        xml.endElement();
+    }
+
+    xml.indent(1);
+    xml.endElement();
+}
+
+//------------------------------------------------------------------------------
+// Write a table (an empty _Streams table if fileName is empty)
+//------------------------------------------------------------------------------
+void Idt2Xml::writeTable(XmlWriter& xml, const string& table, const string& fileName)
+{
+    m_currentTable = table;
+    if (!m_quiet) 
+    {
+        std::cerr << "Writing table '" << table << "'" << std::endl;
+    }
+
+    xml.indent(1);
+    xml.startElement("table");
+    xml.attribute("name", Codepage::toUtf8(table, m_codepage));
+
+    if (fileName.empty())
+    {
+        xml.indent(2);
+        xml.startElement("col");
+        xml.attribute("key", "yes");
+        xml.attribute("def", "s62");
+        xml.text("Name");
+        xml.endElement();
+
+        xml.indent(2);
+        xml.startElement("col");
+        xml.attribute("def", "V0");
+        xml.text("Data");
+        xml.endElement();
+    }
+    else
+    {
+        IdtReader idt(m_inputPath, fileName);
+        const vector<string>& columns = idt.columns();
+        const vector<string>& defs = idt.defs();
+
+        // emit column headers
+        vector<size_t> keyCols;
+        for (size_t i = 0; i < columns.size(); ++i)
+        {
+            xml.indent(2);
+            xml.startElement("col");
+            if (std::find(idt.keys().begin(), idt.keys().end(), columns[i]) != idt.keys().end())
+            {
+                xml.attribute("key", "yes");
+                keyCols.push_back(i);
+            }
+            xml.attribute("def", defs[i]);
+            xml.text(Codepage::toUtf8(columns[i], m_codepage));
+            xml.endElement();
+        }
+
+        // only columns whose type is in upper case may be NULL
+        auto checkNulls = [&](const vector<string>& fields)
+        {
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                if (fields[i].empty() && islower(static_cast<unsigned char>(defs[i][0])))
+                {
+                    char line[16];
+                    sprintf(line, "%u", idt.line());
+                    throw runtime_error("\"" + fileName + "\", line " + line + ": field \"" 
+                                        + columns[i] + "\" cannot be NULL");
+                }
+            }
+        };
+
+        // read the rows, unless they are written as they come
+        typedef std::pair<string, size_t> Key;
+        vector<Key> keys;
+        vector<vector<string> > rows;
+        vector<string> fields;
+        bool more = true;
+        if (m_sortRows)
+        {
+            while (idt.readRow(fields))
+            {
+                checkNulls(fields);
+
+                string key;
+                for (size_t i = 0; i < keyCols.size(); ++i)
+                    key += "." + fields[keyCols[i]];
+
+                keys.push_back(Key(key, rows.size()));
+                rows.push_back(fields);
+            }
+            std::stable_sort(keys.begin(), keys.end());
+        }
+
+        // emit rows
+        for (size_t n = 0; m_sortRows ? n < keys.size() : (more = idt.readRow(fields)); ++n)
+        {
+            const vector<string>& row = m_sortRows ? rows[keys[n].second] : fields;
+            m_currentRow = static_cast<unsigned>(n + 1);
+            if (!m_sortRows)
+                checkNulls(row);
+
+            // MSDN: "Binary data is stored with an index name created by 
+            //        concatenating the table name and the values of the 
+            //        record's primary keys using a period delimiter."
+            string index;
+            for (size_t i = 0; i < keyCols.size(); ++i)
+                index += "." + row[keyCols[i]];
+            index = table == "_Streams" ? index.substr(1) : table + index;
+
+            xml.indent(2);
+            xml.startElement("row");
+            for (size_t col = 0; col < row.size(); ++col)
+            {
+                m_currentCol = static_cast<unsigned>(col + 1);
+                xml.indent(3);
+                xml.startElement("td");
+                if (!row[col].empty())
+                {
+                    if (tolower(defs[col][0]) == 'v')
+                        writeBinary(xml, idt.binaryPath(row[col]), Codepage::toUtf8(index, m_codepage));
+                    else
+                        writeText(xml, row[col]);
+                }
+                xml.endElement();
+            }
+            xml.indent(2);
+            xml.endElement();
+        }
+    }
+
+    xml.indent(1);
+    xml.endElement();
+    xml.indent(0);
+}
+
+//------------------------------------------------------------------------------
+// Write a string field, as Base64 encoded UTF-16 if it is not valid XML
+//------------------------------------------------------------------------------
+void Idt2Xml::writeText(XmlWriter& xml, const string& field)
+{
+    string text = Codepage::toUtf8(field, m_codepage);
+    if (validCharacters(text))
+    {
+        xml.text(text);
+    }
+    else
+    {
+        xml.attribute("dt:dt", "bin.base64");
+        xml.text(encodeBase64(utf8ToUtf16(text)));
+    }
+}
+
+//------------------------------------------------------------------------------
+// Write a binary field
+//------------------------------------------------------------------------------
+void Idt2Xml::writeBinary(XmlWriter& xml, const string& path, const string& id)
+{
+    if (m_dumpStreams)
+    {
+        string digest = copyFile(path, joinPath(m_binDir, id));
+        xml.attribute("href", m_binDirRel.empty() ? id : m_binDirRel + "/" + id);
+        xml.attribute("md5", digest);
+        return;
+    }
+
+    // the digest precedes the data, so the file is read twice
+    xml.attribute("dt:dt", "bin.base64");
+    xml.attribute("md5", copyFile(path, string()));
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == 0)
+        throw runtime_error("Cannot open \"" + path + "\"");
+
+    // encode in lines of CHUNK_BIN bytes, written in batches
+    string text = "\n";
+    char line[CHUNK_BASE64 + 1];
+    u_char buf[CHUNK_BIN];
+    size_t len;
+    do 
+    {
+        len = fread(buf, 1, CHUNK_BIN, file);
+        int chars = b64_ntop(buf, len, line, sizeof(line));
+        if (chars < 0)
+        {
+            fclose(file);
+            throw runtime_error("Base64 encoding failed");
+        }
+
+        text.append(line, chars);
+        text += '\n';
+        if (text.size() >= XmlReader::CHUNK_SIZE)
+        {
+            xml.text(text);
+            text.erase();
+        }
+    } while (len == CHUNK_BIN);
+
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    if (failed)
+        throw runtime_error("Cannot read \"" + path + "\"");
+
+    xml.text(text + "\t\t\t");
+}
+
+//------------------------------------------------------------------------------
+// Write an XML document to IDT files, or to the database m_database
+//------------------------------------------------------------------------------
+void Idt2Xml::toIdt()
+{
+    XmlReader xml(m_inputPath);
+    if (xml.next() != XmlReader::eventStart || xml.name() != "msi")
+        throw xml.error("Root element must be 'msi'");
+
+    if (const string* codepage = xml.attribute("codepage"))
+        m_codepage = strtoul(codepage->c_str(), 0, 10);
+
+    if (m_database.get())
+    {
+        m_database->setCodepage(m_codepage);
+    }
+    else
+    {
+        makeDir(m_outputPath);
+        if (m_codepage != 0)
+            IdtWriter::writeCodepage(m_outputPath, m_codepage);
+    }
+
+    for (;;)
+    {
+        XmlReader::Event event = xml.next();
+        if (event == XmlReader::eventEnd)
+            break;
+
+        if (event == XmlReader::eventText)
+        {
+            if (!isSpace(xml.text()))
+                throw xml.error("Unexpected text");
+        }
+        else if (xml.name() == "summary")
+        {
+            readSummary(xml);
+        }
+        else if (xml.name() == "table")
+        {
+            readTable(xml);
+        }
+        else
+        {
+            throw xml.error("Unexpected element '" + xml.name() + "'");
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Read summary information
+//------------------------------------------------------------------------------
+void Idt2Xml::readSummary(XmlReader& xml)
+{
+    static const char* const columns[] = { "PropertyId", "Value" };
+    static const char* const defs[] = { "i2", "l255" };
+
+    std::unique_ptr<IdtWriter> idt;
+    if (!m_database.get())
+    {
+        idt.reset(new IdtWriter(m_outputPath, "_SummaryInformation", 
+                                vector<string>(columns, columns + 2), 
+                                vector<string>(defs, defs + 2), 
+                                vector<string>(columns, columns + 1)));
+    }
+
+    for (;;)
+    {
+        XmlReader::Event event = xml.next();
+        if (event == XmlReader::eventEnd)
+            break;
+
+        if (event == XmlReader::eventText)
+        {
+            if (!isSpace(xml.text()))
+                throw xml.error("Unexpected text");
+            continue;
+        }
+
+        int pid = 0;
+        for (int i = 0; i < 19 && pid == 0; ++i)
+        {
+            if (xml.name() == SUMMARY_TAGS[i])
+                pid = i + 1;
+        }
+        if (pid == 0)
+            throw xml.error("Unknown summary property '" + xml.name() + "'");
+
+        string value = trim(readText(xml));
+        if (value.empty())
+            continue;
+
+        if (m_database.get())
+        {
+            unsigned long long time;
+            switch (propertyType(pid))
+            {
+            case MsiWriter::propFileTime:
+                if (!fileTime(value, time))
+                    throw xml.error("Invalid date in summary property '" + string(SUMMARY_TAGS[pid - 1]) + "'");
+                m_database->setSummaryTime(pid, time);
+                break;
+
+            case MsiWriter::propString:
+                if (!Codepage::fromUtf8(value, m_codepage, value))
+                    throw xml.error("Summary property '" + string(SUMMARY_TAGS[pid - 1]) + "' cannot be represented in the codepage");
+                m_database->setSummaryString(pid, value);
+                break;
+
+            default:
+                m_database->setSummaryInteger(pid, propertyType(pid), strtol(value.c_str(), 0, 10));
+                break;
+            }
+            continue;
+        }
+
+        if (isDateProperty(pid))
+            value = idtDate(value);
+        else if (!Codepage::fromUtf8(value, m_codepage, value))
+            throw xml.error("Summary property '" + string(SUMMARY_TAGS[pid - 1]) + "' cannot be represented in the codepage");
+
+        char buf[16];
+        sprintf(buf, "%d", pid);
+        vector<string> fields(1, buf);
+        fields.push_back(value);
+        idt->writeRow(fields);
+    }
+
+    if (idt.get())
+        idt->close();
+}
+
+//------------------------------------------------------------------------------
+// Read a table
+//------------------------------------------------------------------------------
+void Idt2Xml::readTable(XmlReader& xml)
+{
+    const string* name = xml.attribute("name");
+    if (name == 0)
+        throw xml.error("Missing table name");
+
+    if (!Codepage::fromUtf8(*name, m_codepage, m_currentTable))
+        throw xml.error("Table name cannot be represented in the codepage");
+
+    if (!m_quiet) 
+    {
+        std::cerr << "Writing table '" << m_currentTable << "'" << std::endl;
+    }
+
+    vector<string> columns, defs, keys;
+    vector<size_t> keyCols;
+    std::unique_ptr<IdtWriter> idt;
+    bool created = false;
+    std::set<string> binaryNames;   // lower case, for case insensitive file systems
+    m_currentRow = 0;
+
+    // create the IDT file or the table of the database, once the columns are known
+    auto createTable = [&]()
+    {
+        if (columns.empty())
+            throw xml.error("Table has no columns");
+
+        created = true;
+        if (!m_database.get())
+        {
+            idt.reset(new IdtWriter(m_outputPath, m_currentTable, columns, defs, keys));
+            return;
+        }
+
+        // the rows of _Streams are streams of the storage
+        if (m_currentTable == "_Streams")
+            return;
+
+        try
+        {
+            vector<MsiWriter::Column> tableColumns(columns.size());
+            for (size_t i = 0; i < columns.size(); ++i)
+            {
+                tableColumns[i].name = columns[i];
+                tableColumns[i].type = MsiWriter::columnType(defs[i], std::find(keyCols.begin(), keyCols.end(), i) != keyCols.end());
+            }
+            m_database->createTable(m_currentTable, tableColumns);
+        }
+        catch (const runtime_error& e)
+        {
+            throw xml.error(e.what());
+        }
+    };
+
+    for (;;)
+    {
+        XmlReader::Event event = xml.next();
+        if (event == XmlReader::eventEnd)
+            break;
+
+        if (event == XmlReader::eventText)
+        {
+            if (!isSpace(xml.text()))
+                throw xml.error("Unexpected text");
+            continue;
+        }
+
+        // column header
+        if (xml.name() == "col")
+        {
+            if (created)
+                throw xml.error("Column headers must precede the rows");
+
+            const string* def = xml.attribute("def");
+            if (def == 0 || def->empty())
+                throw xml.error("Missing column definition");
+
+            const string* key = xml.attribute("key");
+            bool isKey = key != 0 && *key == "yes";
+            defs.push_back(*def);
+
+            string column;
+            if (!Codepage::fromUtf8(trim(readText(xml)), m_codepage, column))
+                throw xml.error("Column name cannot be represented in the codepage");
+
+            if (isKey)
+            {
+                keys.push_back(column);
+                keyCols.push_back(columns.size());
+            }
+            columns.push_back(column);
+            continue;
+        }
+
+        if (xml.name() != "row")
+            throw xml.error("Unexpected element '" + xml.name() + "'");
+
+        if (!created)
+            createTable();
+
+        // read the fields of a row
+        ++m_currentRow;
+        m_currentCol = 0;
+        vector<string> fields;
+        vector<std::shared_ptr<ScratchFile> > streams;
+        for (;;)
+        {
+            event = xml.next();
+            if (event == XmlReader::eventEnd)
+                break;
+
+            if (event == XmlReader::eventText)
+            {
+                if (!isSpace(xml.text()))
+                    throw xml.error("Unexpected text");
+                continue;
+            }
+
+            if (xml.name() != "td")
+                throw xml.error("Unexpected element '" + xml.name() + "'");
+
+            if (++m_currentCol > defs.size())
+                throw xml.error("Too many fields");
+
+            const string& def = defs[m_currentCol - 1];
+            string field;
+            std::shared_ptr<ScratchFile> stream;
+            if (tolower(def[0]) == 'v' && m_database.get())
+            {
+                stream.reset(new ScratchFile);
+                if (!readBinary(xml, string(), stream.get()))
+                    stream.reset();
+            }
+            else if (tolower(def[0]) == 'v')
+            {
+                // name the file after the primary key, if that makes a valid file name
+                string fileName;
+                for (size_t i = 0; i < keyCols.size() && keyCols[i] < fields.size(); ++i)
+                    fileName += (i ? "." : "") + fields[keyCols[i]];
+
+                string lower = fileName;
+                std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+                if (fileName.empty() 
+                    || keyCols.empty() || keyCols.back() >= fields.size()
+                    || fileName.find_first_of("\\/:*?\"<>|") != string::npos
+                    || !validCharacters(fileName) || fileName[0] == '.'
+                    || binaryNames.count(lower + ".ibd"))
+                {
+                    char buf[16];
+                    sprintf(buf, "~%u", m_currentRow);
+                    fileName = lower = buf;
+                }
+                fileName += ".ibd";
+                binaryNames.insert(lower + ".ibd");
+
+                if (readBinary(xml, idt->binaryPath(fileName)))
+                    field = fileName;
+            }
+            else
+            {
+                const string* dt = xml.attribute("dt:dt");
+                bool base64 = dt != 0 && *dt == "bin.base64";
+
+                string text = readText(xml);
+                if (base64)
+                {
+                    try
+                    {
+                        text = utf16ToUtf8(decodeBase64(text));
+                    }
+                    catch (const runtime_error& e)
+                    {
+                        throw xml.error(e.what());
+                    }
+                }
+
+                if (!Codepage::fromUtf8(text, m_codepage, field))
+                    throw xml.error("Field cannot be represented in the codepage");
+            }
+
+            if (field.empty() && !stream && islower(static_cast<unsigned char>(def[0])))
+                throw xml.error("Field cannot be NULL");
+
+            fields.push_back(field);
+            streams.push_back(stream);
+        }
+
+        if (fields.size() != columns.size())
+            throw xml.error("Too few fields");
+
+        if (idt.get())
+        {
+            idt->writeRow(fields);
+            continue;
+        }
+
+        MsiWriter::Row row(fields.size());
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            row[i].null = fields[i].empty() && !streams[i];
+            row[i].stream = streams[i];
+            if (tolower(defs[i][0]) != 'i')
+            {
+                row[i].text = fields[i];
+            }
+            else if (!row[i].null)
+            {
+                char* end;
+                row[i].value = strtol(fields[i].c_str(), &end, 10);
+                if (*end != 0)
+                    throw xml.error("Field " + columns[i] + " must be an integer");
+            }
+        }
+
+        try
+        {
+            if (m_currentTable != "_Streams")
+                m_database->insertRow(m_currentTable, row);
+            else if (row.size() == 2 && row[1].stream)
+                m_database->addStream(row[0].text, row[1].stream);
+        }
+        catch (const runtime_error& e)
+        {
+            throw xml.error(e.what());
+        }
+    }
+
+    if (!created)
+        createTable();
+
+    if (idt.get())
+        idt->close();
+}
+
+//------------------------------------------------------------------------------
+// Read the character data of an element without children
+//------------------------------------------------------------------------------
+string Idt2Xml::readText(XmlReader& xml)
+{
+    string text;
+    for (;;)
+    {
+        switch (xml.next())
+        {
+        case XmlReader::eventText:
+            text += xml.text();
+            break;
+
+        case XmlReader::eventEnd:
+            return text;
+
+        default:
+            throw xml.error("Unexpected element '" + xml.name() + "'");
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Read a binary field, inline or referenced, into a file or a stream
+//------------------------------------------------------------------------------
+bool Idt2Xml::readBinary(XmlReader& xml, const string& path, ScratchFile* stream)
+{
+    // attributes of the td element
+    const string* attr = xml.attribute("md5");
+    string md5 = attr ? *attr : string();
+    bool hasMD5 = attr != 0;
+    attr = xml.attribute("href");
+    bool hasHref = attr != 0;
+    string href = attr ? *attr : string();
+
+    // case 1: external binary data
+    if (hasHref)
+    {
+        if (!isSpace(readText(xml)))
+            throw xml.error("Field must be empty if href specified");
+
+        if (href.compare(0, 6, "media:") == 0)
+            throw xml.error("Cabinets built from 'media:' references are only supported by xml2msi");
+
+        if (href.compare(0, 8, "file:///") == 0)
+            href.erase(0, 8);
+
+        string src = isAbsolute(href) ? href : joinPath(dirPart(m_inputPath), href);
+        checkMD5(hasMD5 ? &md5 : 0, copyFile(src, path, stream));
+        return true;
+    }
+
+    // case 2: Base64 encoded data
+    Base64Decoder decoder(path, stream);
+    for (;;)
+    {
+        XmlReader::Event event = xml.next();
+        if (event == XmlReader::eventEnd)
+            break;
+
+        if (event != XmlReader::eventText)
+            throw xml.error("Unexpected element '" + xml.name() + "'");
+
+        try
+        {
+            decoder.feed(xml.text());
+        }
+        catch (const runtime_error& e)
+        {
+            throw xml.error(e.what());
+        }
+    }
+
+    if (decoder.empty() && !hasMD5)
+        return false;
+
+    string digest;
+    try
+    {
+        digest = decoder.finish();
+    }
+    catch (const runtime_error& e)
+    {
+        throw xml.error(e.what());
+    }
+
+    checkMD5(hasMD5 ? &md5 : 0, digest);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Compare an MD5 digest with the expected one
+//------------------------------------------------------------------------------
+void Idt2Xml::checkMD5(const string* expected, const string& digest)
+{
+    if (expected == 0 || _stricmp(expected->c_str(), digest.c_str()) == 0)
+        return;
+
+    char position[64];
+    sprintf(position, ", row %u, field %u", m_currentRow, m_currentCol);
+    string where = "table \"" + m_currentTable + "\"" + position;
+
+    if (m_checkMD5)
+    {
+        throw runtime_error("Failed MD5 checksum test in " + where + "\n"
+                            "New checksum: " + digest + "\n"
+                            "(Use the -m option to ignore this error)");
+    }
+
+    if (!m_quiet)
+    {
+        std::cerr << "Warning: Failed MD5 checksum test in " << where << std::endl;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Print usage message
+//------------------------------------------------------------------------------
+void Idt2Xml::printUsage() const
+{
+    std::cerr << "\nUsage: " << std::endl;
+    std::cerr << "idt2xml [-q] [-n] [-m] [-e ENCODING] [-s STYLESHEET] [-b [DIR]] [-o OUTPUT] input" << std::endl;
+    std::cerr << "  input is a folder of IDT files, converted to XML, or an XML file," << std::endl;
+    std::cerr << "  converted to a folder of IDT files, or to a database if OUTPUT ends" << std::endl;
+    std::cerr << "  with .msi or .msm." << std::endl;
+    std::cerr << " -q --quiet                    quiet processing" << std::endl;
+    std::cerr << " -n --no-sort                  disable sorting of rows" << std::endl;
+    std::cerr << " -m --md5                      ignore MD5 checksum errors" << std::endl;
+    std::cerr << " -e --encoding=ENCODING        force XML encoding to ENCODING (default is US-ASCII)" << std::endl;
+    std::cerr << " -s --stylesheet=NAME          use XSL stylesheet NAME" << std::endl;
+    std::cerr << " -b --dump-streams=DIR         save binary streams to DIR subdirectory" << std::endl;
+    std::cerr << " -o --output=PATH              write XML file, IDT folder or database to PATH" << std::endl;
+    std::cerr << std::endl;
+}
+
+//------------------------------------------------------------------------------
+// Parse command line
+//------------------------------------------------------------------------------
+void Idt2Xml::parseCommandLine(int argc, char* argv[])
+{
+    // short option string (option letters followed by a colon ':' require an argument)
+    static const char optstring[] = "qnms:b:o:e:";
+
+    // mapping of long to short arguments
+    static const Option longopts[] = 
+    {
+        { "quiet",              no_argument,        NULL,   'q' },
+        { "no-sort",            no_argument,        NULL,   'n' },
+        { "md5",                no_argument,        NULL,   'm' },
+        { "encoding",           required_argument,  NULL,   'e' },
+        { "stylesheet",         required_argument,  NULL,   's' },
+        { "dump-streams",       optional_argument,  NULL,   'b' },
+        { "output",             required_argument,  NULL,   'o' },
+        { NULL,                 0,                  NULL,   0   }
+    };
+
+    int c;
+    int longIdx = 0;
+    while ((c = getopt_long(argc, argv, optstring, longopts, &longIdx)) != -1) 
+    {
+        if (optarg != NULL && *optarg == '-') 
+        {
+            optarg = NULL;
+            --optind;
+        }
+
+        switch (c) 
+        {
+        case 'q':  // run quiet
+            m_quiet = true;
+            break;
+
+        case 'n':  // disable row sorting
+            m_sortRows = false;
+            break;
+
+        case 'm':  // ignore MD5 checksum errors
+            m_checkMD5 = false;
+            break;
+
+        case 'e':  // force XML encoding
+            if (!optarg || Codepage::fromName(optarg) == 0) 
+            {
+                std::cerr << "Unsupported encoding." << std::endl;
+                printUsage();
+                exit(2);
+            }
+            m_encoding = optarg;
+            break;
+
+        case 's':  // style sheet
+            if (optarg) m_styleSheet = optarg;
+            break;
+
+        case 'b':  // bin dir
+            m_dumpStreams = true;
+            if (optarg) m_binDirRel = optarg;
+            if (m_binDirRel.find_first_of(":/\\") != string::npos) 
+            {
+                std::cerr << "Invalid folder name specified: " << m_binDirRel << std::endl;
+                printUsage();
+                exit(2);
+            }
+            break;
+
+        case 'o':  // output file or folder
+            if (optarg) m_outputPath = optarg;
+            break;
+
+        case '?':  // invalid argument
+            printUsage();
+            exit(2);
+        }
+    }
+
+    if (optind != argc - 1) 
+    {
+        printUsage();
+        exit(2);
+    }
+
+    m_inputPath = argv[optind];
+
+    // default output: file or folder named after the input, in the current folder
+    if (m_outputPath.empty())
+    {
+        m_outputPath = baseName(m_inputPath);
+        if (isDirectory(m_inputPath))
+            m_outputPath += ".xml";
+    }
+
+    m_outputDir = dirPart(m_outputPath);
+    m_binDir = joinPath(m_outputDir.empty() ? string(".") : m_outputDir, m_binDirRel);
+}
@@ -0,0 +1,123 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// IDT to XML converter
+//
+// Converts a folder of installer text archive files (.idt), as written by
+// MsiDatabaseExport or msidb.exe, to the XML format of msi2xml, and an
+// msi2xml document back to a folder of IDT files that MsiDatabaseImport
+// can read, or directly to a database (.msi, .msm) written by MsiWriter.
+// No direction needs the Windows Installer or MSXML: the files are
+// streamed, so that only the rows of the table being written to XML, or
+// the tables of the database, are kept in memory.
+//
+//------------------------------------------------------------------------------
+#ifndef IDT2XML_H_INCLUDED
+#define IDT2XML_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <memory>
+#include <string>
+
+class MsiWriter;
+class ScratchFile;
+class XmlReader;
+class XmlWriter;
+
+class Idt2Xml
+{
+public:
+    // constructor
+    Idt2Xml(int argc, char* argv[]);
+
+    // destructor
+    ~Idt2Xml();
+
+    // convert a folder to XML, or an XML file to a folder or a database
+    void                convert();
+
+private:
+    // write the IDT files of m_inputPath to the document m_outputPath
+    void                toXml();
+
+    // write the summary information
+    void                writeSummary(XmlWriter& xml, const std::string& fileName);
+
+    // write a table
+    void                writeTable(XmlWriter& xml, const std::string& table, const std::string& fileName);
+
+    // write a string field
+    void                writeText(XmlWriter& xml, const std::string& field);
+
+    // write a binary field
+    void                writeBinary(XmlWriter& xml, const std::string& path, const std::string& id);
+
+    // write the document m_inputPath to IDT files in m_outputPath, or to m_database
+    void                toIdt();
+
+    // read the summary information
+    void                readSummary(XmlReader& xml);
+
+    // read a table
+    void                readTable(XmlReader& xml);
+
+    // read a string field
+    std::string         readText(XmlReader& xml);
+
+    // read a binary field into the file path, or into stream unless NULL (false if NULL)
+    bool                readBinary(XmlReader& xml, const std::string& path, ScratchFile* stream = 0);
+
+    // compare a digest with the md5 attribute of the current td element
+    void                checkMD5(const std::string* expected, const std::string& digest);
+
+    // parse command line options
+    void                parseCommandLine(int argc, char* argv[]);
+
+    // print usage message
+    void                printUsage() const;
+
+    std::string         m_inputPath;        // input folder or document
+    std::string         m_outputPath;       // output document or folder
+    std::string         m_outputDir;        // folder of the output document
+    std::string         m_encoding;         // XML encoding
+    std::string         m_styleSheet;       // XSL stylesheet (none if empty)
+    std::string         m_binDir;           // folder for binary fields
+    std::string         m_binDirRel;        // m_binDir relative to m_outputDir
+    std::string         m_currentTable;     // table being converted
+    unsigned            m_currentRow;       // row being converted (1-based)
+    unsigned            m_currentCol;       // field being converted (1-based)
+    unsigned            m_codepage;         // database codepage (0: neutral)
+    bool                m_dumpStreams;      // write binary fields to files
+    bool                m_sortRows;         // sort rows by primary key
+    bool                m_checkMD5;         // MD5 mismatches are errors
+    bool                m_quiet;            // no progress messages
+    std::unique_ptr<MsiWriter> m_database;  // database written instead of IDT files
+};
+
+#endif // IDT2XML_H_INCLUDED
@@ -44,6 +44,21 @@
 //------------------------------------------------------------------------------
 #define BUF_SIZE 512                 // initial buffer size (arbitrary)
 
+//------------------------------------------------------------------------------
+// Format an MD5 digest as hex string
+//------------------------------------------------------------------------------
+static tstring hexDigest(const MD5_CTX& ctx)
+{
+    tostringstream oss;
+    oss.fill(_T('0'));
+    oss.setf(std::ios::hex, std::ios::basefield);
+    for (int j = 0; j < 16; ++j) 
+    {
+        oss << std::setw(2) << static_cast<unsigned int>(ctx.digest[j]);
+    }
+    return oss.str();
+}
+
 //------------------------------------------------------------------------------
 // Main entry point
 //------------------------------------------------------------------------------
@@ -100,6 +115,7 @@ Msi2Xml::Msi2Xml(int argc, _TCHAR* argv[]) :
     m_encoding(_T("US-ASCII")),
     m_useDefaultStyleSheet(true),
     m_dumpStreams(false),
+    m_referenceStreams(false),
     m_extractCabs(false),
     m_sortRows(true),
     m_mergeModule(false),
@@ -244,6 +260,7 @@ void Msi2Xml::dump()
 
             // list rows
             dumpRows(it->c_str(), parentNode);
+            addSizeHints(pElement);
         }
         catch (...)
         {
@@ -265,17 +282,10 @@ void Msi2Xml::dump()
     xml::IXMLDOMNodePtr parentNode(m_rootElement->appendChild(pElement));
 
     dumpStreams(parentNode);
+    addSizeHints(pElement);
     indent(parentNode, 1);
     indent(m_rootElement, 0);
 
-    // validate generated XML against DTD
-    xml::IXMLDOMParseErrorPtr err = m_doc->validate();
-    if (err->errorCode != 0) 
-    {
-        tcerr << color::red << _T("Error ") << _T(":\n") 
-              << (LPCTSTR)err->reason << color::base ;
-    }
-
     // save document
     OK(m_doc->save(m_outputPath.c_str()));
 }
@@ -936,6 +946,32 @@ void Msi2Xml::dumpStreams(xml::IXMLDOMNode* parentNode)
     }
 }
 
+//------------------------------------------------------------------------------
+// Add size hints to a table element
+//
+// The "rows" attribute holds the number of rows, "bytes" the total decoded
+// size of the table's binary fields (the sum of their "size" attributes),
+// so that readers can reserve memory before reading the table.
+//------------------------------------------------------------------------------
+void Msi2Xml::addSizeHints(xml::IXMLDOMElement* table)
+{
+    table->setAttribute(L"rows", _variant_t(table->selectNodes(L"row")->length));
+
+    ULONGLONG bytes = 0;
+    xml::IXMLDOMNodeListPtr sizes(table->selectNodes(L"row/td/@size"));
+    while (xml::IXMLDOMNodePtr size = sizes->nextNode())
+    {
+        bytes += _ttoi64((LPCTSTR)(_bstr_t)size->nodeValue);
+    }
+
+    if (bytes > 0)
+    {
+        tostringstream oss;
+        oss << bytes;
+        table->setAttribute(L"bytes", oss.str().c_str());
+    }
+}
+
 //------------------------------------------------------------------------------
 // Get msi codepage
 //------------------------------------------------------------------------------
@@ -989,7 +1025,27 @@ void Msi2Xml::dumpBinaryStream(LPCTSTR id,
         strBinHref = id;
     }
 
-    if (!m_dumpStreams) 
+    if (!m_streamSource.empty())
+    {
+        // reference the stream in the source database
+        MD5_CTX ctx;
+        MD5Init(&ctx);
+
+        std::vector<char> bufBinary(1 << 16);
+        DWORD cbBufIn;
+        do 
+        {
+            cbBufIn = static_cast<DWORD>(bufBinary.size());
+            OK(MsiRecordReadStream(row, column, &bufBinary[0], &cbBufIn));
+            MD5Update(&ctx, (LPCVOID)&bufBinary[0], cbBufIn, 1);
+        } while (cbBufIn == bufBinary.size());
+        MD5Final(&ctx);
+
+        tstring href = _T("msi-stream:") + m_streamSource + _T("#") + id;
+        elm->setAttribute(L"href", href.c_str());
+        elm->setAttribute(L"md5", hexDigest(ctx).c_str());
+    }
+    else if (!m_dumpStreams) 
     {
         // Encode binary data with base64
         // (MSXML can do this encoding for you, but for memory efficiency
@@ -1046,14 +1102,10 @@ void Msi2Xml::dumpBinaryStream(LPCTSTR id,
 
         // finalize MD5 and generate "md5" attribute
         MD5Final(&ctx);
-        tostringstream oss;
-        oss.fill(_T('0'));
-        oss.setf(std::ios::hex, std::ios::basefield);
-        for (int j = 0; j < 16; ++j) 
-        {
-            oss << std::setw(2) << static_cast<unsigned int>(ctx.digest[j]);
-        }
-        elm->setAttribute(L"md5", oss.str().c_str());
+        elm->setAttribute(L"md5", hexDigest(ctx).c_str());
+
+        // size of the decoded data, for readers that reserve memory
+        elm->setAttribute(L"size", _variant_t(static_cast<long>(dwSize)));
     }
     else 
     {
@@ -1072,14 +1124,7 @@ void Msi2Xml::dumpBinaryStream(LPCTSTR id,
         elm->setAttribute(L"href", strBinHref.c_str());
 
         // write MD5 checksum
-        tostringstream oss;
-        oss.fill(_T('0'));
-        oss.setf(std::ios::hex, std::ios::basefield);
-        for (int j = 0; j < 16; ++j) 
-        {
-            oss << std::setw(2) << static_cast<unsigned int>(ctx.digest[j]);
-        }
-        elm->setAttribute(L"md5", oss.str().c_str());
+        elm->setAttribute(L"md5", hexDigest(ctx).c_str());
 
         // check if file exists
         if (GetFileAttributes(strBinFile.c_str()) != 0xFFFFFFFF) 
@@ -1163,7 +1208,7 @@ void Msi2Xml::printBanner() const
 void Msi2Xml::printUsage() const
 {
     tcerr << _T("\nUsage: ") << std::endl;
-    tcerr << _T("msi2xml [-q] [-n] [-d] [-m] [-e ENCODING] [-s [STYLESHEET]] [-b [DIR]]") << std::endl;
+    tcerr << _T("msi2xml [-q] [-n] [-d] [-m] [-e ENCODING] [-s [STYLESHEET]] [-b [DIR]] [-r]") << std::endl;
     tcerr << _T("        [-c [DIR[,MEDIAS]]] [-o XMLFILE] file\n");
     tcerr << _T(" -Q --nologo                   don't print banner message") << std::endl;
     tcerr << _T(" -q --quiet                    quiet processing") << std::endl;
@@ -1173,6 +1218,7 @@ void Msi2Xml::printUsage() const
     tcerr << _T(" -s --stylesheet               disable default XSL stylesheet") << std::endl;
     tcerr << _T(" -s --stylesheet=NAME          use XSL stylesheet NAME") << std::endl;
     tcerr << _T(" -b --dump-streams=DIR         save binary streams to DIR subdirectory") << std::endl;
+    tcerr << _T(" -r --reference-streams        reference binary streams in the input file") << std::endl;
     tcerr << _T(" -c --extract-cabs=DIR,MEDIAS  extract content of cabinets (for MEDIAS) to DIR") << std::endl;
     tcerr << _T(" -o --output=FILE              write MSI file to FILE") << std::endl;
     tcerr << std::endl;
@@ -1189,7 +1235,7 @@ void Msi2Xml::parseCommandLine(int argc, _TCHAR* argv[])
     _TCHAR ext[_MAX_EXT];
 
     // short option string (option letters followed by a colon ':' require an argument)
-    static const _TCHAR optstring[] = _T("qQdmnls:b:o:e:c:");
+    static const _TCHAR optstring[] = _T("qQdmnlrs:b:o:e:c:");
 
     // mapping of long to short arguments
     static const Option longopts[] = 
@@ -1203,6 +1249,7 @@ void Msi2Xml::parseCommandLine(int argc, _TCHAR* argv[])
         { _T("no-sort"),            no_argument,        NULL,   _T('n') },
         { _T("stylesheet"),         optional_argument,  NULL,   _T('s') },
         { _T("dump-streams"),       optional_argument,  NULL,   _T('b') },
+        { _T("reference-streams"),  no_argument,        NULL,   _T('r') },
         { _T("extract-cabs"),       optional_argument,  NULL,   _T('c') },
         { _T("output"),             required_argument,  NULL,   _T('o') },
         { NULL,                     0,                  NULL,   0       }
@@ -1254,6 +1301,10 @@ void Msi2Xml::parseCommandLine(int argc, _TCHAR* argv[])
             }
             break;
 
+        case _T('r'):  // reference binary streams in the input file
+            m_referenceStreams = true;
+            break;
+
         case _T('c'):  // extract cabinet files
             m_extractCabs = true;
             if (optarg) 
@@ -1383,6 +1434,17 @@ void Msi2Xml::parseCommandLine(int argc, _TCHAR* argv[])
         m_outputDir = buf;
     }
 
+    // binary streams are referenced by the path of the input file, relative
+    // to the XML file if both are in the same folder
+    if (m_referenceStreams)
+    {
+        m_streamSource = m_inputPath;
+        if (_tcsicmp(m_inputDir.c_str(), m_outputDir.c_str()) == 0)
+        {
+            m_streamSource = m_inputPath.substr(m_inputDir.length());
+        }
+    }
+
     // Write default style sheet
     if (m_useDefaultStyleSheet) 
     {
@@ -63,6 +63,9 @@ protected:
     // dump embedded streams
     void                        dumpStreams(xml::IXMLDOMNode* parentNode);
 
+    // add the row count and the size of the inline binary data to a table element
+    static void                 addSizeHints(xml::IXMLDOMElement* table);
+
 private:
     // parse command line options
     void                        parseCommandLine(int argc, _TCHAR* argv[]);
@@ -122,10 +125,12 @@ private:
     tstring                     m_cabDirRel;            // directory for cabinet files
     tstring                     m_encoding;             // XML encoding
     tstring                     m_styleSheet;           // name of alternative stylesheet
+    tstring                     m_streamSource;         // input file as referenced by msi-stream: hrefs
     int                         m_quiet;                // don't show progress
     bool                        m_nologo;               // don't print banner message
     bool                        m_useDefaultStyleSheet; // use default stylesheet
     bool                        m_dumpStreams;          // write external binary files
+    bool                        m_referenceStreams;     // reference binary streams in the input file
     bool                        m_extractCabs;          // extract content of cabinet files
     bool                        m_sortRows;             // sort rows according to first field
     bool                        m_mergeModule;          // extract merge module
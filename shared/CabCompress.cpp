@@ -24,19 +24,25 @@
 // SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //
 //------------------------------------------------------------------------------
-#include "..\shared\version.h"
 #include "CabCompress.h"
-#include <windows.h>
-#include <fci.h>
+#include "CabWriter.h"
+#include "CabReader.h"
+#include "ScratchFile.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string>
+#include <map>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include "..\shared\version.h"
+#include <windows.h>
+#include <fci.h>
 #include <io.h>
 #include <share.h>
 #include <sys/stat.h>
 #include <fcntl.h>
-#include <string>
-#include <stdexcept>
 
 #include <crtdbg.h>
 #include <atlexcept.h>
@@ -47,18 +53,76 @@
 #endif
 
 #pragma comment(lib, "Cabinet.lib")
+#endif // _WIN32
 
 using namespace std;
 
+//------------------------------------------------------------------------------
+namespace
+{
+    //--------------------------------------------------------------------------
+    string narrow(const _TCHAR* str)
+    {
+#ifdef _WIN32
+        return str ? string(ATL::CT2A(str)) : string();
+#else
+        return str ? string(str) : string();
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+    CabWriter::Compression writerCompression(CabCompress::Compression comp)
+    {
+        switch (comp)
+        {
+        case CabCompress::compMSZIP:    return CabWriter::compMSZIP;
+        case CabCompress::compLZX:      return CabWriter::compLZX;
+        default:                        return CabWriter::compNone;
+        }
+    }
+}
+
 //------------------------------------------------------------------------------
 struct CabCompress::Impl
 {
-    HFCI                hfci;
-    ERF                 erf;
     int                 cabIndex;
+    int                 cabIndexStart;
     string              cabTemplate;
+    string              cabFolder;
+    string              diskName;
+    unsigned long       mediaSize;
+    unsigned short      setID;
+    unsigned int        headerReserved;
+    unsigned int        jobs;
+    int                 lzxWindow;
+    LzxEffort           lzxEffort;
+    CabWriter*          writer;         // native writer (uncompressed, MSZIP and LZX cabinets)
+    ScratchFile*        output;         // receives the cabinet instead of a file (if set)
+
+    void                createWriter();
+
+#ifdef _WIN32
+    // FCI context (Quantum cabinets)
+    HFCI                hfci;
+    ERF                 erf;
+    CCAB                ccab;
+
+    // FCI file handle: a CRT file or one of the scratch files below
+    struct FciFile
+    {
+        int             fd;
+        ScratchFile*    scratch;
+    };
+
+    // FCI temporary files, kept in memory
+    typedef map<string, ScratchFile*> ScratchMap;
+    ScratchMap          scratchFiles;
+    unsigned long       scratchCount;
+
+    static bool         isScratch(const char* name);
+
+    void                createFci();
 
-    static bool         createDirectoryPath(const char* path);
     static const char*  fcierrorToString(int err);
 
     static FNFCIGETNEXTCABINET(getNextCab);
@@ -74,6 +138,7 @@ struct CabCompress::Impl
     static FNFCISEEK(seek);
     static FNFCIDELETE(remove);
     static FNFCIGETTEMPFILE(getTempFile);
+#endif
 };
 
 //------------------------------------------------------------------------------
@@ -87,58 +152,143 @@ CabCompress::CabCompress(const _TCHAR*  cabFolder,
     m_pImpl(new Impl)
 {
     // initialize members
-    m_pImpl->hfci = NULL;
-    m_pImpl->cabTemplate = cabTemplate ?  ATL::CT2A(cabTemplate) : "";
+    m_pImpl->writer = NULL;
+    m_pImpl->output = NULL;
+    m_pImpl->jobs = 1;
+    m_pImpl->lzxWindow = 21;
+    m_pImpl->lzxEffort = lzxNormal;
+    m_pImpl->cabTemplate = narrow(cabTemplate);
+    m_pImpl->cabFolder = narrow(cabFolder);
+    m_pImpl->diskName = narrow(diskName);
     m_pImpl->cabIndex = cabIndexStart;
+    m_pImpl->cabIndexStart = cabIndexStart;
+    m_pImpl->mediaSize = mediaSize;
+    m_pImpl->setID = setID;
+    m_pImpl->headerReserved = headerReserved;
+
+#ifdef _WIN32
+    m_pImpl->hfci = NULL;
+    m_pImpl->scratchCount = 0;
 
-    CCAB ccab = { 0 };
+    CCAB& ccab = m_pImpl->ccab;
+    ZeroMemory(&ccab, sizeof(ccab));
     ccab.cb                 = mediaSize == 0 ? ULONG_MAX : mediaSize;
     ccab.cbFolderThresh     = ULONG_MAX;
     ccab.iCab               = m_pImpl->cabIndex;
     ccab.setID              = setID;
     ccab.iDisk              = 0;
     ccab.cbReserveCFHeader  = headerReserved;
-    strcpy_s(ccab.szDisk, ARRAYSIZE(ccab.szDisk), diskName ? ATL::CT2A(diskName) : "");
-    strcpy_s(ccab.szCabPath, ARRAYSIZE(ccab.szCabPath), cabFolder ?  ATL::CT2A(cabFolder) : "");
+    strcpy_s(ccab.szDisk, ARRAYSIZE(ccab.szDisk), m_pImpl->diskName.c_str());
+    strcpy_s(ccab.szCabPath, ARRAYSIZE(ccab.szCabPath), m_pImpl->cabFolder.c_str());
     sprintf_s(ccab.szCab, m_pImpl->cabTemplate.c_str() , ccab.iCab);
+#endif
 
-    // try creating error context
-    m_pImpl->hfci = 
-        FCICreate(&m_pImpl->erf,
-                  Impl::filePlaced,
-                  Impl::alloc, 
-                  Impl::free, 
-                  Impl::open, 
-                  Impl::read, 
-                  Impl::write, 
-                  Impl::close, 
-                  Impl::seek,
-                  Impl::remove,
-                  Impl::getTempFile,
-                  &ccab,
-                  m_pImpl);
-
-    if (m_pImpl->hfci == NULL)
-        throw runtime_error(Impl::fcierrorToString(m_pImpl->erf.erfOper));
+    // the compression context is created by the first call to addFile(): 
+    // FCI is only needed for Quantum compression
 }
 
 //------------------------------------------------------------------------------
 CabCompress::~CabCompress()
 {
+#ifdef _WIN32
     if (m_pImpl->hfci)
     {
         flush();
         FCIDestroy(m_pImpl->hfci);
     }
 
+    for (Impl::ScratchMap::iterator it = m_pImpl->scratchFiles.begin(); it != m_pImpl->scratchFiles.end(); ++it)
+    {
+        delete it->second;
+    }
+#endif
+
+    if (m_pImpl->writer)
+    {
+        try
+        {
+            m_pImpl->writer->flushCabinet();
+        }
+        catch (const runtime_error&)
+        {
+        }
+
+        delete m_pImpl->writer;
+    }
+
     delete m_pImpl;
 }
 
+//------------------------------------------------------------------------------
+void CabCompress::setJobs(unsigned int jobs)
+{
+    m_pImpl->jobs = jobs;
+}
+
+//------------------------------------------------------------------------------
+void CabCompress::setOutput(ScratchFile* out)
+{
+    m_pImpl->output = out;
+    if (m_pImpl->writer)
+        m_pImpl->writer->setOutput(out);
+}
+
+//------------------------------------------------------------------------------
+void CabCompress::setLzx(int windowBits, LzxEffort effort)
+{
+    if (windowBits < Lzx::MIN_WINDOW || windowBits > Lzx::MAX_WINDOW)
+        throw runtime_error("Invalid LZX window size");
+
+    m_pImpl->lzxWindow = windowBits;
+    m_pImpl->lzxEffort = effort;
+    if (m_pImpl->writer)
+        m_pImpl->writer->setLzx(windowBits, static_cast<Lzx::Effort>(effort));
+}
+
+//------------------------------------------------------------------------------
+void CabCompress::Impl::createWriter()
+{
+    writer = new CabWriter(cabFolder, 
+                           cabTemplate, 
+                           mediaSize, 
+                           cabIndex, 
+                           setID, 
+                           diskName, 
+                           headerReserved, 
+                           jobs);
+    writer->setLzx(lzxWindow, static_cast<Lzx::Effort>(lzxEffort));
+    writer->setOutput(output);
+}
+
+#ifdef _WIN32
+//------------------------------------------------------------------------------
+void CabCompress::Impl::createFci()
+{
+    // try creating error context
+    hfci = FCICreate(&erf,
+                     filePlaced,
+                     alloc, 
+                     free, 
+                     open, 
+                     read, 
+                     write, 
+                     close, 
+                     seek,
+                     remove,
+                     getTempFile,
+                     &ccab,
+                     this);
+
+    if (hfci == NULL)
+        throw runtime_error(fcierrorToString(erf.erfOper));
+}
+#endif
+
 //------------------------------------------------------------------------------
 std::string CabCompress::evalCabTemplate(int index) const
 {
-    char cab[MAX_PATH];
-    sprintf_s(cab, m_pImpl->cabTemplate.c_str() , index);
+    char cab[260];
+    snprintf(cab, sizeof(cab), m_pImpl->cabTemplate.c_str() , index);
     return cab;
 }
 
@@ -147,56 +297,126 @@ int CabCompress::addFile(const _TCHAR*  filePath,
                          const _TCHAR*  fileName /* = 0 */, 
                          Compression    comp /* = compMSZIP */)
 {
-    ATL::CT2A filePathA(filePath);
+    string filePathA = narrow(filePath);
 
-    char cabName[_MAX_FNAME];
+    string cabName;
     if (fileName == 0)
     {
-        char drive[_MAX_DRIVE];
-        char dir[_MAX_DIR];
-        char fname[_MAX_FNAME];
-        char ext[_MAX_EXT];
-        _splitpath_s(filePathA, 
-                     drive, ARRAYSIZE(drive), 
-                     dir, ARRAYSIZE(dir), 
-                     fname, ARRAYSIZE(fname), 
-                     ext, ARRAYSIZE(ext));
-        _makepath_s(cabName, ARRAYSIZE(cabName), NULL, NULL, fname, ext);
+        string::size_type pos = filePathA.find_last_of("\\/:");
+        cabName = pos == string::npos ? filePathA : filePathA.substr(pos + 1);
     }
     else
     {
-        strcpy_s(cabName, ARRAYSIZE(cabName), ATL::CT2A(fileName));
+        cabName = narrow(fileName);
     }
 
+    // native writer for uncompressed, MSZIP and LZX cabinets
+    bool native = comp != compQuantum;
+#ifdef _WIN32
+    if (m_pImpl->hfci == NULL && (native || m_pImpl->writer != NULL))
+#endif
+    {
+        if (!native)
+        {
+#ifdef _WIN32
+            throw runtime_error("Cannot mix Quantum with other compression types in a cabinet");
+#else
+            throw runtime_error("Quantum compression is not supported on this platform");
+#endif
+        }
+
+        if (m_pImpl->writer == NULL)
+            m_pImpl->createWriter();
+
+        m_pImpl->cabIndex = m_pImpl->writer->addFile(filePathA, cabName, writerCompression(comp));
+        return m_pImpl->cabIndex;
+    }
+
+#ifdef _WIN32
+    if (native)
+        throw runtime_error("Cannot mix Quantum with other compression types in a cabinet");
+
+    if (m_pImpl->hfci == NULL)
+        m_pImpl->createFci();
+
     TCOMP ct;
     switch (comp)
     {
-    case compNone:      ct = tcompTYPE_NONE; break;
-    case compMSZIP:     ct = tcompTYPE_MSZIP; break;
-    case compLZX:       ct = tcompTYPE_LZX | tcompLZX_WINDOW_HI; break;
     case compQuantum:   ct = tcompTYPE_QUANTUM | tcompQUANTUM_LEVEL_HI | tcompQUANTUM_MEM_HI; break;
     default:            ct = tcompTYPE_NONE; break;
     }
 
     int index = m_pImpl->cabIndex;
-    BOOL res = FCIAddFile(m_pImpl->hfci, static_cast<char*>(filePathA), cabName, FALSE, Impl::getNextCab, Impl::progress, Impl::getOpenInfo, ct);
+    BOOL res = FCIAddFile(m_pImpl->hfci, const_cast<char*>(filePathA.c_str()), const_cast<char*>(cabName.c_str()), FALSE, Impl::getNextCab, Impl::progress, Impl::getOpenInfo, ct);
     return (res ? index : -1);
+#endif
+}
+
+//------------------------------------------------------------------------------
+bool CabCompress::copyFolder(CabReader& reader, size_t folder, Compression comp /* = compMSZIP */)
+{
+    // folders are copied by the native writer only
+    if (comp == compQuantum)
+        return false;
+
+#ifdef _WIN32
+    if (m_pImpl->hfci != NULL)
+        throw runtime_error("Cannot mix Quantum with other compression types in a cabinet");
+#endif
+
+    if (m_pImpl->writer == NULL)
+        m_pImpl->createWriter();
+
+    if (reader.folders().at(folder).type != m_pImpl->writer->folderType(writerCompression(comp)))
+        return false;
+
+    m_pImpl->cabIndex = m_pImpl->writer->copyFolder(reader, folder);
+    return true;
 }
 
 //------------------------------------------------------------------------------
 int CabCompress::flushCabinet()
 {
-    BOOL res = FCIFlushCabinet(m_pImpl->hfci, FALSE, Impl::getNextCab, Impl::progress);
-    return (res ? m_pImpl->cabIndex : -1);
+    if (m_pImpl->writer)
+    {
+        // write cabinet, the next file goes into a new one
+        int index = m_pImpl->writer->flushCabinet();
+        m_pImpl->cabIndex = m_pImpl->writer->flushFolder();
+        return index;
+    }
+
+#ifdef _WIN32
+    if (m_pImpl->hfci != NULL)
+    {
+        BOOL res = FCIFlushCabinet(m_pImpl->hfci, FALSE, Impl::getNextCab, Impl::progress);
+        return (res ? m_pImpl->cabIndex : -1);
+    }
+#endif
+
+    return m_pImpl->cabIndex;
 }
 
 //------------------------------------------------------------------------------
 int CabCompress::flush()
 {
-    BOOL res = FCIFlushFolder(m_pImpl->hfci, Impl::getNextCab, Impl::progress);
-    return (res ? m_pImpl->cabIndex : -1);
+    if (m_pImpl->writer)
+    {
+        m_pImpl->cabIndex = m_pImpl->writer->flushFolder();
+        return m_pImpl->cabIndex;
+    }
+
+#ifdef _WIN32
+    if (m_pImpl->hfci != NULL)
+    {
+        BOOL res = FCIFlushFolder(m_pImpl->hfci, Impl::getNextCab, Impl::progress);
+        return (res ? m_pImpl->cabIndex : -1);
+    }
+#endif
+
+    return m_pImpl->cabIndex;
 }
 
+#ifdef _WIN32
 //------------------------------------------------------------------------------
 FNFCIGETNEXTCABINET(CabCompress::Impl::getNextCab)
 {
@@ -275,8 +495,13 @@ FNFCIGETOPENINFO(CabCompress::Impl::getOpenInfo)
     /*
     * Return handle using _open
     */
-    _sopen_s(&hf, pszName, _O_RDONLY | _O_BINARY, _SH_DENYNO, _S_IREAD);
-    return hf;
+    if (_sopen_s(&hf, pszName, _O_RDONLY | _O_BINARY, _SH_DENYNO, _S_IREAD) != 0)
+        return -1;
+
+    FciFile* file = new FciFile;
+    file->fd = hf;
+    file->scratch = NULL;
+    return reinterpret_cast<INT_PTR>(file);
 }
 
 //------------------------------------------------------------------------------
@@ -302,18 +527,50 @@ FNFCIFREE(CabCompress::Impl::free)
     ::free(memory);
 }
 
+//------------------------------------------------------------------------------
+bool CabCompress::Impl::isScratch(const char* name)
+{
+    return strncmp(name, "scratch:", 8) == 0;
+}
+
 //------------------------------------------------------------------------------
 FNFCIOPEN(CabCompress::Impl::open)
 {
-    int result;
-    *err = ::_sopen_s(&result, pszFile, oflag, _SH_DENYNO, pmode);
-    return result;
+    Impl* pImpl = reinterpret_cast<Impl*>(pv);
+
+    FciFile* file = new FciFile;
+    file->fd = -1;
+    file->scratch = NULL;
+
+    if (isScratch(pszFile))
+    {
+        // temporary files stay in memory (see getTempFile)
+        ScratchFile*& scratch = pImpl->scratchFiles[pszFile];
+        if (scratch == NULL)
+            scratch = new ScratchFile;
+        else if (oflag & _O_TRUNC)
+            scratch->truncate();
+
+        scratch->seek(0, SEEK_SET);
+        file->scratch = scratch;
+    }
+    else if ((*err = ::_sopen_s(&file->fd, pszFile, oflag, _SH_DENYNO, pmode)) != 0)
+    {
+        delete file;
+        return -1;
+    }
+
+    return reinterpret_cast<INT_PTR>(file);
 }
 
 //------------------------------------------------------------------------------
 FNFCIREAD(CabCompress::Impl::read)
 {
-    unsigned int result = (unsigned int) ::_read(hf, memory, cb);
+    FciFile* file = reinterpret_cast<FciFile*>(hf);
+    if (file->scratch)
+        return static_cast<UINT>(file->scratch->read(memory, cb));
+
+    unsigned int result = (unsigned int) ::_read(file->fd, memory, cb);
     if (result == -1)
         *err = errno;
     return result;
@@ -322,7 +579,16 @@ FNFCIREAD(CabCompress::Impl::read)
 //------------------------------------------------------------------------------
 FNFCIWRITE(CabCompress::Impl::write)
 {
-    unsigned int result = (unsigned int) ::_write(hf, memory, cb);
+    FciFile* file = reinterpret_cast<FciFile*>(hf);
+    if (file->scratch)
+    {
+        UINT result = static_cast<UINT>(file->scratch->write(memory, cb));
+        if (result != cb)
+            *err = ENOSPC;
+        return result;
+    }
+
+    unsigned int result = (unsigned int) ::_write(file->fd, memory, cb);
     if (result == -1)
         *err = errno;
     return result;
@@ -331,24 +597,42 @@ FNFCIWRITE(CabCompress::Impl::write)
 //------------------------------------------------------------------------------
 FNFCICLOSE(CabCompress::Impl::close)
 {
-    int result = ::_close(hf);
+    FciFile* file = reinterpret_cast<FciFile*>(hf);
+    int result = file->scratch ? 0 : ::_close(file->fd);
     if (result != 0)
         *err = errno;
+    delete file;
     return result;
 }
 
 //------------------------------------------------------------------------------
 FNFCISEEK(CabCompress::Impl::seek)
 {
-    long result = ::_lseek(hf, dist, seektype);
+    FciFile* file = reinterpret_cast<FciFile*>(hf);
+    // (FCI's temporary files stay below 2 GB, the limit of a cabinet)
+    long result = file->scratch ? static_cast<long>(file->scratch->seek(dist, seektype)) 
+                                : ::_lseek(file->fd, dist, seektype);
     if (result == -1)
-        *err = errno;
+        *err = file->scratch ? EINVAL : errno;
     return result;
 }
 
 //------------------------------------------------------------------------------
 FNFCIDELETE(CabCompress::Impl::remove)
 {
+    Impl* pImpl = reinterpret_cast<Impl*>(pv);
+
+    if (isScratch(pszFile))
+    {
+        ScratchMap::iterator it = pImpl->scratchFiles.find(pszFile);
+        if (it != pImpl->scratchFiles.end())
+        {
+            delete it->second;
+            pImpl->scratchFiles.erase(it);
+        }
+        return 0;
+    }
+
     int result = ::remove(pszFile);
     if (result != 0)
         *err = errno;
@@ -358,20 +642,12 @@ FNFCIDELETE(CabCompress::Impl::remove)
 //------------------------------------------------------------------------------
 FNFCIGETTEMPFILE(CabCompress::Impl::getTempFile)
 {
-    char* tmp = _tempnam("","cab");      // Get a name
-    if ((tmp != NULL) && (strlen(tmp) < (size_t)cbTempName)) 
-    {
-        strcpy_s(pszTempName, cbTempName, tmp); // Copy to caller's buffer
-        free(tmp);                      // Free temporary name buffer
-        return TRUE;                    // Success
-    }
-
-    if (tmp)
-    {
-        free(tmp);
-    }
+    // temporary files are scratch files of this context: they live in
+    // memory and spill to disk above the ScratchFile budget
+    Impl* pImpl = reinterpret_cast<Impl*>(pv);
 
-    return FALSE;
+    int len = _snprintf_s(pszTempName, cbTempName, _TRUNCATE, "scratch:%lx", ++pImpl->scratchCount);
+    return len > 0 ? TRUE : FALSE;
 }
 
 //------------------------------------------------------------------------------
@@ -391,3 +667,5 @@ const char* CabCompress::Impl::fcierrorToString(int err)
     default:                    return "Unknown error";
     }
 }
+
+#endif // _WIN32
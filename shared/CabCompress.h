@@ -24,8 +24,21 @@
 // SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //
 //------------------------------------------------------------------------------
+#ifndef CAB_COMPRESS_H_INCLUDED
+#define CAB_COMPRESS_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
 #include "tstring.h"
-#include <tchar.h>
+#include <stddef.h>
+
+class CabReader;
+class ScratchFile;
+
+#ifndef _WIN32
+#define __stdcall
+#endif
 
 class CabCompress
 {
@@ -38,6 +51,13 @@ public:
         compQuantum
     };
 
+    enum LzxEffort
+    {
+        lzxFast,            // hash chains, greedy parsing
+        lzxNormal,          // longer hash chains, lazy parsing
+        lzxMax              // binary trees, near-optimal parsing
+    };
+
     // constructor
     CabCompress(const _TCHAR*   cabFolder, 
                 const _TCHAR*   cabTemplate,
@@ -50,9 +70,21 @@ public:
     // destructor
     ~CabCompress();
 
+    // set number of worker threads for MSZIP compression
+    void                setJobs(unsigned int jobs);
+
+    // write the cabinet into out instead of a file (single cabinet only)
+    void                setOutput(ScratchFile* out);
+
+    // set LZX window size (15..21) and effort (default: 21, lzxNormal)
+    void                setLzx(int windowBits, LzxEffort effort);
+
     // add a new file (returns last cabinet index)
     int                 addFile(const _TCHAR* filePath, const _TCHAR* fileName = 0, Compression comp = compMSZIP);
 
+    // copy a folder of an existing cabinet if it was compressed with comp (returns false otherwise)
+    bool                copyFolder(CabReader& reader, size_t folder, Compression comp = compMSZIP);
+
     // begin a new contued cabinet (returns last cabinet index)
     int                 flushCabinet();
 
@@ -72,3 +104,5 @@ private:
     struct Impl;
     Impl* m_pImpl;
 };
+
+#endif // CAB_COMPRESS_H_INCLUDED
@@ -0,0 +1,223 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "CabReader.h"
+#include "Codepage.h"
+#include <string.h>
+#include <stdexcept>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const size_t        CFHEADER_SIZE       = 36;
+    const size_t        CFFOLDER_SIZE       = 8;
+    const size_t        CFFILE_SIZE         = 16;
+    const size_t        CFDATA_SIZE         = 8;
+
+    const unsigned      cfhdrPREV_CABINET   = 0x0001;
+    const unsigned      cfhdrNEXT_CABINET   = 0x0002;
+    const unsigned      cfhdrRESERVE_PRESENT = 0x0004;
+
+    const unsigned      ifoldCONTINUED_FROM_PREV    = 0xFFFD;
+    const unsigned      ifoldCONTINUED_TO_NEXT      = 0xFFFE;
+    const unsigned      ifoldCONTINUED_PREV_AND_NEXT = 0xFFFF;
+
+    //--------------------------------------------------------------------------
+    unsigned get16(const unsigned char* p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    //--------------------------------------------------------------------------
+    unsigned long get32(const unsigned char* p)
+    {
+        return get16(p) | (static_cast<unsigned long>(get16(p + 2)) << 16);
+    }
+}
+
+//------------------------------------------------------------------------------
+CabReader::CabReader(const std::string& cabPath) :
+    CabReader(fopen(cabPath.c_str(), "rb"), cabPath)
+{
+}
+
+#ifdef _WIN32
+//------------------------------------------------------------------------------
+CabReader::CabReader(const std::wstring& cabPath) :
+    CabReader(_wfopen(cabPath.c_str(), L"rb"), Codepage::narrowPath(cabPath))
+{
+}
+#endif
+
+//------------------------------------------------------------------------------
+CabReader::CabReader(FILE* file, const std::string& cabPath) :
+    m_path(cabPath),
+    m_file(file),
+    m_dataReserved(0)
+{
+    if (m_file == NULL)
+        throw runtime_error("Could not open cabinet file: " + cabPath);
+
+    try
+    {
+        // header
+        unsigned char header[CFHEADER_SIZE];
+        read(header, sizeof(header));
+        if (memcmp(header, "MSCF", 4) != 0)
+            throw runtime_error("Not a cabinet file: " + cabPath);
+
+        unsigned long filesOffset = get32(header + 16);
+        unsigned folderCount = get16(header + 26);
+        unsigned fileCount = get16(header + 28);
+        unsigned flags = get16(header + 30);
+
+        unsigned folderReserved = 0;
+        if (flags & cfhdrRESERVE_PRESENT)
+        {
+            unsigned char reserve[4];
+            read(reserve, sizeof(reserve));
+            folderReserved = reserve[2];
+            m_dataReserved = reserve[3];
+            fseek(m_file, get16(reserve), SEEK_CUR);
+        }
+
+        // skip names of previous and next cabinet and disk
+        int names = ((flags & cfhdrPREV_CABINET) ? 2 : 0) + ((flags & cfhdrNEXT_CABINET) ? 2 : 0);
+        while (names > 0)
+        {
+            int c = fgetc(m_file);
+            if (c == EOF)
+                throw runtime_error("Invalid cabinet file: " + cabPath);
+            if (c == 0)
+                --names;
+        }
+
+        // folders
+        m_folders.resize(folderCount);
+        for (unsigned i = 0; i < folderCount; ++i)
+        {
+            unsigned char entry[CFFOLDER_SIZE];
+            read(entry, sizeof(entry));
+            fseek(m_file, folderReserved, SEEK_CUR);
+
+            Folder& folder = m_folders[i];
+            folder.dataOffset = get32(entry);
+            folder.blocks = get16(entry + 4);
+            folder.type = get16(entry + 6);
+            folder.complete = true;
+        }
+
+        if (folderCount > 0 && (flags & cfhdrPREV_CABINET)) m_folders.front().complete = false;
+        if (folderCount > 0 && (flags & cfhdrNEXT_CABINET)) m_folders.back().complete = false;
+
+        // files
+        if (fseek(m_file, filesOffset, SEEK_SET) != 0)
+            throw runtime_error("Invalid cabinet file: " + cabPath);
+
+        for (unsigned i = 0; i < fileCount; ++i)
+        {
+            unsigned char entry[CFFILE_SIZE];
+            read(entry, sizeof(entry));
+
+            File file;
+            file.size = get32(entry);
+            file.offset = get32(entry + 4);
+            file.date = get16(entry + 10);
+            file.time = get16(entry + 12);
+            file.attribs = get16(entry + 14);
+
+            for (int c = fgetc(m_file); c != 0; c = fgetc(m_file))
+            {
+                if (c == EOF)
+                    throw runtime_error("Invalid cabinet file: " + cabPath);
+                file.name += static_cast<char>(c);
+            }
+
+            unsigned index = get16(entry + 8);
+            switch (index)
+            {
+            case ifoldCONTINUED_FROM_PREV:
+            case ifoldCONTINUED_PREV_AND_NEXT:
+                index = 0;
+                break;
+            case ifoldCONTINUED_TO_NEXT:
+                index = folderCount - 1;
+                break;
+            }
+
+            if (index >= folderCount)
+                throw runtime_error("Invalid cabinet file: " + cabPath);
+
+            // files must follow each other in the folder
+            Folder& folder = m_folders[index];
+            unsigned long expected = folder.files.empty() ? 0 : folder.files.back().offset + folder.files.back().size;
+            if (file.offset != expected)
+                folder.complete = false;
+
+            folder.files.push_back(file);
+        }
+    }
+    catch (...)
+    {
+        fclose(m_file);
+        throw;
+    }
+}
+
+//------------------------------------------------------------------------------
+CabReader::~CabReader()
+{
+    fclose(m_file);
+}
+
+//------------------------------------------------------------------------------
+void CabReader::seekFolder(size_t folder)
+{
+    if (fseek(m_file, m_folders.at(folder).dataOffset, SEEK_SET) != 0)
+        throw runtime_error("Invalid cabinet file: " + m_path);
+}
+
+//------------------------------------------------------------------------------
+void CabReader::readBlock(std::vector<unsigned char>& data, size_t& uncompressedLen)
+{
+    unsigned char header[CFDATA_SIZE];
+    read(header, sizeof(header));
+    fseek(m_file, m_dataReserved, SEEK_CUR);
+
+    data.resize(get16(header + 4));
+    uncompressedLen = get16(header + 6);
+    if (!data.empty())
+        read(&data[0], data.size());
+}
+
+//------------------------------------------------------------------------------
+void CabReader::read(void* buf, size_t len)
+{
+    if (fread(buf, 1, len, m_file) != len)
+        throw runtime_error("Invalid cabinet file: " + m_path);
+}
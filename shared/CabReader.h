@@ -0,0 +1,102 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Cabinet reader
+//
+// Reads the CFFOLDER and CFFILE tables of a single cabinet file and gives
+// access to the raw CFDATA blocks of its folders, without decompressing
+// them. It is used to copy unchanged folders of a previous build into a
+// new cabinet (see CabWriter::copyFolder()).
+//
+//------------------------------------------------------------------------------
+#ifndef CAB_READER_H_INCLUDED
+#define CAB_READER_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class CabReader
+{
+public:
+    struct File
+    {
+        std::string     name;           // name in cabinet
+        unsigned long   size;           // uncompressed size
+        unsigned long   offset;         // offset in folder
+        unsigned        date;           // DOS date
+        unsigned        time;           // DOS time
+        unsigned        attribs;        // attributes
+    };
+
+    struct Folder
+    {
+        unsigned long   dataOffset;     // offset of first CFDATA block
+        unsigned        blocks;         // number of CFDATA blocks
+        unsigned        type;           // compression type
+        bool            complete;       // folder is entirely contained in this cabinet
+        std::vector<File> files;        // files in cabinet order
+    };
+
+    // constructor (throws std::runtime_error if the cabinet is invalid)
+    explicit CabReader(const std::string& cabPath);
+#ifdef _WIN32
+    explicit CabReader(const std::wstring& cabPath);
+#endif
+
+    // destructor
+    ~CabReader();
+
+    // folders of the cabinet
+    const std::vector<Folder>& folders() const { return m_folders; }
+
+    // position at the first CFDATA block of a folder
+    void                seekFolder(size_t folder);
+
+    // read the next CFDATA block (data without header, and uncompressed size)
+    void                readBlock(std::vector<unsigned char>& data, size_t& uncompressedLen);
+
+private:
+    CabReader(const CabReader&);
+    CabReader& operator=(const CabReader&);
+
+    // read an opened cabinet (path for messages)
+    CabReader(FILE* file, const std::string& cabPath);
+
+    // read exactly len bytes
+    void                read(void* buf, size_t len);
+
+    std::string         m_path;         // cabinet path
+    FILE*               m_file;         // cabinet file
+    unsigned            m_dataReserved; // size of per-block reserved area
+    std::vector<Folder> m_folders;      // folders
+};
+
+#endif // CAB_READER_H_INCLUDED
@@ -0,0 +1,825 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "CabWriter.h"
+#include "CabReader.h"
+#include "MsZip.h"
+#include "ThreadPool.h"
+#include "ScratchFile.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const size_t        CFHEADER_SIZE       = 36;
+    const size_t        CFFOLDER_SIZE       = 8;
+    const size_t        CFFILE_SIZE         = 16;
+    const size_t        CFDATA_SIZE         = 8;
+
+    const unsigned      cfhdrPREV_CABINET   = 0x0001;
+    const unsigned      cfhdrNEXT_CABINET   = 0x0002;
+    const unsigned      cfhdrRESERVE_PRESENT = 0x0004;
+
+    const unsigned      ifoldCONTINUED_FROM_PREV    = 0xFFFD;
+    const unsigned      ifoldCONTINUED_TO_NEXT      = 0xFFFE;
+    const unsigned      ifoldCONTINUED_PREV_AND_NEXT = 0xFFFF;
+
+    const unsigned      MAX_FOLDER_BLOCKS   = 0xFFFF;
+    const size_t        MAX_DATA_SIZE       = 0xFFFF;
+    const size_t        MAX_FILES           = 0xFFFF;
+    const unsigned long long MAX_CABINET_SIZE = 0xFFFFFFFFull;
+    const unsigned      MAX_FILE_SIZE       = 0x7FFF8000;
+    const size_t        IO_BUFFER_SIZE      = 1 << 20;
+    const size_t        BLOCKS_PER_JOB      = 8;
+
+    // file attributes stored in CFFILE
+    const unsigned      attrREADONLY        = 0x01;
+    const unsigned      attrHIDDEN          = 0x02;
+    const unsigned      attrSYSTEM          = 0x04;
+    const unsigned      attrARCHIVE         = 0x20;
+
+    //--------------------------------------------------------------------------
+    void put16(vector<unsigned char>& buf, unsigned value)
+    {
+        buf.push_back(static_cast<unsigned char>(value));
+        buf.push_back(static_cast<unsigned char>(value >> 8));
+    }
+
+    //--------------------------------------------------------------------------
+    void put32(vector<unsigned char>& buf, unsigned long value)
+    {
+        put16(buf, value & 0xFFFF);
+        put16(buf, (value >> 16) & 0xFFFF);
+    }
+
+    //--------------------------------------------------------------------------
+    // cabinet checksum (see MS-CAB, section 2.5)
+    unsigned long checksum(const unsigned char* data, size_t len, unsigned long seed)
+    {
+        unsigned long csum = seed;
+        for (size_t n = len / 4; n > 0; --n, data += 4)
+        {
+            csum ^= static_cast<unsigned long>(data[0])
+                  | (static_cast<unsigned long>(data[1]) << 8)
+                  | (static_cast<unsigned long>(data[2]) << 16)
+                  | (static_cast<unsigned long>(data[3]) << 24);
+        }
+
+        unsigned long ul = 0;
+        switch (len % 4)
+        {
+        case 3: ul |= static_cast<unsigned long>(*data++) << 16;   // fall through
+        case 2: ul |= static_cast<unsigned long>(*data++) << 8;    // fall through
+        case 1: ul |= *data;
+        }
+
+        return (csum ^ ul) & 0xFFFFFFFF;
+    }
+
+    //--------------------------------------------------------------------------
+    // build a CFDATA record
+    void makeDataBlock(const unsigned char* data, size_t len, size_t uncompressedLen, vector<unsigned char>& block)
+    {
+        vector<unsigned char> sizes;
+        put16(sizes, static_cast<unsigned>(len));
+        put16(sizes, static_cast<unsigned>(uncompressedLen));
+
+        unsigned long csum = checksum(&sizes[0], sizes.size(), checksum(data, len, 0));
+
+        block.clear();
+        block.reserve(CFDATA_SIZE + len);
+        put32(block, csum);
+        block.insert(block.end(), sizes.begin(), sizes.end());
+        block.insert(block.end(), data, data + len);
+    }
+
+    //--------------------------------------------------------------------------
+    // determine DOS date, time and attributes of a file
+    void fileInfo(const string& path, unsigned& date, unsigned& time, unsigned& attribs)
+    {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            throw runtime_error("Failure opening file to be stored in cabinet: " + path);
+
+        time_t mtime = st.st_mtime;
+        struct tm lt;
+#ifdef _WIN32
+        localtime_s(&lt, &mtime);
+#else
+        localtime_r(&mtime, &lt);
+#endif
+        date = ((lt.tm_year - 80) << 9) | ((lt.tm_mon + 1) << 5) | lt.tm_mday;
+        time = (lt.tm_hour << 11) | (lt.tm_min << 5) | (lt.tm_sec / 2);
+
+        attribs = 0;
+#ifdef _WIN32
+        DWORD attrs = GetFileAttributesA(path.c_str());
+        if (attrs != INVALID_FILE_ATTRIBUTES)
+        {
+            if (attrs & FILE_ATTRIBUTE_READONLY)    attribs |= attrREADONLY;
+            if (attrs & FILE_ATTRIBUTE_SYSTEM)      attribs |= attrSYSTEM;
+            if (attrs & FILE_ATTRIBUTE_HIDDEN)      attribs |= attrHIDDEN;
+            if (attrs & FILE_ATTRIBUTE_ARCHIVE)     attribs |= attrARCHIVE;
+        }
+#else
+        if ((st.st_mode & S_IWUSR) == 0) attribs |= attrREADONLY;
+        attribs |= attrARCHIVE;
+#endif
+    }
+}
+
+//------------------------------------------------------------------------------
+struct CabWriter::Impl
+{
+    struct FileEntry
+    {
+        unsigned long   size;           // uncompressed size
+        unsigned long   offset;         // offset in folder
+        unsigned        date;           // DOS date
+        unsigned        time;           // DOS time
+        unsigned        attribs;        // attributes
+        string          name;           // name in cabinet
+    };
+
+    struct CabFileEntry
+    {
+        FileEntry       file;           // file
+        unsigned        folder;         // folder index in cabinet
+        bool            fromPrev;       // continued from previous cabinet
+        bool            toNext;         // continued in next cabinet
+    };
+
+    struct FolderEntry
+    {
+        unsigned long   dataOffset;     // offset of first CFDATA in data file
+        unsigned        blocks;         // number of CFDATA blocks
+        unsigned        type;           // compression type
+    };
+
+    // settings
+    string              cabFolder;
+    string              cabTemplate;
+    unsigned long       mediaSize;      // maximum cabinet size (0: no limit)
+    int                 cabIndexStart;
+    unsigned short      setID;
+    string              diskName;
+    unsigned int        headerReserved;
+    ThreadPool          pool;
+    ScratchFile*        output;         // receives the cabinet instead of a file (if set)
+
+    // current cabinet
+    int                 cabIndex;       // index passed to the cabinet template
+    bool                continued;      // continues the previous cabinet
+    vector<CabFileEntry> files;
+    vector<FolderEntry> folders;
+    size_t              tableSize;      // size of CFFOLDER and CFFILE entries
+    ScratchFile         data;           // CFDATA blocks
+    unsigned long       dataSize;       // size of CFDATA blocks
+
+    // LZX settings
+    int                 lzxWindow;
+    Lzx::Effort         lzxEffort;
+
+    // current folder
+    bool                folderOpen;     // a folder is being filled
+    Compression         comp;           // compression of current folder
+    unsigned            type;           // folder compression type
+    Lzx*                lzx;            // LZX encoder of current folder
+    unsigned long       folderSize;     // uncompressed size of current folder
+    unsigned long       folderWritten;  // uncompressed size of written blocks
+    vector<FileEntry>   folderFiles;    // files of current folder
+    size_t              placed;         // number of folder files listed in current cabinet
+    vector<unsigned char> pending;      // uncompressed data, not yet in a block
+    vector<unsigned char> history;      // uncompressed data preceding pending
+
+    Impl(unsigned int jobs) :
+        mediaSize(0), cabIndexStart(0), setID(0), headerReserved(0), pool(jobs), output(NULL),
+        cabIndex(0), continued(false), tableSize(0), dataSize(0),
+        lzxWindow(21), lzxEffort(Lzx::effortNormal),
+        folderOpen(false), comp(compNone), type(0), lzx(NULL), folderSize(0), folderWritten(0), placed(0)
+    {
+    }
+
+    ~Impl()
+    {
+        delete lzx;
+    }
+
+    unsigned            folderType(Compression comp) const;
+    void                openFolder(Compression comp, unsigned type);
+    void                addFolder();
+    void                placeFile(const FileEntry& file, bool fromPrev);
+    void                compressPending(bool final);
+    void                writeBlock(const vector<unsigned char>& block, size_t uncompressedLen);
+    bool                fits(size_t files, size_t bytes) const;
+    size_t              headerSize(bool next) const;
+    string              cabinetName(int index) const;
+    void                nextCabinet();
+    void                writeCabinet(bool next);
+};
+
+//------------------------------------------------------------------------------
+CabWriter::CabWriter(const std::string&    cabFolder,
+                     const std::string&    cabTemplate,
+                     unsigned long         mediaSize /* = 0 */,
+                     int                   cabIndexStart /* = 1 */,
+                     unsigned short        setID /* = 0 */,
+                     const std::string&    diskName /* = "" */,
+                     unsigned int          headerReserved /* = 0 */,
+                     unsigned int          jobs /* = 1 */) :
+    m_pImpl(new Impl(jobs))
+{
+    m_pImpl->cabFolder = cabFolder;
+    m_pImpl->cabTemplate = cabTemplate;
+    m_pImpl->mediaSize = mediaSize;
+    m_pImpl->cabIndexStart = cabIndexStart;
+    m_pImpl->setID = setID;
+    m_pImpl->diskName = diskName;
+    m_pImpl->headerReserved = headerReserved;
+    m_pImpl->cabIndex = cabIndexStart;
+}
+
+//------------------------------------------------------------------------------
+CabWriter::~CabWriter()
+{
+    delete m_pImpl;
+}
+
+//------------------------------------------------------------------------------
+std::string CabWriter::cabinetName(int index) const
+{
+    return m_pImpl->cabinetName(index);
+}
+
+//------------------------------------------------------------------------------
+int CabWriter::addFile(const std::string& filePath, const std::string& fileName, Compression comp)
+{
+    Impl::FileEntry entry;
+    fileInfo(filePath, entry.date, entry.time, entry.attribs);
+    entry.name = fileName;
+
+    FILE* in = fopen(filePath.c_str(), "rb");
+    if (in == NULL)
+        throw runtime_error("Failure opening file to be stored in cabinet: " + filePath);
+
+    try
+    {
+        // determine file size
+        fseek(in, 0, SEEK_END);
+        long size = ftell(in);
+        fseek(in, 0, SEEK_SET);
+        if (size < 0 || static_cast<unsigned long>(size) > MAX_FILE_SIZE)
+            throw runtime_error("File too large to be stored in cabinet: " + filePath);
+
+        // start a new folder if compression changes or the folder is full
+        if (m_pImpl->folderOpen &&
+            (m_pImpl->type != m_pImpl->folderType(comp) ||
+             m_pImpl->folderSize + static_cast<unsigned long>(size) > MAX_FOLDER_BLOCKS * static_cast<unsigned long>(MsZip::BLOCK_SIZE)))
+        {
+            flushFolder();
+        }
+
+        if (!m_pImpl->folderOpen)
+        {
+            m_pImpl->openFolder(comp, m_pImpl->folderType(comp));
+        }
+
+        entry.size = static_cast<unsigned long>(size);
+        entry.offset = m_pImpl->folderSize;
+        m_pImpl->folderFiles.push_back(entry);
+        m_pImpl->folderSize += entry.size;
+
+        // read file
+        size_t batch = (std::max)(size_t(1), m_pImpl->pool.jobs() * BLOCKS_PER_JOB) * MsZip::BLOCK_SIZE;
+        vector<unsigned char> buf(IO_BUFFER_SIZE);
+        unsigned long left = entry.size;
+        while (left > 0)
+        {
+            size_t n = fread(&buf[0], 1, (std::min)(buf.size(), static_cast<size_t>(left)), in);
+            if (n == 0)
+                throw runtime_error("Failure reading file to be stored in cabinet: " + filePath);
+
+            m_pImpl->pending.insert(m_pImpl->pending.end(), buf.begin(), buf.begin() + n);
+            left -= static_cast<unsigned long>(n);
+
+            if (m_pImpl->pending.size() >= batch)
+            {
+                m_pImpl->compressPending(false);
+            }
+        }
+    }
+    catch (...)
+    {
+        fclose(in);
+        throw;
+    }
+
+    fclose(in);
+    return m_pImpl->cabIndex;
+}
+
+//------------------------------------------------------------------------------
+unsigned CabWriter::folderType(Compression comp) const
+{
+    return m_pImpl->folderType(comp);
+}
+
+//------------------------------------------------------------------------------
+int CabWriter::copyFolder(CabReader& reader, size_t folder)
+{
+    const CabReader::Folder& src = reader.folders().at(folder);
+    if (!src.complete)
+        throw runtime_error("Cannot copy a folder continued in another cabinet");
+
+    flushFolder();
+
+    // the blocks are copied as they are: no compression in the writer
+    m_pImpl->openFolder(compNone, src.type);
+    for (size_t i = 0; i < src.files.size(); ++i)
+    {
+        const CabReader::File& file = src.files[i];
+
+        Impl::FileEntry entry;
+        entry.size = file.size;
+        entry.offset = file.offset;
+        entry.date = file.date;
+        entry.time = file.time;
+        entry.attribs = file.attribs;
+        entry.name = file.name;
+        m_pImpl->folderFiles.push_back(entry);
+        m_pImpl->folderSize = file.offset + file.size;
+    }
+
+    vector<unsigned char> data, block;
+    size_t uncompressedLen;
+    reader.seekFolder(folder);
+    for (unsigned i = 0; i < src.blocks; ++i)
+    {
+        reader.readBlock(data, uncompressedLen);
+        if (data.empty() || data.size() > MAX_DATA_SIZE)
+            throw runtime_error("Invalid data block in source cabinet");
+
+        makeDataBlock(&data[0], data.size(), uncompressedLen, block);
+        m_pImpl->writeBlock(block, uncompressedLen);
+    }
+
+    if (m_pImpl->folderWritten != m_pImpl->folderSize)
+        throw runtime_error("Invalid folder size in source cabinet");
+
+    return flushFolder();
+}
+
+//------------------------------------------------------------------------------
+int CabWriter::flushFolder()
+{
+    if (!m_pImpl->folderOpen)
+        return m_pImpl->cabIndex;
+
+    m_pImpl->compressPending(true);
+
+    // empty files at the end of the folder
+    for (; m_pImpl->placed < m_pImpl->folderFiles.size(); ++m_pImpl->placed)
+    {
+        m_pImpl->placeFile(m_pImpl->folderFiles[m_pImpl->placed], false);
+    }
+
+    m_pImpl->folderOpen = false;
+    m_pImpl->folderFiles.clear();
+    m_pImpl->placed = 0;
+    return m_pImpl->cabIndex;
+}
+
+//------------------------------------------------------------------------------
+int CabWriter::flushCabinet()
+{
+    flushFolder();
+
+    int index = m_pImpl->cabIndex;
+    if (m_pImpl->files.empty())
+        return index;
+
+    m_pImpl->nextCabinet();
+    return index;
+}
+
+//------------------------------------------------------------------------------
+void CabWriter::setOutput(ScratchFile* out)
+{
+    m_pImpl->output = out;
+}
+
+//------------------------------------------------------------------------------
+void CabWriter::setLzx(int windowBits, Lzx::Effort effort)
+{
+    if (windowBits < Lzx::MIN_WINDOW || windowBits > Lzx::MAX_WINDOW)
+        throw runtime_error("Invalid LZX window size");
+
+    m_pImpl->lzxWindow = windowBits;
+    m_pImpl->lzxEffort = effort;
+}
+
+//------------------------------------------------------------------------------
+unsigned CabWriter::Impl::folderType(Compression folderComp) const
+{
+    switch (folderComp)
+    {
+    case compMSZIP: return 1;
+    case compLZX:   return Lzx::folderType(lzxWindow);
+    default:        return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+void CabWriter::Impl::openFolder(Compression folderComp, unsigned folderType)
+{
+    comp = folderComp;
+    type = folderType;
+
+    delete lzx;
+    lzx = NULL;
+    if (comp == compLZX)
+        lzx = new Lzx(lzxWindow, lzxEffort);
+
+    folderSize = 0;
+    folderWritten = 0;
+    folderOpen = true;
+    folderFiles.clear();
+    placed = 0;
+    pending.clear();
+    history.clear();
+
+    addFolder();
+}
+
+//------------------------------------------------------------------------------
+void CabWriter::Impl::addFolder()
+{
+    FolderEntry folder;
+    folder.dataOffset = dataSize;
+    folder.blocks = 0;
+    folder.type = type;
+    folders.push_back(folder);
+    tableSize += CFFOLDER_SIZE;
+}
+
+//------------------------------------------------------------------------------
+void CabWriter::Impl::placeFile(const FileEntry& file, bool fromPrev)
+{
+    CabFileEntry entry;
+    entry.file = file;
+    entry.folder = static_cast<unsigned>(folders.size() - 1);
+    entry.fromPrev = fromPrev;
+    entry.toNext = false;
+    files.push_back(entry);
+    tableSize += CFFILE_SIZE + file.name.size() + 1;
+}
+
+//------------------------------------------------------------------------------
+void CabWriter::Impl::compressPending(bool final)
+{
+    if (comp == compLZX)
+    {
+        // LZX frames depend on each other: compress sequentially
+        vector<Lzx::Frame> frames;
+        if (!pending.empty()) lzx->compress(&pending[0], pending.size(), frames);
+        if (final) lzx->finish(frames);
+        pending.clear();
+
+        vector<unsigned char> block;
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            if (frames[i].data.size() > MAX_DATA_SIZE)
+                throw runtime_error("LZX frame too large");
+
+            makeDataBlock(&frames[i].data[0], frames[i].data.size(), frames[i].size, block);
+            writeBlock(block, frames[i].size);
+        }
+        return;
+    }
+
+    const size_t blockSize = MsZip::BLOCK_SIZE;
+    size_t count = final ? (pending.size() + blockSize - 1) / blockSize : pending.size() / blockSize;
+    if (count == 0)
+        return;
+
+    // compress blocks
+    vector<vector<unsigned char> > blocks(count);
+    pool.forEach(count, [&](size_t i)
+    {
+        const unsigned char* block = &pending[0] + i * blockSize;
+        size_t len = (std::min)(blockSize, pending.size() - i * blockSize);
+
+        if (comp == compMSZIP)
+        {
+            vector<unsigned char> compressed;
+            compressed.reserve(MsZip::MAX_BLOCK_SIZE);
+            if (i == 0)
+                MsZip::compressBlock(history.empty() ? NULL : &history[0], history.size(), block, len, compressed);
+            else
+                MsZip::compressBlock(block - MsZip::HISTORY_SIZE, MsZip::HISTORY_SIZE, block, len, compressed);
+            makeDataBlock(&compressed[0], compressed.size(), len, blocks[i]);
+        }
+        else
+        {
+            makeDataBlock(block, len, len, blocks[i]);
+        }
+    });
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        writeBlock(blocks[i], (std::min)(blockSize, pending.size() - i * blockSize));
+    }
+
+    // keep history and unprocessed data
+    size_t consumed = (std::min)(pending.size(), count * blockSize);
+    size_t keep = (std::min)(consumed, static_cast<size_t>(MsZip::HISTORY_SIZE));
+    if (keep < MsZip::HISTORY_SIZE && !history.empty())
+    {
+        size_t old = (std::min)(history.size(), MsZip::HISTORY_SIZE - keep);
+        history.erase(history.begin(), history.end() - old);
+    }
+    else
+    {
+        history.clear();
+    }
+    history.insert(history.end(), pending.begin() + (consumed - keep), pending.begin() + consumed);
+    pending.erase(pending.begin(), pending.begin() + consumed);
+}
+
+//------------------------------------------------------------------------------
+void CabWriter::Impl::writeBlock(const vector<unsigned char>& block, size_t uncompressedLen)
+{
+    unsigned long end = folderWritten + static_cast<unsigned long>(uncompressedLen);
+
+    for (;;)
+    {
+        // files starting in this block are listed in the same cabinet
+        size_t count = 0, bytes = block.size();
+        for (size_t i = placed; i < folderFiles.size(); ++i)
+        {
+            const FileEntry& file = folderFiles[i];
+            if (file.offset > end || (file.offset == end && file.size != 0))
+                break;
+
+            ++count;
+            bytes += CFFILE_SIZE + file.name.size() + 1;
+        }
+
+        if (fits(count, bytes))
+        {
+            for (; count > 0; --count)
+            {
+                placeFile(folderFiles[placed++], false);
+            }
+            break;
+        }
+
+        if (dataSize == 0)
+            throw runtime_error("Media size too small for cabinet");
+
+        nextCabinet();
+    }
+
+    if (data.write(&block[0], block.size()) != block.size())
+        throw runtime_error("Could not write to temporary file");
+
+    dataSize += static_cast<unsigned long>(block.size());
+    folders.back().blocks += 1;
+    folderWritten = end;
+}
+
+//------------------------------------------------------------------------------
+bool CabWriter::Impl::fits(size_t count, size_t bytes) const
+{
+    if (files.size() + count > MAX_FILES)
+        return false;
+
+    unsigned long long size = static_cast<unsigned long long>(headerSize(mediaSize != 0)) + tableSize + dataSize + bytes;
+    return size <= (mediaSize != 0 ? mediaSize : MAX_CABINET_SIZE);
+}
+
+//------------------------------------------------------------------------------
+size_t CabWriter::Impl::headerSize(bool next) const
+{
+    size_t size = CFHEADER_SIZE + (headerReserved ? 4 + headerReserved : 0);
+    if (continued)  size += cabinetName(cabIndex - 1).size() + 1 + diskName.size() + 1;
+    if (next)       size += cabinetName(cabIndex + 1).size() + 1 + diskName.size() + 1;
+    return size;
+}
+
+//------------------------------------------------------------------------------
+string CabWriter::Impl::cabinetName(int index) const
+{
+    char cab[260];
+    snprintf(cab, sizeof(cab), cabTemplate.c_str(), index);
+    return cab;
+}
+
+//------------------------------------------------------------------------------
+void CabWriter::Impl::nextCabinet()
+{
+    // the folder continues in the next cabinet, unless it has no data in this one
+    bool split = folderOpen && folders.back().blocks > 0;
+    if (folderOpen && !split)
+    {
+        folders.pop_back();
+        tableSize -= CFFOLDER_SIZE;
+    }
+
+    if (split)
+    {
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            CabFileEntry& entry = files[i];
+            if (entry.folder == folders.size() - 1 && entry.file.offset + entry.file.size > folderWritten)
+                entry.toNext = true;
+        }
+    }
+
+    if (!files.empty() || split)
+        writeCabinet(split);
+
+    // start next cabinet
+    ++cabIndex;
+    continued = split;
+    files.clear();
+    folders.clear();
+    tableSize = 0;
+    data.truncate();
+    dataSize = 0;
+
+    if (folderOpen)
+    {
+        addFolder();
+        for (size_t i = 0; split && i < placed; ++i)
+        {
+            const FileEntry& file = folderFiles[i];
+            if (file.offset + file.size > folderWritten)
+                placeFile(file, true);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void CabWriter::Impl::writeCabinet(bool next)
+{
+    if (folders.size() > 0xFFFF)
+        throw runtime_error("Too many folders in cabinet");
+
+    string prevName = continued ? cabinetName(cabIndex - 1) : "";
+    string nextName = next ? cabinetName(cabIndex + 1) : "";
+    string cabPath = cabFolder + cabinetName(cabIndex);
+
+    size_t filesOffset = headerSize(next) + folders.size() * CFFOLDER_SIZE;
+    size_t dataOffset = headerSize(next) + tableSize;
+    unsigned long long cabSize = static_cast<unsigned long long>(dataOffset) + dataSize;
+    if (cabSize > MAX_CABINET_SIZE)
+        throw runtime_error("Cabinet too large");
+
+    unsigned flags = (continued ? cfhdrPREV_CABINET : 0)
+                   | (next ? cfhdrNEXT_CABINET : 0)
+                   | (headerReserved ? cfhdrRESERVE_PRESENT : 0);
+
+    // header
+    vector<unsigned char> header;
+    header.reserve(dataOffset);
+    header.push_back('M'); header.push_back('S'); header.push_back('C'); header.push_back('F');
+    put32(header, 0);
+    put32(header, static_cast<unsigned long>(cabSize));
+    put32(header, 0);
+    put32(header, static_cast<unsigned long>(filesOffset));
+    put32(header, 0);
+    header.push_back(3);    // versionMinor
+    header.push_back(1);    // versionMajor
+    put16(header, static_cast<unsigned>(folders.size()));
+    put16(header, static_cast<unsigned>(files.size()));
+    put16(header, flags);
+    put16(header, setID);
+    put16(header, static_cast<unsigned>(cabIndex - cabIndexStart) & 0xFFFF);
+    if (headerReserved)
+    {
+        put16(header, headerReserved);
+        header.push_back(0);    // cbCFFolder
+        header.push_back(0);    // cbCFData
+        header.insert(header.end(), headerReserved, 0);
+    }
+
+    if (continued)
+    {
+        header.insert(header.end(), prevName.c_str(), prevName.c_str() + prevName.size() + 1);
+        header.insert(header.end(), diskName.c_str(), diskName.c_str() + diskName.size() + 1);
+    }
+
+    if (next)
+    {
+        header.insert(header.end(), nextName.c_str(), nextName.c_str() + nextName.size() + 1);
+        header.insert(header.end(), diskName.c_str(), diskName.c_str() + diskName.size() + 1);
+    }
+
+    // folders
+    for (size_t i = 0; i < folders.size(); ++i)
+    {
+        const FolderEntry& folder = folders[i];
+        put32(header, static_cast<unsigned long>(dataOffset + folder.dataOffset));
+        put16(header, folder.blocks);
+        put16(header, folder.type);
+    }
+
+    // files
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+        const CabFileEntry& entry = files[i];
+
+        unsigned folder = entry.folder;
+        if (entry.fromPrev && entry.toNext) folder = ifoldCONTINUED_PREV_AND_NEXT;
+        else if (entry.fromPrev)            folder = ifoldCONTINUED_FROM_PREV;
+        else if (entry.toNext)              folder = ifoldCONTINUED_TO_NEXT;
+
+        put32(header, entry.file.size);
+        put32(header, entry.file.offset);
+        put16(header, folder);
+        put16(header, entry.file.date);
+        put16(header, entry.file.time);
+        put16(header, entry.file.attribs);
+        header.insert(header.end(), entry.file.name.c_str(), entry.file.name.c_str() + entry.file.name.size() + 1);
+    }
+
+    // write cabinet to scratch output
+    vector<unsigned char> buf(IO_BUFFER_SIZE);
+    if (output != NULL)
+    {
+        if (output->size() != 0)
+            throw runtime_error("Only a single cabinet can be written to memory: " + cabPath);
+
+        bool ok = output->write(&header[0], header.size()) == header.size();
+        data.seek(0, SEEK_SET);
+        for (unsigned long left = dataSize; ok && left > 0; )
+        {
+            size_t n = data.read(&buf[0], (std::min)(buf.size(), static_cast<size_t>(left)));
+            ok = n > 0 && output->write(&buf[0], n) == n;
+            left -= static_cast<unsigned long>(n);
+        }
+
+        if (!ok)
+            throw runtime_error("Could not write cabinet: " + cabPath);
+        return;
+    }
+
+    // write cabinet file
+    FILE* out = fopen(cabPath.c_str(), "wb");
+    if (out == NULL)
+        throw runtime_error("Could not create cabinet file: " + cabPath);
+
+    bool ok = fwrite(&header[0], 1, header.size(), out) == header.size();
+
+    data.seek(0, SEEK_SET);
+    for (unsigned long left = dataSize; ok && left > 0; )
+    {
+        size_t n = data.read(&buf[0], (std::min)(buf.size(), static_cast<size_t>(left)));
+        ok = n > 0 && fwrite(&buf[0], 1, n, out) == n;
+        left -= static_cast<unsigned long>(n);
+    }
+
+    ok = (fclose(out) == 0) && ok;
+    if (!ok)
+    {
+        remove(cabPath.c_str());
+        throw runtime_error("Could not write cabinet file: " + cabPath);
+    }
+}
@@ -0,0 +1,114 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Native cabinet writer
+//
+// Writes a set of cabinet files with uncompressed, MSZIP or LZX compressed
+// folders. The CFDATA blocks of the current cabinet are collected in a
+// scratch file (in memory up to the ScratchFile budget), while the
+// CFFOLDER and CFFILE tables are kept in memory. The cabinet is written in one pass once it is complete.
+//
+// If a media size is given, a cabinet is closed as soon as the next
+// CFDATA block would not fit, and the current folder continues in the
+// next cabinet of the set. Files spanning two cabinets are listed in both
+// (MS-CAB, section 2.3).
+//
+// MSZIP blocks are compressed in batches on a thread pool. Each block is
+// primed with the preceding 32 KB of the folder, so the cabinets are the
+// same regardless of the number of jobs. LZX folders are compressed
+// sequentially. Folders of an existing cabinet can be copied block by
+// block, so that unchanged files need not be compressed again.
+//
+//------------------------------------------------------------------------------
+#ifndef CAB_WRITER_H_INCLUDED
+#define CAB_WRITER_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "Lzx.h"
+#include <string>
+
+class CabReader;
+class ScratchFile;
+
+class CabWriter
+{
+public:
+    enum Compression
+    {
+        compNone,
+        compMSZIP,
+        compLZX
+    };
+
+    // constructor (mediaSize 0: no limit)
+    CabWriter(const std::string&    cabFolder,
+              const std::string&    cabTemplate,
+              unsigned long         mediaSize = 0,
+              int                   cabIndexStart = 1,
+              unsigned short        setID = 0,
+              const std::string&    diskName = "",
+              unsigned int          headerReserved = 0,
+              unsigned int          jobs = 1);
+
+    // destructor (discards the current cabinet unless flushCabinet() was called)
+    ~CabWriter();
+
+    // write the cabinet into out instead of a file in cabFolder (single cabinet only)
+    void                setOutput(ScratchFile* out);
+
+    // set LZX window size (15..21) and effort for subsequent folders
+    void                setLzx(int windowBits, Lzx::Effort effort);
+
+    // add a file (returns current cabinet index)
+    int                 addFile(const std::string& filePath, const std::string& fileName, Compression comp);
+
+    // CFFOLDER compression type of folders written with comp
+    unsigned            folderType(Compression comp) const;
+
+    // copy a folder of another cabinet without recompressing it (returns current cabinet index)
+    int                 copyFolder(CabReader& reader, size_t folder);
+
+    // finish the current folder (returns current cabinet index)
+    int                 flushFolder();
+
+    // write the current cabinet, the next file starts a new one (returns index of written cabinet)
+    int                 flushCabinet();
+
+    // name of the cabinet with the given index
+    std::string         cabinetName(int index) const;
+
+private:
+    CabWriter(const CabWriter&);
+    CabWriter& operator=(const CabWriter&);
+
+    struct Impl;
+    Impl* m_pImpl;
+};
+
+#endif // CAB_WRITER_H_INCLUDED
@@ -0,0 +1,228 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "Codepage.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <errno.h>
+#include <iconv.h>
+#endif
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    //--------------------------------------------------------------------------
+    unsigned effective(unsigned codepage)
+    {
+        return codepage == 0 ? 1252 : codepage;
+    }
+
+#ifndef _WIN32
+    //--------------------------------------------------------------------------
+    string iconvName(unsigned codepage)
+    {
+        switch (codepage)
+        {
+        case Codepage::UTF8:    return "UTF-8";
+        case Codepage::ASCII:   return "US-ASCII";
+        case Codepage::LATIN1:  return "ISO-8859-1";
+        }
+
+        char name[16];
+        sprintf(name, "CP%u", codepage);
+        return name;
+    }
+
+    //--------------------------------------------------------------------------
+    // convert with iconv (false if a character cannot be converted)
+    bool convert(const string& text, const string& from, const string& to, string& result)
+    {
+        iconv_t cd = iconv_open(to.c_str(), from.c_str());
+        if (cd == (iconv_t)-1)
+            throw runtime_error("Unsupported codepage conversion from " + from + " to " + to);
+
+        result.clear();
+        vector<char> buf(4 * text.size() + 16);
+        char* in = const_cast<char*>(text.data());
+        size_t inLeft = text.size();
+        bool ok = true;
+        while (inLeft > 0)
+        {
+            char* out = &buf[0];
+            size_t outLeft = buf.size();
+            size_t res = iconv(cd, &in, &inLeft, &out, &outLeft);
+            result.append(&buf[0], out - &buf[0]);
+            if (res == (size_t)-1 && errno != E2BIG)
+            {
+                ok = false;
+                break;
+            }
+        }
+
+        iconv_close(cd);
+        return ok;
+    }
+#endif // _WIN32
+}
+
+//------------------------------------------------------------------------------
+// Codepage of an encoding name
+//------------------------------------------------------------------------------
+unsigned Codepage::fromName(const string& encoding)
+{
+    string name;
+    for (size_t i = 0; i < encoding.size(); ++i)
+    {
+        if (encoding[i] != '-' && encoding[i] != '_')
+            name += static_cast<char>(tolower(static_cast<unsigned char>(encoding[i])));
+    }
+
+    if (name == "utf8")
+        return UTF8;
+    if (name == "usascii" || name == "ascii")
+        return ASCII;
+    if (name == "iso88591" || name == "latin1")
+        return LATIN1;
+    if (name.compare(0, 7, "windows") == 0 && name.size() > 7)
+        return static_cast<unsigned>(atoi(name.c_str() + 7));
+    if (name.compare(0, 2, "cp") == 0 && name.size() > 2)
+        return static_cast<unsigned>(atoi(name.c_str() + 2));
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// True if text is plain ASCII
+//------------------------------------------------------------------------------
+bool Codepage::isAscii(const string& text)
+{
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        if (static_cast<unsigned char>(text[i]) >= 0x80)
+            return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Convert text in codepage to UTF-8
+//------------------------------------------------------------------------------
+string Codepage::toUtf8(const string& text, unsigned codepage)
+{
+    codepage = effective(codepage);
+    if (codepage == UTF8 || isAscii(text))
+        return text;
+
+#ifdef _WIN32
+    int len = MultiByteToWideChar(codepage, 0, text.data(), static_cast<int>(text.size()), NULL, 0);
+    if (len == 0)
+        throw runtime_error("Unsupported codepage");
+
+    vector<wchar_t> wide(len);
+    MultiByteToWideChar(codepage, 0, text.data(), static_cast<int>(text.size()), &wide[0], len);
+    int size = WideCharToMultiByte(CP_UTF8, 0, &wide[0], len, NULL, 0, NULL, NULL);
+    string result(size, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, &wide[0], len, &result[0], size, NULL, NULL);
+    return result;
+#else
+    string result;
+    if (!convert(text, iconvName(codepage), "UTF-8", result))
+        throw runtime_error("Invalid characters for " + iconvName(codepage));
+    return result;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Convert UTF-8 to text in codepage
+//------------------------------------------------------------------------------
+bool Codepage::fromUtf8(const string& text, unsigned codepage, string& result)
+{
+    codepage = effective(codepage);
+    if (codepage == UTF8 || isAscii(text))
+    {
+        result = text;
+        return true;
+    }
+
+#ifdef _WIN32
+    int len = MultiByteToWideChar(CP_UTF8, MB_ERR_INVALID_CHARS, text.data(), static_cast<int>(text.size()), NULL, 0);
+    if (len == 0)
+        return false;
+
+    vector<wchar_t> wide(len);
+    MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), &wide[0], len);
+
+    BOOL usedDefault = FALSE;
+    BOOL* pUsedDefault = codepage < 50000 ? &usedDefault : NULL;
+    int size = WideCharToMultiByte(codepage, WC_NO_BEST_FIT_CHARS, &wide[0], len, NULL, 0, NULL, pUsedDefault);
+    if (size == 0)
+        throw runtime_error("Unsupported codepage");
+
+    result.assign(size, '\0');
+    WideCharToMultiByte(codepage, WC_NO_BEST_FIT_CHARS, &wide[0], len, &result[0], size, NULL, pUsedDefault);
+    return !usedDefault;
+#else
+    return convert(text, "UTF-8", iconvName(codepage), result);
+#endif
+}
+
+#ifdef _WIN32
+//------------------------------------------------------------------------------
+// Convert a path in the ANSI codepage to UTF-16
+//------------------------------------------------------------------------------
+wstring Codepage::widePath(const string& path)
+{
+    int len = MultiByteToWideChar(CP_ACP, 0, path.data(), static_cast<int>(path.size()), NULL, 0);
+    wstring wide(len, L'\0');
+    if (len > 0)
+        MultiByteToWideChar(CP_ACP, 0, path.data(), static_cast<int>(path.size()), &wide[0], len);
+    return wide;
+}
+
+//------------------------------------------------------------------------------
+// Convert a UTF-16 path to the ANSI codepage
+//------------------------------------------------------------------------------
+string Codepage::narrowPath(const wstring& path)
+{
+    int len = WideCharToMultiByte(CP_ACP, 0, path.data(), static_cast<int>(path.size()), NULL, 0, NULL, NULL);
+    string narrow(len, '\0');
+    if (len > 0)
+        WideCharToMultiByte(CP_ACP, 0, path.data(), static_cast<int>(path.size()), &narrow[0], len, NULL, NULL);
+    return narrow;
+}
+#endif
@@ -0,0 +1,71 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Codepage conversion
+//
+// Converts strings between the codepage of a database and UTF-8, using
+// the Windows API on Windows and iconv elsewhere. ASCII strings are
+// returned unchanged without calling either. The neutral codepage 0 is
+// treated as Windows-1252. On Windows, paths are also converted between
+// UTF-16 and the ANSI codepage, for the classes that open files by either.
+//
+//------------------------------------------------------------------------------
+#ifndef CODEPAGE_H_INCLUDED
+#define CODEPAGE_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <string>
+
+namespace Codepage
+{
+    const unsigned      UTF8        = 65001;
+    const unsigned      ASCII       = 20127;
+    const unsigned      LATIN1      = 28591;
+
+    // codepage of an encoding name such as "UTF-8", "windows-1252" or "ISO-8859-1" (0 if unknown)
+    unsigned            fromName(const std::string& encoding);
+
+    // convert text in codepage to UTF-8 (throws runtime_error)
+    std::string         toUtf8(const std::string& text, unsigned codepage);
+
+    // convert UTF-8 to text in codepage (false if a character cannot be represented)
+    bool                fromUtf8(const std::string& text, unsigned codepage, std::string& result);
+
+    // true if text is plain ASCII
+    bool                isAscii(const std::string& text);
+
+#ifdef _WIN32
+    // convert a path between UTF-16 and the ANSI codepage, the codepage of
+    // narrow paths (Windows only; characters outside it become '?')
+    std::wstring        widePath(const std::string& path);
+    std::string         narrowPath(const std::wstring& path);
+#endif
+}
+
+#endif // CODEPAGE_H_INCLUDED
@@ -0,0 +1,455 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "CompoundFile.h"
+#include "Codepage.h"
+#include "ScratchFile.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const size_t        SECTOR_SIZE         = 512;
+    const size_t        MINI_SECTOR_SIZE    = 64;
+    const size_t        MINI_STREAM_CUTOFF  = 4096;
+    const size_t        DIR_ENTRY_SIZE      = 128;
+    const size_t        HEADER_DIFAT        = 109;
+    const size_t        MAX_NAME_LEN        = 31;
+    const size_t        IO_BUFFER_SIZE      = 1 << 20;
+
+    const unsigned long DIFSECT             = 0xFFFFFFFC;
+    const unsigned long FATSECT             = 0xFFFFFFFD;
+    const unsigned long ENDOFCHAIN          = 0xFFFFFFFE;
+    const unsigned long FREESECT            = 0xFFFFFFFF;
+    const unsigned long NOSTREAM            = 0xFFFFFFFF;
+
+    const unsigned      STGTY_STREAM        = 2;
+    const unsigned      STGTY_ROOT          = 5;
+    const unsigned      COLOR_RED           = 0;
+    const unsigned      COLOR_BLACK         = 1;
+
+    //--------------------------------------------------------------------------
+    void put16(vector<unsigned char>& buf, unsigned value)
+    {
+        buf.push_back(static_cast<unsigned char>(value));
+        buf.push_back(static_cast<unsigned char>(value >> 8));
+    }
+
+    //--------------------------------------------------------------------------
+    void put32(vector<unsigned char>& buf, unsigned long value)
+    {
+        put16(buf, value & 0xFFFF);
+        put16(buf, (value >> 16) & 0xFFFF);
+    }
+
+    //--------------------------------------------------------------------------
+    size_t sectorsFor(unsigned long long size, size_t sectorSize)
+    {
+        return static_cast<size_t>((size + sectorSize - 1) / sectorSize);
+    }
+
+    //--------------------------------------------------------------------------
+    // append a chain of count sectors to fat (returns first sector)
+    unsigned long allocate(vector<unsigned long>& fat, size_t count)
+    {
+        if (count == 0)
+            return ENDOFCHAIN;
+
+        unsigned long first = static_cast<unsigned long>(fat.size());
+        for (size_t i = 1; i < count; ++i)
+            fat.push_back(first + static_cast<unsigned long>(i));
+        fat.push_back(ENDOFCHAIN);
+        return first;
+    }
+
+    //--------------------------------------------------------------------------
+    // directory order: shorter names first, then by upper case characters (MS-CFB, 2.6.4)
+    bool nameLess(const wstring& a, const wstring& b)
+    {
+        if (a.size() != b.size())
+            return a.size() < b.size();
+
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            unsigned ca = a[i] >= L'a' && a[i] <= L'z' ? a[i] - 0x20 : a[i];
+            unsigned cb = b[i] >= L'a' && b[i] <= L'z' ? b[i] - 0x20 : b[i];
+            if (ca != cb)
+                return ca < cb;
+        }
+
+        return false;
+    }
+
+    //--------------------------------------------------------------------------
+    struct DirEntry
+    {
+        wstring         name;
+        unsigned        type;
+        unsigned        color;
+        unsigned long   left;
+        unsigned long   right;
+        unsigned long   child;
+        unsigned long   start;
+        unsigned long long size;
+        unsigned        depth;
+    };
+
+    //--------------------------------------------------------------------------
+    // build a balanced tree of the entries ids[lo, hi) (returns root id)
+    unsigned long buildTree(vector<DirEntry>& entries, const vector<unsigned long>& ids, size_t lo, size_t hi, unsigned depth)
+    {
+        if (lo >= hi)
+            return NOSTREAM;
+
+        size_t mid = lo + (hi - lo) / 2;
+        DirEntry& entry = entries[ids[mid]];
+        entry.depth = depth;
+        entry.left = buildTree(entries, ids, lo, mid, depth + 1);
+        entry.right = buildTree(entries, ids, mid + 1, hi, depth + 1);
+        return ids[mid];
+    }
+
+    //--------------------------------------------------------------------------
+    void putEntry(vector<unsigned char>& buf, const DirEntry& entry, const unsigned char* clsid)
+    {
+        size_t pos = buf.size();
+        for (size_t i = 0; i < entry.name.size(); ++i)
+            put16(buf, entry.name[i] & 0xFFFF);
+        buf.resize(pos + 64, 0);
+
+        put16(buf, entry.name.empty() ? 0 : static_cast<unsigned>(2 * (entry.name.size() + 1)));
+        buf.push_back(static_cast<unsigned char>(entry.type));
+        buf.push_back(static_cast<unsigned char>(entry.color));
+        put32(buf, entry.left);
+        put32(buf, entry.right);
+        put32(buf, entry.child);
+        if (clsid)
+            buf.insert(buf.end(), clsid, clsid + 16);
+        else
+            buf.resize(buf.size() + 16, 0);
+        put32(buf, 0);                          // state bits
+        buf.resize(buf.size() + 16, 0);         // creation and modification time
+        put32(buf, entry.start);
+        put32(buf, static_cast<unsigned long>(entry.size));
+        put32(buf, 0);
+    }
+
+    //--------------------------------------------------------------------------
+    void writeBuffer(FILE* out, const vector<unsigned char>& buf, const string& path)
+    {
+        if (!buf.empty() && fwrite(&buf[0], 1, buf.size(), out) != buf.size())
+            throw runtime_error("Could not write compound file: " + path);
+    }
+
+    //--------------------------------------------------------------------------
+    // copy a stream and pad it to a multiple of sectorSize
+    void writeStream(FILE* out, ScratchFile& data, size_t sectorSize, vector<unsigned char>& buf, const string& path)
+    {
+        data.seek(0, SEEK_SET);
+        for (size_t left = data.size(); left > 0; )
+        {
+            size_t n = data.read(&buf[0], (std::min)(buf.size(), left));
+            if (n == 0 || fwrite(&buf[0], 1, n, out) != n)
+                throw runtime_error("Could not write compound file: " + path);
+            left -= n;
+        }
+
+        size_t pad = (sectorSize - data.size() % sectorSize) % sectorSize;
+        for (; pad > 0; --pad)
+        {
+            if (fputc(0, out) == EOF)
+                throw runtime_error("Could not write compound file: " + path);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+CompoundFile::CompoundFile()
+{
+    memset(m_clsid, 0, sizeof(m_clsid));
+}
+
+//------------------------------------------------------------------------------
+void CompoundFile::setClassId(const unsigned char clsid[16])
+{
+    memcpy(m_clsid, clsid, sizeof(m_clsid));
+}
+
+//------------------------------------------------------------------------------
+void CompoundFile::addStream(const wstring& name, const shared_ptr<ScratchFile>& data)
+{
+    if (name.empty() || name.size() > MAX_NAME_LEN)
+        throw runtime_error("Invalid compound file stream name");
+
+    for (vector<Stream>::iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+    {
+        if (!nameLess(it->name, name) && !nameLess(name, it->name))
+        {
+            it->data = data;
+            return;
+        }
+    }
+
+    Stream stream;
+    stream.name = name;
+    stream.data = data;
+    m_streams.push_back(stream);
+}
+
+//------------------------------------------------------------------------------
+void CompoundFile::addStream(const wstring& name, const string& data)
+{
+    shared_ptr<ScratchFile> stream(new ScratchFile);
+    if (!data.empty() && stream->write(data.data(), data.size()) != data.size())
+        throw runtime_error("Out of memory");
+    addStream(name, stream);
+}
+
+//------------------------------------------------------------------------------
+// Write compound file (a partly written file is removed)
+//------------------------------------------------------------------------------
+void CompoundFile::write(const string& path) const
+{
+    FILE* out = fopen(path.c_str(), "wb");
+    try
+    {
+        writeFile(out, path);
+    }
+    catch (...)
+    {
+        if (out != NULL)
+            remove(path.c_str());
+        throw;
+    }
+}
+
+#ifdef _WIN32
+void CompoundFile::write(const wstring& path) const
+{
+    FILE* out = _wfopen(path.c_str(), L"wb");
+    try
+    {
+        writeFile(out, Codepage::narrowPath(path));
+    }
+    catch (...)
+    {
+        if (out != NULL)
+            _wremove(path.c_str());
+        throw;
+    }
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Write compound file to an opened file
+//
+// Sectors are laid out as: large streams, mini stream, mini FAT,
+// directory, FAT and DIFAT. The file is closed; path is for messages.
+//------------------------------------------------------------------------------
+void CompoundFile::writeFile(FILE* out, const string& path) const
+{
+    if (out == NULL)
+        throw runtime_error("Could not create compound file: " + path);
+
+    // directory: root storage followed by the streams
+    vector<DirEntry> entries(m_streams.size() + 1);
+    entries[0].name = L"Root Entry";
+    entries[0].type = STGTY_ROOT;
+
+    vector<unsigned long> fat, miniFat;
+    for (size_t i = 0; i < m_streams.size(); ++i)
+    {
+        DirEntry& entry = entries[i + 1];
+        entry.name = m_streams[i].name;
+        entry.type = STGTY_STREAM;
+        entry.size = m_streams[i].data->size();
+        if (entry.size > 0xFFFFFFFFull)
+            throw runtime_error("Compound file stream too large");
+
+        if (entry.size >= MINI_STREAM_CUTOFF)
+            entry.start = allocate(fat, sectorsFor(entry.size, SECTOR_SIZE));
+        else
+            entry.start = allocate(miniFat, sectorsFor(entry.size, MINI_SECTOR_SIZE));
+    }
+
+    // the mini stream is the contents of the root storage
+    entries[0].size = static_cast<unsigned long long>(miniFat.size()) * MINI_SECTOR_SIZE;
+    entries[0].start = allocate(fat, sectorsFor(entries[0].size, SECTOR_SIZE));
+
+    size_t miniFatSectors = sectorsFor(miniFat.size() * 4, SECTOR_SIZE);
+    unsigned long miniFatStart = allocate(fat, miniFatSectors);
+
+    size_t dirSectors = sectorsFor(entries.size() * DIR_ENTRY_SIZE, SECTOR_SIZE);
+    unsigned long dirStart = allocate(fat, dirSectors);
+
+    // the FAT must also cover its own sectors and those of the DIFAT
+    size_t fatSectors = 0, difatSectors = 0;
+    for (;;)
+    {
+        size_t total = fat.size() + fatSectors + difatSectors;
+        if (fatSectors * (SECTOR_SIZE / 4) >= total)
+            break;
+
+        ++fatSectors;
+        difatSectors = fatSectors > HEADER_DIFAT ? sectorsFor(fatSectors - HEADER_DIFAT, SECTOR_SIZE / 4 - 1) : 0;
+    }
+
+    unsigned long fatStart = static_cast<unsigned long>(fat.size());
+    fat.insert(fat.end(), fatSectors, FATSECT);
+    unsigned long difatStart = static_cast<unsigned long>(fat.size());
+    fat.insert(fat.end(), difatSectors, DIFSECT);
+    fat.resize(fatSectors * (SECTOR_SIZE / 4), FREESECT);
+
+    // directory tree of the root storage, nodes below the last complete level are red
+    vector<unsigned long> ids;
+    for (size_t i = 1; i < entries.size(); ++i)
+    {
+        entries[i].left = entries[i].right = entries[i].child = NOSTREAM;
+        ids.push_back(static_cast<unsigned long>(i));
+    }
+
+    struct ByName
+    {
+        const vector<DirEntry>& entries;
+        ByName(const vector<DirEntry>& e) : entries(e) {}
+        bool operator()(unsigned long a, unsigned long b) const { return nameLess(entries[a].name, entries[b].name); }
+    };
+    sort(ids.begin(), ids.end(), ByName(entries));
+
+    entries[0].left = entries[0].right = NOSTREAM;
+    entries[0].child = buildTree(entries, ids, 0, ids.size(), 0);
+
+    unsigned complete = 0;
+    while ((static_cast<size_t>(2) << complete) - 1 <= ids.size())
+        ++complete;
+    for (size_t i = 0; i < entries.size(); ++i)
+        entries[i].color = i > 0 && entries[i].depth >= complete ? COLOR_RED : COLOR_BLACK;
+
+    // header
+    vector<unsigned char> header;
+    static const unsigned char signature[8] = { 0xD0, 0xCF, 0x11, 0xE0, 0xA1, 0xB1, 0x1A, 0xE1 };
+    header.insert(header.end(), signature, signature + 8);
+    header.resize(24, 0);                       // header class id
+    put16(header, 0x003E);                      // minor version
+    put16(header, 0x0003);                      // major version
+    put16(header, 0xFFFE);                      // byte order
+    put16(header, 9);                           // sector shift
+    put16(header, 6);                           // mini sector shift
+    header.resize(40, 0);                       // reserved
+    put32(header, 0);                           // directory sectors (version 3)
+    put32(header, static_cast<unsigned long>(fatSectors));
+    put32(header, dirStart);
+    put32(header, 0);                           // transaction signature
+    put32(header, MINI_STREAM_CUTOFF);
+    put32(header, miniFatSectors ? miniFatStart : ENDOFCHAIN);
+    put32(header, static_cast<unsigned long>(miniFatSectors));
+    put32(header, difatSectors ? difatStart : ENDOFCHAIN);
+    put32(header, static_cast<unsigned long>(difatSectors));
+    for (size_t i = 0; i < HEADER_DIFAT; ++i)
+        put32(header, i < fatSectors ? fatStart + static_cast<unsigned long>(i) : FREESECT);
+
+    try
+    {
+        vector<unsigned char> buf(IO_BUFFER_SIZE);
+        writeBuffer(out, header, path);
+
+        // large streams, then the mini stream holding the small ones
+        for (size_t i = 0; i < m_streams.size(); ++i)
+        {
+            if (entries[i + 1].size >= MINI_STREAM_CUTOFF)
+                writeStream(out, *m_streams[i].data, SECTOR_SIZE, buf, path);
+        }
+
+        for (size_t i = 0; i < m_streams.size(); ++i)
+        {
+            if (entries[i + 1].size < MINI_STREAM_CUTOFF)
+                writeStream(out, *m_streams[i].data, MINI_SECTOR_SIZE, buf, path);
+        }
+
+        vector<unsigned char> sector;
+        sector.resize((SECTOR_SIZE - entries[0].size % SECTOR_SIZE) % SECTOR_SIZE, 0);
+        writeBuffer(out, sector, path);
+
+        // mini FAT
+        sector.clear();
+        for (size_t i = 0; i < miniFatSectors * (SECTOR_SIZE / 4); ++i)
+            put32(sector, i < miniFat.size() ? miniFat[i] : FREESECT);
+        writeBuffer(out, sector, path);
+
+        // directory
+        sector.clear();
+        for (size_t i = 0; i < dirSectors * (SECTOR_SIZE / DIR_ENTRY_SIZE); ++i)
+        {
+            if (i < entries.size())
+            {
+                putEntry(sector, entries[i], i == 0 ? m_clsid : NULL);
+            }
+            else
+            {
+                DirEntry unused;
+                unused.type = 0;
+                unused.color = COLOR_RED;
+                unused.left = unused.right = unused.child = NOSTREAM;
+                unused.start = 0;
+                unused.size = 0;
+                putEntry(sector, unused, NULL);
+            }
+        }
+        writeBuffer(out, sector, path);
+
+        // FAT
+        sector.clear();
+        for (size_t i = 0; i < fat.size(); ++i)
+            put32(sector, fat[i]);
+        writeBuffer(out, sector, path);
+
+        // DIFAT sectors list the FAT sectors beyond the first 109
+        sector.clear();
+        for (size_t i = 0; i < difatSectors; ++i)
+        {
+            for (size_t j = 0; j < SECTOR_SIZE / 4 - 1; ++j)
+            {
+                size_t fatIndex = HEADER_DIFAT + i * (SECTOR_SIZE / 4 - 1) + j;
+                put32(sector, fatIndex < fatSectors ? fatStart + static_cast<unsigned long>(fatIndex) : FREESECT);
+            }
+            put32(sector, i + 1 < difatSectors ? difatStart + static_cast<unsigned long>(i) + 1 : ENDOFCHAIN);
+        }
+        writeBuffer(out, sector, path);
+    }
+    catch (...)
+    {
+        fclose(out);
+        throw;
+    }
+
+    if (fclose(out) != 0)
+        throw runtime_error("Could not write compound file: " + path);
+}
@@ -0,0 +1,85 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Compound file writer
+//
+// Writes a structured storage file (MS-CFB, version 3 with 512 byte
+// sectors) holding a flat set of streams in its root storage, as used by
+// Windows Installer databases. Streams smaller than 4096 bytes are packed
+// into the mini stream. The directory entries form a balanced binary tree
+// that is colored to satisfy the red-black rules.
+//
+//------------------------------------------------------------------------------
+#ifndef COMPOUND_FILE_H_INCLUDED
+#define COMPOUND_FILE_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ScratchFile;
+
+class CompoundFile
+{
+public:
+    // constructor
+    CompoundFile();
+
+    // set the class id of the root storage
+    void                setClassId(const unsigned char clsid[16]);
+
+    // add a stream to the root storage (replaces a stream of the same name)
+    void                addStream(const std::wstring& name, const std::shared_ptr<ScratchFile>& data);
+
+    // add a stream from a memory buffer
+    void                addStream(const std::wstring& name, const std::string& data);
+
+    // write the compound file (throws runtime_error)
+    void                write(const std::string& path) const;
+#ifdef _WIN32
+    void                write(const std::wstring& path) const;
+#endif
+
+private:
+    struct Stream
+    {
+        std::wstring                    name;   // stream name (at most 31 characters)
+        std::shared_ptr<ScratchFile>    data;   // stream contents
+    };
+
+    // write the compound file to an opened file, and close it (NULL: not created)
+    void                writeFile(FILE* out, const std::string& path) const;
+
+    std::vector<Stream> m_streams;              // streams of the root storage
+    unsigned char       m_clsid[16];            // class id of the root storage
+};
+
+#endif // COMPOUND_FILE_H_INCLUDED
@@ -0,0 +1,143 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "Huffman.h"
+#include <vector>
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+namespace
+{
+    struct Leaf
+    {
+        unsigned        freq;
+        int             symbol;
+
+        bool operator<(const Leaf& rhs) const
+        {
+            return freq < rhs.freq || (freq == rhs.freq && symbol < rhs.symbol);
+        }
+    };
+}
+
+//------------------------------------------------------------------------------
+void Huffman::buildLengths(const unsigned* freqs, int count, int maxLength, unsigned char* lengths)
+{
+    std::fill(lengths, lengths + count, 0);
+
+    std::vector<Leaf> leaves;
+    for (int i = 0; i < count; ++i)
+    {
+        if (freqs[i] != 0)
+        {
+            Leaf leaf = { freqs[i], i };
+            leaves.push_back(leaf);
+        }
+    }
+
+    // make sure there are at least two codes
+    for (int i = 0; leaves.size() < 2 && i < count; ++i)
+    {
+        if (freqs[i] == 0)
+        {
+            Leaf leaf = { 1, i };
+            leaves.push_back(leaf);
+        }
+    }
+
+    if (leaves.size() < 2)
+    {
+        for (size_t i = 0; i < leaves.size(); ++i) lengths[leaves[i].symbol] = 1;
+        return;
+    }
+
+    for (;;)
+    {
+        std::sort(leaves.begin(), leaves.end());
+
+        // two-queue construction: leaves in ascending order, followed by
+        // internal nodes, which are created in ascending order
+        size_t n = leaves.size();
+        std::vector<unsigned> weight(2 * n - 1);
+        std::vector<int> parent(2 * n - 1, -1);
+        for (size_t i = 0; i < n; ++i) weight[i] = leaves[i].freq;
+
+        size_t nextLeaf = 0, nextNode = n, last = n;
+        for (; last < 2 * n - 1; ++last)
+        {
+            size_t pick[2];
+            for (int k = 0; k < 2; ++k)
+            {
+                if (nextLeaf < n && (nextNode >= last || weight[nextLeaf] <= weight[nextNode]))
+                    pick[k] = nextLeaf++;
+                else
+                    pick[k] = nextNode++;
+            }
+
+            weight[last] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = parent[pick[1]] = static_cast<int>(last);
+        }
+
+        // depth of each node (the root is the last node)
+        std::vector<int> depth(2 * n - 1, 0);
+        int longest = 0;
+        for (size_t i = 2 * n - 1; i-- > 0; )
+        {
+            if (parent[i] >= 0) depth[i] = depth[parent[i]] + 1;
+            if (i < n) longest = (std::max)(longest, depth[i]);
+        }
+
+        if (longest <= maxLength)
+        {
+            for (size_t i = 0; i < n; ++i) lengths[leaves[i].symbol] = static_cast<unsigned char>(depth[i]);
+            return;
+        }
+
+        // flatten the frequency distribution and try again
+        for (size_t i = 0; i < n; ++i) leaves[i].freq = (leaves[i].freq >> 1) | 1;
+    }
+}
+
+//------------------------------------------------------------------------------
+void Huffman::buildCodes(const unsigned char* lengths, int count, unsigned short* codes)
+{
+    unsigned lengthCount[33] = { 0 };
+    for (int i = 0; i < count; ++i) ++lengthCount[lengths[i]];
+    lengthCount[0] = 0;
+
+    unsigned nextCode[33] = { 0 };
+    unsigned code = 0;
+    for (int bits = 1; bits <= 32; ++bits)
+    {
+        code = (code + lengthCount[bits - 1]) << 1;
+        nextCode[bits] = code;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        codes[i] = lengths[i] != 0 ? static_cast<unsigned short>(nextCode[lengths[i]]++) : 0;
+    }
+}
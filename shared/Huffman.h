@@ -0,0 +1,60 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Canonical Huffman codes
+//
+// Used by the cabinet compressors. Code lengths are limited to a maximum
+// length, and the resulting codes are always complete: if fewer than two
+// symbols occur, dummy symbols are given a code, since some decoders
+// reject trees with a single code.
+//
+//------------------------------------------------------------------------------
+#ifndef HUFFMAN_H_INCLUDED
+#define HUFFMAN_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+class Huffman
+{
+public:
+    // compute code lengths (at most maxLength bits) from symbol frequencies
+    static void         buildLengths(const unsigned* freqs, int count, int maxLength, unsigned char* lengths);
+
+    // assign canonical codes (most significant bit first) to code lengths
+    static void         buildCodes(const unsigned char* lengths, int count, unsigned short* codes);
+
+    // reverse the lowest n bits of a code
+    static unsigned     reverse(unsigned code, int n)
+    {
+        unsigned result = 0;
+        for (int i = 0; i < n; ++i, code >>= 1) result = (result << 1) | (code & 1);
+        return result;
+    }
+};
+
+#endif // HUFFMAN_H_INCLUDED
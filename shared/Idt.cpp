@@ -0,0 +1,440 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "Idt.h"
+#include "Codepage.h"
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const char          ESC_TAB             = 0x10;
+    const char          ESC_CR              = 0x11;
+    const char          ESC_LF              = 0x19;
+
+#ifdef _WIN32
+    const char          PATH_SEP            = '\\';
+#else
+    const char          PATH_SEP            = '/';
+#endif
+
+    //--------------------------------------------------------------------------
+    string joinPath(const string& dir, const string& name)
+    {
+        if (dir.empty() || dir[dir.size() - 1] == '\\' || dir[dir.size() - 1] == '/')
+            return dir + name;
+        return dir + PATH_SEP + name;
+    }
+
+#ifdef _WIN32
+    //--------------------------------------------------------------------------
+    wstring joinPath(const wstring& dir, const wstring& name)
+    {
+        if (dir.empty() || dir[dir.size() - 1] == L'\\' || dir[dir.size() - 1] == L'/')
+            return dir + name;
+        return dir + L'\\' + name;
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Constructors
+//------------------------------------------------------------------------------
+IdtWriter::IdtWriter(const string&          dir, 
+                     const string&          table,
+                     const vector<string>&  columns,
+                     const vector<string>&  defs,
+                     const vector<string>&  keys,
+                     unsigned               codepage) :
+    m_dir(dir),
+#ifdef _WIN32
+    m_wideDir(Codepage::widePath(dir)),
+#endif
+    m_table(table),
+    m_fileName(table + ".idt"),
+    m_file(0),
+    m_binaryDir(false)
+{
+    if (columns.size() != defs.size() || columns.empty())
+        throw runtime_error("Invalid column definitions for table \"" + table + "\"");
+
+    m_file = fopen(joinPath(dir, m_fileName).c_str(), "wb");
+    writeHeader(columns, defs, keys, codepage);
+}
+
+#ifdef _WIN32
+IdtWriter::IdtWriter(const wstring&         dir, 
+                     const string&          table,
+                     const vector<string>&  columns,
+                     const vector<string>&  defs,
+                     const vector<string>&  keys,
+                     unsigned               codepage) :
+    m_dir(Codepage::narrowPath(dir)),
+    m_wideDir(dir),
+    m_table(table),
+    m_fileName(table + ".idt"),
+    m_file(0),
+    m_binaryDir(false)
+{
+    if (columns.size() != defs.size() || columns.empty())
+        throw runtime_error("Invalid column definitions for table \"" + table + "\"");
+
+    m_file = _wfopen(joinPath(dir, Codepage::widePath(m_fileName)).c_str(), L"wb");
+    writeHeader(columns, defs, keys, codepage);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Write the header of the opened file
+//------------------------------------------------------------------------------
+void IdtWriter::writeHeader(const vector<string>&   columns,
+                            const vector<string>&   defs,
+                            const vector<string>&   keys,
+                            unsigned                codepage)
+{
+    if (m_file == 0)
+        throw runtime_error("Cannot create \"" + joinPath(m_dir, m_fileName) + "\"");
+
+    writeLine(columns, false);
+    writeLine(defs, false);
+
+    // the codepage of the strings precedes the table name
+    vector<string> label;
+    if (codepage != 0)
+    {
+        char buf[16];
+        sprintf(buf, "%u", codepage);
+        label.push_back(buf);
+    }
+    label.push_back(m_table);
+    label.insert(label.end(), keys.begin(), keys.end());
+    writeLine(label, false);
+}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+IdtWriter::~IdtWriter()
+{
+    if (m_file) fclose(m_file);
+}
+
+//------------------------------------------------------------------------------
+// Write a row
+//------------------------------------------------------------------------------
+void IdtWriter::writeRow(const vector<string>& fields)
+{
+    writeLine(fields, true);
+}
+
+//------------------------------------------------------------------------------
+// Path of a binary field file (creates the folder named after the table)
+//------------------------------------------------------------------------------
+string IdtWriter::binaryPath(const string& name)
+{
+    string dir = joinPath(m_dir, m_table);
+    if (!m_binaryDir)
+    {
+        if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+            throw runtime_error("Cannot create folder \"" + dir + "\"");
+        m_binaryDir = true;
+    }
+
+    return joinPath(dir, name);
+}
+
+#ifdef _WIN32
+//------------------------------------------------------------------------------
+// Wide path of a binary field file (creates the folder named after the table)
+//------------------------------------------------------------------------------
+wstring IdtWriter::wideBinaryPath(const string& name)
+{
+    wstring dir = joinPath(m_wideDir, Codepage::widePath(m_table));
+    if (!m_binaryDir)
+    {
+        if (_wmkdir(dir.c_str()) != 0 && errno != EEXIST)
+            throw runtime_error("Cannot create folder \"" + joinPath(m_dir, m_table) + "\"");
+        m_binaryDir = true;
+    }
+
+    return joinPath(dir, Codepage::widePath(name));
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Close the file
+//------------------------------------------------------------------------------
+void IdtWriter::close()
+{
+    if (m_file == 0)
+        return;
+
+    bool failed = ferror(m_file) != 0;
+    failed = fclose(m_file) != 0 || failed;
+    m_file = 0;
+
+    if (failed)
+        throw runtime_error("Cannot write \"" + joinPath(m_dir, m_fileName) + "\"");
+}
+
+//------------------------------------------------------------------------------
+// Escape tabs and line breaks
+//------------------------------------------------------------------------------
+string IdtWriter::escape(const string& field)
+{
+    if (field.find_first_of("\t\r\n") == string::npos)
+        return field;
+
+    string escaped(field);
+    for (string::iterator it = escaped.begin(); it != escaped.end(); ++it)
+    {
+        switch (*it)
+        {
+        case '\t':  *it = ESC_TAB; break;
+        case '\r':  *it = ESC_CR; break;
+        case '\n':  *it = ESC_LF; break;
+        }
+    }
+
+    return escaped;
+}
+
+//------------------------------------------------------------------------------
+// Write the codepage of the database
+//------------------------------------------------------------------------------
+void IdtWriter::writeCodepage(const string& dir, unsigned codepage)
+{
+    string path = joinPath(dir, "_ForceCodepage.idt");
+    FILE* file = fopen(path.c_str(), "wb");
+    if (file == 0)
+        throw runtime_error("Cannot create \"" + path + "\"");
+
+    fprintf(file, "\r\n\r\n%u\t_ForceCodepage\r\n", codepage);
+    bool failed = ferror(file) != 0;
+    failed = fclose(file) != 0 || failed;
+    if (failed)
+        throw runtime_error("Cannot write \"" + path + "\"");
+}
+
+//------------------------------------------------------------------------------
+// Write a line of tab separated fields (lines end with CR LF)
+//------------------------------------------------------------------------------
+void IdtWriter::writeLine(const vector<string>& fields, bool escaped)
+{
+    if (m_file == 0)
+        throw runtime_error("\"" + m_fileName + "\" is closed");
+
+    for (size_t i = 0; i < fields.size(); ++i)
+    {
+        if (i > 0) fputc('\t', m_file);
+        const string& field = escaped ? escape(fields[i]) : fields[i];
+        fwrite(field.data(), 1, field.size(), m_file);
+    }
+    fputs("\r\n", m_file);
+
+    if (ferror(m_file))
+        throw runtime_error("Cannot write \"" + joinPath(m_dir, m_fileName) + "\"");
+}
+
+//------------------------------------------------------------------------------
+// Constructors
+//------------------------------------------------------------------------------
+IdtReader::IdtReader(const string& dir, const string& fileName) :
+    IdtReader(fopen(joinPath(dir, fileName).c_str(), "rb"), dir, fileName)
+{
+}
+
+#ifdef _WIN32
+IdtReader::IdtReader(const wstring& dir, const string& fileName) :
+    IdtReader(_wfopen(joinPath(dir, Codepage::widePath(fileName)).c_str(), L"rb"), 
+              Codepage::narrowPath(dir), fileName)
+{
+}
+#endif
+
+IdtReader::IdtReader(FILE* file, const string& dir, const string& fileName) :
+    m_dir(dir),
+    m_fileName(fileName),
+    m_codepage(0),
+    m_file(file),
+    m_line(0),
+    m_chunk(1 << 16),
+    m_chunkPos(0),
+    m_chunkEnd(0)
+{
+    if (m_file == 0)
+        throw runtime_error("Cannot open \"" + joinPath(dir, fileName) + "\"");
+
+    vector<string> label;
+    if (!readLine(m_columns) || !readLine(m_defs) || !readLine(label))
+        throw runtime_error("\"" + fileName + "\" is not an IDT file");
+
+    // the codepage precedes the table name
+    if (!label.empty() && !label[0].empty() && isdigit(static_cast<unsigned char>(label[0][0])))
+    {
+        m_codepage = static_cast<unsigned>(atoi(label[0].c_str()));
+        label.erase(label.begin());
+    }
+
+    if (label.empty() || label[0].empty())
+        throw runtime_error("\"" + fileName + "\" lacks a table name");
+
+    m_table = label[0];
+    m_keys.assign(label.begin() + 1, label.end());
+
+    // '_ForceCodepage' has no columns
+    if (m_columns.size() == 1 && m_columns[0].empty())
+    {
+        m_columns.clear();
+        m_defs.clear();
+    }
+
+    if (m_columns.size() != m_defs.size())
+        throw runtime_error("\"" + fileName + "\": the number of column names and definitions differ");
+}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+IdtReader::~IdtReader()
+{
+    if (m_file) fclose(m_file);
+}
+
+//------------------------------------------------------------------------------
+// Read the next row
+//------------------------------------------------------------------------------
+bool IdtReader::readRow(vector<string>& fields)
+{
+    while (readLine(fields))
+    {
+        // skip empty lines (the first column is a key and cannot be NULL)
+        if (fields.size() == 1 && fields[0].empty())
+            continue;
+
+        if (fields.size() != m_columns.size())
+        {
+            char line[16];
+            sprintf(line, "%u", m_line);
+            throw runtime_error("\"" + m_fileName + "\", line " + line + ": wrong number of fields");
+        }
+
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            if (fields[i].find_first_of("\x10\x11\x19") != string::npos)
+                fields[i] = unescape(fields[i]);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Path of a binary field file
+//------------------------------------------------------------------------------
+string IdtReader::binaryPath(const string& name) const
+{
+    return joinPath(joinPath(m_dir, m_table), name);
+}
+
+//------------------------------------------------------------------------------
+// Undo the escaping of tabs and line breaks
+//------------------------------------------------------------------------------
+string IdtReader::unescape(const string& field)
+{
+    string unescaped(field);
+    for (string::iterator it = unescaped.begin(); it != unescaped.end(); ++it)
+    {
+        switch (*it)
+        {
+        case ESC_TAB:   *it = '\t'; break;
+        case ESC_CR:    *it = '\r'; break;
+        case ESC_LF:    *it = '\n'; break;
+        }
+    }
+
+    return unescaped;
+}
+
+//------------------------------------------------------------------------------
+// Read a line and split it at tabs (lines end with LF or CR LF)
+//------------------------------------------------------------------------------
+bool IdtReader::readLine(vector<string>& fields)
+{
+    // lengths are explicit: a field may hold NUL characters
+    m_buffer.clear();
+    for (bool eol = false; !eol; )
+    {
+        if (m_chunkPos == m_chunkEnd)
+        {
+            m_chunkEnd = fread(&m_chunk[0], 1, m_chunk.size(), m_file);
+            m_chunkPos = 0;
+            if (m_chunkEnd == 0)
+                break;
+        }
+
+        const char* begin = &m_chunk[m_chunkPos];
+        const char* lf = static_cast<const char*>(memchr(begin, '\n', m_chunkEnd - m_chunkPos));
+        size_t len = lf != 0 ? static_cast<size_t>(lf - begin) + 1 : m_chunkEnd - m_chunkPos;
+        m_buffer.append(begin, len);
+        m_chunkPos += len;
+        eol = lf != 0;
+    }
+
+    if (m_buffer.empty())
+    {
+        if (ferror(m_file))
+            throw runtime_error("Cannot read \"" + joinPath(m_dir, m_fileName) + "\"");
+        return false;
+    }
+
+    ++m_line;
+    if (m_buffer[m_buffer.size() - 1] == '\n')
+        m_buffer.erase(m_buffer.size() - 1);
+    if (!m_buffer.empty() && m_buffer[m_buffer.size() - 1] == '\r')
+        m_buffer.erase(m_buffer.size() - 1);
+
+    fields.clear();
+    size_t start = 0;
+    for (size_t tab; (tab = m_buffer.find('\t', start)) != string::npos; start = tab + 1)
+        fields.push_back(m_buffer.substr(start, tab - start));
+    fields.push_back(m_buffer.substr(start));
+    return true;
+}
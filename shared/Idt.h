@@ -0,0 +1,179 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Installer text archive files (.idt)
+//
+// An IDT file holds one table as tab separated text: the column names,
+// the column definitions ("s72", "I2", "L0", "v0", ...), and the table
+// name followed by the names of the primary key columns, each on a line of
+// its own, followed by one line per row. Tabs, carriage returns and line
+// feeds within a field are written as 0x10, 0x11 and 0x19. A binary field
+// holds the name of a file in a folder named after the table, next to the
+// IDT file.
+//
+// The codepage of a table, if any, precedes the table name on the third
+// line; '_ForceCodepage.idt' holds nothing but the codepage of the
+// database. Strings are passed as bytes in the codepage of the database.
+//
+//------------------------------------------------------------------------------
+#ifndef IDT_H_INCLUDED
+#define IDT_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class IdtWriter
+{
+public:
+    // create <dir>/<table>.idt and write the header (codepage 0: none, throws runtime_error)
+    IdtWriter(const std::string&                dir, 
+              const std::string&                table,
+              const std::vector<std::string>&   columns,
+              const std::vector<std::string>&   defs,
+              const std::vector<std::string>&   keys,
+              unsigned                          codepage = 0);
+#ifdef _WIN32
+    IdtWriter(const std::wstring&               dir, 
+              const std::string&                table,
+              const std::vector<std::string>&   columns,
+              const std::vector<std::string>&   defs,
+              const std::vector<std::string>&   keys,
+              unsigned                          codepage = 0);
+#endif
+
+    // destructor (closes the file)
+    ~IdtWriter();
+
+    // write a row, empty fields are NULL (throws runtime_error)
+    void                writeRow(const std::vector<std::string>& fields);
+
+    // path of the file holding a binary field, to be named by name in the row
+    std::string         binaryPath(const std::string& name);
+#ifdef _WIN32
+    std::wstring        wideBinaryPath(const std::string& name);
+#endif
+
+    // close the file (throws runtime_error)
+    void                close();
+
+    // name of the IDT file within dir
+    const std::string&  fileName() const { return m_fileName; }
+
+    // escape tabs and line breaks of a field
+    static std::string  escape(const std::string& field);
+
+    // write <dir>/_ForceCodepage.idt (throws runtime_error)
+    static void         writeCodepage(const std::string& dir, unsigned codepage);
+
+private:
+    IdtWriter(const IdtWriter&);
+    IdtWriter& operator=(const IdtWriter&);
+
+    // write the header to the opened file (throws runtime_error)
+    void                writeHeader(const std::vector<std::string>& columns,
+                                    const std::vector<std::string>& defs,
+                                    const std::vector<std::string>& keys,
+                                    unsigned                        codepage);
+
+    // write a line of tab separated fields
+    void                writeLine(const std::vector<std::string>& fields, bool escaped);
+
+    std::string         m_dir;          // folder of the IDT file
+#ifdef _WIN32
+    std::wstring        m_wideDir;      // folder of the IDT file (UTF-16)
+#endif
+    std::string         m_table;        // table name
+    std::string         m_fileName;     // IDT file name
+    FILE*               m_file;         // IDT file
+    bool                m_binaryDir;    // folder for binary fields created
+};
+
+class IdtReader
+{
+public:
+    // open <dir>/<fileName> and read the header (throws runtime_error)
+    IdtReader(const std::string& dir, const std::string& fileName);
+#ifdef _WIN32
+    IdtReader(const std::wstring& dir, const std::string& fileName);
+#endif
+
+    // destructor (closes the file)
+    ~IdtReader();
+
+    // table name
+    const std::string&  table() const { return m_table; }
+
+    // column names, definitions and primary key columns
+    const std::vector<std::string>& columns() const { return m_columns; }
+    const std::vector<std::string>& defs() const { return m_defs; }
+    const std::vector<std::string>& keys() const { return m_keys; }
+
+    // codepage given in the header (0: none)
+    unsigned            codepage() const { return m_codepage; }
+
+    // read the next row, empty fields are NULL (false at the end, throws runtime_error)
+    bool                readRow(std::vector<std::string>& fields);
+
+    // path of the file holding a binary field named by name
+    std::string         binaryPath(const std::string& name) const;
+
+    // line number of the last row read
+    unsigned            line() const { return m_line; }
+
+    // undo the escaping of tabs and line breaks of a field
+    static std::string  unescape(const std::string& field);
+
+private:
+    IdtReader(const IdtReader&);
+    IdtReader& operator=(const IdtReader&);
+
+    // read the header of an opened file (dir for messages and binary paths)
+    IdtReader(FILE* file, const std::string& dir, const std::string& fileName);
+
+    // read a line and split it at tabs (false at the end)
+    bool                readLine(std::vector<std::string>& fields);
+
+    std::string         m_dir;          // folder of the IDT file
+    std::string         m_fileName;     // IDT file name
+    std::string         m_table;        // table name
+    std::vector<std::string> m_columns; // column names
+    std::vector<std::string> m_defs;    // column definitions
+    std::vector<std::string> m_keys;    // primary key columns
+    unsigned            m_codepage;     // codepage (0: none)
+    FILE*               m_file;         // IDT file
+    unsigned            m_line;         // current line
+    std::string         m_buffer;       // line buffer
+    std::vector<char>   m_chunk;        // read buffer
+    size_t              m_chunkPos;     // next byte of the read buffer
+    size_t              m_chunkEnd;     // end of the data in the read buffer
+};
+
+#endif // IDT_H_INCLUDED
@@ -0,0 +1,978 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "Lzx.h"
+#include "Huffman.h"
+#include <string.h>
+#include <stdexcept>
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+namespace
+{
+    // LZX alphabets
+    const int           NUM_CHARS           = 256;
+    const int           NUM_PRIMARY_LENGTHS = 7;
+    const int           NUM_SECONDARY_LENGTHS = 249;
+    const int           MAX_POSITION_SLOTS  = 50;
+    const int           MAX_MAIN_SIZE       = NUM_CHARS + MAX_POSITION_SLOTS * 8;
+    const int           PRETREE_SIZE        = 20;
+    const int           ALIGNED_SIZE        = 8;
+    const int           MAX_CODE_LENGTH     = 16;
+    const int           MAX_PRETREE_LENGTH  = 15;
+    const int           MAX_ALIGNED_LENGTH  = 7;
+
+    const int           MIN_MATCH           = 2;
+    const int           MAX_MATCH           = 257;
+
+    const int           BLOCK_TYPE_VERBATIM = 1;
+    const int           BLOCK_TYPE_ALIGNED  = 2;
+
+    // encoder parameters
+    const size_t        BLOCK_SIZE          = 4 * Lzx::FRAME_SIZE;
+    const int           MAX_HASH_BITS       = 20;
+    const unsigned      TOO_FAR             = 16384;    // discard 3 byte matches farther away
+    const unsigned long MAX_COST            = 0xFFFFFFFF;
+
+    struct EffortParams
+    {
+        int             depth;          // match finder search depth
+        int             nice;           // stop searching at this length
+        bool            lazy;           // lazy parsing
+    };
+
+    const EffortParams  effortParams[] =
+    {
+        {   8,  32, false },            // fast
+        {  64, 128, true  },            // normal
+        {  48, 128, false }             // max (binary trees, optimal parsing)
+    };
+
+    //--------------------------------------------------------------------------
+    // position slot tables
+    struct PositionSlots
+    {
+        unsigned char   extraBits[MAX_POSITION_SLOTS + 1];
+        unsigned long   base[MAX_POSITION_SLOTS + 1];
+
+        PositionSlots()
+        {
+            for (int i = 0, j = 0; i <= MAX_POSITION_SLOTS; i += 2)
+            {
+                extraBits[i] = static_cast<unsigned char>(j);
+                if (i + 1 <= MAX_POSITION_SLOTS) extraBits[i + 1] = static_cast<unsigned char>(j);
+                if (i != 0 && j < 17) ++j;
+            }
+
+            unsigned long j = 0;
+            for (int i = 0; i <= MAX_POSITION_SLOTS; ++i)
+            {
+                base[i] = j;
+                j += 1ul << extraBits[i];
+            }
+        }
+    };
+
+    const PositionSlots slots;
+
+    //--------------------------------------------------------------------------
+    // position slot of a formatted offset (offset + 2)
+    unsigned slotOf(unsigned long f)
+    {
+        if (f < 4)
+            return f;
+
+        if (f >= 524288)
+            return 38 + static_cast<unsigned>((f - 524288) >> 17);
+
+        unsigned n = 2;
+        while ((f >> (n + 1)) != 0) ++n;
+        return 2 * n + ((f >> (n - 1)) & 1);
+    }
+
+    //--------------------------------------------------------------------------
+    int positionSlots(int windowBits)
+    {
+        return windowBits == 21 ? 50 : windowBits == 20 ? 42 : 2 * windowBits;
+    }
+
+    //--------------------------------------------------------------------------
+    // bit writer: 16 bit little-endian words, most significant bit first
+    class BitWriter
+    {
+    public:
+        BitWriter() : m_acc(0), m_count(0) {}
+
+        void put(unsigned long value, int bits)
+        {
+            if (bits > 16)
+            {
+                put(value >> 16, bits - 16);
+                bits = 16;
+            }
+
+            m_acc = (m_acc << bits) | (value & ((1ul << bits) - 1));
+            m_count += bits;
+            if (m_count >= 16)
+            {
+                m_count -= 16;
+                unsigned word = static_cast<unsigned>(m_acc >> m_count) & 0xFFFF;
+                m_out.push_back(static_cast<unsigned char>(word));
+                m_out.push_back(static_cast<unsigned char>(word >> 8));
+            }
+        }
+
+        void align()
+        {
+            if (m_count > 0) put(0, 16 - m_count);
+        }
+
+        std::vector<unsigned char>& data()
+        {
+            return m_out;
+        }
+
+    private:
+        std::vector<unsigned char> m_out;
+        unsigned long   m_acc;
+        int             m_count;
+    };
+
+    //--------------------------------------------------------------------------
+    // literal (len == 0) or match
+    struct Item
+    {
+        unsigned short  len;
+        unsigned long   value;          // literal, repeated offset index (0..2) or formatted offset
+    };
+
+    //--------------------------------------------------------------------------
+    // code lengths of the main, length and aligned offset trees
+    struct Trees
+    {
+        unsigned char   main[MAX_MAIN_SIZE];
+        unsigned char   length[NUM_SECONDARY_LENGTHS];
+        unsigned char   aligned[ALIGNED_SIZE];
+    };
+
+    //--------------------------------------------------------------------------
+    struct Stats
+    {
+        unsigned        main[MAX_MAIN_SIZE];
+        unsigned        length[NUM_SECONDARY_LENGTHS];
+        unsigned        aligned[ALIGNED_SIZE];
+
+        Stats()
+        {
+            std::fill(main, main + MAX_MAIN_SIZE, 0);
+            std::fill(length, length + NUM_SECONDARY_LENGTHS, 0);
+            std::fill(aligned, aligned + ALIGNED_SIZE, 0);
+        }
+
+        void add(const Item& item)
+        {
+            if (item.len == 0)
+            {
+                ++main[item.value];
+                return;
+            }
+
+            unsigned slot = item.value < 3 ? item.value : slotOf(item.value);
+            unsigned header = (std::min)(item.len - MIN_MATCH, NUM_PRIMARY_LENGTHS);
+            ++main[NUM_CHARS + slot * 8 + header];
+            if (header == NUM_PRIMARY_LENGTHS) ++length[item.len - MIN_MATCH - NUM_PRIMARY_LENGTHS];
+            if (slot >= 3 && slots.extraBits[slot] >= 3) ++aligned[(item.value - slots.base[slot]) & 7];
+        }
+    };
+}
+
+//------------------------------------------------------------------------------
+struct Lzx::Impl
+{
+    struct Node
+    {
+        unsigned long   cost;           // cost of the cheapest path to this position
+        unsigned short  len;            // length of the last item of the path
+        unsigned long   value;          // offset of the last item of the path
+        unsigned long   reps[3];        // repeated offsets after the path
+    };
+
+    int                 windowBits;
+    unsigned long       maxOffset;
+    int                 mainSize;
+    EffortParams        params;
+    bool                optimal;        // binary trees and optimal parsing
+
+    // window
+    std::vector<unsigned char> buf;
+    unsigned long       bufStart;       // folder position of buf[0]
+    unsigned long       pos;            // folder position of next byte to compress
+    unsigned long       end;            // end of data available to the match finder
+
+    // match finder
+    int                 hashBits;
+    unsigned            hashBytes;      // 4 for hash chains, 3 for binary trees
+    std::vector<unsigned> head;         // position + 1 of last occurrence of a hash
+    std::vector<unsigned> chain;        // hash chains (fast, normal) or binary tree (max)
+
+    // encoder state
+    BitWriter           out;
+    bool                started;        // stream header written
+    unsigned long       reps[3];        // repeated offsets R0, R1, R2
+    Trees               prevLengths;    // tree lengths of previous block
+    Trees               costLengths;    // code lengths used to estimate costs
+
+    Impl(int windowBits, Effort effort);
+
+    // end of the data passed to compress() so far
+    unsigned long       dataEnd() const
+    {
+        return bufStart + static_cast<unsigned long>(buf.size());
+    }
+
+    const unsigned char* at(unsigned long p) const
+    {
+        return &buf[p - bufStart];
+    }
+
+    unsigned            hash(unsigned long p) const
+    {
+        const unsigned char* s = at(p);
+        unsigned long v = (static_cast<unsigned long>(s[0]) << 16) | (s[1] << 8) | s[2];
+        if (hashBytes == 4) v = ((v << 8) | s[3]) & 0xFFFFFFFF;
+        return static_cast<unsigned>(((v * 2654435761ul) & 0xFFFFFFFF) >> (32 - hashBits));
+    }
+
+    unsigned            matchLength(unsigned long p, unsigned long offset, unsigned limit) const
+    {
+        const unsigned char* s = at(p);
+        const unsigned char* m = s - offset;
+        unsigned len = 0;
+        while (len < limit && s[len] == m[len]) ++len;
+        return len;
+    }
+
+    unsigned            matchLimit(unsigned long p) const
+    {
+        unsigned long frameEnd = (p / FRAME_SIZE + 1) * FRAME_SIZE;
+        return static_cast<unsigned>((std::min)((std::min)(frameEnd, end) - p, static_cast<unsigned long>(MAX_MATCH)));
+    }
+
+    void                encodeBlock(size_t len, std::vector<Frame>& frames);
+    void                parseGreedy(unsigned long start, std::vector<Item>& items);
+    void                parseOptimal(unsigned long start, std::vector<Item>& items);
+    unsigned            findChain(unsigned long p, unsigned limit, unsigned long& offset);
+    void                insertChain(unsigned long p);
+    unsigned            findTree(unsigned long p, unsigned long* lens, unsigned long* offsets, bool record);
+    void                optimalPass(unsigned long start, const std::vector<unsigned>& matchIndex,
+                                    const std::vector<unsigned long>& matches, std::vector<Node>& nodes,
+                                    std::vector<Item>& items) const;
+    void                writeBlock(const std::vector<Item>& items, unsigned long start, std::vector<Frame>& frames);
+    void                writeTree(const unsigned char* lengths, unsigned char* prev, int count);
+    void                updateCosts(const Stats& stats);
+};
+
+//------------------------------------------------------------------------------
+Lzx::Impl::Impl(int bits, Effort effort) :
+    windowBits(bits),
+    maxOffset((1ul << bits) - 3),
+    mainSize(NUM_CHARS + positionSlots(bits) * 8),
+    params(effortParams[effort]),
+    optimal(effort == effortMax),
+    bufStart(0),
+    pos(0),
+    end(0),
+    hashBits((std::min)(bits, MAX_HASH_BITS)),
+    hashBytes(optimal ? 3 : 4),
+    head(1ul << hashBits, 0),
+    chain((optimal ? 2ul : 1ul) << bits, 0),
+    started(false)
+{
+    reps[0] = reps[1] = reps[2] = 1;
+    memset(&prevLengths, 0, sizeof(prevLengths));
+
+    // initial cost estimate
+    std::fill(costLengths.main, costLengths.main + NUM_CHARS, 8);
+    std::fill(costLengths.main + NUM_CHARS, costLengths.main + MAX_MAIN_SIZE, 10);
+    std::fill(costLengths.length, costLengths.length + NUM_SECONDARY_LENGTHS, 8);
+    std::fill(costLengths.aligned, costLengths.aligned + ALIGNED_SIZE, 3);
+}
+
+//------------------------------------------------------------------------------
+Lzx::Lzx(int windowBits, Effort effort) :
+    m_pImpl(NULL)
+{
+    if (windowBits < MIN_WINDOW || windowBits > MAX_WINDOW)
+        throw std::runtime_error("Invalid LZX window size");
+
+    m_pImpl = new Impl(windowBits, effort);
+}
+
+//------------------------------------------------------------------------------
+Lzx::~Lzx()
+{
+    delete m_pImpl;
+}
+
+//------------------------------------------------------------------------------
+void Lzx::compress(const unsigned char* data, size_t len, std::vector<Frame>& frames)
+{
+    m_pImpl->buf.insert(m_pImpl->buf.end(), data, data + len);
+
+    // keep MAX_MATCH bytes of lookahead past the block for the binary trees
+    while (m_pImpl->dataEnd() - m_pImpl->pos >= BLOCK_SIZE + MAX_MATCH)
+    {
+        m_pImpl->encodeBlock(BLOCK_SIZE, frames);
+    }
+}
+
+//------------------------------------------------------------------------------
+void Lzx::finish(std::vector<Frame>& frames)
+{
+    for (size_t left; (left = m_pImpl->dataEnd() - m_pImpl->pos) > 0; )
+    {
+        m_pImpl->encodeBlock((std::min)(left, BLOCK_SIZE), frames);
+    }
+}
+
+//------------------------------------------------------------------------------
+void Lzx::Impl::encodeBlock(size_t len, std::vector<Frame>& frames)
+{
+    unsigned long start = pos;
+    end = pos + static_cast<unsigned long>(len);
+
+    std::vector<Item> items;
+    items.reserve(len);
+    if (optimal)
+        parseOptimal(start, items);
+    else
+        parseGreedy(start, items);
+
+    writeBlock(items, start, frames);
+    pos = end;
+
+    // drop data that has left the window
+    unsigned long window = 1ul << windowBits;
+    if (pos - bufStart > window + 4 * BLOCK_SIZE)
+    {
+        unsigned long drop = pos - window - bufStart;
+        buf.erase(buf.begin(), buf.begin() + drop);
+        bufStart += drop;
+    }
+}
+
+//------------------------------------------------------------------------------
+// hash chain match finder (fast, normal)
+//------------------------------------------------------------------------------
+void Lzx::Impl::insertChain(unsigned long p)
+{
+    if (p + hashBytes > end)
+        return;
+
+    unsigned h = hash(p);
+    chain[p & ((1ul << windowBits) - 1)] = head[h];
+    head[h] = static_cast<unsigned>(p + 1);
+}
+
+//------------------------------------------------------------------------------
+unsigned Lzx::Impl::findChain(unsigned long p, unsigned limit, unsigned long& offset)
+{
+    unsigned best = 0;
+    if (p + hashBytes > end || limit < 3)
+    {
+        insertChain(p);
+        return best;
+    }
+
+    const unsigned char* s = at(p);
+    unsigned long mask = (1ul << windowBits) - 1;
+    unsigned long cur = head[hash(p)];
+    for (int depth = params.depth; cur != 0 && depth > 0; --depth)
+    {
+        unsigned long candidate = cur - 1;
+        unsigned long dist = p - candidate;
+        if (dist > maxOffset || dist > p)
+            break;
+
+        const unsigned char* m = s - dist;
+        if (m[best] == s[best] && m[0] == s[0] && m[1] == s[1])
+        {
+            unsigned len = 2;
+            while (len < limit && m[len] == s[len]) ++len;
+            if (len > best)
+            {
+                best = len;
+                offset = dist;
+                if (len >= limit || len >= static_cast<unsigned>(params.nice))
+                    break;
+            }
+        }
+
+        cur = chain[candidate & mask];
+    }
+
+    insertChain(p);
+
+    if (best == 3 && offset > TOO_FAR)
+        best = 0;
+    return best < 3 ? 0 : best;
+}
+
+//------------------------------------------------------------------------------
+void Lzx::Impl::parseGreedy(unsigned long start, std::vector<Item>& items)
+{
+    // best match at a position: repeated offsets, then the hash chains
+    struct Match
+    {
+        unsigned        len;
+        unsigned long   value;
+    };
+
+    Match next = { 0, 0 };
+    bool haveNext = false;
+
+    for (unsigned long p = start; p < end; )
+    {
+        Match match = { 0, 0 };
+        if (haveNext)
+        {
+            match = next;
+            haveNext = false;
+        }
+        else
+        {
+            unsigned limit = matchLimit(p);
+            unsigned long offset = 0;
+            match.len = findChain(p, limit, offset);
+            match.value = offset + 2;
+
+            for (unsigned r = 0; r < 3 && limit >= MIN_MATCH; ++r)
+            {
+                if (reps[r] > p)
+                    continue;
+
+                unsigned len = matchLength(p, reps[r], limit);
+                if (len >= MIN_MATCH && (len + 1 >= match.len || (match.len != 0 && offset == reps[r])))
+                {
+                    match.len = len;
+                    match.value = r;
+                    break;
+                }
+            }
+
+            for (unsigned r = 0; match.value >= 3 && r < 3; ++r)
+            {
+                if (offset == reps[r]) match.value = r;
+            }
+        }
+
+        // lazy evaluation: prefer a literal if the next position has a longer match
+        if (params.lazy && match.len >= MIN_MATCH && match.len < static_cast<unsigned>(params.nice) && p + 1 < end)
+        {
+            unsigned limit = matchLimit(p + 1);
+            unsigned long offset = 0;
+            next.len = findChain(p + 1, limit, offset);
+            next.value = offset + 2;
+            for (unsigned r = 0; r < 3 && limit >= MIN_MATCH; ++r)
+            {
+                if (reps[r] > p + 1)
+                    continue;
+
+                unsigned len = matchLength(p + 1, reps[r], limit);
+                if (len >= MIN_MATCH && (len + 1 >= next.len || (next.len != 0 && offset == reps[r])))
+                {
+                    next.len = len;
+                    next.value = r;
+                    break;
+                }
+            }
+
+            for (unsigned r = 0; next.value >= 3 && r < 3; ++r)
+            {
+                if (offset == reps[r]) next.value = r;
+            }
+
+            haveNext = true;
+            if (next.len > match.len + (match.value < 3 ? 1u : 0u))
+            {
+                match.len = 0;
+            }
+        }
+
+        if (match.len < MIN_MATCH)
+        {
+            Item item = { 0, *at(p) };
+            items.push_back(item);
+            ++p;
+            continue;
+        }
+
+        Item item = { static_cast<unsigned short>(match.len), match.value };
+        items.push_back(item);
+
+        // update repeated offsets
+        if (match.value >= 3)
+        {
+            reps[2] = reps[1];
+            reps[1] = reps[0];
+            reps[0] = match.value - 2;
+        }
+        else if (match.value != 0)
+        {
+            std::swap(reps[0], reps[match.value]);
+        }
+
+        // insert the positions covered by the match
+        for (unsigned long q = p + (haveNext ? 2 : 1); q < p + match.len; ++q)
+        {
+            insertChain(q);
+        }
+
+        p += match.len;
+        haveNext = false;
+    }
+}
+
+//------------------------------------------------------------------------------
+// binary tree match finder (max): records matches of increasing length
+//------------------------------------------------------------------------------
+unsigned Lzx::Impl::findTree(unsigned long p, unsigned long* lens, unsigned long* offsets, bool record)
+{
+    // the trees are ordered by up to MAX_MATCH bytes, which may extend past
+    // the block: a shorter limit would leave the trees out of order once the
+    // following data is inserted
+    unsigned long available = dataEnd();
+    if (p + hashBytes > available)
+        return 0;
+
+    unsigned lenLimit = static_cast<unsigned>((std::min)(available - p, static_cast<unsigned long>(MAX_MATCH)));
+    unsigned h = hash(p);
+    unsigned long cur = head[h];
+    head[h] = static_cast<unsigned>(p + 1);
+
+    const unsigned char* s = at(p);
+    unsigned long mask = (1ul << windowBits) - 1;
+    unsigned* ptr0 = &chain[2 * (p & mask) + 1];   // subtree of larger strings
+    unsigned* ptr1 = &chain[2 * (p & mask)];       // subtree of smaller strings
+    unsigned len0 = 0, len1 = 0, best = 2, count = 0;
+
+    for (int depth = params.depth; ; --depth)
+    {
+        unsigned long dist = p - (cur - 1);
+        if (cur == 0 || depth == 0 || dist > maxOffset)
+        {
+            *ptr0 = *ptr1 = 0;
+            break;
+        }
+
+        unsigned* pair = &chain[2 * ((cur - 1) & mask)];
+        const unsigned char* m = s - dist;
+        unsigned len = (std::min)(len0, len1);
+        if (m[len] == s[len])
+        {
+            while (++len < lenLimit && m[len] == s[len])
+                ;
+
+            if (len > best)
+            {
+                best = len;
+                if (record)
+                {
+                    lens[count] = len;
+                    offsets[count] = dist;
+                    ++count;
+                }
+
+                if (len == lenLimit)
+                {
+                    *ptr1 = pair[0];
+                    *ptr0 = pair[1];
+                    break;
+                }
+            }
+        }
+
+        if (m[len] < s[len])
+        {
+            *ptr1 = static_cast<unsigned>(cur);
+            ptr1 = &pair[1];
+            cur = *ptr1;
+            len1 = len;
+        }
+        else
+        {
+            *ptr0 = static_cast<unsigned>(cur);
+            ptr0 = &pair[0];
+            cur = *ptr0;
+            len0 = len;
+        }
+    }
+
+    return count;
+}
+
+//------------------------------------------------------------------------------
+void Lzx::Impl::parseOptimal(unsigned long start, std::vector<Item>& items)
+{
+    size_t n = end - start;
+
+    // find matches at every position, skipping over very long matches
+    std::vector<unsigned> matchIndex(n + 1);
+    std::vector<unsigned long> matches;
+    unsigned long lens[MAX_MATCH + 1], offsets[MAX_MATCH + 1];
+    for (unsigned long p = start; p < end; )
+    {
+        matchIndex[p - start] = static_cast<unsigned>(matches.size());
+        unsigned count = findTree(p, lens, offsets, true);
+        unsigned limit = matchLimit(p);
+        unsigned last = 0;
+        for (unsigned k = 0; k < count; ++k)
+        {
+            unsigned len = (std::min)(static_cast<unsigned>(lens[k]), limit);
+            if (len > last)
+            {
+                matches.push_back(len);
+                matches.push_back(offsets[k]);
+                last = len;
+            }
+        }
+
+        ++p;
+        if (last >= static_cast<unsigned>(params.nice))
+        {
+            for (unsigned long skipEnd = p - 1 + last; p < skipEnd; ++p)
+            {
+                matchIndex[p - start] = static_cast<unsigned>(matches.size());
+                findTree(p, NULL, NULL, false);
+            }
+        }
+    }
+    matchIndex[n] = static_cast<unsigned>(matches.size());
+
+    // first pass with the costs of the previous block, second pass with
+    // the costs resulting from the first pass
+    std::vector<Node> nodes(n + 1);
+    std::vector<Item> trial;
+    trial.reserve(n);
+    optimalPass(start, matchIndex, matches, nodes, trial);
+
+    Stats stats;
+    for (size_t i = 0; i < trial.size(); ++i) stats.add(trial[i]);
+    updateCosts(stats);
+
+    optimalPass(start, matchIndex, matches, nodes, items);
+    std::copy(nodes[n].reps, nodes[n].reps + 3, reps);
+}
+
+//------------------------------------------------------------------------------
+void Lzx::Impl::optimalPass(unsigned long start, 
+                            const std::vector<unsigned>& matchIndex,
+                            const std::vector<unsigned long>& matches, 
+                            std::vector<Node>& nodes,
+                            std::vector<Item>& items) const
+{
+    const Trees& c = costLengths;
+    size_t n = nodes.size() - 1;
+
+    for (size_t i = 0; i <= n; ++i) nodes[i].cost = MAX_COST;
+    nodes[0].cost = 0;
+    std::copy(reps, reps + 3, nodes[0].reps);
+
+    size_t skipUntil = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const Node& node = nodes[i];
+        unsigned long p = start + static_cast<unsigned long>(i);
+
+        // literal
+        unsigned char literal = *at(p);
+        unsigned long cost = node.cost + c.main[literal];
+        if (cost < nodes[i + 1].cost)
+        {
+            Node& next = nodes[i + 1];
+            next.cost = cost;
+            next.len = 0;
+            next.value = literal;
+            std::copy(node.reps, node.reps + 3, next.reps);
+        }
+
+        unsigned limit = matchLimit(p);
+        if (i < skipUntil || limit < MIN_MATCH)
+            continue;
+
+        unsigned longest = 0;
+
+        // repeated offsets
+        for (unsigned r = 0; r < 3; ++r)
+        {
+            unsigned long offset = node.reps[r];
+            if (offset > p || (r > 0 && offset == node.reps[0]) || (r > 1 && offset == node.reps[1]))
+                continue;
+
+            unsigned len = matchLength(p, offset, limit);
+            longest = (std::max)(longest, len);
+            for (unsigned l = MIN_MATCH; l <= len; ++l)
+            {
+                unsigned header = (std::min)(l - MIN_MATCH, static_cast<unsigned>(NUM_PRIMARY_LENGTHS));
+                cost = node.cost + c.main[NUM_CHARS + r * 8 + header];
+                if (header == NUM_PRIMARY_LENGTHS) cost += c.length[l - MIN_MATCH - NUM_PRIMARY_LENGTHS];
+
+                Node& next = nodes[i + l];
+                if (cost < next.cost)
+                {
+                    next.cost = cost;
+                    next.len = static_cast<unsigned short>(l);
+                    next.value = r;
+                    std::copy(node.reps, node.reps + 3, next.reps);
+                    std::swap(next.reps[0], next.reps[r]);
+                }
+            }
+        }
+
+        // matches
+        unsigned prev = MIN_MATCH;
+        for (unsigned k = matchIndex[i]; k < matchIndex[i + 1]; k += 2)
+        {
+            unsigned len = static_cast<unsigned>(matches[k]);
+            unsigned long offset = matches[k + 1];
+            if (offset == node.reps[0] || offset == node.reps[1] || offset == node.reps[2])
+                continue;
+
+            longest = (std::max)(longest, len);
+            unsigned long f = offset + 2;
+            unsigned slot = slotOf(f);
+            for (unsigned l = prev + 1; l <= len; ++l)
+            {
+                unsigned header = (std::min)(l - MIN_MATCH, static_cast<unsigned>(NUM_PRIMARY_LENGTHS));
+                cost = node.cost + c.main[NUM_CHARS + slot * 8 + header] + slots.extraBits[slot];
+                if (header == NUM_PRIMARY_LENGTHS) cost += c.length[l - MIN_MATCH - NUM_PRIMARY_LENGTHS];
+
+                Node& next = nodes[i + l];
+                if (cost < next.cost)
+                {
+                    next.cost = cost;
+                    next.len = static_cast<unsigned short>(l);
+                    next.value = f;
+                    next.reps[0] = offset;
+                    next.reps[1] = node.reps[0];
+                    next.reps[2] = node.reps[1];
+                }
+            }
+            prev = len;
+        }
+
+        // do not bother with positions covered by a very long match
+        if (longest >= static_cast<unsigned>(params.nice))
+            skipUntil = i + longest;
+    }
+
+    // trace back the cheapest path
+    items.clear();
+    for (size_t j = n; j > 0; )
+    {
+        const Node& node = nodes[j];
+        Item item = { node.len, node.value };
+        items.push_back(item);
+        j -= node.len == 0 ? 1 : node.len;
+    }
+    std::reverse(items.begin(), items.end());
+}
+
+//------------------------------------------------------------------------------
+void Lzx::Impl::updateCosts(const Stats& stats)
+{
+    unsigned freqs[MAX_MAIN_SIZE];
+
+    for (int i = 0; i < mainSize; ++i) freqs[i] = stats.main[i] + 1;
+    Huffman::buildLengths(freqs, mainSize, MAX_CODE_LENGTH, costLengths.main);
+
+    for (int i = 0; i < NUM_SECONDARY_LENGTHS; ++i) freqs[i] = stats.length[i] + 1;
+    Huffman::buildLengths(freqs, NUM_SECONDARY_LENGTHS, MAX_CODE_LENGTH, costLengths.length);
+}
+
+//------------------------------------------------------------------------------
+void Lzx::Impl::writeTree(const unsigned char* lengths, unsigned char* prev, int count)
+{
+    // pretree symbols: 0..16 delta, 17/18 runs of zeros, 19 run of equal lengths
+    std::vector<int> syms;
+    for (int i = 0; i < count; )
+    {
+        int run = 1;
+        while (i + run < count && lengths[i + run] == lengths[i]) ++run;
+
+        if (lengths[i] == 0 && run >= 4)
+        {
+            run = (std::min)(run, 51);
+            if (run >= 20)
+            {
+                syms.push_back(18);
+                syms.push_back(run - 20);
+            }
+            else
+            {
+                syms.push_back(17);
+                syms.push_back(run - 4);
+            }
+            i += run;
+        }
+        else if (run >= 4)
+        {
+            run = (std::min)(run, 5);
+            syms.push_back(19);
+            syms.push_back(run - 4);
+            syms.push_back((prev[i] - lengths[i] + 17) % 17);
+            i += run;
+        }
+        else
+        {
+            syms.push_back((prev[i] - lengths[i] + 17) % 17);
+            ++i;
+        }
+    }
+
+    unsigned freqs[PRETREE_SIZE] = { 0 };
+    for (size_t k = 0; k < syms.size(); ++k)
+    {
+        ++freqs[syms[k]];
+        if (syms[k] >= 17) ++k;
+    }
+
+    unsigned char pretree[PRETREE_SIZE];
+    unsigned short codes[PRETREE_SIZE];
+    Huffman::buildLengths(freqs, PRETREE_SIZE, MAX_PRETREE_LENGTH, pretree);
+    Huffman::buildCodes(pretree, PRETREE_SIZE, codes);
+
+    for (int k = 0; k < PRETREE_SIZE; ++k) out.put(pretree[k], 4);
+    for (size_t k = 0; k < syms.size(); ++k)
+    {
+        int sym = syms[k];
+        out.put(codes[sym], pretree[sym]);
+        if      (sym == 17) out.put(syms[++k], 4);
+        else if (sym == 18) out.put(syms[++k], 5);
+        else if (sym == 19) out.put(syms[++k], 1);
+    }
+
+    memcpy(prev, lengths, count);
+}
+
+//------------------------------------------------------------------------------
+void Lzx::Impl::writeBlock(const std::vector<Item>& items, unsigned long start, std::vector<Frame>& frames)
+{
+    Stats stats;
+    for (size_t i = 0; i < items.size(); ++i) stats.add(items[i]);
+
+    Trees lengths;
+    unsigned short mainCodes[MAX_MAIN_SIZE], lengthCodes[NUM_SECONDARY_LENGTHS], alignedCodes[ALIGNED_SIZE];
+    Huffman::buildLengths(stats.main, mainSize, MAX_CODE_LENGTH, lengths.main);
+    Huffman::buildLengths(stats.length, NUM_SECONDARY_LENGTHS, MAX_CODE_LENGTH, lengths.length);
+    Huffman::buildLengths(stats.aligned, ALIGNED_SIZE, MAX_ALIGNED_LENGTH, lengths.aligned);
+    Huffman::buildCodes(lengths.main, mainSize, mainCodes);
+    Huffman::buildCodes(lengths.length, NUM_SECONDARY_LENGTHS, lengthCodes);
+    Huffman::buildCodes(lengths.aligned, ALIGNED_SIZE, alignedCodes);
+
+    // aligned offset block if the aligned tree pays for itself
+    unsigned long alignedBits = 3 * ALIGNED_SIZE, verbatimBits = 0;
+    for (int k = 0; k < ALIGNED_SIZE; ++k)
+    {
+        alignedBits += stats.aligned[k] * lengths.aligned[k];
+        verbatimBits += stats.aligned[k] * 3;
+    }
+    bool aligned = alignedBits < verbatimBits;
+
+    // header (no E8 translation)
+    if (!started)
+    {
+        out.put(0, 1);
+        started = true;
+    }
+
+    unsigned long size = end - start;
+    out.put(aligned ? BLOCK_TYPE_ALIGNED : BLOCK_TYPE_VERBATIM, 3);
+    out.put(size >> 8, 16);
+    out.put(size & 0xFF, 8);
+
+    if (aligned)
+    {
+        for (int k = 0; k < ALIGNED_SIZE; ++k) out.put(lengths.aligned[k], 3);
+    }
+
+    writeTree(lengths.main, prevLengths.main, NUM_CHARS);
+    writeTree(lengths.main + NUM_CHARS, prevLengths.main + NUM_CHARS, mainSize - NUM_CHARS);
+    writeTree(lengths.length, prevLengths.length, NUM_SECONDARY_LENGTHS);
+
+    // items, ending a frame every 32 KB
+    unsigned long p = start;
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const Item& item = items[i];
+        if (item.len == 0)
+        {
+            out.put(mainCodes[item.value], lengths.main[item.value]);
+            ++p;
+        }
+        else
+        {
+            unsigned slot = item.value < 3 ? item.value : slotOf(item.value);
+            unsigned header = (std::min)(item.len - MIN_MATCH, NUM_PRIMARY_LENGTHS);
+            unsigned sym = NUM_CHARS + slot * 8 + header;
+            out.put(mainCodes[sym], lengths.main[sym]);
+            if (header == NUM_PRIMARY_LENGTHS)
+            {
+                unsigned footer = item.len - MIN_MATCH - NUM_PRIMARY_LENGTHS;
+                out.put(lengthCodes[footer], lengths.length[footer]);
+            }
+
+            if (slot >= 3)
+            {
+                int extra = slots.extraBits[slot];
+                unsigned long footer = item.value - slots.base[slot];
+                if (aligned && extra >= 3)
+                {
+                    if (extra > 3) out.put(footer >> 3, extra - 3);
+                    out.put(alignedCodes[footer & 7], lengths.aligned[footer & 7]);
+                }
+                else if (extra > 0)
+                {
+                    out.put(footer, extra);
+                }
+            }
+
+            p += item.len;
+        }
+
+        if (p % FRAME_SIZE == 0 || p == end)
+        {
+            out.align();
+            Frame frame;
+            frame.data.swap(out.data());
+            frame.size = p % FRAME_SIZE == 0 ? static_cast<size_t>(FRAME_SIZE) : p % FRAME_SIZE;
+            frames.push_back(frame);
+        }
+    }
+
+    if (optimal)
+        updateCosts(stats);
+}
@@ -0,0 +1,106 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// LZX compressor
+//
+// Produces the LZX bitstream used in cabinet folders (MS-PATCH, section
+// 2; without E8 translation). The data of a folder is divided into 32 KB
+// frames, each of which becomes one CFDATA block. Unlike MSZIP, the
+// encoder state (window, repeated offsets and previous tree lengths)
+// carries over from one frame to the next, so a folder is compressed
+// sequentially.
+//
+// The window size ranges from 2^15 to 2^21 bytes. The effort selects the
+// match finder and parser:
+//
+//   fast    hash chains, greedy parsing
+//   normal  longer hash chains, lazy parsing
+//   max     binary trees, near-optimal parsing (two passes per block)
+//
+// The output only depends on the data, the window size and the effort,
+// not on how the data is passed to compress().
+//
+//------------------------------------------------------------------------------
+#ifndef LZX_H_INCLUDED
+#define LZX_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <vector>
+#include <stddef.h>
+
+class Lzx
+{
+public:
+    enum
+    {
+        FRAME_SIZE      = 32768,    // uncompressed frame size
+        MIN_WINDOW      = 15,       // smallest window (bits)
+        MAX_WINDOW      = 21        // largest window (bits)
+    };
+
+    enum Effort
+    {
+        effortFast,
+        effortNormal,
+        effortMax
+    };
+
+    struct Frame
+    {
+        std::vector<unsigned char>  data;   // compressed data
+        size_t                      size;   // uncompressed size
+    };
+
+    // constructor
+    Lzx(int windowBits, Effort effort);
+
+    // destructor
+    ~Lzx();
+
+    // compress data (appends completed frames)
+    void                compress(const unsigned char* data, size_t len, std::vector<Frame>& frames);
+
+    // compress remaining data and end the last frame
+    void                finish(std::vector<Frame>& frames);
+
+    // folder compression type (CFFOLDER.typeCompress)
+    static unsigned     folderType(int windowBits)
+    {
+        return 3 | (windowBits << 8);
+    }
+
+private:
+    Lzx(const Lzx&);
+    Lzx& operator=(const Lzx&);
+
+    struct Impl;
+    Impl* m_pImpl;
+};
+
+#endif // LZX_H_INCLUDED
@@ -0,0 +1,424 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "MsZip.h"
+#include "Huffman.h"
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+namespace
+{
+    // match finder parameters
+    const int           MIN_MATCH       = 3;
+    const int           MAX_MATCH       = 258;
+    const int           MAX_DISTANCE    = 32768;
+    const int           TOO_FAR         = 4096;     // discard 3 byte matches farther away
+    const int           MAX_CHAIN       = 128;      // hash chain search depth
+    const int           NICE_MATCH      = 128;      // stop searching at this length
+    const int           MAX_LAZY        = 32;       // no lazy evaluation beyond this length
+    const int           HASH_BITS       = 15;
+    const int           HASH_SIZE       = 1 << HASH_BITS;
+
+    // deflate alphabets
+    const int           LITLEN_CODES    = 286;
+    const int           DIST_CODES      = 30;
+    const int           CLEN_CODES      = 19;
+    const int           END_OF_BLOCK    = 256;
+
+    const unsigned short lengthBase[29] =
+    {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+    };
+
+    const unsigned char lengthExtra[29] =
+    {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+    };
+
+    const unsigned short distBase[30] =
+    {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+    };
+
+    const unsigned char distExtra[30] =
+    {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+    };
+
+    const unsigned char clenOrder[CLEN_CODES] =
+    {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+
+    //--------------------------------------------------------------------------
+    // lookup tables from match length / distance to deflate code
+    struct CodeTables
+    {
+        unsigned char   lengthCode[MAX_MATCH + 1];
+        unsigned char   distCode[512];
+
+        CodeTables()
+        {
+            for (int code = 0; code < 29; ++code)
+            {
+                int end = code < 28 ? lengthBase[code + 1] : MAX_MATCH + 1;
+                for (int len = lengthBase[code]; len < end; ++len) lengthCode[len] = static_cast<unsigned char>(code);
+            }
+            lengthCode[MAX_MATCH] = 28;
+
+            for (int code = 0; code < 30; ++code)
+            {
+                int end = code < 29 ? distBase[code + 1] : MAX_DISTANCE + 1;
+                for (int dist = distBase[code]; dist < end; ++dist)
+                {
+                    if (dist <= 256)                distCode[dist - 1] = static_cast<unsigned char>(code);
+                    else if (((dist - 1) & 127) == 0) distCode[256 + ((dist - 1) >> 7)] = static_cast<unsigned char>(code);
+                }
+            }
+        }
+
+        int             distanceCode(int dist) const
+        {
+            return dist <= 256 ? distCode[dist - 1] : distCode[256 + ((dist - 1) >> 7)];
+        }
+    };
+
+    const CodeTables& codeTables()
+    {
+        static const CodeTables tables;
+        return tables;
+    }
+
+    //--------------------------------------------------------------------------
+    // LSB-first bit writer
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<unsigned char>& out) : m_out(out), m_bits(0), m_count(0) {}
+
+        void            put(unsigned value, int n)
+        {
+            m_bits |= value << m_count;
+            m_count += n;
+            while (m_count >= 8)
+            {
+                m_out.push_back(static_cast<unsigned char>(m_bits));
+                m_bits >>= 8;
+                m_count -= 8;
+            }
+        }
+
+        void            align()
+        {
+            if (m_count > 0) m_out.push_back(static_cast<unsigned char>(m_bits));
+            m_bits = 0;
+            m_count = 0;
+        }
+
+    private:
+        std::vector<unsigned char>& m_out;
+        unsigned        m_bits;
+        int             m_count;
+    };
+
+    //--------------------------------------------------------------------------
+    // token: literal (dist == 0) or match
+    struct Token
+    {
+        unsigned short  value;      // literal byte or match length
+        unsigned short  dist;       // match distance
+    };
+
+    //--------------------------------------------------------------------------
+    inline unsigned hash3(const unsigned char* p)
+    {
+        return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+    }
+
+    //--------------------------------------------------------------------------
+    // find LZ77 tokens for window[start, end), where window[0, start) is history
+    void findTokens(const unsigned char* window, int start, int end, std::vector<Token>& tokens)
+    {
+        std::vector<int> head(HASH_SIZE, -1);
+        std::vector<int> prev(end, -1);
+
+        auto insert = [&](int pos)
+        {
+            if (pos + MIN_MATCH <= end)
+            {
+                unsigned h = hash3(window + pos);
+                prev[pos] = head[h];
+                head[h] = pos;
+            }
+        };
+
+        auto longestMatch = [&](int pos, int& bestDist) -> int
+        {
+            int maxLen = (std::min)(MAX_MATCH, end - pos);
+            if (maxLen < MIN_MATCH) return 0;
+
+            int bestLen = 0;
+            int chain = MAX_CHAIN;
+            for (int cand = head[hash3(window + pos)]; cand >= 0 && chain-- > 0; cand = prev[cand])
+            {
+                if (pos - cand > MAX_DISTANCE) break;
+                if (window[cand + bestLen] != window[pos + bestLen]) continue;
+
+                int len = 0;
+                while (len < maxLen && window[cand + len] == window[pos + len]) ++len;
+                if (len > bestLen)
+                {
+                    bestLen = len;
+                    bestDist = pos - cand;
+                    if (len >= NICE_MATCH || len == maxLen) break;
+                }
+            }
+
+            if (bestLen == MIN_MATCH && bestDist > TOO_FAR) bestLen = 0;
+            return bestLen >= MIN_MATCH ? bestLen : 0;
+        };
+
+        // prime the hash chains with the history
+        for (int pos = 0; pos < start; ++pos) insert(pos);
+
+        // lazy evaluation: a match is only taken if the next position
+        // does not yield a longer one
+        int prevLen = 0, prevDist = 0;
+        bool pending = false;
+        int pos = start;
+        while (pos < end)
+        {
+            int curDist = 0;
+            int curLen = (prevLen >= MAX_LAZY) ? 0 : longestMatch(pos, curDist);
+            insert(pos);
+
+            if (prevLen >= MIN_MATCH && curLen <= prevLen)
+            {
+                Token token = { static_cast<unsigned short>(prevLen), static_cast<unsigned short>(prevDist) };
+                tokens.push_back(token);
+
+                int matchEnd = pos - 1 + prevLen;
+                for (++pos; pos < matchEnd; ++pos) insert(pos);
+                prevLen = 0;
+                pending = false;
+                continue;
+            }
+
+            if (pending)
+            {
+                Token token = { window[pos - 1], 0 };
+                tokens.push_back(token);
+            }
+
+            prevLen = curLen;
+            prevDist = curDist;
+            pending = true;
+            ++pos;
+        }
+
+        if (pending)
+        {
+            if (prevLen >= MIN_MATCH)
+            {
+                Token token = { static_cast<unsigned short>(prevLen), static_cast<unsigned short>(prevDist) };
+                tokens.push_back(token);
+            }
+            else
+            {
+                Token token = { window[pos - 1], 0 };
+                tokens.push_back(token);
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // write a final stored block
+    void writeStored(const unsigned char* data, size_t len, std::vector<unsigned char>& out)
+    {
+        BitWriter bits(out);
+        bits.put(1, 1);     // BFINAL
+        bits.put(0, 2);     // BTYPE = stored
+        bits.align();
+        bits.put(static_cast<unsigned>(len), 16);
+        bits.put(static_cast<unsigned>(~len) & 0xFFFF, 16);
+        out.insert(out.end(), data, data + len);
+    }
+
+    //--------------------------------------------------------------------------
+    // write a final block with dynamic Huffman codes
+    void writeDynamic(const std::vector<Token>& tokens, std::vector<unsigned char>& out)
+    {
+        const CodeTables& tables = codeTables();
+
+        // symbol statistics
+        unsigned litFreq[LITLEN_CODES] = { 0 };
+        unsigned distFreq[DIST_CODES] = { 0 };
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            if (tokens[i].dist == 0)
+            {
+                ++litFreq[tokens[i].value];
+            }
+            else
+            {
+                ++litFreq[257 + tables.lengthCode[tokens[i].value]];
+                ++distFreq[tables.distanceCode(tokens[i].dist)];
+            }
+        }
+        litFreq[END_OF_BLOCK] = 1;
+
+        unsigned char litLen[LITLEN_CODES], distLen[DIST_CODES];
+        unsigned short litCode[LITLEN_CODES], distCodes[DIST_CODES];
+        Huffman::buildLengths(litFreq, LITLEN_CODES, 15, litLen);
+        Huffman::buildLengths(distFreq, DIST_CODES, 15, distLen);
+        Huffman::buildCodes(litLen, LITLEN_CODES, litCode);
+        Huffman::buildCodes(distLen, DIST_CODES, distCodes);
+
+        int hlit = LITLEN_CODES;
+        while (hlit > 257 && litLen[hlit - 1] == 0) --hlit;
+        int hdist = DIST_CODES;
+        while (hdist > 1 && distLen[hdist - 1] == 0) --hdist;
+
+        // run length encode the code lengths
+        std::vector<unsigned char> lens(litLen, litLen + hlit);
+        lens.insert(lens.end(), distLen, distLen + hdist);
+
+        std::vector<std::pair<int, int> > clens;    // (symbol, extra bits value)
+        for (size_t i = 0; i < lens.size(); )
+        {
+            size_t run = 1;
+            while (i + run < lens.size() && lens[i + run] == lens[i]) ++run;
+
+            if (lens[i] == 0)
+            {
+                size_t left = run;
+                while (left >= 11) { size_t n = (std::min)(left, size_t(138)); clens.push_back(std::make_pair(18, int(n - 11))); left -= n; }
+                if (left >= 3)     { clens.push_back(std::make_pair(17, int(left - 3))); left = 0; }
+                while (left-- > 0) clens.push_back(std::make_pair(0, 0));
+            }
+            else
+            {
+                clens.push_back(std::make_pair(int(lens[i]), 0));
+                size_t left = run - 1;
+                while (left >= 3) { size_t n = (std::min)(left, size_t(6)); clens.push_back(std::make_pair(16, int(n - 3))); left -= n; }
+                while (left-- > 0) clens.push_back(std::make_pair(int(lens[i]), 0));
+            }
+
+            i += run;
+        }
+
+        unsigned clenFreq[CLEN_CODES] = { 0 };
+        for (size_t i = 0; i < clens.size(); ++i) ++clenFreq[clens[i].first];
+
+        unsigned char clenLen[CLEN_CODES];
+        unsigned short clenCode[CLEN_CODES];
+        Huffman::buildLengths(clenFreq, CLEN_CODES, 7, clenLen);
+        Huffman::buildCodes(clenLen, CLEN_CODES, clenCode);
+
+        int hclen = CLEN_CODES;
+        while (hclen > 4 && clenLen[clenOrder[hclen - 1]] == 0) --hclen;
+
+        // block header
+        BitWriter bits(out);
+        bits.put(1, 1);     // BFINAL
+        bits.put(2, 2);     // BTYPE = dynamic
+        bits.put(hlit - 257, 5);
+        bits.put(hdist - 1, 5);
+        bits.put(hclen - 4, 4);
+        for (int i = 0; i < hclen; ++i) bits.put(clenLen[clenOrder[i]], 3);
+
+        for (size_t i = 0; i < clens.size(); ++i)
+        {
+            int sym = clens[i].first;
+            bits.put(Huffman::reverse(clenCode[sym], clenLen[sym]), clenLen[sym]);
+            if (sym == 16)      bits.put(clens[i].second, 2);
+            else if (sym == 17) bits.put(clens[i].second, 3);
+            else if (sym == 18) bits.put(clens[i].second, 7);
+        }
+
+        // compressed data
+        for (size_t i = 0; i < tokens.size(); ++i)
+        {
+            const Token& token = tokens[i];
+            if (token.dist == 0)
+            {
+                bits.put(Huffman::reverse(litCode[token.value], litLen[token.value]), litLen[token.value]);
+            }
+            else
+            {
+                int lc = tables.lengthCode[token.value];
+                bits.put(Huffman::reverse(litCode[257 + lc], litLen[257 + lc]), litLen[257 + lc]);
+                bits.put(token.value - lengthBase[lc], lengthExtra[lc]);
+
+                int dc = tables.distanceCode(token.dist);
+                bits.put(Huffman::reverse(distCodes[dc], distLen[dc]), distLen[dc]);
+                bits.put(token.dist - distBase[dc], distExtra[dc]);
+            }
+        }
+
+        bits.put(Huffman::reverse(litCode[END_OF_BLOCK], litLen[END_OF_BLOCK]), litLen[END_OF_BLOCK]);
+        bits.align();
+    }
+}
+
+//------------------------------------------------------------------------------
+void MsZip::compressBlock(const unsigned char* history, size_t historyLen,
+                          const unsigned char* data, size_t len,
+                          std::vector<unsigned char>& out)
+{
+    if (historyLen > HISTORY_SIZE)
+    {
+        history += historyLen - HISTORY_SIZE;
+        historyLen = HISTORY_SIZE;
+    }
+
+    // contiguous window: history followed by block data (and one spare byte)
+    std::vector<unsigned char> window;
+    window.reserve(historyLen + len + 1);
+    window.insert(window.end(), history, history + historyLen);
+    window.insert(window.end(), data, data + len);
+    window.push_back(0);
+
+    std::vector<Token> tokens;
+    tokens.reserve(len);
+    findTokens(&window[0], static_cast<int>(historyLen), static_cast<int>(historyLen + len), tokens);
+
+    size_t start = out.size();
+    out.push_back('C');
+    out.push_back('K');
+    writeDynamic(tokens, out);
+
+    // fall back to a stored block if compression does not pay
+    if (out.size() - start > len + 7)
+    {
+        out.resize(start + 2);
+        writeStored(data, len, out);
+    }
+}
@@ -0,0 +1,66 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// MSZIP compressor
+//
+// An MSZIP folder is a sequence of CFDATA blocks, each holding at most
+// 32 KB of uncompressed data as "CK" followed by a complete deflate
+// stream (RFC 1951). The decompressor keeps its 32 KB history window
+// from one block to the next, so a block may refer back into the data of
+// the previous block.
+//
+// compressBlock() receives that history explicitly. Blocks are therefore
+// independent of each other's compressed output, and can be compressed
+// concurrently without changing the result.
+//
+//------------------------------------------------------------------------------
+#ifndef MSZIP_H_INCLUDED
+#define MSZIP_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <vector>
+#include <stddef.h>
+
+class MsZip
+{
+public:
+    enum
+    {
+        BLOCK_SIZE      = 32768,            // uncompressed block size
+        HISTORY_SIZE    = 32768,            // deflate window size
+        MAX_BLOCK_SIZE  = BLOCK_SIZE + 12   // worst case compressed block size
+    };
+
+    // compress a block (history: preceding uncompressed data of the folder)
+    static void         compressBlock(const unsigned char* history, size_t historyLen,
+                                      const unsigned char* data, size_t len,
+                                      std::vector<unsigned char>& out);
+};
+
+#endif // MSZIP_H_INCLUDED
@@ -0,0 +1,117 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "MsiStreamName.h"
+
+namespace
+{
+    const wchar_t   TABLE_PREFIX    = 0x4840;
+    const wchar_t   PAIR_BASE       = 0x3800;
+    const wchar_t   SINGLE_BASE     = 0x4800;
+    const char      ALPHABET[]      = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz._";
+
+    //--------------------------------------------------------------------------
+    // Index of a character in the alphabet (-1 if not in alphabet)
+    //--------------------------------------------------------------------------
+    int charIndex(wchar_t ch)
+    {
+        if (ch >= L'0' && ch <= L'9') return ch - L'0';
+        if (ch >= L'A' && ch <= L'Z') return ch - L'A' + 10;
+        if (ch >= L'a' && ch <= L'z') return ch - L'a' + 36;
+        if (ch == L'.') return 62;
+        if (ch == L'_') return 63;
+        return -1;
+    }
+}
+
+//------------------------------------------------------------------------------
+std::wstring encodeStreamName(const std::wstring& name, bool table)
+{
+    std::wstring encoded;
+    encoded.reserve(name.size() + 1);
+
+    if (table)
+        encoded += TABLE_PREFIX;
+
+    for (size_t i = 0; i < name.size(); ++i)
+    {
+        int c = charIndex(name[i]);
+        if (c < 0)
+        {
+            encoded += name[i];
+            continue;
+        }
+
+        int n = i + 1 < name.size() ? charIndex(name[i + 1]) : -1;
+        if (n < 0)
+        {
+            encoded += static_cast<wchar_t>(SINGLE_BASE + c);
+        }
+        else
+        {
+            encoded += static_cast<wchar_t>(PAIR_BASE + c + (n << 6));
+            ++i;
+        }
+    }
+
+    return encoded;
+}
+
+//------------------------------------------------------------------------------
+std::wstring decodeStreamName(const std::wstring& name, bool* table)
+{
+    std::wstring decoded;
+    decoded.reserve(2 * name.size());
+
+    size_t i = 0;
+    bool isTable = !name.empty() && name[0] == TABLE_PREFIX;
+    if (isTable)
+        ++i;
+
+    for (; i < name.size(); ++i)
+    {
+        unsigned ch = name[i];
+        if (ch >= PAIR_BASE && ch < SINGLE_BASE)
+        {
+            ch -= PAIR_BASE;
+            decoded += static_cast<wchar_t>(ALPHABET[ch & 0x3F]);
+            decoded += static_cast<wchar_t>(ALPHABET[ch >> 6]);
+        }
+        else if (ch >= SINGLE_BASE && ch < TABLE_PREFIX)
+        {
+            decoded += static_cast<wchar_t>(ALPHABET[ch - SINGLE_BASE]);
+        }
+        else
+        {
+            decoded += static_cast<wchar_t>(ch);
+        }
+    }
+
+    if (table)
+        *table = isTable;
+
+    return decoded;
+}
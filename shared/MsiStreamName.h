@@ -0,0 +1,52 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// MSI stream names
+//
+// Windows Installer stores tables and binary streams in the streams of a
+// compound file. Stream names are compacted to fit the 31 character limit
+// of compound file names: two characters of the set [0-9A-Za-z._] are
+// packed into one code point in the range 0x3800..0x47FF, a single such
+// character maps to 0x4800..0x483F, and all other characters are kept.
+// Table streams are prefixed with 0x4840.
+//
+//------------------------------------------------------------------------------
+#ifndef MSI_STREAM_NAME_H_INCLUDED
+#define MSI_STREAM_NAME_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <string>
+
+// encode the name of a table or binary stream
+std::wstring encodeStreamName(const std::wstring& name, bool table = false);
+
+// decode an encoded stream name (table is set if it names a table)
+std::wstring decodeStreamName(const std::wstring& name, bool* table = 0);
+
+#endif // MSI_STREAM_NAME_H_INCLUDED
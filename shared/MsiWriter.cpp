@@ -0,0 +1,532 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "MsiWriter.h"
+#include "MsiStreamName.h"
+#include "CompoundFile.h"
+#include "ScratchFile.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdexcept>
+#include <algorithm>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    // column type bits (the low byte holds the size)
+    const unsigned      colValid            = 0x0100;
+    const unsigned      colLocalizable      = 0x0200;
+    const unsigned      colScalar           = 0x0400;   // string or short integer, not a stream
+    const unsigned      colString           = 0x0800;
+    const unsigned      colNullable         = 0x1000;
+    const unsigned      colKey              = 0x2000;
+
+    const unsigned      LONG_STRING_REFS    = 0xFFFF;   // pool size requiring 3 byte string references
+    const unsigned      MAX_REFCOUNT        = 0xFFFF;
+
+    // class id of Windows Installer databases {000C1084-0000-0000-C000-000000000046}
+    const unsigned char CLSID_MsiDatabase[16] = 
+        { 0x84, 0x10, 0x0C, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 };
+
+    // format id of the summary information property set {F29F85E0-4FF9-1068-AB91-08002B27B3D9}
+    const unsigned char FMTID_SummaryInformation[16] = 
+        { 0xE0, 0x85, 0x9F, 0xF2, 0xF9, 0x4F, 0x68, 0x10, 0xAB, 0x91, 0x08, 0x00, 0x2B, 0x27, 0xB3, 0xD9 };
+
+    //--------------------------------------------------------------------------
+    void put16(string& buf, unsigned long value)
+    {
+        buf += static_cast<char>(value & 0xFF);
+        buf += static_cast<char>((value >> 8) & 0xFF);
+    }
+
+    //--------------------------------------------------------------------------
+    void put32(string& buf, unsigned long value)
+    {
+        put16(buf, value & 0xFFFF);
+        put16(buf, (value >> 16) & 0xFFFF);
+    }
+
+    //--------------------------------------------------------------------------
+    bool isBinary(unsigned type)    { return (type & (colString | colScalar)) == colString; }
+    bool isString(unsigned type)    { return (type & (colString | colScalar)) == (colString | colScalar); }
+
+    //--------------------------------------------------------------------------
+    // stream names are ASCII, characters are widened as is
+    wstring widen(const string& s)
+    {
+        wstring w;
+        for (size_t i = 0; i < s.size(); ++i)
+            w += static_cast<wchar_t>(static_cast<unsigned char>(s[i]));
+        return w;
+    }
+
+    //--------------------------------------------------------------------------
+    // text of a field as used in stream names and key comparisons
+    string fieldText(const MsiWriter::Field& field, unsigned type)
+    {
+        if (field.null)
+            return string();
+
+        if (type & colString)
+            return field.text;
+
+        char buf[16];
+        sprintf(buf, "%ld", field.value);
+        return buf;
+    }
+
+    //--------------------------------------------------------------------------
+    // string pool (id 0 is the NULL string)
+    class StringPool
+    {
+    public:
+        // add a reference to a string (returns its id)
+        unsigned long add(const string& s)
+        {
+            if (s.empty())
+                return 0;
+
+            map<string, unsigned long>::const_iterator it = m_ids.find(s);
+            if (it != m_ids.end())
+            {
+                ++m_refs[it->second - 1];
+                return it->second;
+            }
+
+            m_strings.push_back(s);
+            m_refs.push_back(1);
+            return m_ids[s] = static_cast<unsigned long>(m_strings.size());
+        }
+
+        size_t              size() const                { return m_strings.size(); }
+        const string&       str(size_t i) const         { return m_strings[i]; }
+        unsigned long       refs(size_t i) const        { return m_refs[i]; }
+
+    private:
+        map<string, unsigned long>  m_ids;
+        vector<string>              m_strings;
+        vector<unsigned long>       m_refs;
+    };
+
+    //--------------------------------------------------------------------------
+    // orders rows by the stored values of their key columns
+    struct KeyLess
+    {
+        const vector<vector<unsigned long> >&   cells;
+        const vector<size_t>&                   keys;
+
+        KeyLess(const vector<vector<unsigned long> >& c, const vector<size_t>& k) : cells(c), keys(k) {}
+
+        bool operator()(size_t a, size_t b) const
+        {
+            for (size_t i = 0; i < keys.size(); ++i)
+            {
+                if (cells[a][keys[i]] != cells[b][keys[i]])
+                    return cells[a][keys[i]] < cells[b][keys[i]];
+            }
+            return false;
+        }
+    };
+
+    //--------------------------------------------------------------------------
+    // serialize a table: all values of the first column, then of the second column etc.
+    string tableStream(const vector<vector<unsigned long> >& cells, const vector<size_t>& order, const vector<unsigned>& widths)
+    {
+        string data;
+        for (size_t col = 0; col < widths.size(); ++col)
+        {
+            for (size_t i = 0; i < order.size(); ++i)
+            {
+                unsigned long value = cells[order[i]][col];
+                for (unsigned byte = 0; byte < widths[col]; ++byte)
+                    data += static_cast<char>((value >> (8 * byte)) & 0xFF);
+            }
+        }
+        return data;
+    }
+}
+
+//------------------------------------------------------------------------------
+MsiWriter::MsiWriter() :
+    m_codepage(0)
+{
+}
+
+//------------------------------------------------------------------------------
+// Column type of a column definition
+//
+// The definition is the type character (s, l: string, i: integer, v:
+// binary; upper case if nullable) followed by the size.
+//------------------------------------------------------------------------------
+unsigned MsiWriter::columnType(const string& def, bool key)
+{
+    if (def.size() < 2 || !isalpha(static_cast<unsigned char>(def[0])))
+        throw runtime_error("Invalid field definition: " + def);
+
+    for (size_t i = 1; i < def.size(); ++i)
+    {
+        if (!isdigit(static_cast<unsigned char>(def[i])))
+            throw runtime_error("Invalid field definition: " + def);
+    }
+
+    int len = atoi(def.c_str() + 1);
+    unsigned type;
+    switch (tolower(def[0]))
+    {
+    case 's':   // string
+    case 'l':   // string (localizable)
+        if (len > 255)
+            throw runtime_error("Invalid string length specified: " + def);
+        type = colString | colScalar | colValid | len;
+        if (tolower(def[0]) == 'l')
+            type |= colLocalizable;
+        break;
+
+    case 'i':   // integer
+        if (len == 2)
+            type = colScalar | colValid | 2;
+        else if (len == 4)
+            type = colValid | 4;
+        else
+            throw runtime_error("Invalid integer size specified: " + def);
+        break;
+
+    case 'v':   // binary stream
+        if (len != 0)
+            throw runtime_error("Error in binary stream specification: " + def);
+        type = colString | colValid;
+        break;
+
+    default:
+        throw runtime_error("Invalid field definition: " + def);
+    }
+
+    if (isupper(static_cast<unsigned char>(def[0])))
+        type |= colNullable;
+
+    if (key)
+        type |= colKey;
+
+    return type;
+}
+
+//------------------------------------------------------------------------------
+void MsiWriter::setCodepage(unsigned codepage)
+{
+    m_codepage = codepage;
+}
+
+//------------------------------------------------------------------------------
+void MsiWriter::createTable(const string& name, const vector<Column>& columns)
+{
+    if (m_tableIndex.find(name) != m_tableIndex.end())
+        throw runtime_error("Table '" + name + "' already exists");
+
+    if (columns.empty() || !(columns.front().type & colKey))
+        throw runtime_error("Missing primary key in table '" + name + "'");
+
+    Table table;
+    table.name = name;
+    table.columns = columns;
+    m_tableIndex[name] = m_tables.size();
+    m_tables.push_back(table);
+}
+
+//------------------------------------------------------------------------------
+void MsiWriter::insertRow(const string& tableName, const Row& row)
+{
+    map<string, size_t>::const_iterator it = m_tableIndex.find(tableName);
+    if (it == m_tableIndex.end())
+        throw runtime_error("Unknown table '" + tableName + "'");
+
+    Table& table = m_tables[it->second];
+    if (row.size() != table.columns.size())
+        throw runtime_error("Invalid number of fields in table '" + tableName + "'");
+
+    string key;
+    for (size_t col = 0; col < row.size(); ++col)
+    {
+        if (table.columns[col].type & colKey)
+            key += fieldText(row[col], table.columns[col].type) + '\0';
+    }
+
+    if (!table.keys.insert(key).second)
+        throw runtime_error("The table contains non-unique primary keys");
+
+    table.rows.push_back(row);
+}
+
+//------------------------------------------------------------------------------
+void MsiWriter::addStream(const string& name, const shared_ptr<ScratchFile>& data)
+{
+    m_streams[name] = data;
+}
+
+//------------------------------------------------------------------------------
+void MsiWriter::setSummaryInteger(unsigned id, PropertyType type, long value)
+{
+    Property& prop = m_summary[id];
+    prop.type = type;
+    prop.value = static_cast<unsigned long>(value);
+    prop.text.erase();
+}
+
+//------------------------------------------------------------------------------
+void MsiWriter::setSummaryString(unsigned id, const string& value)
+{
+    Property& prop = m_summary[id];
+    prop.type = propString;
+    prop.value = 0;
+    prop.text = value;
+}
+
+//------------------------------------------------------------------------------
+void MsiWriter::setSummaryTime(unsigned id, unsigned long long fileTime)
+{
+    Property& prop = m_summary[id];
+    prop.type = propFileTime;
+    prop.value = fileTime;
+    prop.text.erase();
+}
+
+//------------------------------------------------------------------------------
+// Write database
+//------------------------------------------------------------------------------
+void MsiWriter::write(const string& path) const
+{
+    CompoundFile storage;
+    buildStorage(storage);
+    storage.write(path);
+}
+
+#ifdef _WIN32
+void MsiWriter::write(const wstring& path) const
+{
+    CompoundFile storage;
+    buildStorage(storage);
+    storage.write(path);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Add the streams of the database to a storage
+//------------------------------------------------------------------------------
+void MsiWriter::buildStorage(CompoundFile& storage) const
+{
+    storage.setClassId(CLSID_MsiDatabase);
+
+    // string references of the system tables come first
+    StringPool pool;
+    vector<vector<unsigned long> > tablesCells, columnsCells;
+    for (size_t t = 0; t < m_tables.size(); ++t)
+    {
+        tablesCells.push_back(vector<unsigned long>(1, pool.add(m_tables[t].name)));
+    }
+
+    for (size_t t = 0; t < m_tables.size(); ++t)
+    {
+        const vector<Column>& columns = m_tables[t].columns;
+        for (size_t col = 0; col < columns.size(); ++col)
+        {
+            vector<unsigned long> cells(4);
+            cells[0] = pool.add(m_tables[t].name);
+            cells[1] = (col + 1 + 0x8000) & 0xFFFF;
+            cells[2] = pool.add(columns[col].name);
+            cells[3] = (columns[col].type + 0x8000) & 0xFFFF;
+            columnsCells.push_back(cells);
+        }
+    }
+
+    // stored values of all tables
+    vector<vector<vector<unsigned long> > > tableCells(m_tables.size());
+    for (size_t t = 0; t < m_tables.size(); ++t)
+    {
+        const Table& table = m_tables[t];
+        for (size_t r = 0; r < table.rows.size(); ++r)
+        {
+            vector<unsigned long> cells(table.columns.size());
+            for (size_t col = 0; col < cells.size(); ++col)
+            {
+                const Field& field = table.rows[r][col];
+                unsigned type = table.columns[col].type;
+                if (isBinary(type))
+                    cells[col] = field.stream ? 1 : 0;
+                else if (type & colString)
+                    cells[col] = field.null ? 0 : pool.add(field.text);
+                else if (field.null)
+                    cells[col] = 0;
+                else if ((type & 0xFF) == 2)
+                    cells[col] = (static_cast<unsigned long>(field.value) + 0x8000) & 0xFFFF;
+                else
+                    cells[col] = (static_cast<unsigned long>(field.value) ^ 0x80000000) & 0xFFFFFFFF;
+            }
+            tableCells[t].push_back(cells);
+        }
+    }
+
+    unsigned refWidth = pool.size() >= LONG_STRING_REFS ? 3 : 2;
+
+    // '_Tables' and '_Columns'
+    {
+        vector<size_t> keys(1, 0), order;
+        for (size_t i = 0; i < tablesCells.size(); ++i) order.push_back(i);
+        stable_sort(order.begin(), order.end(), KeyLess(tablesCells, keys));
+        storage.addStream(encodeStreamName(L"_Tables", true), tableStream(tablesCells, order, vector<unsigned>(1, refWidth)));
+
+        keys.push_back(1);
+        order.clear();
+        for (size_t i = 0; i < columnsCells.size(); ++i) order.push_back(i);
+        stable_sort(order.begin(), order.end(), KeyLess(columnsCells, keys));
+        vector<unsigned> widths(4, 2);
+        widths[0] = widths[2] = refWidth;
+        storage.addStream(encodeStreamName(L"_Columns", true), tableStream(columnsCells, order, widths));
+    }
+
+    // user tables and their binary fields
+    for (size_t t = 0; t < m_tables.size(); ++t)
+    {
+        const Table& table = m_tables[t];
+        if (table.rows.empty())
+            continue;
+
+        vector<unsigned> widths;
+        vector<size_t> keys;
+        for (size_t col = 0; col < table.columns.size(); ++col)
+        {
+            unsigned type = table.columns[col].type;
+            widths.push_back(isString(type) ? refWidth : (isBinary(type) || (type & 0xFF) == 2) ? 2 : 4);
+            if (type & colKey)
+                keys.push_back(col);
+        }
+
+        vector<size_t> order;
+        for (size_t i = 0; i < table.rows.size(); ++i) order.push_back(i);
+        stable_sort(order.begin(), order.end(), KeyLess(tableCells[t], keys));
+        storage.addStream(encodeStreamName(widen(table.name), true), tableStream(tableCells[t], order, widths));
+
+        // MSDN: "Binary data is stored with an index name created by 
+        //        concatenating the table name and the values of the 
+        //        record's primary keys using a period delimiter."
+        for (size_t r = 0; r < table.rows.size(); ++r)
+        {
+            for (size_t col = 0; col < table.columns.size(); ++col)
+            {
+                if (!isBinary(table.columns[col].type) || !table.rows[r][col].stream)
+                    continue;
+
+                string name = table.name;
+                for (size_t k = 0; k < keys.size(); ++k)
+                    name += '.' + fieldText(table.rows[r][keys[k]], table.columns[keys[k]].type);
+
+                storage.addStream(encodeStreamName(widen(name)), table.rows[r][col].stream);
+            }
+        }
+    }
+
+    // '_Streams'
+    for (StreamMap::const_iterator it = m_streams.begin(); it != m_streams.end(); ++it)
+    {
+        storage.addStream(encodeStreamName(widen(it->first)), it->second);
+    }
+
+    // string pool: codepage, then length and reference count of each string
+    string poolData, stringData;
+    put32(poolData, m_codepage | (refWidth == 3 ? 0x80000000 : 0));
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+        const string& s = pool.str(i);
+        if (s.size() > 0xFFFF)
+        {
+            // long strings take two entries, the first holding the high word of the length
+            put16(poolData, 0);
+            put16(poolData, static_cast<unsigned long>(s.size() >> 16));
+        }
+        put16(poolData, s.size() & 0xFFFF);
+        put16(poolData, (std::min)(pool.refs(i), static_cast<unsigned long>(MAX_REFCOUNT)));
+        stringData += s;
+    }
+
+    storage.addStream(encodeStreamName(L"_StringPool", true), poolData);
+    storage.addStream(encodeStreamName(L"_StringData", true), stringData);
+
+    if (!m_summary.empty())
+        storage.addStream(L"\005SummaryInformation", summaryInformation());
+}
+
+//------------------------------------------------------------------------------
+// Serialize summary information property set (MS-OLEPS, section 2.21)
+//------------------------------------------------------------------------------
+string MsiWriter::summaryInformation() const
+{
+    // property identifiers and offsets, followed by the properties
+    string index, props;
+    size_t offset = 8 + 8 * m_summary.size();
+    for (PropertyMap::const_iterator it = m_summary.begin(); it != m_summary.end(); ++it)
+    {
+        put32(index, it->first);
+        put32(index, static_cast<unsigned long>(offset + props.size()));
+        put32(props, it->second.type);
+
+        switch (it->second.type)
+        {
+        case propI2:
+            put16(props, it->second.value & 0xFFFF);
+            put16(props, 0);
+            break;
+
+        case propI4:
+            put32(props, it->second.value & 0xFFFFFFFF);
+            break;
+
+        case propString:
+            put32(props, static_cast<unsigned long>(it->second.text.size() + 1));
+            props += it->second.text;
+            props.append(4 - it->second.text.size() % 4, '\0');
+            break;
+
+        case propFileTime:
+            put32(props, it->second.value & 0xFFFFFFFF);
+            put32(props, (it->second.value >> 32) & 0xFFFFFFFF);
+            break;
+        }
+    }
+
+    string data;
+    put16(data, 0xFFFE);                        // byte order
+    put16(data, 0);                             // version
+    put32(data, 0x00020005);                    // Win32, OS version 5
+    data.append(16, '\0');                      // class id
+    put32(data, 1);                             // property sets
+    data.append(reinterpret_cast<const char*>(FMTID_SummaryInformation), 16);
+    put32(data, 48);                            // section offset
+
+    put32(data, static_cast<unsigned long>(offset + props.size()));
+    put32(data, static_cast<unsigned long>(m_summary.size()));
+    return data + index + props;
+}
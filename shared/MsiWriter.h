@@ -0,0 +1,157 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Native MSI database writer
+//
+// Builds a Windows Installer database without msi.dll. Tables are kept in
+// memory until write() serializes them the way Windows Installer stores
+// them: every table is a stream holding its columns one after the other
+// (rows sorted by primary key), strings are references into a shared
+// string pool ('_StringPool' and '_StringData'), and the table and
+// column definitions are stored in the '_Tables' and '_Columns' tables.
+// Binary fields become separate streams named after the table and the
+// primary key of their row. The streams are written to a compound file
+// (see CompoundFile).
+//
+// Strings are passed as bytes in the codepage of the database. Table
+// names, column names and the primary keys of rows with binary fields
+// must be ASCII, as they form stream names.
+//
+//------------------------------------------------------------------------------
+#ifndef MSI_WRITER_H_INCLUDED
+#define MSI_WRITER_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+class CompoundFile;
+class ScratchFile;
+
+class MsiWriter
+{
+public:
+    // column definition
+    struct Column
+    {
+        std::string     name;           // column name
+        unsigned        type;           // column type as stored in '_Columns' (see columnType())
+    };
+
+    // field value (integer columns use value, string columns text, binary columns stream)
+    struct Field
+    {
+        Field() : null(true), value(0) {}
+
+        bool            null;           // field is NULL
+        long            value;          // integer value
+        std::string     text;           // string value (empty: NULL)
+        std::shared_ptr<ScratchFile> stream; // binary data
+    };
+
+    typedef std::vector<Field> Row;
+
+    // summary information property types
+    enum PropertyType
+    {
+        propI2          = 2,            // VT_I2
+        propI4          = 3,            // VT_I4
+        propString      = 30,           // VT_LPSTR
+        propFileTime    = 64            // VT_FILETIME
+    };
+
+    // constructor
+    MsiWriter();
+
+    // column type of a column definition such as "s72", "I2", "L0" or "v0" (throws runtime_error)
+    static unsigned     columnType(const std::string& def, bool key);
+
+    // set the codepage of the string pool
+    void                setCodepage(unsigned codepage);
+
+    // create a table (throws runtime_error if it exists)
+    void                createTable(const std::string& name, const std::vector<Column>& columns);
+
+    // insert a row (throws runtime_error on a duplicate primary key)
+    void                insertRow(const std::string& table, const Row& row);
+
+    // add a stream to the storage, i.e. a row of the '_Streams' table
+    void                addStream(const std::string& name, const std::shared_ptr<ScratchFile>& data);
+
+    // set an integer summary information property
+    void                setSummaryInteger(unsigned id, PropertyType type, long value);
+
+    // set a string summary information property
+    void                setSummaryString(unsigned id, const std::string& value);
+
+    // set a date summary information property (FILETIME, UTC)
+    void                setSummaryTime(unsigned id, unsigned long long fileTime);
+
+    // write the database (throws runtime_error)
+    void                write(const std::string& path) const;
+#ifdef _WIN32
+    void                write(const std::wstring& path) const;
+#endif
+
+private:
+    struct Table
+    {
+        std::string             name;       // table name
+        std::vector<Column>     columns;    // column definitions
+        std::vector<Row>        rows;       // rows in insertion order
+        std::set<std::string>   keys;       // primary keys of all rows
+    };
+
+    struct Property
+    {
+        PropertyType            type;       // property type
+        unsigned long long      value;      // integer value or FILETIME
+        std::string             text;       // string value
+    };
+
+    typedef std::map<std::string, std::shared_ptr<ScratchFile> > StreamMap;
+    typedef std::map<unsigned, Property> PropertyMap;
+
+    // add the tables, string pool and summary information to a storage
+    void                buildStorage(CompoundFile& storage) const;
+
+    // serialize the summary information property set
+    std::string         summaryInformation() const;
+
+    unsigned            m_codepage;     // string pool codepage
+    std::vector<Table>  m_tables;       // tables in creation order
+    std::map<std::string, size_t> m_tableIndex; // table name => index into m_tables
+    StreamMap           m_streams;      // '_Streams' rows
+    PropertyMap         m_summary;      // summary information properties
+};
+
+#endif // MSI_WRITER_H_INCLUDED
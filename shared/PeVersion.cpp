@@ -0,0 +1,390 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "PeVersion.h"
+#include <sstream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const unsigned      RT_VERSION_ID       = 16;           // resource type of version resources
+    const unsigned      RESOURCE_DIRECTORY  = 2;            // index of the resource data directory
+    const unsigned long FIXED_SIGNATURE     = 0xFEEF04BDUL; // VS_FIXEDFILEINFO::dwSignature
+    const size_t        FIXED_SIZE          = 52;           // sizeof(VS_FIXEDFILEINFO)
+
+    //--------------------------------------------------------------------------
+    // read-only mapping of a whole file (empty if it cannot be mapped)
+    class MappedFile
+    {
+    public:
+        explicit MappedFile(const tstring& path) :
+            m_data(0),
+            m_size(0)
+        {
+#ifdef _WIN32
+            HANDLE file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, 
+                                     NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+            if (file == INVALID_HANDLE_VALUE)
+                return;
+
+            LARGE_INTEGER size;
+            if (GetFileSizeEx(file, &size) && size.QuadPart > 0 
+                && static_cast<unsigned long long>(size.QuadPart) <= static_cast<size_t>(-1))
+            {
+                // the view keeps the mapping alive
+                HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+                if (mapping != NULL)
+                {
+                    m_data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+                    m_size = m_data != 0 ? static_cast<size_t>(size.QuadPart) : 0;
+                    CloseHandle(mapping);
+                }
+            }
+            CloseHandle(file);
+#else
+            int fd = open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                return;
+
+            struct stat st;
+            if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0
+                && static_cast<unsigned long long>(st.st_size) <= static_cast<size_t>(-1))
+            {
+                void* data = mmap(0, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED)
+                {
+                    m_data = static_cast<const unsigned char*>(data);
+                    m_size = static_cast<size_t>(st.st_size);
+                }
+            }
+            close(fd);
+#endif
+        }
+
+        ~MappedFile()
+        {
+            if (m_data == 0)
+                return;
+#ifdef _WIN32
+            UnmapViewOfFile(m_data);
+#else
+            munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+        }
+
+        // true if len bytes at offset are inside the file
+        bool contains(size_t offset, size_t len) const
+        {
+            return offset <= m_size && len <= m_size - offset;
+        }
+
+        // little-endian fields (0 beyond the end of the file)
+        unsigned u16(size_t offset) const
+        {
+            return contains(offset, 2) ? m_data[offset] | (m_data[offset + 1] << 8) : 0;
+        }
+
+        unsigned long u32(size_t offset) const
+        {
+            return u16(offset) | (static_cast<unsigned long>(u16(offset + 2)) << 16);
+        }
+
+    private:
+        MappedFile(const MappedFile&);
+        MappedFile& operator=(const MappedFile&);
+
+        const unsigned char* m_data;
+        size_t              m_size;
+    };
+
+    //--------------------------------------------------------------------------
+    // section table of a PE image
+    class Sections
+    {
+    public:
+        Sections(const MappedFile& file, size_t offset, unsigned count) :
+            m_file(file),
+            m_offset(offset),
+            m_count(count)
+        {
+        }
+
+        // file offset of len bytes at a relative virtual address (false if not in a section)
+        bool toOffset(unsigned long rva, size_t len, size_t& offset) const
+        {
+            for (unsigned i = 0; i < m_count; ++i)
+            {
+                size_t header = m_offset + i * 40;
+                unsigned long address = m_file.u32(header + 12);
+                unsigned long rawSize = m_file.u32(header + 16);
+                unsigned long rawOffset = m_file.u32(header + 20);
+
+                if (rva >= address && rva - address < rawSize && len <= rawSize - (rva - address))
+                {
+                    offset = rawOffset + (rva - address);
+                    return m_file.contains(offset, len);
+                }
+            }
+            return false;
+        }
+
+    private:
+        const MappedFile&   m_file;
+        size_t              m_offset;       // offset of the first section header
+        unsigned            m_count;        // number of sections
+    };
+
+    //--------------------------------------------------------------------------
+    // Find an entry of a resource directory: the entry with the given ID, or
+    // the first entry if id is 0. Returns the offset of the subdirectory or
+    // data entry relative to the resource section, and the ID of the entry.
+    //--------------------------------------------------------------------------
+    bool findResource(const MappedFile& file, const Sections& sections, unsigned long root, 
+                      unsigned long directory, unsigned id, unsigned long& data, unsigned& entryId)
+    {
+        size_t offset;
+        if (!sections.toOffset(root + directory, 16, offset))
+            return false;
+
+        unsigned named = file.u16(offset + 12);
+        unsigned ids = file.u16(offset + 14);
+        size_t entries;
+        if (!sections.toOffset(root + directory + 16, (named + ids) * 8, entries))
+            return false;
+
+        // named entries come first, but version resources have numeric IDs
+        for (unsigned i = id != 0 ? named : 0; i < named + ids; ++i)
+        {
+            unsigned long name = file.u32(entries + i * 8);
+            if (id == 0 || name == id)
+            {
+                data = file.u32(entries + i * 8 + 4);
+                entryId = static_cast<unsigned>(name & 0xFFFF);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //--------------------------------------------------------------------------
+    // block of a version resource (VS_VERSIONINFO, StringFileInfo, Var...)
+    struct Block
+    {
+        size_t          key;            // offset of the UTF-16 key
+        size_t          value;          // offset of the value
+        size_t          valueLength;    // length of the value in bytes
+        size_t          children;       // offset of the first child
+        size_t          end;            // end of the block
+    };
+
+    //--------------------------------------------------------------------------
+    // offset rounded up to a DWORD boundary of the resource at base
+    size_t align(size_t offset, size_t base)
+    {
+        return base + ((offset - base + 3) & ~static_cast<size_t>(3));
+    }
+
+    //--------------------------------------------------------------------------
+    // read the header of the block at offset, within limit
+    bool readBlock(const MappedFile& file, size_t base, size_t offset, size_t limit, Block& block)
+    {
+        size_t length = file.u16(offset);
+        if (length < 6 || offset > limit || length > limit - offset)
+            return false;
+
+        block.end = offset + length;
+        block.key = offset + 6;
+
+        size_t keyEnd = block.key;
+        while (keyEnd + 2 <= block.end && file.u16(keyEnd) != 0)
+            keyEnd += 2;
+        if (keyEnd + 2 > block.end)
+            return false;
+
+        // the length of text values is given in characters
+        block.valueLength = file.u16(offset + 2) * (file.u16(offset + 4) == 1 ? 2 : 1);
+        block.value = align(keyEnd + 2, base);
+        block.children = align(block.value + block.valueLength, base);
+        return block.value + block.valueLength <= block.end;
+    }
+
+    //--------------------------------------------------------------------------
+    // compare the key of a block with an ASCII string
+    bool keyIs(const MappedFile& file, const Block& block, const char* key)
+    {
+        size_t offset = block.key;
+        for (; *key != '\0'; ++key, offset += 2)
+        {
+            if (file.u16(offset) != static_cast<unsigned char>(*key))
+                return false;
+        }
+        return file.u16(offset) == 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+//
+// Read the version resource of a PE file
+//
+// The DOS header points to the PE signature, which is followed by the COFF
+// header and the optional header with the data directories, whose layout
+// depends on whether the image is PE32 or PE32+. The resource directory is
+// a three level tree (type, name, language); the version resource is the
+// first name and language of type RT_VERSION. Its root block holds the
+// VS_FIXEDFILEINFO, the "VarFileInfo" child block the translations.
+//
+//------------------------------------------------------------------------------
+bool readPeVersion(const tstring& path, PeVersion& version)
+{
+    MappedFile file(path);
+    if (!file.contains(0, 64) || file.u16(0) != 0x5A4D)           // "MZ"
+        return false;
+
+    size_t pe = file.u32(0x3C);
+    if (!file.contains(pe, 24) || file.u32(pe) != 0x00004550)     // "PE\0\0"
+        return false;
+
+    unsigned sectionCount = file.u16(pe + 6);
+    size_t optional = pe + 24;
+    size_t optionalSize = file.u16(pe + 20);
+
+    // data directories of PE32 and PE32+ images
+    size_t directories;
+    size_t directoryCount;
+    switch (file.u16(optional))
+    {
+    case 0x10B:
+        directories = optional + 96;
+        directoryCount = file.u32(optional + 92);
+        break;
+
+    case 0x20B:
+        directories = optional + 112;
+        directoryCount = file.u32(optional + 108);
+        break;
+
+    default:
+        return false;
+    }
+
+    if (directoryCount <= RESOURCE_DIRECTORY || directories + (RESOURCE_DIRECTORY + 1) * 8 > optional + optionalSize)
+        return false;
+
+    Sections sections(file, optional + optionalSize, sectionCount);
+    if (!file.contains(optional + optionalSize, sectionCount * 40))
+        return false;
+
+    unsigned long root = file.u32(directories + RESOURCE_DIRECTORY * 8);
+    if (root == 0)
+        return false;
+
+    // type, name and language
+    unsigned long entry;
+    unsigned id, language;
+    if (!findResource(file, sections, root, 0, RT_VERSION_ID, entry, id) || !(entry & 0x80000000UL)
+        || !findResource(file, sections, root, entry & 0x7FFFFFFFUL, 0, entry, id) || !(entry & 0x80000000UL)
+        || !findResource(file, sections, root, entry & 0x7FFFFFFFUL, 0, entry, language) || (entry & 0x80000000UL))
+    {
+        return false;
+    }
+
+    // data entry
+    size_t dataEntry;
+    if (!sections.toOffset(root + entry, 16, dataEntry))
+        return false;
+
+    unsigned long dataSize = file.u32(dataEntry + 4);
+    size_t base;
+    if (!sections.toOffset(file.u32(dataEntry), dataSize, base))
+        return false;
+
+    // VS_VERSIONINFO
+    Block info;
+    if (!readBlock(file, base, base, base + dataSize, info) || !keyIs(file, info, "VS_VERSION_INFO")
+        || info.valueLength < FIXED_SIZE || file.u32(info.value) != FIXED_SIGNATURE)
+    {
+        return false;
+    }
+
+    unsigned long fileMS = file.u32(info.value + 8);
+    unsigned long fileLS = file.u32(info.value + 12);
+    unsigned long productMS = file.u32(info.value + 16);
+    unsigned long productLS = file.u32(info.value + 20);
+
+    version.fileVersion[0] = static_cast<unsigned short>(fileMS >> 16);
+    version.fileVersion[1] = static_cast<unsigned short>(fileMS & 0xFFFF);
+    version.fileVersion[2] = static_cast<unsigned short>(fileLS >> 16);
+    version.fileVersion[3] = static_cast<unsigned short>(fileLS & 0xFFFF);
+    version.productVersion[0] = static_cast<unsigned short>(productMS >> 16);
+    version.productVersion[1] = static_cast<unsigned short>(productMS & 0xFFFF);
+    version.productVersion[2] = static_cast<unsigned short>(productLS >> 16);
+    version.productVersion[3] = static_cast<unsigned short>(productLS & 0xFFFF);
+
+    // first translation, or the language of the resource
+    version.language = language;
+    version.codepage = 0;
+
+    Block child;
+    for (size_t offset = info.children; readBlock(file, base, offset, info.end, child); offset = align(child.end, base))
+    {
+        if (!keyIs(file, child, "VarFileInfo"))
+            continue;
+
+        Block var;
+        for (size_t varOffset = child.children; readBlock(file, base, varOffset, child.end, var); varOffset = align(var.end, base))
+        {
+            if (keyIs(file, var, "Translation") && var.valueLength >= 4)
+            {
+                version.language = file.u16(var.value);
+                version.codepage = file.u16(var.value + 2);
+                break;
+            }
+        }
+        break;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+string formatVersion(const unsigned short version[4])
+{
+    ostringstream oss;
+    oss << version[0] << "." << version[1] << "." << version[2] << "." << version[3];
+    return oss.str();
+}
@@ -0,0 +1,62 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Version resource of a PE file
+//
+// Reads the VS_FIXEDFILEINFO of a PE32 or PE32+ image without the Windows
+// loader (GetFileVersionInfo). The file is mapped into memory, and the
+// parser follows the headers, the section table and the resource
+// directory straight to the RT_VERSION resource, so that only the few
+// pages on that path are actually read. It works the same on Windows and
+// POSIX systems.
+//
+//------------------------------------------------------------------------------
+#ifndef PE_VERSION_H_INCLUDED
+#define PE_VERSION_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "tstring.h"
+#include <string>
+
+struct PeVersion
+{
+    unsigned short      fileVersion[4];     // file version (major, minor, build, revision)
+    unsigned short      productVersion[4];  // product version
+    unsigned            language;           // language ID of the first translation (0: none)
+    unsigned            codepage;           // codepage of the first translation
+};
+
+// read the version resource of a PE file (returns false if the file cannot be
+// read, is not a PE image or has no version resource)
+bool readPeVersion(const tstring& path, PeVersion& version);
+
+// version as "major.minor.build.revision"
+std::string formatVersion(const unsigned short version[4]);
+
+#endif // PE_VERSION_H_INCLUDED
@@ -0,0 +1,237 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "ScratchFile.h"
+#include <string.h>
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const size_t        MIN_RESERVE         = 1 << 20;
+
+    std::atomic<unsigned long long> usedMemory(0);
+    std::atomic<unsigned long long> memoryBudget(512ull << 20);
+
+    //--------------------------------------------------------------------------
+    // take bytes from the memory budget
+    bool acquire(unsigned long long bytes)
+    {
+        unsigned long long used = usedMemory.load();
+        do
+        {
+            if (used + bytes > memoryBudget.load())
+                return false;
+        }
+        while (!usedMemory.compare_exchange_weak(used, used + bytes));
+
+        return true;
+    }
+
+    //--------------------------------------------------------------------------
+    // set the position of a file (64 bit, also where long is 32 bit)
+    int seekFile(FILE* file, long long offset, int origin)
+    {
+#ifdef _MSC_VER
+        return _fseeki64(file, static_cast<__int64>(offset), origin);
+#else
+        return fseeko(file, static_cast<off_t>(offset), origin);
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+    // position of a file (64 bit, also where long is 32 bit)
+    long long tellFile(FILE* file)
+    {
+#ifdef _MSC_VER
+        return _ftelli64(file);
+#else
+        return ftello(file);
+#endif
+    }
+}
+
+//------------------------------------------------------------------------------
+ScratchFile::ScratchFile() :
+    m_reserved(0),
+    m_size(0),
+    m_pos(0),
+    m_file(NULL)
+{
+}
+
+//------------------------------------------------------------------------------
+ScratchFile::~ScratchFile()
+{
+    truncate();
+}
+
+//------------------------------------------------------------------------------
+void ScratchFile::setMemoryLimit(unsigned long long limit)
+{
+    memoryBudget = limit;
+}
+
+//------------------------------------------------------------------------------
+unsigned long long ScratchFile::memoryLimit()
+{
+    return memoryBudget;
+}
+
+//------------------------------------------------------------------------------
+size_t ScratchFile::write(const void* data, size_t len)
+{
+    if (m_file == NULL)
+    {
+        size_t end = m_pos + len;
+        if (end > m_size && !reserve(end) && !spill())
+            return 0;
+    }
+
+    if (m_file != NULL)
+    {
+        size_t n = fwrite(data, 1, len, m_file);
+        long long pos = tellFile(m_file);
+        if (pos >= 0)
+            m_size = (std::max)(m_size, static_cast<size_t>(pos));
+        return n;
+    }
+
+    if (m_pos + len > m_size)
+    {
+        m_size = m_pos + len;
+        m_data.resize(m_size);
+    }
+
+    if (len > 0)
+        memcpy(&m_data[m_pos], data, len);
+    m_pos += len;
+    return len;
+}
+
+//------------------------------------------------------------------------------
+size_t ScratchFile::read(void* data, size_t len)
+{
+    if (m_file != NULL)
+        return fread(data, 1, len, m_file);
+
+    size_t n = m_pos < m_size ? (std::min)(len, m_size - m_pos) : 0;
+    if (n > 0)
+        memcpy(data, &m_data[m_pos], n);
+    m_pos += n;
+    return n;
+}
+
+//------------------------------------------------------------------------------
+long long ScratchFile::seek(long long offset, int origin)
+{
+    if (m_file != NULL)
+        return seekFile(m_file, offset, origin) == 0 ? tellFile(m_file) : -1;
+
+    long long base = 0;
+    switch (origin)
+    {
+    case SEEK_SET:  base = 0; break;
+    case SEEK_CUR:  base = static_cast<long long>(m_pos); break;
+    case SEEK_END:  base = static_cast<long long>(m_size); break;
+    default:        return -1;
+    }
+
+    if (base + offset < 0)
+        return -1;
+
+    m_pos = static_cast<size_t>(base + offset);
+    return static_cast<long long>(m_pos);
+}
+
+//------------------------------------------------------------------------------
+bool ScratchFile::preallocate(size_t size)
+{
+    if (m_file != NULL)
+        return true;
+
+    return reserve(size) || spill();
+}
+
+//------------------------------------------------------------------------------
+void ScratchFile::truncate()
+{
+    if (m_file != NULL)
+    {
+        fclose(m_file);
+        m_file = NULL;
+    }
+
+    vector<unsigned char>().swap(m_data);
+    usedMemory -= m_reserved;
+    m_reserved = 0;
+    m_size = 0;
+    m_pos = 0;
+}
+
+//------------------------------------------------------------------------------
+bool ScratchFile::reserve(size_t size)
+{
+    if (size <= m_reserved)
+        return true;
+
+    // grow geometrically, but settle for the exact size near the limit
+    size_t want = (std::max)(size, (std::max)(2 * m_reserved, MIN_RESERVE));
+    if (!acquire(want - m_reserved))
+    {
+        want = size;
+        if (!acquire(want - m_reserved))
+            return false;
+    }
+
+    m_reserved = want;
+    m_data.reserve(m_reserved);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+bool ScratchFile::spill()
+{
+    m_file = tmpfile();
+    if (m_file == NULL)
+        return false;
+
+    if ((m_size > 0 && fwrite(&m_data[0], 1, m_size, m_file) != m_size)
+        || seekFile(m_file, static_cast<long long>(m_pos), SEEK_SET) != 0)
+    {
+        fclose(m_file);
+        m_file = NULL;
+        return false;
+    }
+
+    vector<unsigned char>().swap(m_data);
+    usedMemory -= m_reserved;
+    m_reserved = 0;
+    return true;
+}
@@ -0,0 +1,103 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Scratch file
+//
+// ScratchFile is a temporary file that is kept in memory. All scratch
+// files of the process share one memory budget (setMemoryLimit()). When a
+// scratch file would exceed the budget, its contents are moved to a real
+// temporary file and it continues on disk ("spill").
+//
+// A scratch file has a single read/write position, like a FILE opened
+// with "w+b". It is not thread safe, but different scratch files may be
+// used concurrently.
+//
+//------------------------------------------------------------------------------
+#ifndef SCRATCH_FILE_H_INCLUDED
+#define SCRATCH_FILE_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <stdio.h>
+#include <vector>
+
+class ScratchFile
+{
+public:
+    // constructor
+    ScratchFile();
+
+    // destructor
+    ~ScratchFile();
+
+    // write at the current position (returns the number of bytes written)
+    size_t              write(const void* data, size_t len);
+
+    // read from the current position (returns the number of bytes read)
+    size_t              read(void* data, size_t len);
+
+    // set the current position (origin: SEEK_SET, SEEK_CUR or SEEK_END; returns -1 on failure)
+    long long           seek(long long offset, int origin);
+
+    // expect size bytes of contents: take them from the memory budget at once, or
+    // continue on disk right away if they exceed it (returns false on failure)
+    bool                preallocate(size_t size);
+
+    // discard the contents
+    void                truncate();
+
+    // size of the contents
+    size_t              size() const        { return m_size; }
+
+    // contents were moved to disk
+    bool                spilled() const     { return m_file != NULL; }
+
+    // set memory budget shared by all scratch files in bytes (0: always use disk)
+    static void         setMemoryLimit(unsigned long long limit);
+
+    // memory budget shared by all scratch files in bytes
+    static unsigned long long memoryLimit();
+
+private:
+    ScratchFile(const ScratchFile&);
+    ScratchFile& operator=(const ScratchFile&);
+
+    // make room for size bytes in memory (returns false if over budget)
+    bool                reserve(size_t size);
+
+    // move contents to a temporary file
+    bool                spill();
+
+    std::vector<unsigned char> m_data;  // contents (in memory)
+    size_t              m_reserved;     // bytes taken from the memory budget
+    size_t              m_size;         // size of contents
+    size_t              m_pos;          // current position
+    FILE*               m_file;         // contents (on disk)
+};
+
+#endif // SCRATCH_FILE_H_INCLUDED
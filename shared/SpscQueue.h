@@ -0,0 +1,144 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Bounded single-producer/single-consumer queue
+//
+// SpscQueue hands items from one producer thread to one consumer thread
+// through a ring buffer of fixed capacity. The head and tail indices are
+// atomics, so push() and pop() do not take a lock while the queue is
+// neither full nor empty. A full queue blocks the producer (backpressure),
+// an empty one the consumer; only then does a thread sleep on a condition
+// variable, and only then does the other thread take the lock to wake it.
+//
+// close() ends the queue: push() fails from then on, while pop() still
+// returns the items already queued. The consumer closes the queue as well
+// if it gives up, so that a blocked producer is released.
+//
+//------------------------------------------------------------------------------
+#ifndef SPSC_QUEUE_H_INCLUDED
+#define SPSC_QUEUE_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <utility>
+
+template <class T>
+class SpscQueue
+{
+public:
+    // constructor
+    explicit SpscQueue(size_t capacity) :
+        m_slots(capacity + 1),
+        m_head(0),
+        m_tail(0),
+        m_closed(false),
+        m_waiting(0)
+    {
+    }
+
+    // append an item, waiting while the queue is full (false: the queue is closed)
+    bool                push(T item)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % m_slots.size();
+        await([&]() { return m_closed || m_head != next; });
+        if (m_closed)
+            return false;
+
+        m_slots[tail] = std::move(item);
+        m_tail = next;
+        wake();
+        return true;
+    }
+
+    // remove the oldest item, waiting while the queue is empty (false: closed and drained)
+    bool                pop(T& item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        await([&]() { return m_closed || m_tail != head; });
+        if (m_tail == head)
+            return false;
+
+        item = std::move(m_slots[head]);
+        m_slots[head] = T();
+        m_head = (head + 1) % m_slots.size();
+        wake();
+        return true;
+    }
+
+    // no more items will be pushed (releases both threads)
+    void                close()
+    {
+        m_closed = true;
+        wake();
+    }
+
+private:
+    SpscQueue(const SpscQueue&);
+    SpscQueue& operator=(const SpscQueue&);
+
+    // wait until ready() holds
+    template <class Pred>
+    void                await(Pred ready)
+    {
+        if (ready())
+            return;
+
+        // the waiting count is raised before ready() is checked again, so 
+        // wake() either sees it or the index it stored is seen here
+        std::unique_lock<std::mutex> lock(m_lock);
+        ++m_waiting;
+        while (!ready()) 
+            m_signal.wait(lock);
+        --m_waiting;
+    }
+
+    // wake the other thread, if it waits
+    void                wake()
+    {
+        if (m_waiting > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_signal.notify_all();
+        }
+    }
+
+    std::vector<T>          m_slots;    // ring buffer (one slot is kept free)
+    std::atomic<size_t>     m_head;     // next slot to pop
+    std::atomic<size_t>     m_tail;     // next slot to push
+    std::atomic<bool>       m_closed;   // no more items
+    std::atomic<int>        m_waiting;  // threads waiting in await()
+    std::mutex              m_lock;
+    std::condition_variable m_signal;
+};
+
+#endif // SPSC_QUEUE_H_INCLUDED
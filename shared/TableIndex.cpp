@@ -0,0 +1,369 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "TableIndex.h"
+#include "Codepage.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const size_t        BUFFER_SIZE         = 1 << 16;
+
+    //--------------------------------------------------------------------------
+    bool isSpace(int c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    //--------------------------------------------------------------------------
+    // buffered input that keeps track of offset, line and column
+    class Scanner
+    {
+    public:
+        // (path for messages)
+        Scanner(FILE* file, const string& path) :
+            m_file(file),
+            m_path(path),
+            m_buffer(BUFFER_SIZE),
+            m_pos(0),
+            m_end(0),
+            m_bufferOffset(0),
+            m_line(1),
+            m_column(1)
+        {
+            if (m_file == 0)
+                throw runtime_error("Cannot open \"" + path + "\"");
+        }
+
+        ~Scanner()
+        {
+            fclose(m_file);
+        }
+
+        // next character (-1 at the end of the file)
+        int peek()
+        {
+            if (m_pos == m_end)
+            {
+                m_bufferOffset += m_end;
+                m_pos = 0;
+                m_end = fread(&m_buffer[0], 1, m_buffer.size(), m_file);
+                if (m_end == 0)
+                    return -1;
+            }
+
+            return static_cast<unsigned char>(m_buffer[m_pos]);
+        }
+
+        int get()
+        {
+            int c = peek();
+            if (c < 0)
+                return c;
+
+            ++m_pos;
+            if (c == '\n')
+            {
+                ++m_line;
+                m_column = 1;
+            }
+            else if ((c & 0xC0) != 0x80)
+            {
+                ++m_column;
+            }
+
+            return c;
+        }
+
+        // consume str if it follows (str must not contain a line break)
+        bool match(const char* str)
+        {
+            size_t len = strlen(str);
+            if (m_end - m_pos < len)
+            {
+                m_bufferOffset += m_pos;
+                memmove(&m_buffer[0], &m_buffer[m_pos], m_end - m_pos);
+                m_end -= m_pos;
+                m_pos = 0;
+                m_end += fread(&m_buffer[m_end], 1, m_buffer.size() - m_end, m_file);
+                if (m_end < len)
+                    return false;
+            }
+
+            if (memcmp(&m_buffer[m_pos], str, len) != 0)
+                return false;
+
+            m_pos += len;
+            m_column += static_cast<unsigned>(len);
+            return true;
+        }
+
+        // skip up to and including str
+        void skipPast(const char* str)
+        {
+            while (!match(str))
+            {
+                if (get() < 0)
+                    throw error(string("Unexpected end of file, expected \"") + str + "\"");
+            }
+        }
+
+        unsigned long long offset() const { return m_bufferOffset + m_pos; }
+        unsigned line() const { return m_line; }
+        unsigned column() const { return m_column; }
+
+        runtime_error error(const string& message) const
+        {
+            char pos[64];
+            sprintf(pos, "(%u,%u): ", m_line, m_column);
+            return runtime_error(m_path + pos + message);
+        }
+
+    private:
+        FILE*               m_file;
+        string              m_path;
+        vector<char>        m_buffer;
+        size_t              m_pos;
+        size_t              m_end;
+        unsigned long long  m_bufferOffset;
+        unsigned            m_line;
+        unsigned            m_column;
+    };
+
+    //--------------------------------------------------------------------------
+    // skip a declaration such as <!DOCTYPE ...> (after "<!")
+    void skipDeclaration(Scanner& in)
+    {
+        int quote = 0;
+        bool subset = false;
+        for (;;)
+        {
+            int c = in.get();
+            if (c < 0)
+                throw in.error("Unexpected end of file in declaration");
+
+            if (quote)
+            {
+                if (c == quote) quote = 0;
+            }
+            else if (c == '"' || c == '\'')
+            {
+                quote = c;
+            }
+            else if (c == '[')
+            {
+                subset = true;
+            }
+            else if (c == ']')
+            {
+                subset = false;
+            }
+            else if (c == '>' && !subset)
+            {
+                break;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // read a start tag (after '<'), returns true for an empty element
+    bool readStartTag(Scanner& in, string& element, string& name)
+    {
+        int c;
+        while ((c = in.peek()) >= 0 && !isSpace(c) && c != '/' && c != '>')
+            element += static_cast<char>(in.get());
+
+        for (;;)
+        {
+            while (isSpace(in.peek()))
+                in.get();
+
+            if (in.match("/>"))
+                return true;
+            if (in.match(">"))
+                return false;
+
+            string attribute;
+            while ((c = in.peek()) >= 0 && !isSpace(c) && c != '=' && c != '>')
+                attribute += static_cast<char>(in.get());
+            while (isSpace(in.peek()))
+                in.get();
+
+            if (in.get() != '=')
+                throw in.error("'=' expected after attribute \"" + attribute + "\"");
+            while (isSpace(in.peek()))
+                in.get();
+
+            int quote = in.get();
+            if (quote != '"' && quote != '\'')
+                throw in.error("Invalid attribute in <" + element + ">");
+
+            string value;
+            while ((c = in.get()) != quote)
+            {
+                if (c < 0)
+                    throw in.error("Unterminated value of attribute \"" + attribute + "\"");
+                value += static_cast<char>(c);
+            }
+
+            if (attribute == "name")
+                name = value;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Constructors
+//------------------------------------------------------------------------------
+TableIndex::TableIndex(const string& path)
+{
+    scan(fopen(path.c_str(), "rb"), path);
+}
+
+#ifdef _WIN32
+TableIndex::TableIndex(const wstring& path)
+{
+    scan(_wfopen(path.c_str(), L"rb"), Codepage::narrowPath(path));
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Scan a document
+//------------------------------------------------------------------------------
+void TableIndex::scan(FILE* file, const string& path)
+{
+    Scanner in(file, path);
+    size_t depth = 0;
+    Entry entry;
+
+    for (;;)
+    {
+        // character data, such as Base64 data, up to the next markup
+        int c;
+        while ((c = in.peek()) >= 0 && c != '<')
+            in.get();
+        if (c < 0)
+            break;
+
+        unsigned long long offset = in.offset();
+        unsigned line = in.line();
+        unsigned column = in.column();
+        in.get();
+
+        if (in.match("!--"))
+        {
+            in.skipPast("-->");
+        }
+        else if (in.match("![CDATA["))
+        {
+            in.skipPast("]]>");
+        }
+        else if (in.match("?"))
+        {
+            in.skipPast("?>");
+        }
+        else if (in.match("!"))
+        {
+            skipDeclaration(in);
+        }
+        else if (in.match("/"))
+        {
+            in.skipPast(">");
+            if (depth == 0)
+                throw in.error("End tag without start tag");
+
+            if (--depth == 1)
+            {
+                entry.endOffset = offset;
+                entry.endLine = line;
+                entry.endColumn = column;
+                m_entries.push_back(entry);
+            }
+        }
+        else
+        {
+            string element, name;
+            bool empty = readStartTag(in, element, name);
+
+            if (depth == 1)
+            {
+                entry.element = element;
+                entry.name = name;
+                entry.offset = offset;
+                entry.contentOffset = in.offset();
+                entry.empty = empty;
+                if (empty)
+                {
+                    entry.endOffset = entry.contentOffset;
+                    entry.endLine = in.line();
+                    entry.endColumn = in.column();
+                    m_entries.push_back(entry);
+                }
+            }
+
+            if (!empty)
+                ++depth;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Child starting at offset
+//------------------------------------------------------------------------------
+const TableIndex::Entry* TableIndex::entryAt(unsigned long long offset) const
+{
+    // entries are in document order
+    size_t lo = 0, hi = m_entries.size();
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (m_entries[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo < m_entries.size() && m_entries[lo].offset == offset ? &m_entries[lo] : 0;
+}
+
+//------------------------------------------------------------------------------
+// Table by name
+//------------------------------------------------------------------------------
+const TableIndex::Entry* TableIndex::table(const string& name) const
+{
+    for (Entries::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        if (it->element == "table" && it->name == name)
+            return &*it;
+    }
+
+    return 0;
+}
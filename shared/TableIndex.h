@@ -0,0 +1,92 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Table index of an XML document
+//
+// A first, cheap scan of a document written by msi2xml. The markup is
+// located without decoding character data, references or attribute
+// values, so the scan costs little more than reading the file. For each
+// child of the root element, such as the 'summary' element and the tables,
+// the index records where its content begins and ends, so that a parser
+// can skip the tables an operation does not touch (see XmlReader::skipTo)
+// instead of parsing megabytes of Base64 data.
+//
+// The scan does not check that the document is well-formed; the parser
+// does that for the parts it reads.
+//
+//------------------------------------------------------------------------------
+#ifndef TABLE_INDEX_H_INCLUDED
+#define TABLE_INDEX_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class TableIndex
+{
+public:
+    // child of the root element
+    struct Entry
+    {
+        std::string         element;        // element name ("table", "summary")
+        std::string         name;           // "name" attribute (tables)
+        unsigned long long  offset;         // start of the start tag
+        unsigned long long  contentOffset;  // end of the start tag
+        unsigned long long  endOffset;      // start of the end tag (contentOffset if empty)
+        unsigned            endLine;        // line of the end tag
+        unsigned            endColumn;      // column of the end tag
+        bool                empty;          // empty element ("<table/>")
+    };
+
+    typedef std::vector<Entry> Entries;
+
+    // scan a document (throws runtime_error)
+    explicit TableIndex(const std::string& path);
+#ifdef _WIN32
+    explicit TableIndex(const std::wstring& path);
+#endif
+
+    // children of the root element, in document order
+    const Entries&      entries() const { return m_entries; }
+
+    // child starting at offset (NULL if none)
+    const Entry*        entryAt(unsigned long long offset) const;
+
+    // table by name (NULL if absent)
+    const Entry*        table(const std::string& name) const;
+
+private:
+    // scan an opened document (path for messages)
+    void                scan(FILE* file, const std::string& path);
+
+    Entries             m_entries;      // children of the root element
+};
+
+#endif // TABLE_INDEX_H_INCLUDED
@@ -0,0 +1,128 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Thread pool
+//
+// ThreadPool runs independent work items on a fixed number of worker
+// threads. forEach() calls the supplied function object once for every
+// index in [0, count) and returns when all items are done. The calling
+// thread takes part in the work, so a pool with one job runs everything
+// inline, in index order.
+//
+// If a work item throws, no further items are started and the first
+// exception is rethrown on the calling thread once all workers have
+// stopped. Work items must not touch COM objects owned by the caller
+// (e.g. the MSXML document), nor write to the console.
+//
+//------------------------------------------------------------------------------
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+class ThreadPool
+{
+public:
+    // constructor (0 jobs = one per logical processor)
+    explicit ThreadPool(unsigned jobs = 0) :
+        m_jobs(jobs == 0 ? processorCount() : jobs)
+    {
+    }
+
+    // number of worker threads
+    unsigned            jobs() const { return m_jobs; }
+
+    // call fn(index) for each index in [0, count)
+    template <class Fn>
+    void                forEach(size_t count, Fn fn) const
+    {
+        size_t threads = (std::min)(static_cast<size_t>(m_jobs), count);
+        if (threads <= 1)
+        {
+            for (size_t i = 0; i < count; ++i) fn(i);
+            return;
+        }
+
+        std::atomic<size_t> next(0);
+        std::atomic<bool>   abort(false);
+        std::exception_ptr  error;
+        std::mutex          errorLock;
+
+        auto worker = [&]()
+        {
+            for (size_t i = next++; i < count && !abort; i = next++)
+            {
+                try
+                {
+                    fn(i);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(errorLock);
+                    if (!error) error = std::current_exception();
+                    abort = true;
+                }
+            }
+        };
+
+        std::vector<std::thread> pool;
+        pool.reserve(threads - 1);
+        for (size_t t = 1; t < threads; ++t)
+        {
+            pool.push_back(std::thread(worker));
+        }
+
+        worker();
+
+        for (size_t t = 0; t < pool.size(); ++t)
+        {
+            pool[t].join();
+        }
+
+        if (error) std::rethrow_exception(error);
+    }
+
+    // number of logical processors
+    static unsigned     processorCount()
+    {
+        unsigned count = std::thread::hardware_concurrency();
+        return count == 0 ? 1 : count;
+    }
+
+private:
+    unsigned            m_jobs;
+};
+
+#endif // THREAD_POOL_H_INCLUDED
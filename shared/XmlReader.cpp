@@ -0,0 +1,653 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "XmlReader.h"
+#include "Codepage.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const size_t        BUFFER_SIZE         = 1 << 16;
+
+    //--------------------------------------------------------------------------
+    bool isSpace(int c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    //--------------------------------------------------------------------------
+    bool isNameChar(int c)
+    {
+        return c >= 0x80 || isalnum(c) || c == '_' || c == ':' || c == '-' || c == '.';
+    }
+
+    //--------------------------------------------------------------------------
+    // append a code point as UTF-8
+    void appendUtf8(string& out, unsigned long cp)
+    {
+        if (cp < 0x80)
+        {
+            out += static_cast<char>(cp);
+        }
+        else if (cp < 0x800)
+        {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else if (cp < 0x10000)
+        {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+        else
+        {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Constructors
+//------------------------------------------------------------------------------
+XmlReader::XmlReader(const string& path) :
+    XmlReader(fopen(path.c_str(), "rb"), path)
+{
+}
+
+#ifdef _WIN32
+XmlReader::XmlReader(const wstring& path) :
+    XmlReader(_wfopen(path.c_str(), L"rb"), Codepage::narrowPath(path))
+{
+}
+#endif
+
+XmlReader::XmlReader(FILE* file, const string& path) :
+    m_file(file),
+    m_path(path),
+    m_buffer(BUFFER_SIZE),
+    m_pos(0),
+    m_end(0),
+    m_bufferOffset(0),
+    m_eventOffset(0),
+    m_line(1),
+    m_column(1),
+    m_eventLine(1),
+    m_eventColumn(1),
+    m_encoding("UTF-8"),
+    m_codepage(0),
+    m_emptyElement(false),
+    m_inCData(false),
+    m_seenRoot(false)
+{
+    if (m_file == 0)
+        throw runtime_error("Cannot open \"" + path + "\"");
+
+    // skip a byte order mark
+    match("\xEF\xBB\xBF");
+}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+XmlReader::~XmlReader()
+{
+    if (m_file) fclose(m_file);
+}
+
+//------------------------------------------------------------------------------
+// Read the next event
+//------------------------------------------------------------------------------
+XmlReader::Event XmlReader::next()
+{
+    // end tag of an empty element
+    if (m_emptyElement)
+    {
+        m_emptyElement = false;
+        m_stack.pop_back();
+        return eventEnd;
+    }
+
+    for (;;)
+    {
+        m_eventLine = m_line;
+        m_eventColumn = m_column;
+        m_eventOffset = offset();
+        m_name.clear();
+        m_attributes.clear();
+        m_text.clear();
+
+        if (m_inCData)
+        {
+            readCData();
+            return eventText;
+        }
+
+        int c = peek();
+        if (c < 0)
+        {
+            if (!m_stack.empty())
+                throw error("Unexpected end of file, expected </" + m_stack.back() + ">");
+            if (!m_seenRoot)
+                throw error("Missing root element");
+            return eventEof;
+        }
+
+        if (c != '<')
+        {
+            // character data outside of the root element must be white space
+            if (readText() && !m_stack.empty())
+                return eventText;
+            continue;
+        }
+
+        get();
+        if (match("?"))
+        {
+            readDeclaration();
+        }
+        else if (match("!--"))
+        {
+            skipPast("-->");
+        }
+        else if (match("![CDATA["))
+        {
+            if (m_stack.empty())
+                throw error("CDATA section outside of the root element");
+            m_inCData = true;
+            readCData();
+            return eventText;
+        }
+        else if (match("!DOCTYPE"))
+        {
+            skipDoctype();
+        }
+        else if (match("/"))
+        {
+            readEndTag();
+            return eventEnd;
+        }
+        else
+        {
+            readStartTag();
+            return eventStart;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Attribute of the current start tag
+//------------------------------------------------------------------------------
+const string* XmlReader::attribute(const string& name) const
+{
+    for (Attributes::const_iterator it = m_attributes.begin(); it != m_attributes.end(); ++it)
+    {
+        if (it->first == name)
+            return &it->second;
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Continue at an offset within the content of the current element
+//------------------------------------------------------------------------------
+void XmlReader::skipTo(unsigned long long offset, unsigned line, unsigned column)
+{
+    if (m_stack.empty() || m_emptyElement || m_inCData || offset < this->offset())
+        throw error("Cannot skip to this position");
+
+#ifdef _MSC_VER
+    int res = _fseeki64(m_file, static_cast<__int64>(offset), SEEK_SET);
+#else
+    int res = fseeko(m_file, static_cast<off_t>(offset), SEEK_SET);
+#endif
+    if (res != 0)
+        throw error("Cannot seek in the document");
+
+    m_bufferOffset = offset;
+    m_pos = 0;
+    m_end = 0;
+    m_line = line;
+    m_column = column;
+}
+
+//------------------------------------------------------------------------------
+// Exception with position
+//------------------------------------------------------------------------------
+runtime_error XmlReader::error(const string& message) const
+{
+    char pos[64];
+    sprintf(pos, "(%u,%u): ", m_eventLine, m_eventColumn);
+    return runtime_error(m_path + pos + message);
+}
+
+//------------------------------------------------------------------------------
+// Next character
+//------------------------------------------------------------------------------
+int XmlReader::peek()
+{
+    if (m_pos == m_end)
+    {
+        m_bufferOffset += m_end;
+        m_pos = 0;
+        m_end = fread(&m_buffer[0], 1, m_buffer.size(), m_file);
+        if (m_end == 0)
+            return -1;
+    }
+
+    return static_cast<unsigned char>(m_buffer[m_pos]);
+}
+
+//------------------------------------------------------------------------------
+int XmlReader::get()
+{
+    int c = peek();
+    if (c < 0)
+        return c;
+
+    ++m_pos;
+    if (c == '\n')
+    {
+        ++m_line;
+        m_column = 1;
+    }
+    else if ((c & 0xC0) != 0x80)
+    {
+        ++m_column;
+    }
+
+    return c;
+}
+
+//------------------------------------------------------------------------------
+// Consume str if it follows (str must not contain a line break)
+//------------------------------------------------------------------------------
+bool XmlReader::match(const char* str)
+{
+    size_t len = strlen(str);
+    if (m_end - m_pos < len)
+    {
+        // move the rest to the front and refill
+        m_bufferOffset += m_pos;
+        memmove(&m_buffer[0], &m_buffer[m_pos], m_end - m_pos);
+        m_end -= m_pos;
+        m_pos = 0;
+        m_end += fread(&m_buffer[m_end], 1, m_buffer.size() - m_end, m_file);
+        if (m_end < len)
+            return false;
+    }
+
+    if (memcmp(&m_buffer[m_pos], str, len) != 0)
+        return false;
+
+    m_pos += len;
+    m_column += static_cast<unsigned>(len);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Skip white space
+//------------------------------------------------------------------------------
+void XmlReader::skipSpace()
+{
+    while (isSpace(peek()))
+        get();
+}
+
+//------------------------------------------------------------------------------
+// Skip up to and including str
+//------------------------------------------------------------------------------
+void XmlReader::skipPast(const char* str)
+{
+    while (!match(str))
+    {
+        if (get() < 0)
+            throw error(string("Unexpected end of file, expected \"") + str + "\"");
+    }
+}
+
+//------------------------------------------------------------------------------
+// Read a name
+//------------------------------------------------------------------------------
+string XmlReader::readName()
+{
+    string name;
+    while (isNameChar(peek()))
+        name += static_cast<char>(get());
+
+    if (name.empty())
+        throw error("Name expected");
+
+    return name;
+}
+
+//------------------------------------------------------------------------------
+// Read an entity or character reference (after '&')
+//------------------------------------------------------------------------------
+void XmlReader::readReference(string& out)
+{
+    string ref;
+    for (int c = get(); c != ';'; c = get())
+    {
+        if (c < 0 || isSpace(c) || c == '<' || c == '&' || ref.size() > 16)
+            throw error("Invalid reference \"&" + ref + "\"");
+        ref += static_cast<char>(c);
+    }
+
+    if (ref == "lt")        out += '<';
+    else if (ref == "gt")   out += '>';
+    else if (ref == "amp")  out += '&';
+    else if (ref == "quot") out += '"';
+    else if (ref == "apos") out += '\'';
+    else if (ref.size() > 1 && ref[0] == '#')
+    {
+        char* end;
+        unsigned long cp = ref[1] == 'x' ? strtoul(ref.c_str() + 2, &end, 16) : strtoul(ref.c_str() + 1, &end, 10);
+        if (*end != '\0' || cp == 0 || cp > 0x10FFFF)
+            throw error("Invalid character reference \"&" + ref + ";\"");
+        appendUtf8(out, cp);
+    }
+    else
+    {
+        throw error("Unknown entity \"&" + ref + ";\"");
+    }
+}
+
+//------------------------------------------------------------------------------
+// Append raw characters to out, converted to UTF-8
+//------------------------------------------------------------------------------
+void XmlReader::flushRaw(string& raw, string& out) const
+{
+    if (raw.empty())
+        return;
+
+    if (m_codepage == 0)
+    {
+        out += raw;
+    }
+    else
+    {
+        try
+        {
+            out += Codepage::toUtf8(raw, m_codepage);
+        }
+        catch (const runtime_error& e)
+        {
+            throw error(e.what());
+        }
+    }
+
+    raw.clear();
+}
+
+//------------------------------------------------------------------------------
+// Processing instruction (after "<?")
+//------------------------------------------------------------------------------
+void XmlReader::readDeclaration()
+{
+    string target = readName();
+    if (target != "xml")
+    {
+        skipPast("?>");
+        return;
+    }
+
+    // pseudo attributes of the XML declaration
+    for (;;)
+    {
+        skipSpace();
+        if (match("?>"))
+            break;
+
+        string name = readName();
+        skipSpace();
+        if (get() != '=')
+            throw error("'=' expected in XML declaration");
+        skipSpace();
+        int quote = get();
+        if (quote != '"' && quote != '\'')
+            throw error("Quote expected in XML declaration");
+
+        string value;
+        for (int c = get(); c != quote; c = get())
+        {
+            if (c < 0)
+                throw error("Unexpected end of file in XML declaration");
+            value += static_cast<char>(c);
+        }
+
+        if (name == "encoding")
+        {
+            m_encoding = value;
+            unsigned codepage = Codepage::fromName(value);
+            if (codepage == 0)
+                throw error("Unsupported encoding \"" + value + "\"");
+            m_codepage = codepage == Codepage::UTF8 || codepage == Codepage::ASCII ? 0 : codepage;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Skip the document type declaration (after "<!DOCTYPE")
+//------------------------------------------------------------------------------
+void XmlReader::skipDoctype()
+{
+    int quote = 0;
+    bool subset = false;
+    for (;;)
+    {
+        int c = get();
+        if (c < 0)
+            throw error("Unexpected end of file in document type declaration");
+
+        if (quote)
+        {
+            if (c == quote) quote = 0;
+        }
+        else if (c == '"' || c == '\'')
+        {
+            quote = c;
+        }
+        else if (c == '<' && match("!--"))
+        {
+            skipPast("-->");
+        }
+        else if (c == '[')
+        {
+            subset = true;
+        }
+        else if (c == ']')
+        {
+            subset = false;
+        }
+        else if (c == '>' && !subset)
+        {
+            break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Start tag (after '<')
+//------------------------------------------------------------------------------
+void XmlReader::readStartTag()
+{
+    if (m_stack.empty() && m_seenRoot)
+        throw error("Content after the root element");
+
+    m_name = readName();
+    for (;;)
+    {
+        bool space = isSpace(peek());
+        skipSpace();
+
+        if (match("/>"))
+        {
+            m_emptyElement = true;
+            break;
+        }
+        if (match(">"))
+            break;
+
+        if (!space)
+            throw error("White space expected in <" + m_name + ">");
+
+        string name = readName();
+        skipSpace();
+        if (get() != '=')
+            throw error("'=' expected after attribute \"" + name + "\"");
+        skipSpace();
+        int quote = get();
+        if (quote != '"' && quote != '\'')
+            throw error("Quote expected for attribute \"" + name + "\"");
+
+        string value, raw;
+        for (int c = get(); c != quote; c = get())
+        {
+            if (c < 0 || c == '<')
+                throw error("Unterminated value of attribute \"" + name + "\"");
+
+            if (c == '&')
+            {
+                flushRaw(raw, value);
+                readReference(value);
+            }
+            else if (c == '\r' || c == '\n' || c == '\t')
+            {
+                if (c != '\r' || peek() != '\n') raw += ' ';
+            }
+            else
+            {
+                raw += static_cast<char>(c);
+            }
+        }
+        flushRaw(raw, value);
+
+        if (attribute(name))
+            throw error("Duplicate attribute \"" + name + "\"");
+        m_attributes.push_back(make_pair(name, value));
+    }
+
+    m_stack.push_back(m_name);
+    m_seenRoot = true;
+}
+
+//------------------------------------------------------------------------------
+// End tag (after "</")
+//------------------------------------------------------------------------------
+void XmlReader::readEndTag()
+{
+    m_name = readName();
+    skipSpace();
+    if (get() != '>')
+        throw error("'>' expected in </" + m_name + ">");
+
+    if (m_stack.empty() || m_stack.back() != m_name)
+        throw error("Unexpected </" + m_name + ">" + (m_stack.empty() ? string() : ", expected </" + m_stack.back() + ">"));
+    m_stack.pop_back();
+}
+
+//------------------------------------------------------------------------------
+// Character data up to the next '<' or CHUNK_SIZE (false if only white space)
+//------------------------------------------------------------------------------
+bool XmlReader::readText()
+{
+    string raw;
+    bool space = true;
+    for (int c = peek(); c >= 0 && c != '<'; c = peek())
+    {
+        // split long text between characters
+        if (raw.size() + m_text.size() >= CHUNK_SIZE && c < 0x80)
+            break;
+
+        get();
+        if (c == '&')
+        {
+            flushRaw(raw, m_text);
+            readReference(m_text);
+            space = false;
+        }
+        else if (c == '\r')
+        {
+            if (peek() != '\n') raw += '\n';
+        }
+        else
+        {
+            raw += static_cast<char>(c);
+            space = space && isSpace(c);
+        }
+    }
+    flushRaw(raw, m_text);
+
+    if (!space && m_stack.empty())
+        throw error("Character data outside of the root element");
+
+    return !space || !m_text.empty();
+}
+
+//------------------------------------------------------------------------------
+// Contents of a CDATA section up to "]]>" or CHUNK_SIZE (true at the end)
+//------------------------------------------------------------------------------
+bool XmlReader::readCData()
+{
+    string raw;
+    for (;;)
+    {
+        if (match("]]>"))
+        {
+            m_inCData = false;
+            break;
+        }
+
+        int c = get();
+        if (c < 0)
+            throw error("Unterminated CDATA section");
+
+        if (c == '\r')
+        {
+            if (peek() != '\n') raw += '\n';
+        }
+        else
+        {
+            raw += static_cast<char>(c);
+        }
+
+        if (raw.size() >= CHUNK_SIZE && peek() < 0x80)
+            break;
+    }
+
+    flushRaw(raw, m_text);
+    return !m_inCData;
+}
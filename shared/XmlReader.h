@@ -0,0 +1,185 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Streaming XML reader
+//
+// A small pull parser for documents such as those written by msi2xml. It
+// reports start tags (with their attributes), end tags and character data
+// one event at a time, so that documents of any size can be processed in
+// constant memory: long character data, such as Base64 encoded binary
+// fields, is reported in chunks of at most CHUNK_SIZE bytes. Comments,
+// processing instructions and the document type declaration are skipped.
+// Entity and character references are replaced, and line breaks are
+// normalized to '\n'. The byte offsets of the events in the file are
+// available as well, so that a document can be copied with selected
+// parts replaced, and the content of an element can be skipped without
+// being parsed if its end is known.
+//
+// Names, attribute values and character data are returned as UTF-8,
+// whatever the encoding given in the XML declaration. The reader checks
+// that the document is well-formed, but does not validate it.
+//
+//------------------------------------------------------------------------------
+#ifndef XML_READER_H_INCLUDED
+#define XML_READER_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <stdio.h>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+class XmlReader
+{
+public:
+    enum Event
+    {
+        eventStart,                     // start tag (also reported for empty elements)
+        eventEnd,                       // end tag
+        eventText,                      // character data
+        eventEof                        // end of the document
+    };
+
+    enum { CHUNK_SIZE = 65536 };
+
+    typedef std::vector<std::pair<std::string, std::string> > Attributes;
+
+    // open a document (throws runtime_error)
+    explicit XmlReader(const std::string& path);
+#ifdef _WIN32
+    explicit XmlReader(const std::wstring& path);
+#endif
+
+    // destructor
+    ~XmlReader();
+
+    // read the next event (throws runtime_error if the document is malformed)
+    Event               next();
+
+    // element name of the current start or end tag
+    const std::string&  name() const { return m_name; }
+
+    // attribute of the current start tag (NULL if absent)
+    const std::string*  attribute(const std::string& name) const;
+
+    // all attributes of the current start tag
+    const Attributes&   attributes() const { return m_attributes; }
+
+    // character data of the current text event
+    const std::string&  text() const { return m_text; }
+
+    // nesting depth (1 within the root element)
+    size_t              depth() const { return m_stack.size(); }
+
+    // encoding given in the XML declaration
+    const std::string&  encoding() const { return m_encoding; }
+
+    // position of the current event
+    unsigned            line() const { return m_eventLine; }
+    unsigned            column() const { return m_eventColumn; }
+
+    // byte offset of the current event in the file
+    unsigned long long  eventOffset() const { return m_eventOffset; }
+
+    // byte offset just past the markup read so far (the end of a start or end tag)
+    unsigned long long  offset() const { return m_bufferOffset + m_pos; }
+
+    // current start tag is an empty element ("<name/>")
+    bool                emptyElement() const { return m_emptyElement; }
+
+    // continue at offset within the content of the current element, such as the
+    // start of its end tag found by a first scan (throws runtime_error)
+    void                skipTo(unsigned long long offset, unsigned line, unsigned column);
+
+    // exception carrying message and the position of the current event
+    std::runtime_error  error(const std::string& message) const;
+
+private:
+    XmlReader(const XmlReader&);
+    XmlReader& operator=(const XmlReader&);
+
+    // read an opened document (path for messages)
+    XmlReader(FILE* file, const std::string& path);
+
+    // next character (-1 at the end of the file)
+    int                 peek();
+    int                 get();
+
+    // consume str if it follows
+    bool                match(const char* str);
+
+    // skip white space
+    void                skipSpace();
+
+    // skip up to and including str
+    void                skipPast(const char* str);
+
+    // read a name
+    std::string         readName();
+
+    // read a reference after '&' and append it to out as UTF-8
+    void                readReference(std::string& out);
+
+    // append raw characters to out, converted to UTF-8
+    void                flushRaw(std::string& raw, std::string& out) const;
+
+    // parse the XML declaration, the document type declaration and the like
+    void                readDeclaration();
+    void                skipDoctype();
+
+    // parse a start tag (after '<'), an end tag (after "</") and character data
+    void                readStartTag();
+    void                readEndTag();
+    bool                readText();
+    bool                readCData();
+
+    FILE*               m_file;         // document
+    std::string         m_path;         // document path
+    std::vector<char>   m_buffer;       // read buffer
+    size_t              m_pos;          // position in m_buffer
+    size_t              m_end;          // end of data in m_buffer
+    unsigned long long  m_bufferOffset; // file offset of m_buffer[0]
+    unsigned long long  m_eventOffset;  // file offset of the current event
+    unsigned            m_line;         // current line
+    unsigned            m_column;       // current column
+    unsigned            m_eventLine;    // line of the current event
+    unsigned            m_eventColumn;  // column of the current event
+    std::string         m_encoding;     // declared encoding
+    unsigned            m_codepage;     // codepage of m_encoding (0: UTF-8 or ASCII)
+    std::string         m_name;         // current element name
+    Attributes          m_attributes;   // current attributes
+    std::string         m_text;         // current character data
+    std::vector<std::string> m_stack;   // open elements
+    bool                m_emptyElement; // current start tag is an empty element
+    bool                m_inCData;      // inside a CDATA section that did not fit into a chunk
+    bool                m_seenRoot;     // root element was read
+};
+
+#endif // XML_READER_H_INCLUDED
@@ -0,0 +1,402 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "XmlValidator.h"
+#include <string.h>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    // declared attribute (values: '|' separated list, NULL for CDATA)
+    struct AttributeDecl
+    {
+        const char*     name;
+        const char*     values;
+        bool            required;
+    };
+
+    const AttributeDecl MSI_ATTRIBUTES[] =
+    {
+        { "version",        0,                  true  },
+        { "xmlns:dt",       0,                  false },
+        { "msm",            "yes|no",           false },
+        { "codepage",       0,                  false },
+        { "compression",    0,                  false },
+        { 0,                0,                  false }
+    };
+
+    const AttributeDecl TABLE_ATTRIBUTES[] =
+    {
+        { "name",           0,                  true  },
+        { "rows",           0,                  false },
+        { "bytes",          0,                  false },
+        { 0,                0,                  false }
+    };
+
+    const AttributeDecl COL_ATTRIBUTES[] =
+    {
+        { "key",            "yes|no",           false },
+        { "def",            0,                  false },
+        { 0,                0,                  false }
+    };
+
+    const AttributeDecl TD_ATTRIBUTES[] =
+    {
+        { "href",           0,                  false },
+        { "dt:dt",          "string|bin.base64", false },
+        { "md5",            0,                  false },
+        { "size",           0,                  false },
+        { 0,                0,                  false }
+    };
+
+    const AttributeDecl NO_ATTRIBUTES[] =
+    {
+        { 0,                0,                  false }
+    };
+
+    // summary properties in document order
+    const char* const SUMMARY_PROPERTIES[] =
+    {
+        "codepage", "title", "subject", "author", "keywords", "comments",
+        "template", "lastauthor", "revnumber", "lastprinted", "createdtm",
+        "lastsavedtm", "pagecount", "wordcount", "charcount", "appname",
+        "security"
+    };
+
+    const int SUMMARY_COUNT = sizeof(SUMMARY_PROPERTIES) / sizeof(SUMMARY_PROPERTIES[0]);
+
+    //--------------------------------------------------------------------------
+    // True if a summary property must be present
+    //--------------------------------------------------------------------------
+    bool isRequiredProperty(int index)
+    {
+        const char* name = SUMMARY_PROPERTIES[index];
+        return strcmp(name, "template") == 0 || strcmp(name, "revnumber") == 0
+            || strcmp(name, "pagecount") == 0 || strcmp(name, "wordcount") == 0;
+    }
+
+    //--------------------------------------------------------------------------
+    // True if value is one of the '|' separated values
+    //--------------------------------------------------------------------------
+    bool isEnumValue(const char* values, const string& value)
+    {
+        for (const char* p = values; ; )
+        {
+            const char* end = strchr(p, '|');
+            size_t len = end ? static_cast<size_t>(end - p) : strlen(p);
+            if (value.size() == len && value.compare(0, len, p, len) == 0)
+                return true;
+            if (end == 0)
+                return false;
+            p = end + 1;
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // Check attributes against their declarations (returns an error message)
+    //--------------------------------------------------------------------------
+    string checkAttributes(const string& element, 
+                           const XmlValidator::Attributes& attributes, 
+                           const AttributeDecl* decls)
+    {
+        for (XmlValidator::Attributes::const_iterator it = attributes.begin(); it != attributes.end(); ++it)
+        {
+            const AttributeDecl* decl = decls;
+            while (decl->name && it->first != decl->name)
+                ++decl;
+
+            if (decl->name == 0)
+                return "Attribute '" + it->first + "' is not declared for <" + element + ">";
+
+            if (decl->values && !isEnumValue(decl->values, it->second))
+                return "Attribute '" + it->first + "' of <" + element + "> must be one of " 
+                    + decl->values + ", not '" + it->second + "'";
+        }
+
+        for (const AttributeDecl* decl = decls; decl->name; ++decl)
+        {
+            if (!decl->required)
+                continue;
+
+            XmlValidator::Attributes::const_iterator it = attributes.begin();
+            while (it != attributes.end() && it->first != decl->name)
+                ++it;
+
+            if (it == attributes.end())
+                return "Required attribute '" + string(decl->name) + "' of <" + element + "> is missing";
+        }
+
+        return string();
+    }
+
+    //--------------------------------------------------------------------------
+    // True if text is white space only
+    //--------------------------------------------------------------------------
+    bool isSpace(const string& text)
+    {
+        return text.find_first_not_of(" \t\r\n") == string::npos;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+XmlValidator::XmlValidator() :
+    m_seenRoot(false)
+{
+}
+
+//------------------------------------------------------------------------------
+// Start tag
+//------------------------------------------------------------------------------
+bool XmlValidator::startElement(const string& name, const Attributes& attributes)
+{
+    if (!m_error.empty())
+        return false;
+
+    const AttributeDecl* decls = NO_ATTRIBUTES;
+    Element element;
+    int property = 0;
+
+    if (m_stack.empty())
+    {
+        if (m_seenRoot)
+            return fail("Only one root element is allowed");
+        if (name != "msi")
+            return fail("Root element must be <msi>, not <" + name + ">");
+
+        m_seenRoot = true;
+        element = elemMsi;
+        decls = MSI_ATTRIBUTES;
+    }
+    else
+    {
+        Open& parent = m_stack.back();
+        switch (parent.element)
+        {
+        case elemMsi:
+            if (name == "summary")
+            {
+                if (parent.last > 0)
+                    return fail("<summary> must be the first child of <msi>");
+                parent.seen = true;
+                element = elemSummary;
+            }
+            else if (name == "table")
+            {
+                if (!parent.seen)
+                    return fail("<summary> must precede <table>");
+                element = elemTable;
+                decls = TABLE_ATTRIBUTES;
+            }
+            else
+            {
+                return fail("<" + name + "> is not allowed in <msi>");
+            }
+            ++parent.last;
+            break;
+
+        case elemSummary:
+            while (property < SUMMARY_COUNT && name != SUMMARY_PROPERTIES[property])
+                ++property;
+
+            if (property == SUMMARY_COUNT)
+                return fail("<" + name + "> is not allowed in <summary>");
+            if (property <= parent.last)
+                return fail("<" + name + "> is repeated or out of order in <summary>");
+
+            for (int i = parent.last + 1; i < property; ++i)
+            {
+                if (isRequiredProperty(i))
+                    return fail("<summary> is missing <" + string(SUMMARY_PROPERTIES[i]) + "> before <" + name + ">");
+            }
+
+            parent.last = property;
+            element = elemProperty;
+            break;
+
+        case elemTable:
+            if (name == "col")
+            {
+                if (parent.seen)
+                    return fail("<col> must precede the rows of table '" + m_table + "'");
+                ++parent.last;
+                element = elemCol;
+                decls = COL_ATTRIBUTES;
+            }
+            else if (name == "row")
+            {
+                if (parent.last == 0)
+                    return fail("Table '" + m_table + "' has no columns");
+                parent.seen = true;
+                element = elemRow;
+            }
+            else
+            {
+                return fail("<" + name + "> is not allowed in <table>");
+            }
+            break;
+
+        case elemRow:
+            if (name != "td")
+                return fail("<" + name + "> is not allowed in <row>");
+            ++parent.last;
+            element = elemTd;
+            decls = TD_ATTRIBUTES;
+            break;
+
+        default:
+            return fail("<" + name + "> is not allowed in an element with character data only");
+        }
+    }
+
+    string message = checkAttributes(name, attributes, decls);
+    if (!message.empty())
+        return fail(message);
+
+    if (element == elemTable)
+    {
+        Attributes::const_iterator it = attributes.begin();
+        while (it->first != "name")
+            ++it;
+        m_table = it->second;
+    }
+
+    push(element);
+    if (element == elemProperty)
+        m_stack.back().last = property;
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Character data
+//------------------------------------------------------------------------------
+bool XmlValidator::text(const string& text)
+{
+    if (!m_error.empty())
+        return false;
+
+    if (m_stack.empty())
+        return true;
+
+    const char* element = 0;
+    switch (m_stack.back().element)
+    {
+    case elemMsi:       element = "msi";        break;
+    case elemSummary:   element = "summary";    break;
+    case elemTable:     element = "table";      break;
+    case elemRow:       element = "row";        break;
+    default:                                    break;
+    }
+
+    if (element && !isSpace(text))
+        return fail("Text is not allowed in <" + string(element) + ">");
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// End tag
+//------------------------------------------------------------------------------
+bool XmlValidator::endElement()
+{
+    if (!m_error.empty())
+        return false;
+
+    if (m_stack.empty())
+        return fail("Unexpected end tag");
+
+    const Open& open = m_stack.back();
+    switch (open.element)
+    {
+    case elemMsi:
+        if (!open.seen)
+            return fail("<msi> must contain <summary>");
+        break;
+
+    case elemSummary:
+        for (int i = open.last + 1; i < SUMMARY_COUNT; ++i)
+        {
+            if (isRequiredProperty(i))
+                return fail("<summary> is missing <" + string(SUMMARY_PROPERTIES[i]) + ">");
+        }
+        break;
+
+    case elemTable:
+        if (open.last == 0)
+            return fail("Table '" + m_table + "' has no columns");
+        break;
+
+    case elemRow:
+        if (open.last == 0)
+            return fail("Row of table '" + m_table + "' has no fields");
+        break;
+
+    default:
+        break;
+    }
+
+    m_stack.pop_back();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// End of the document
+//------------------------------------------------------------------------------
+bool XmlValidator::endDocument()
+{
+    if (!m_error.empty())
+        return false;
+
+    if (!m_seenRoot)
+        return fail("Missing root element <msi>");
+    if (!m_stack.empty())
+        return fail("Unexpected end of document");
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Record an error
+//------------------------------------------------------------------------------
+bool XmlValidator::fail(const string& message)
+{
+    if (m_error.empty())
+        m_error = message;
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Open an element
+//------------------------------------------------------------------------------
+void XmlValidator::push(Element element)
+{
+    Open open = { element, element == elemSummary ? -1 : 0, false };
+    m_stack.push_back(open);
+}
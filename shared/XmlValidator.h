@@ -0,0 +1,109 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Structural validator for msi2xml documents
+//
+// Checks the grammar of the document type declared in template_dt.xml:
+// element nesting and order, the required 'summary' properties, the
+// declared attributes and their enumerated values, and that element
+// content holds no character data. The validator is driven by element
+// events, so that it can be driven by a streaming parser or by a walk of
+// a loaded document, at the cost of a few comparisons per element.
+//
+// Character data of leaf elements such as 'td' need not be passed to
+// text(). The first error is kept, later events are ignored. Names and
+// values are UTF-8.
+//
+//------------------------------------------------------------------------------
+#ifndef XML_VALIDATOR_H_INCLUDED
+#define XML_VALIDATOR_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <string>
+#include <utility>
+#include <vector>
+
+class XmlValidator
+{
+public:
+    typedef std::vector<std::pair<std::string, std::string> > Attributes;
+
+    // constructor
+    XmlValidator();
+
+    // start tag (false if the element is not valid at this point)
+    bool                startElement(const std::string& name, const Attributes& attributes = Attributes());
+
+    // character data (false if it is not white space and the element has element content)
+    bool                text(const std::string& text);
+
+    // end tag (false if required children are missing)
+    bool                endElement();
+
+    // end of the document (false if the document is incomplete)
+    bool                endDocument();
+
+    // nesting depth (1 within the root element)
+    size_t              depth() const { return m_stack.size(); }
+
+    // first error (empty if the document is valid so far)
+    const std::string&  error() const { return m_error; }
+
+private:
+    enum Element
+    {
+        elemMsi,
+        elemSummary,
+        elemProperty,
+        elemTable,
+        elemCol,
+        elemRow,
+        elemTd
+    };
+
+    struct Open
+    {
+        Element         element;        // element type
+        int             last;           // index of last summary property, or number of children
+        bool            seen;           // msi: summary was seen; table: a row was seen
+    };
+
+    // record an error (always returns false)
+    bool                fail(const std::string& message);
+
+    // open an element
+    void                push(Element element);
+
+    std::vector<Open>   m_stack;        // open elements
+    std::string         m_table;        // name of the current table
+    bool                m_seenRoot;     // root element was read
+    std::string         m_error;        // first error
+};
+
+#endif // XML_VALIDATOR_H_INCLUDED
@@ -0,0 +1,290 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "XmlWriter.h"
+#include "Codepage.h"
+#include <string.h>
+#include <stdexcept>
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+namespace
+{
+    //--------------------------------------------------------------------------
+    // length of the UTF-8 sequence starting with c
+    size_t utf8Length(unsigned char c)
+    {
+        if (c >= 0xF0) return 4;
+        if (c >= 0xE0) return 3;
+        if (c >= 0xC0) return 2;
+        return 1;
+    }
+
+    //--------------------------------------------------------------------------
+    // code point of a UTF-8 sequence
+    unsigned long codePoint(const char* p, size_t len)
+    {
+        static const unsigned char mask[] = { 0, 0x7F, 0x1F, 0x0F, 0x07 };
+        unsigned long cp = static_cast<unsigned char>(p[0]) & mask[len];
+        for (size_t i = 1; i < len; ++i)
+            cp = (cp << 6) | (static_cast<unsigned char>(p[i]) & 0x3F);
+        return cp;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+XmlWriter::XmlWriter(const string& path, const string& encoding) :
+    m_file(fopen(path.c_str(), "wb")),
+    m_path(path),
+    m_codepage(Codepage::fromName(encoding)),
+    m_startTag(false)
+{
+    if (m_file == 0)
+        throw runtime_error("Cannot create \"" + path + "\"");
+
+    if (m_codepage == 0)
+    {
+        fclose(m_file);
+        m_file = 0;
+        throw runtime_error("Unsupported encoding \"" + encoding + "\"");
+    }
+
+    raw("<?xml version=\"1.0\" encoding=\"" + encoding + "\" standalone=\"yes\"?>");
+}
+
+//------------------------------------------------------------------------------
+// Destructor
+//------------------------------------------------------------------------------
+XmlWriter::~XmlWriter()
+{
+    if (m_file) fclose(m_file);
+}
+
+//------------------------------------------------------------------------------
+// Write markup as is
+//------------------------------------------------------------------------------
+void XmlWriter::raw(const string& markup)
+{
+    closeStartTag();
+    write(markup.data(), markup.size());
+}
+
+//------------------------------------------------------------------------------
+// Start a new indented line
+//------------------------------------------------------------------------------
+void XmlWriter::indent(unsigned level)
+{
+    closeStartTag();
+    write("\n", 1);
+    for (unsigned i = 0; i < level; ++i)
+        write("\t", 1);
+}
+
+//------------------------------------------------------------------------------
+// Open an element
+//------------------------------------------------------------------------------
+void XmlWriter::startElement(const string& name)
+{
+    closeStartTag();
+    write("<", 1);
+    write(name.data(), name.size());
+    m_stack.push_back(name);
+    m_startTag = true;
+}
+
+//------------------------------------------------------------------------------
+// Add an attribute
+//------------------------------------------------------------------------------
+void XmlWriter::attribute(const string& name, const string& value)
+{
+    if (!m_startTag)
+        throw runtime_error("Attribute \"" + name + "\" outside of a start tag");
+
+    write(" ", 1);
+    write(name.data(), name.size());
+    write("=\"", 2);
+    escaped(value, true);
+    write("\"", 1);
+}
+
+//------------------------------------------------------------------------------
+// Write character data
+//------------------------------------------------------------------------------
+void XmlWriter::text(const string& text)
+{
+    if (text.empty())
+        return;
+
+    closeStartTag();
+    escaped(text, false);
+}
+
+//------------------------------------------------------------------------------
+// Close the innermost element
+//------------------------------------------------------------------------------
+void XmlWriter::endElement()
+{
+    if (m_stack.empty())
+        throw runtime_error("No element to close");
+
+    if (m_startTag)
+    {
+        write("/>", 2);
+        m_startTag = false;
+    }
+    else
+    {
+        write("</", 2);
+        write(m_stack.back().data(), m_stack.back().size());
+        write(">", 1);
+    }
+
+    m_stack.pop_back();
+}
+
+//------------------------------------------------------------------------------
+// Close the file
+//------------------------------------------------------------------------------
+void XmlWriter::close()
+{
+    if (m_file == 0)
+        return;
+
+    write("\n", 1);
+    bool failed = fclose(m_file) != 0;
+    m_file = 0;
+
+    if (failed)
+        throw runtime_error("Cannot write \"" + m_path + "\"");
+}
+
+//------------------------------------------------------------------------------
+// Finish a pending start tag
+//------------------------------------------------------------------------------
+void XmlWriter::closeStartTag()
+{
+    if (m_startTag)
+    {
+        write(">", 1);
+        m_startTag = false;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Write escaped text
+//------------------------------------------------------------------------------
+void XmlWriter::escaped(const string& text, bool attribute)
+{
+    const char* p = text.data();
+    const char* end = p + text.size();
+    while (p < end)
+    {
+        // run of characters that need no escaping
+        const char* run = p;
+        while (p < end && static_cast<unsigned char>(*p) < 0x80 && *p != '&' && *p != '<' && *p != '>' 
+               && *p != '\r' && !(attribute && (*p == '"' || *p == '\t' || *p == '\n')))
+        {
+            ++p;
+        }
+        write(run, p - run);
+        if (p == end)
+            break;
+
+        // run of non-ASCII characters
+        if (static_cast<unsigned char>(*p) >= 0x80)
+        {
+            run = p;
+            while (p < end && static_cast<unsigned char>(*p) >= 0x80)
+                ++p;
+            nonAscii(string(run, p));
+            continue;
+        }
+
+        switch (*p++)
+        {
+        case '&':   write("&amp;", 5); break;
+        case '<':   write("&lt;", 4); break;
+        case '>':   write("&gt;", 4); break;
+        case '"':   write("&quot;", 6); break;
+        case '\t':  write("&#9;", 4); break;
+        case '\n':  write("&#10;", 5); break;
+        case '\r':  write("&#13;", 5); break;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Write non-ASCII characters, as character references if necessary
+//------------------------------------------------------------------------------
+void XmlWriter::nonAscii(const string& text)
+{
+    if (m_codepage == Codepage::UTF8)
+    {
+        write(text.data(), text.size());
+        return;
+    }
+
+    string converted;
+    if (m_codepage != Codepage::ASCII && Codepage::fromUtf8(text, m_codepage, converted))
+    {
+        write(converted.data(), converted.size());
+        return;
+    }
+
+    // character by character
+    for (size_t i = 0; i < text.size(); )
+    {
+        size_t len = utf8Length(static_cast<unsigned char>(text[i]));
+        if (i + len > text.size())
+            len = text.size() - i;
+
+        string ch = text.substr(i, len);
+        if (m_codepage == Codepage::ASCII || !Codepage::fromUtf8(ch, m_codepage, converted))
+        {
+            char ref[16];
+            sprintf(ref, "&#x%lX;", codePoint(ch.data(), len));
+            converted = ref;
+        }
+
+        write(converted.data(), converted.size());
+        i += len;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Write bytes
+//------------------------------------------------------------------------------
+void XmlWriter::write(const char* data, size_t len)
+{
+    if (m_file == 0)
+        throw runtime_error("\"" + m_path + "\" is closed");
+
+    if (len > 0 && fwrite(data, 1, len, m_file) != len)
+        throw runtime_error("Cannot write \"" + m_path + "\"");
+}
@@ -0,0 +1,103 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Streaming XML writer
+//
+// Writes elements, attributes and character data straight to a file, in
+// the layout of msi2xml: the caller places line breaks and tabs with
+// indent(), elements without content are closed with "/>". Carriage
+// returns are written as character references, so that they survive the
+// line break normalization of XML parsers. Names, values
+// and character data are passed as UTF-8 and written in the encoding of the
+// document; characters the encoding cannot represent are written as
+// character references.
+//
+//------------------------------------------------------------------------------
+#ifndef XML_WRITER_H_INCLUDED
+#define XML_WRITER_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+class XmlWriter
+{
+public:
+    // create a document and write the XML declaration (throws runtime_error)
+    XmlWriter(const std::string& path, const std::string& encoding = "US-ASCII");
+
+    // destructor (closes the file)
+    ~XmlWriter();
+
+    // write markup such as processing instructions or comments as is
+    void                raw(const std::string& markup);
+
+    // start a new line indented by level tabs
+    void                indent(unsigned level);
+
+    // open an element
+    void                startElement(const std::string& name);
+
+    // add an attribute to the element just opened
+    void                attribute(const std::string& name, const std::string& value);
+
+    // write character data
+    void                text(const std::string& text);
+
+    // close the innermost element
+    void                endElement();
+
+    // close the file (throws runtime_error)
+    void                close();
+
+private:
+    XmlWriter(const XmlWriter&);
+    XmlWriter& operator=(const XmlWriter&);
+
+    // finish a pending start tag
+    void                closeStartTag();
+
+    // write escaped text, converted to the document encoding
+    void                escaped(const std::string& text, bool attribute);
+
+    // write a run of non-ASCII characters
+    void                nonAscii(const std::string& text);
+
+    // write bytes
+    void                write(const char* data, size_t len);
+
+    FILE*               m_file;         // document
+    std::string         m_path;         // document path
+    unsigned            m_codepage;     // document codepage
+    std::vector<std::string> m_stack;   // open elements
+    bool                m_startTag;     // start tag of the innermost element is not closed yet
+};
+
+#endif // XML_WRITER_H_INCLUDED
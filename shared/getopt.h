@@ -30,7 +30,7 @@
 #pragma once
 #endif // _MSC_VER > 1000
 
-#include <tchar.h>
+#include "tstring.h"
 
 //------------------------------------------------------------------------------
 // Structure definition for getopt_long
@@ -30,7 +30,20 @@
 #pragma once
 #endif // _MSC_VER > 1000
 
+#ifdef _WIN32
 #include <tchar.h>
+#else
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+typedef char _TCHAR;
+#define _T(x) x
+#define _tcschr strchr
+#define _tcslen strlen
+#define _tcsncmp strncmp
+#define _tgetenv getenv
+#define _tprintf printf
+#endif
 #include <sstream>
 #include <string>
 #include <vector>
@@ -0,0 +1,58 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Minimal test support
+//
+// CHECK() records a failure and continues, so that a test reports all
+// of its failures in one run. A test's main() returns failures(), which
+// makes ctest report the test as failed if any check did not hold.
+//
+//------------------------------------------------------------------------------
+#ifndef CHECK_H_INCLUDED
+#define CHECK_H_INCLUDED
+
+#include <iostream>
+
+//------------------------------------------------------------------------------
+// number of failed checks
+inline int& failures()
+{
+    static int count = 0;
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// record a failed check
+inline void checkFailed(const char* expr, const char* file, int line)
+{
+    std::cerr << file << "(" << line << "): check failed: " << expr << std::endl;
+    ++failures();
+}
+
+#define CHECK(expr) ((expr) ? (void)0 : checkFailed(#expr, __FILE__, __LINE__))
+
+#endif // CHECK_H_INCLUDED
@@ -0,0 +1,543 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Installer database written by idt2xml: the database (first argument) is
+// read back as a compound file, and its string pool, system tables, tables
+// and streams are compared with the document it was written from (second
+// argument).
+//
+//------------------------------------------------------------------------------
+#include "Check.h"
+#include "Codepage.h"
+#include "MsiStreamName.h"
+#include "XmlReader.h"
+#include "base64.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdexcept>
+
+namespace
+{
+    const unsigned long ENDOFCHAIN          = 0xFFFFFFFE;
+    const unsigned long NOSTREAM            = 0xFFFFFFFF;
+    const size_t        SECTOR_SIZE         = 512;
+    const size_t        MINI_SECTOR_SIZE    = 64;
+    const size_t        MINI_STREAM_CUTOFF  = 4096;
+    const size_t        DIR_ENTRY_SIZE      = 128;
+
+    // class id of Windows Installer databases {000C1084-0000-0000-C000-000000000046}
+    const unsigned char CLSID_MsiDatabase[16] = 
+        { 0x84, 0x10, 0x0C, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46 };
+
+    //--------------------------------------------------------------------------
+    unsigned long get16(const std::string& buf, size_t pos)
+    {
+        if (pos + 2 > buf.size())
+            throw std::runtime_error("read past the end of a buffer");
+        return static_cast<unsigned char>(buf[pos]) | (static_cast<unsigned char>(buf[pos + 1]) << 8);
+    }
+
+    //--------------------------------------------------------------------------
+    unsigned long get32(const std::string& buf, size_t pos)
+    {
+        return get16(buf, pos) | (get16(buf, pos + 2) << 16);
+    }
+
+    //--------------------------------------------------------------------------
+    std::string readFile(const char* path)
+    {
+        FILE* file = fopen(path, "rb");
+        if (file == 0)
+            throw std::runtime_error(std::string("Cannot open \"") + path + "\"");
+
+        std::string data;
+        char buf[65536];
+        size_t len;
+        while ((len = fread(buf, 1, sizeof(buf), file)) > 0)
+            data.append(buf, len);
+        fclose(file);
+        return data;
+    }
+
+    //--------------------------------------------------------------------------
+    // compound file names compare by length, then by their upper case characters
+    bool nameLess(const std::wstring& a, const std::wstring& b)
+    {
+        if (a.size() != b.size())
+            return a.size() < b.size();
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            wchar_t ca = a[i] >= L'a' && a[i] <= L'z' ? a[i] - 0x20 : a[i];
+            wchar_t cb = b[i] >= L'a' && b[i] <= L'z' ? b[i] - 0x20 : b[i];
+            if (ca != cb)
+                return ca < cb;
+        }
+        return false;
+    }
+
+    //--------------------------------------------------------------------------
+    // streams of the root storage of a compound file (version 3), checking
+    // the header and the directory on the way
+    class Storage
+    {
+    public:
+        explicit Storage(const std::string& file) : m_file(file)
+        {
+            static const char signature[] = "\xD0\xCF\x11\xE0\xA1\xB1\x1A\xE1";
+            CHECK(m_file.size() >= SECTOR_SIZE && m_file.size() % SECTOR_SIZE == 0);
+            CHECK(m_file.compare(0, 8, signature, 8) == 0);
+            CHECK(get16(m_file, 0x1A) == 3);            // major version
+            CHECK(get16(m_file, 0x1C) == 0xFFFE);       // byte order
+            CHECK(get16(m_file, 0x1E) == 9);            // sector shift
+            CHECK(get16(m_file, 0x20) == 6);            // mini sector shift
+            CHECK(get32(m_file, 0x38) == MINI_STREAM_CUTOFF);
+
+            // FAT sectors listed in the header (and the DIFAT)
+            unsigned long fatSectors = get32(m_file, 0x2C);
+            std::vector<unsigned long> fatList;
+            for (size_t i = 0; i < 109 && fatList.size() < fatSectors; ++i)
+                fatList.push_back(get32(m_file, 0x4C + 4 * i));
+            for (unsigned long difat = get32(m_file, 0x44); fatList.size() < fatSectors && difat != ENDOFCHAIN; )
+            {
+                std::string sector = this->sector(difat);
+                for (size_t i = 0; i + 1 < SECTOR_SIZE / 4 && fatList.size() < fatSectors; ++i)
+                    fatList.push_back(get32(sector, 4 * i));
+                difat = get32(sector, SECTOR_SIZE - 4);
+            }
+            CHECK(fatList.size() == fatSectors);
+
+            std::string fat;
+            for (size_t i = 0; i < fatList.size(); ++i)
+                fat += sector(fatList[i]);
+            for (size_t i = 0; i < fat.size(); i += 4)
+                m_fat.push_back(get32(fat, i));
+
+            // directory, mini FAT and mini stream
+            std::string dir = chain(m_fat, get32(m_file, 0x30), SECTOR_SIZE, m_file, SECTOR_SIZE);
+            CHECK(dir.size() % DIR_ENTRY_SIZE == 0);
+            for (size_t pos = 0; pos + DIR_ENTRY_SIZE <= dir.size(); pos += DIR_ENTRY_SIZE)
+            {
+                Entry entry;
+                size_t nameSize = get16(dir, pos + 0x40);
+                for (size_t i = 0; i + 2 < nameSize; i += 2)
+                    entry.name += static_cast<wchar_t>(get16(dir, pos + i));
+                entry.type = static_cast<unsigned char>(dir[pos + 0x42]);
+                entry.left = get32(dir, pos + 0x44);
+                entry.right = get32(dir, pos + 0x48);
+                entry.child = get32(dir, pos + 0x4C);
+                entry.clsid = dir.substr(pos + 0x50, 16);
+                entry.start = get32(dir, pos + 0x74);
+                entry.size = get32(dir, pos + 0x78);
+                m_entries.push_back(entry);
+            }
+
+            CHECK(!m_entries.empty() && m_entries[0].type == 5 && m_entries[0].name == L"Root Entry");
+            CHECK(m_entries[0].clsid == std::string(reinterpret_cast<const char*>(CLSID_MsiDatabase), 16));
+
+            std::string miniFat = chain(m_fat, get32(m_file, 0x3C), SECTOR_SIZE, m_file, SECTOR_SIZE);
+            for (size_t i = 0; i < miniFat.size(); i += 4)
+                m_miniFat.push_back(get32(miniFat, i));
+            m_miniStream = chain(m_fat, m_entries[0].start, SECTOR_SIZE, m_file, SECTOR_SIZE);
+            CHECK(m_miniStream.size() >= m_entries[0].size);
+
+            // every stream is reached once through the tree of the root storage
+            std::vector<bool> seen(m_entries.size());
+            walk(m_entries[0].child, seen);
+            for (size_t i = 1; i < m_entries.size(); ++i)
+                CHECK(m_entries[i].type == 0 || (m_entries[i].type == 2 && seen[i]));
+        }
+
+        // streams by name
+        const std::map<std::wstring, std::string>& streams() const { return m_streams; }
+
+    private:
+        struct Entry
+        {
+            std::wstring    name;
+            unsigned        type;
+            unsigned long   left, right, child, start, size;
+            std::string     clsid;
+        };
+
+        //----------------------------------------------------------------------
+        std::string sector(unsigned long index) const
+        {
+            if ((index + 2) * SECTOR_SIZE > m_file.size())
+                throw std::runtime_error("sector out of range");
+            return m_file.substr((index + 1) * SECTOR_SIZE, SECTOR_SIZE);
+        }
+
+        //----------------------------------------------------------------------
+        // follow a chain of sectors of a file
+        static std::string chain(const std::vector<unsigned long>& fat, unsigned long start, size_t size, 
+                                 const std::string& data, size_t offset)
+        {
+            std::string result;
+            for (unsigned long index = start; index != ENDOFCHAIN; index = fat[index])
+            {
+                if (index >= fat.size() || offset + (index + 1) * size > data.size() || result.size() > data.size())
+                    throw std::runtime_error("broken sector chain");
+                result.append(data, offset + index * size, size);
+            }
+            return result;
+        }
+
+        //----------------------------------------------------------------------
+        // read the streams of a subtree, checking the order of the names
+        void walk(unsigned long index, std::vector<bool>& seen)
+        {
+            if (index == NOSTREAM)
+                return;
+            if (index >= m_entries.size() || seen[index])
+                throw std::runtime_error("broken directory tree");
+
+            seen[index] = true;
+            const Entry& entry = m_entries[index];
+            if (entry.left != NOSTREAM && entry.left < m_entries.size())
+                CHECK(nameLess(m_entries[entry.left].name, entry.name));
+            if (entry.right != NOSTREAM && entry.right < m_entries.size())
+                CHECK(nameLess(entry.name, m_entries[entry.right].name));
+
+            std::string data = entry.size < MINI_STREAM_CUTOFF
+                ? chain(m_miniFat, entry.start, MINI_SECTOR_SIZE, m_miniStream, 0)
+                : chain(m_fat, entry.start, SECTOR_SIZE, m_file, SECTOR_SIZE);
+            CHECK(data.size() >= entry.size);
+            data.resize(entry.size);
+            CHECK(m_streams.insert(std::make_pair(entry.name, data)).second);
+
+            walk(entry.left, seen);
+            walk(entry.right, seen);
+        }
+
+        std::string                         m_file;
+        std::vector<unsigned long>          m_fat;
+        std::vector<unsigned long>          m_miniFat;
+        std::string                         m_miniStream;
+        std::vector<Entry>                  m_entries;
+        std::map<std::wstring, std::string> m_streams;
+    };
+
+    //--------------------------------------------------------------------------
+    // table of the document, fields as text in the codepage of the database;
+    // binary fields hold the decoded data
+    struct Table
+    {
+        std::vector<std::string>                columns;
+        std::vector<std::string>                defs;
+        std::vector<bool>                       keys;
+        std::vector<std::vector<std::string> >  rows;
+    };
+
+    //--------------------------------------------------------------------------
+    std::map<std::string, Table> readDocument(const char* path, unsigned& codepage)
+    {
+        std::map<std::string, Table> tables;
+        XmlReader xml(path);
+        Table* table = 0;
+        std::string text;
+        bool base64 = false;
+        codepage = 0;
+        for (XmlReader::Event event = xml.next(); event != XmlReader::eventEof; event = xml.next())
+        {
+            if (event == XmlReader::eventText)
+            {
+                text += xml.text();
+            }
+            else if (event == XmlReader::eventStart)
+            {
+                text.clear();
+                const std::string* attr = xml.attribute("dt:dt");
+                base64 = attr && *attr == "bin.base64";
+                if (xml.name() == "msi" && xml.attribute("codepage"))
+                    codepage = static_cast<unsigned>(atoi(xml.attribute("codepage")->c_str()));
+                else if (xml.name() == "table")
+                    table = &tables[*xml.attribute("name")];
+                else if (xml.name() == "col")
+                {
+                    table->defs.push_back(*xml.attribute("def"));
+                    table->keys.push_back(xml.attribute("key") && *xml.attribute("key") == "yes");
+                }
+                else if (xml.name() == "row")
+                {
+                    table->rows.push_back(std::vector<std::string>());
+                }
+            }
+            else if (xml.name() == "col")
+            {
+                table->columns.push_back(text);
+            }
+            else if (xml.name() == "td")
+            {
+                std::string field;
+                if (base64)
+                {
+                    std::vector<u_char> buf(text.size());
+                    int len = b64_pton(text.c_str(), buf.empty() ? 0 : &buf[0], buf.size());
+                    CHECK(len >= 0);
+                    field.assign(buf.begin(), buf.begin() + (std::max)(len, 0));
+                }
+                else
+                {
+                    CHECK(Codepage::fromUtf8(text, codepage, field));
+                }
+                table->rows.back().push_back(field);
+            }
+        }
+        return tables;
+    }
+
+    //--------------------------------------------------------------------------
+    // column type of a definition, from the bits documented for '_Columns'
+    unsigned columnType(const std::string& def, bool key)
+    {
+        unsigned type = 0x0100 | static_cast<unsigned>(atoi(def.c_str() + 1));     // valid, size
+        switch (tolower(def[0]))
+        {
+        case 's':   type |= 0x0C00; break;                                          // string, scalar
+        case 'l':   type |= 0x0E00; break;                                          // localizable
+        case 'i':   type |= 0x0400; break;                                          // scalar
+        case 'v':   type |= 0x0800; break;                                          // stream
+        }
+        if (isupper(static_cast<unsigned char>(def[0]))) type |= 0x1000;            // nullable
+        if (key) type |= 0x2000;
+        return type;
+    }
+
+    //--------------------------------------------------------------------------
+    // table stream: the values of the first column, then of the second etc.
+    std::vector<std::vector<unsigned long> > readTable(const std::string& data, const std::vector<unsigned>& widths)
+    {
+        size_t rowSize = 0;
+        for (size_t col = 0; col < widths.size(); ++col)
+            rowSize += widths[col];
+        CHECK(rowSize > 0 && data.size() % rowSize == 0);
+
+        size_t count = rowSize ? data.size() / rowSize : 0;
+        std::vector<std::vector<unsigned long> > rows(count, std::vector<unsigned long>(widths.size()));
+        size_t pos = 0;
+        for (size_t col = 0; col < widths.size(); ++col)
+        {
+            for (size_t row = 0; row < count; ++row, pos += widths[col])
+            {
+                unsigned long value = 0;
+                for (unsigned byte = 0; byte < widths[col]; ++byte)
+                    value |= static_cast<unsigned long>(static_cast<unsigned char>(data[pos + byte])) << (8 * byte);
+                rows[row][col] = value;
+            }
+        }
+        return rows;
+    }
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "usage: DatabaseTest <database> <document>" << std::endl;
+        return 2;
+    }
+
+    try
+    {
+        unsigned codepage;
+        std::map<std::string, Table> document = readDocument(argv[2], codepage);
+        Storage storage(readFile(argv[1]));
+
+        // decoded stream names
+        std::map<std::string, std::string> tableStreams, streams;
+        for (std::map<std::wstring, std::string>::const_iterator it = storage.streams().begin(); it != storage.streams().end(); ++it)
+        {
+            if (it->first == L"\005SummaryInformation")
+            {
+                CHECK(get16(it->second, 0) == 0xFFFE);
+                CHECK(it->second.find("Installation Database") != std::string::npos);
+                continue;
+            }
+
+            bool table = false;
+            std::wstring name = decodeStreamName(it->first, &table);
+            std::string narrow(name.begin(), name.end());
+            (table ? tableStreams : streams)[narrow] = it->second;
+        }
+        CHECK(storage.streams().count(L"\005SummaryInformation") == 1);
+
+        // string pool: codepage, then length and reference count of each string
+        const std::string& pool = tableStreams["_StringPool"];
+        const std::string& poolData = tableStreams["_StringData"];
+        CHECK(pool.size() >= 4 && pool.size() % 4 == 0);
+        unsigned long poolHeader = get32(pool, 0);
+        CHECK((poolHeader & 0x7FFFFFFF) == codepage);
+        unsigned refWidth = (poolHeader & 0x80000000) ? 3 : 2;
+
+        std::vector<std::string> strings(1);
+        std::vector<unsigned long> refs(1);
+        size_t dataPos = 0;
+        for (size_t pos = 4; pos + 4 <= pool.size(); pos += 4)
+        {
+            unsigned long len = get16(pool, pos), count = get16(pool, pos + 2);
+            if (len == 0 && count != 0 && pos + 8 <= pool.size())
+            {
+                pos += 4;
+                len = (count << 16) | get16(pool, pos);
+                count = get16(pool, pos + 2);
+            }
+            CHECK(len > 0 && count > 0 && dataPos + len <= poolData.size());
+            strings.push_back(poolData.substr(dataPos, len));
+            refs.push_back(count);
+            dataPos += len;
+        }
+        CHECK(dataPos == poolData.size());
+        std::vector<unsigned long> used(strings.size());
+
+        // string of a reference, counting it
+        auto poolString = [&](unsigned long id) -> std::string
+        {
+            CHECK(id > 0 && id < strings.size());
+            if (id == 0 || id >= strings.size())
+                return std::string();
+            ++used[id];
+            return strings[id];
+        };
+
+        // data of a stream, marking it as expected
+        std::set<std::string> expectedStreams;
+        auto stream = [&](const std::string& name) -> std::string
+        {
+            CHECK(streams.count(name) == 1);
+            expectedStreams.insert(name);
+            return streams[name];
+        };
+
+        // '_Tables' lists the tables of the document but '_Streams'
+        std::set<std::string> expectedTables, tables;
+        for (std::map<std::string, Table>::const_iterator it = document.begin(); it != document.end(); ++it)
+        {
+            if (it->first != "_Streams")
+                expectedTables.insert(it->first);
+        }
+
+        std::vector<std::vector<unsigned long> > tablesRows = readTable(tableStreams["_Tables"], std::vector<unsigned>(1, refWidth));
+        for (size_t i = 0; i < tablesRows.size(); ++i)
+            tables.insert(poolString(tablesRows[i][0]));
+        CHECK(tables == expectedTables);
+        CHECK(tablesRows.size() == tables.size());
+
+        // '_Columns': table, number, name and type of each column
+        std::vector<unsigned> widths(4, 2);
+        widths[0] = widths[2] = refWidth;
+        std::vector<std::vector<unsigned long> > columnsRows = readTable(tableStreams["_Columns"], widths);
+        std::map<std::string, std::vector<std::pair<std::string, unsigned> > > columns;
+        for (size_t i = 0; i < columnsRows.size(); ++i)
+        {
+            std::vector<std::pair<std::string, unsigned> >& cols = columns[poolString(columnsRows[i][0])];
+            CHECK(columnsRows[i][1] == 0x8000 + cols.size() + 1);
+            cols.push_back(std::make_pair(poolString(columnsRows[i][2]), static_cast<unsigned>(columnsRows[i][3] - 0x8000)));
+        }
+        CHECK(columns.size() == expectedTables.size());
+
+        // rows of each table, ordered by their keys
+        for (std::set<std::string>::const_iterator it = expectedTables.begin(); it != expectedTables.end(); ++it)
+        {
+            const Table& table = document[*it];
+            const std::vector<std::pair<std::string, unsigned> >& cols = columns[*it];
+            CHECK(cols.size() == table.columns.size());
+            if (cols.size() != table.columns.size())
+                continue;
+
+            std::vector<unsigned> widths;
+            for (size_t col = 0; col < cols.size(); ++col)
+            {
+                unsigned type = cols[col].second;
+                CHECK(cols[col].first == table.columns[col]);
+                CHECK(type == columnType(table.defs[col], table.keys[col]));
+                widths.push_back((type & 0x0C00) == 0x0C00 ? refWidth : (type & 0x0800) || (type & 0xFF) == 2 ? 2 : 4);
+            }
+
+            std::vector<std::vector<unsigned long> > stored = readTable(tableStreams[*it], widths);
+            CHECK(stored.size() == table.rows.size());
+            for (size_t row = 1; row < stored.size(); ++row)
+                CHECK(stored[row - 1] < stored[row]);
+
+            std::vector<std::vector<std::string> > rows, expected;
+            for (size_t row = 0; row < stored.size(); ++row)
+            {
+                std::vector<std::string> fields;
+                std::string streamName = *it;
+                for (size_t col = 0; col < cols.size(); ++col)
+                {
+                    unsigned type = cols[col].second;
+                    unsigned long value = stored[row][col];
+                    char buf[16] = "";
+                    if ((type & 0x0C00) == 0x0C00)
+                        fields.push_back(value ? poolString(value) : std::string());
+                    else if (type & 0x0800)
+                        fields.push_back(value ? stream(streamName) : std::string());
+                    else if (value == 0)
+                        fields.push_back(std::string());
+                    else if ((type & 0xFF) == 2)
+                        fields.push_back((sprintf(buf, "%ld", static_cast<long>(value) - 0x8000), buf));
+                    else
+                        fields.push_back((sprintf(buf, "%ld", static_cast<long>(value ^ 0x80000000)), buf));
+
+                    if (type & 0x2000)
+                        streamName += '.' + fields.back();
+                }
+                rows.push_back(fields);
+            }
+
+            for (size_t row = 0; row < table.rows.size(); ++row)
+                expected.push_back(table.rows[row]);
+            std::sort(rows.begin(), rows.end());
+            std::sort(expected.begin(), expected.end());
+            CHECK(rows == expected);
+        }
+
+        // streams of '_Streams'
+        const Table& streamsTable = document["_Streams"];
+        for (size_t row = 0; row < streamsTable.rows.size(); ++row)
+            CHECK(stream(streamsTable.rows[row][0]) == streamsTable.rows[row][1]);
+
+        // no other streams
+        CHECK(expectedStreams.size() == streams.size());
+
+        // reference counts of the string pool
+        for (size_t id = 1; id < strings.size(); ++id)
+            CHECK(used[id] == refs[id]);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    return failures();
+}
@@ -0,0 +1,113 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// IDT round trip: fields with tabs and line breaks survive escaping, and
+// a table written by IdtWriter, NUL characters included, reads back
+// unchanged with IdtReader.
+//
+//------------------------------------------------------------------------------
+#include "Check.h"
+#include "Idt.h"
+#include <stdexcept>
+
+//------------------------------------------------------------------------------
+int main()
+{
+    const char* samples[] =
+    {
+        "", "plain", "\t", "a\tb", "line 1\r\nline 2", "\n\n\r\r\t\t", "x\x10y", "\xE4\xF6\xFC\t\xDF"
+    };
+    const size_t count = sizeof(samples) / sizeof(samples[0]);
+
+    // escaping
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::string field(samples[i]);
+        std::string escaped = IdtWriter::escape(field);
+        CHECK(escaped.find_first_of("\t\r\n") == std::string::npos);
+        CHECK(escaped.size() == field.size());
+        if (field.find_first_of("\x10\x11\x19") == std::string::npos)
+            CHECK(IdtReader::unescape(escaped) == field);
+    }
+    CHECK(IdtWriter::escape("a\tb\rc\nd") == "a\x10" "b\x11" "c\x19" "d");
+
+    // files
+    std::vector<std::string> columns, defs, keys;
+    columns.push_back("Property");
+    columns.push_back("Value");
+    defs.push_back("s72");
+    defs.push_back("l0");
+    keys.push_back("Property");
+
+    std::vector<std::vector<std::string> > rows;
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::vector<std::string> row;
+        row.push_back("Key" + std::string(1, static_cast<char>('A' + i)));
+        row.push_back(samples[i]);
+        if (row[1].find_first_of("\x10\x11\x19") == std::string::npos) rows.push_back(row);
+    }
+
+    // fields with NUL characters, and lines longer than the read buffer
+    std::vector<std::string> row;
+    row.push_back("KeyNul");
+    row.push_back(std::string("a\0b\0", 4));
+    rows.push_back(row);
+    row[0] = "KeyLong";
+    row[1] = std::string(100000, 'x') + '\0' + std::string(100000, 'y');
+    rows.push_back(row);
+
+    try
+    {
+        IdtWriter writer(".", "Property", columns, defs, keys, 1252);
+        for (size_t i = 0; i < rows.size(); ++i) writer.writeRow(rows[i]);
+        writer.close();
+
+        IdtReader reader(".", writer.fileName());
+        CHECK(reader.table() == "Property");
+        CHECK(reader.columns() == columns);
+        CHECK(reader.defs() == defs);
+        CHECK(reader.keys() == keys);
+        CHECK(reader.codepage() == 1252);
+
+        std::vector<std::string> fields;
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            CHECK(reader.readRow(fields));
+            CHECK(fields == rows[i]);
+            CHECK(reader.line() == 4 + i);
+        }
+        CHECK(!reader.readRow(fields));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        CHECK(!"IDT file round trip failed");
+    }
+
+    return failures();
+}
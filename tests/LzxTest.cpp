@@ -0,0 +1,352 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// LZX round trip: frames written by Lzx are decoded by the reference
+// decoder below, written from MS-PATCH section 2 independently of the
+// encoder. The decoder is strict where the format leaves the encoder a
+// choice that cabinet extractors do not all accept: matches must not
+// cross a frame or a block, and the bitstream must end with the data.
+//
+//------------------------------------------------------------------------------
+#include "Check.h"
+#include "TestData.h"
+#include "Lzx.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+    const int           NUM_CHARS       = 256;
+    const int           PRETREE_SIZE    = 20;
+    const int           ALIGNED_SIZE    = 8;
+    const int           LENGTH_SIZE     = 249;
+    const int           MAX_SLOTS       = 50;
+
+    //--------------------------------------------------------------------------
+    // bit reader: 16 bit little-endian words, most significant bit first
+    class BitReader
+    {
+    public:
+        explicit BitReader(const std::vector<unsigned char>& data) : m_data(data), m_pos(0), m_acc(0), m_bits(0) {}
+
+        unsigned read(int n)
+        {
+            if (n == 0)
+                return 0;
+
+            while (m_bits < n)
+            {
+                if (m_pos >= m_data.size())
+                    throw std::runtime_error("Read past the end of the data");
+                unsigned word = m_data[m_pos] | (m_pos + 1 < m_data.size() ? m_data[m_pos + 1] << 8 : 0);
+                m_pos += 2;
+                m_acc = (m_acc << 16) | word;
+                m_bits += 16;
+            }
+
+            m_bits -= n;
+            return static_cast<unsigned>(m_acc >> m_bits) & ((1u << n) - 1);
+        }
+
+        void align()
+        {
+            m_bits -= m_bits % 16;
+        }
+
+        // all data consumed
+        bool atEnd() const
+        {
+            return m_bits == 0 && m_pos >= m_data.size();
+        }
+
+    private:
+        const std::vector<unsigned char>& m_data;
+        size_t                  m_pos;
+        unsigned long long      m_acc;
+        int                     m_bits;
+    };
+
+    //--------------------------------------------------------------------------
+    // canonical Huffman decoder
+    class HuffmanDecoder
+    {
+    public:
+        void build(const unsigned char* lengths, int count)
+        {
+            std::fill(m_count, m_count + 17, 0);
+            for (int i = 0; i < count; ++i) ++m_count[lengths[i]];
+            m_count[0] = 0;
+
+            int offsets[17] = { 0 };
+            for (int len = 1; len < 16; ++len) offsets[len + 1] = offsets[len] + m_count[len];
+
+            m_symbols.assign(count, 0);
+            for (int i = 0; i < count; ++i)
+            {
+                if (lengths[i] != 0) m_symbols[offsets[lengths[i]]++] = i;
+            }
+        }
+
+        int decode(BitReader& in) const
+        {
+            int code = 0, first = 0, index = 0;
+            for (int len = 1; len <= 16; ++len)
+            {
+                code |= in.read(1);
+                int count = m_count[len];
+                if (code - first < count)
+                    return m_symbols[index + code - first];
+                index += count;
+                first = (first + count) << 1;
+                code <<= 1;
+            }
+
+            throw std::runtime_error("Invalid Huffman code");
+        }
+
+    private:
+        int                     m_count[17];
+        std::vector<int>        m_symbols;
+    };
+
+    //--------------------------------------------------------------------------
+    // read a tree as deltas to the previous lengths of the same tree
+    void readLengths(BitReader& in, unsigned char* lengths, int first, int last)
+    {
+        unsigned char pretreeLengths[PRETREE_SIZE];
+        for (int i = 0; i < PRETREE_SIZE; ++i) pretreeLengths[i] = static_cast<unsigned char>(in.read(4));
+        HuffmanDecoder pretree;
+        pretree.build(pretreeLengths, PRETREE_SIZE);
+
+        for (int x = first; x < last; )
+        {
+            int z = pretree.decode(in);
+            if (z == 17 || z == 18)
+            {
+                int run = z == 17 ? 4 + in.read(4) : 20 + in.read(5);
+                if (x + run > last) throw std::runtime_error("Zero run past the end of the tree");
+                std::fill(lengths + x, lengths + x + run, 0);
+                x += run;
+            }
+            else if (z == 19)
+            {
+                int run = 4 + in.read(1);
+                if (x + run > last) throw std::runtime_error("Run past the end of the tree");
+                z = pretree.decode(in);
+                if (z > 16) throw std::runtime_error("Invalid length in a run");
+                unsigned char len = static_cast<unsigned char>((lengths[x] - z + 17) % 17);
+                std::fill(lengths + x, lengths + x + run, len);
+                x += run;
+            }
+            else
+            {
+                lengths[x] = static_cast<unsigned char>((lengths[x] - z + 17) % 17);
+                ++x;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // decompress the frames of an LZX folder
+    std::vector<unsigned char> decompress(const std::vector<Lzx::Frame>& frames, int windowBits)
+    {
+        std::vector<unsigned char> stream;
+        size_t total = 0;
+        for (size_t i = 0; i < frames.size(); ++i)
+        {
+            if (i + 1 < frames.size() && frames[i].size != Lzx::FRAME_SIZE)
+                throw std::runtime_error("Short frame before the last frame");
+            stream.insert(stream.end(), frames[i].data.begin(), frames[i].data.end());
+            total += frames[i].size;
+        }
+
+        unsigned char extraBits[MAX_SLOTS];
+        unsigned long base[MAX_SLOTS];
+        for (int i = 0, j = 0; i < MAX_SLOTS; ++i)
+        {
+            extraBits[i] = static_cast<unsigned char>(i < 4 ? 0 : (std::min)((i - 2) / 2, 17));
+            base[i] = j;
+            j += 1 << extraBits[i];
+        }
+
+        int slots = windowBits == 21 ? 50 : windowBits == 20 ? 42 : 2 * windowBits;
+        int mainSize = NUM_CHARS + 8 * slots;
+        unsigned char mainLengths[NUM_CHARS + 8 * MAX_SLOTS] = { 0 };
+        unsigned char lengthLengths[LENGTH_SIZE] = { 0 };
+        unsigned char alignedLengths[ALIGNED_SIZE] = { 0 };
+        HuffmanDecoder mainTree, lengthTree, alignedTree;
+        unsigned long reps[3] = { 1, 1, 1 };
+
+        BitReader in(stream);
+        std::vector<unsigned char> out;
+        if (total == 0)
+            return out;
+        if (in.read(1) != 0)
+            throw std::runtime_error("Unexpected E8 translation");
+
+        unsigned long remaining = 0;
+        bool aligned = false;
+        while (out.size() < total)
+        {
+            if (remaining == 0)
+            {
+                unsigned type = in.read(3);
+                if (type != 1 && type != 2) throw std::runtime_error("Unexpected block type");
+                aligned = type == 2;
+                remaining = in.read(16) << 8;
+                remaining |= in.read(8);
+                if (remaining == 0 || out.size() + remaining > total) throw std::runtime_error("Invalid block size");
+
+                if (aligned)
+                {
+                    for (int i = 0; i < ALIGNED_SIZE; ++i) alignedLengths[i] = static_cast<unsigned char>(in.read(3));
+                    alignedTree.build(alignedLengths, ALIGNED_SIZE);
+                }
+
+                readLengths(in, mainLengths, 0, NUM_CHARS);
+                readLengths(in, mainLengths, NUM_CHARS, mainSize);
+                readLengths(in, lengthLengths, 0, LENGTH_SIZE);
+                mainTree.build(mainLengths, mainSize);
+                lengthTree.build(lengthLengths, LENGTH_SIZE);
+            }
+
+            size_t frameEnd = (out.size() / Lzx::FRAME_SIZE + 1) * Lzx::FRAME_SIZE;
+            int sym = mainTree.decode(in);
+            unsigned long len = 1;
+            if (sym < NUM_CHARS)
+            {
+                out.push_back(static_cast<unsigned char>(sym));
+            }
+            else
+            {
+                int header = (sym - NUM_CHARS) & 7, slot = (sym - NUM_CHARS) >> 3;
+                len = header + 2;
+                if (header == 7) len += lengthTree.decode(in);
+
+                unsigned long offset;
+                if (slot < 3)
+                {
+                    offset = reps[slot];
+                    reps[slot] = reps[0];
+                    reps[0] = offset;
+                }
+                else
+                {
+                    int extra = extraBits[slot];
+                    unsigned long footer;
+                    if (aligned && extra >= 3)
+                        footer = (in.read(extra - 3) << 3) + alignedTree.decode(in);
+                    else
+                        footer = in.read(extra);
+
+                    offset = base[slot] + footer - 2;
+                    reps[2] = reps[1];
+                    reps[1] = reps[0];
+                    reps[0] = offset;
+                }
+
+                if (offset == 0 || offset > out.size() || offset > (1ul << windowBits) - 3)
+                    throw std::runtime_error("Match offset out of range");
+                if (len > remaining || out.size() + len > frameEnd)
+                    throw std::runtime_error("Match crosses a block or frame");
+
+                for (unsigned long i = 0; i < len; ++i) out.push_back(out[out.size() - offset]);
+            }
+
+            remaining -= len;
+            if (out.size() == frameEnd || out.size() == total)
+                in.align();
+        }
+
+        if (!in.atEnd())
+            throw std::runtime_error("Data after the end of the folder");
+        return out;
+    }
+
+    //--------------------------------------------------------------------------
+    // compress data in pieces of a given size and decompress it again
+    void roundTrip(const std::vector<unsigned char>& data, int windowBits, Lzx::Effort effort, size_t piece)
+    {
+        Lzx lzx(windowBits, effort);
+        std::vector<Lzx::Frame> frames;
+        for (size_t pos = 0; pos < data.size(); pos += piece)
+            lzx.compress(&data[pos], (std::min)(piece, data.size() - pos), frames);
+        lzx.finish(frames);
+
+        for (size_t i = 0; i < frames.size(); ++i) CHECK(frames[i].data.size() % 2 == 0);
+
+        try
+        {
+            std::vector<unsigned char> out = decompress(frames, windowBits);
+            size_t i = 0;
+            while (i < out.size() && i < data.size() && out[i] == data[i]) ++i;
+            if (i != data.size() || out.size() != data.size())
+            {
+                std::cerr << "window " << windowBits << ", effort " << effort << ", " << data.size() 
+                          << " bytes: first difference at " << i << std::endl;
+                CHECK(!"wrong data");
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "window " << windowBits << ", effort " << effort << ": " << e.what() << std::endl;
+            CHECK(!"decompression failed");
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+int main()
+{
+    const Lzx::Effort efforts[] = { Lzx::effortFast, Lzx::effortNormal, Lzx::effortMax };
+    for (int e = 0; e < 3; ++e)
+    {
+        roundTrip(std::vector<unsigned char>(), 15, efforts[e], 1);
+        roundTrip(testData(1, 1), 15, efforts[e], 1);
+        for (int kind = 0; kind < 4; ++kind)
+        {
+            roundTrip(testData(kind, 3000, kind + 1), 16, efforts[e], 3000);
+            roundTrip(testData(kind, 300000 + kind, kind + 1), 15, efforts[e], 70000);
+            roundTrip(testData(kind, 600000, kind + 1), 21, efforts[e], 4096);
+        }
+    }
+
+    // the output does not depend on how the data is passed to compress()
+    std::vector<unsigned char> data = testData(3, 200000, 7);
+    std::vector<Lzx::Frame> whole, pieces;
+    Lzx a(17, Lzx::effortNormal), b(17, Lzx::effortNormal);
+    a.compress(&data[0], data.size(), whole);
+    a.finish(whole);
+    for (size_t pos = 0; pos < data.size(); pos += 1000)
+        b.compress(&data[pos], (std::min)(static_cast<size_t>(1000), data.size() - pos), pieces);
+    b.finish(pieces);
+    CHECK(whole.size() == pieces.size());
+    for (size_t i = 0; i < whole.size() && i < pieces.size(); ++i)
+        CHECK(whole[i].data == pieces[i].data && whole[i].size == pieces[i].size);
+
+    return failures();
+}
@@ -0,0 +1,117 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// MSZIP round trip: blocks written by MsZip are inflated by zlib, with the
+// preceding 32 KB of the folder as the dictionary, as a cabinet
+// extractor does.
+//
+//------------------------------------------------------------------------------
+#include "Check.h"
+#include "TestData.h"
+#include "MsZip.h"
+#include <zlib.h>
+#include <algorithm>
+
+namespace
+{
+    //--------------------------------------------------------------------------
+    // decompress an MSZIP folder, block by block (false if a block is malformed)
+    bool decompress(const std::vector<std::vector<unsigned char> >& blocks, 
+                    const std::vector<size_t>& sizes, 
+                    std::vector<unsigned char>& out)
+    {
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            const std::vector<unsigned char>& block = blocks[i];
+            if (block.size() < 2 || block[0] != 'C' || block[1] != 'K')
+                return false;
+
+            z_stream zs = z_stream();
+            if (inflateInit2(&zs, -MAX_WBITS) != Z_OK)
+                return false;
+
+            size_t historyLen = (std::min)(out.size(), static_cast<size_t>(MsZip::HISTORY_SIZE));
+            if (historyLen > 0)
+                inflateSetDictionary(&zs, &out[out.size() - historyLen], static_cast<uInt>(historyLen));
+
+            size_t start = out.size();
+            out.resize(start + sizes[i] + 1);
+            zs.next_in = const_cast<Bytef*>(&block[2]);
+            zs.avail_in = static_cast<uInt>(block.size() - 2);
+            zs.next_out = &out[start];
+            zs.avail_out = static_cast<uInt>(sizes[i] + 1);
+            int res = inflate(&zs, Z_FINISH);
+            size_t written = zs.total_out;
+            inflateEnd(&zs);
+
+            out.resize(start + written);
+            if (res != Z_STREAM_END || written != sizes[i] || zs.avail_in != 0)
+                return false;
+        }
+
+        return true;
+    }
+
+    //--------------------------------------------------------------------------
+    // compress data as one folder and decompress it again
+    void roundTrip(const std::vector<unsigned char>& data)
+    {
+        std::vector<std::vector<unsigned char> > blocks;
+        std::vector<size_t> sizes;
+        for (size_t pos = 0; pos < data.size() || pos == 0; pos += MsZip::BLOCK_SIZE)
+        {
+            size_t len = (std::min)(data.size() - pos, static_cast<size_t>(MsZip::BLOCK_SIZE));
+            size_t historyLen = (std::min)(pos, static_cast<size_t>(MsZip::HISTORY_SIZE));
+            std::vector<unsigned char> block;
+            MsZip::compressBlock(data.empty() ? NULL : &data[pos - historyLen], historyLen, 
+                                 data.empty() ? NULL : &data[pos], len, block);
+            CHECK(block.size() <= MsZip::MAX_BLOCK_SIZE);
+            blocks.push_back(block);
+            sizes.push_back(len);
+            if (data.empty()) break;
+        }
+
+        std::vector<unsigned char> out;
+        CHECK(decompress(blocks, sizes, out));
+        CHECK(out == data);
+    }
+}
+
+//------------------------------------------------------------------------------
+int main()
+{
+    roundTrip(std::vector<unsigned char>());
+    roundTrip(testData(1, 1));
+    for (int kind = 0; kind < 4; ++kind)
+    {
+        roundTrip(testData(kind, 1000, kind + 1));
+        roundTrip(testData(kind, MsZip::BLOCK_SIZE, kind + 1));
+        roundTrip(testData(kind, 5 * MsZip::BLOCK_SIZE + 123, kind + 1));
+    }
+
+    return failures();
+}
@@ -0,0 +1,185 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// TableIndex and XmlReader::skipTo: the index finds every child of the
+// root element, and a reader that skips the content of a table continues
+// with the same events, at the same positions, as one that parses it.
+//
+//------------------------------------------------------------------------------
+#include "Check.h"
+#include "TableIndex.h"
+#include "XmlReader.h"
+#include <stdio.h>
+#include <stdexcept>
+
+namespace
+{
+    const char*         PATH        = "TableIndexTest.xml";
+
+    //--------------------------------------------------------------------------
+    // event of the reader, with its position
+    struct Event
+    {
+        XmlReader::Event    type;
+        std::string         name;
+        std::string         text;
+        unsigned            line;
+        unsigned            column;
+        unsigned long long  offset;
+
+        bool operator==(const Event& rhs) const
+        {
+            return type == rhs.type && name == rhs.name && text == rhs.text 
+                && line == rhs.line && column == rhs.column && offset == rhs.offset;
+        }
+    };
+
+    //--------------------------------------------------------------------------
+    // write the test document
+    void writeDocument()
+    {
+        FILE* file = fopen(PATH, "wb");
+        fputs("<?xml version=\"1.0\" encoding=\"windows-1252\"?>\r\n"
+              "<!DOCTYPE msi [\r\n"
+              "  <!ELEMENT msi (summary,table*)>\r\n"
+              "  <!ATTLIST msi version CDATA #REQUIRED>\r\n"
+              "]>\r\n"
+              "<msi version=\"2.0\">\r\n"
+              "  <summary><codepage>1252</codepage><title>Installation &amp; Database</title></summary>\r\n"
+              "  <!-- </table> in a comment -->\r\n"
+              "  <table name=\"Binary\">\r\n"
+              "    <col key=\"yes\" def=\"s72\">Name</col>\r\n"
+              "    <col def=\"v0\">Data</col>\r\n", file);
+
+        for (int i = 0; i < 40; ++i)
+        {
+            fprintf(file, "    <row><td>Data%d</td><td href=\"a&gt;b\" dt:dt=\"bin.base64\">\r\n", i);
+            for (int j = 0; j < 40 * i; ++j)
+                fputs("QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2d3h5ejAxMjM0NTY3\r\n", file);
+            fputs("</td></row>\r\n", file);
+        }
+
+        fputs("  </table>\r\n"
+              "  <table name=\"Empty\"/>\r\n"
+              "  <table name=\"Property\">\r\n"
+              "    <col key=\"yes\" def=\"s72\">Property</col>\r\n"
+              "    <col def=\"l0\">Value</col>\r\n"
+              "    <row><td>Quote</td><td><![CDATA[</table> & <row>]]></td></row>\r\n"
+              "    <row><td>Attr</td><td>&#x3C;/table&#62;</td></row>\r\n"
+              "  </table>\r\n"
+              "  <table name=\"Last\"><col def=\"s72\">Name</col></table>\r\n"
+              "</msi>\r\n", file);
+        fclose(file);
+    }
+
+    //--------------------------------------------------------------------------
+    // read the document, leaving out the content of the tables in skip; with an
+    // index the content is skipped, without one it is parsed but not recorded
+    std::vector<Event> readDocument(const TableIndex* index, const std::string& skip)
+    {
+        std::vector<Event> events;
+        XmlReader xml(PATH);
+        bool skipping = false;
+        for (;;)
+        {
+            Event event;
+            event.type = xml.next();
+            event.name = event.type == XmlReader::eventText ? "" : xml.name();
+            event.text = event.type == XmlReader::eventText ? xml.text() : "";
+            event.line = xml.line();
+            event.column = xml.column();
+            event.offset = xml.eventOffset();
+            if (skipping && event.type == XmlReader::eventEnd && xml.depth() == 1)
+                skipping = false;
+            if (!skipping)
+                events.push_back(event);
+            if (event.type == XmlReader::eventEof)
+                break;
+
+            const std::string* name = xml.attribute("name");
+            if (event.type != XmlReader::eventStart || xml.depth() != 2 || xml.emptyElement()
+                || name == 0 || skip.find("," + *name + ",") == std::string::npos)
+                continue;
+
+            if (index == 0)
+            {
+                skipping = true;
+                continue;
+            }
+
+            const TableIndex::Entry* entry = index->entryAt(xml.eventOffset());
+            CHECK(entry != 0);
+            if (entry != 0)
+            {
+                CHECK(entry->name == *name);
+                CHECK(entry->contentOffset == xml.offset());
+                xml.skipTo(entry->endOffset, entry->endLine, entry->endColumn);
+            }
+        }
+
+        return events;
+    }
+}
+
+//------------------------------------------------------------------------------
+int main()
+{
+    try
+    {
+        writeDocument();
+        TableIndex index(PATH);
+
+        const TableIndex::Entries& entries = index.entries();
+        CHECK(entries.size() == 5);
+        if (entries.size() == 5)
+        {
+            CHECK(entries[0].element == "summary");
+            CHECK(entries[1].element == "table" && entries[1].name == "Binary" && !entries[1].empty);
+            CHECK(entries[2].name == "Empty" && entries[2].empty);
+            CHECK(entries[2].contentOffset == entries[2].endOffset);
+            CHECK(entries[3].name == "Property");
+            CHECK(entries[4].name == "Last");
+        }
+
+        CHECK(index.table("Property") == &entries[3]);
+        CHECK(index.table("Missing") == 0);
+        CHECK(index.entryAt(entries[1].offset) == &entries[1]);
+        CHECK(index.entryAt(entries[1].offset + 1) == 0);
+
+        CHECK(readDocument(&index, ",Binary,") == readDocument(0, ",Binary,"));
+        CHECK(readDocument(&index, ",Property,Last,") == readDocument(0, ",Property,Last,"));
+        CHECK(readDocument(&index, ",Empty,") == readDocument(0, ""));
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        CHECK(!"Exception");
+    }
+
+    remove(PATH);
+    return failures();
+}
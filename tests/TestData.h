@@ -0,0 +1,109 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Test data for the compressors
+//
+//------------------------------------------------------------------------------
+#ifndef TEST_DATA_H_INCLUDED
+#define TEST_DATA_H_INCLUDED
+
+#include <string>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// deterministic pseudo-random generator
+class Random
+{
+public:
+    explicit Random(unsigned long seed) : m_state(seed) {}
+
+    unsigned next(unsigned n)
+    {
+        m_state = (m_state * 1103515245ul + 12345ul) & 0x7FFFFFFF;
+        return static_cast<unsigned>((m_state >> 8) % n);
+    }
+
+private:
+    unsigned long m_state;
+};
+
+//------------------------------------------------------------------------------
+// data of a given kind: 0 random bytes, 1 text, 2 runs of a byte, 3 records
+// with repeated fields at small and large distances
+inline std::vector<unsigned char> testData(int kind, size_t size, unsigned long seed = 1)
+{
+    static const char* words[] =
+    {
+        "Component", "Directory", "File", "Feature", "Registry", "Property",
+        "INSTALLDIR", "ProgramFilesFolder", "[TARGETDIR]", "msi2xml", "\r\n", " "
+    };
+
+    Random random(seed);
+    std::vector<unsigned char> data;
+    data.reserve(size);
+    while (data.size() < size)
+    {
+        switch (kind)
+        {
+        case 0:
+            data.push_back(static_cast<unsigned char>(random.next(256)));
+            break;
+
+        case 1:
+        {
+            const char* word = words[random.next(sizeof(words) / sizeof(words[0]))];
+            data.insert(data.end(), word, word + std::string(word).size());
+            break;
+        }
+
+        case 2:
+            data.insert(data.end(), 1 + random.next(600), static_cast<unsigned char>(random.next(4)));
+            break;
+
+        default:
+            if (data.size() > 64 && random.next(3) != 0)
+            {
+                size_t distance = 1 + random.next(random.next(2) ? 64 : static_cast<unsigned>(data.size()));
+                if (distance > data.size()) distance = data.size();
+                size_t len = 2 + random.next(random.next(4) ? 16 : 300);
+                size_t from = data.size() - distance;
+                for (size_t i = 0; i < len; ++i) data.push_back(data[from + i]);
+            }
+            else
+            {
+                for (unsigned i = random.next(8); i > 0; --i)
+                    data.push_back(static_cast<unsigned char>(random.next(256)));
+            }
+            break;
+        }
+    }
+
+    data.resize(size);
+    return data;
+}
+
+#endif // TEST_DATA_H_INCLUDED
@@ -0,0 +1,162 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// XmlValidator driven by XmlReader, as for a document being loaded: valid
+// documents pass, and each error is reported at the line and column of
+// the markup that causes it.
+//
+//------------------------------------------------------------------------------
+#include "Check.h"
+#include "XmlReader.h"
+#include "XmlValidator.h"
+#include <stdio.h>
+#include <stdexcept>
+
+namespace
+{
+    const char*         PATH        = "XmlValidatorTest.xml";
+
+    // valid document, one element per line
+    const char* const   LINES[] =
+    {
+        "<?xml version=\"1.0\"?>",
+        "<msi version=\"2.0\" xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" msm=\"no\">",
+        "<summary>",
+        "  <codepage>1252</codepage>",
+        "  <template>Intel;1033</template>",
+        "  <revnumber>{00000000-0000-0000-0000-000000000000}</revnumber>",
+        "  <pagecount>200</pagecount>",
+        "  <wordcount>2</wordcount>",
+        "</summary>",
+        "<table name=\"Property\" rows=\"1\">",
+        "  <col key=\"yes\" def=\"s72\">Property</col>",
+        "  <col def=\"l0\">Value</col>",
+        "  <row><td>ProductName</td><td dt:dt=\"string\">msi2xml</td></row>",
+        "</table>",
+        "</msi>"
+    };
+
+    const size_t        LINE_COUNT  = sizeof(LINES) / sizeof(LINES[0]);
+
+    //--------------------------------------------------------------------------
+    // write the document with line index replaced (or removed if replacement is NULL)
+    void writeDocument(size_t index, const char* replacement)
+    {
+        FILE* file = fopen(PATH, "wb");
+        for (size_t i = 0; i < LINE_COUNT; ++i)
+        {
+            const char* line = i == index ? replacement : LINES[i];
+            if (line != 0) fprintf(file, "%s\n", line);
+        }
+        fclose(file);
+    }
+
+    //--------------------------------------------------------------------------
+    // validate the document (false on the first error, with its position)
+    bool validate(std::string& error, unsigned& line, unsigned& column)
+    {
+        XmlReader xml(PATH);
+        XmlValidator validator;
+        for (;;)
+        {
+            XmlReader::Event event = xml.next();
+            bool valid = true;
+            switch (event)
+            {
+            case XmlReader::eventStart: valid = validator.startElement(xml.name(), xml.attributes()); break;
+            case XmlReader::eventEnd:   valid = validator.endElement(); break;
+            case XmlReader::eventText:  valid = validator.text(xml.text()); break;
+            case XmlReader::eventEof:   valid = validator.endDocument(); break;
+            }
+
+            if (!valid)
+            {
+                error = validator.error();
+                line = xml.line();
+                column = xml.column();
+                return false;
+            }
+
+            if (event == XmlReader::eventEof)
+                return true;
+        }
+    }
+
+    //--------------------------------------------------------------------------
+    // check that the modified document fails at line and column with an error containing message
+    void expectError(size_t index, const char* replacement, unsigned line, unsigned column, const char* message)
+    {
+        writeDocument(index, replacement);
+
+        std::string error;
+        unsigned errorLine = 0, errorColumn = 0;
+        CHECK(!validate(error, errorLine, errorColumn));
+        if (errorLine != line || errorColumn != column || error.find(message) == std::string::npos)
+        {
+            std::cerr << "expected (" << line << "," << column << "): " << message << std::endl
+                      << "     got (" << errorLine << "," << errorColumn << "): " << error << std::endl;
+            CHECK(!"wrong error");
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+int main()
+{
+    try
+    {
+        std::string error;
+        unsigned line = 0, column = 0;
+        writeDocument(LINE_COUNT, 0);
+        CHECK(validate(error, line, column));
+        CHECK(error.empty());
+
+        // attributes
+        expectError(1, "<msi version=\"2.0\" msm=\"maybe\">", 2, 1, "'msm'");
+        expectError(1, "<msi msm=\"no\">", 2, 1, "'version'");
+        expectError(9, "<table rows=\"1\">", 10, 1, "'name'");
+        expectError(12, "  <row><td>ProductName</td><td lang=\"en\">msi2xml</td></row>", 13, 28, "'lang'");
+
+        // order and content
+        expectError(4, 0, 5, 3, "missing <template>");
+        expectError(7, 0, 8, 1, "missing <wordcount>");
+        expectError(2, "<table name=\"Early\">", 3, 1, "<summary>");
+        expectError(10, "  <row><td>Early</td></row>", 11, 3, "has no columns");
+        expectError(11, "  <col def=\"l0\">Value</col> text", 12, 28, "Text is not allowed in <table>");
+        expectError(12, "  <row><td>ProductName<b/></td></row>", 13, 23, "<b>");
+        expectError(13, "</table><summary/>", 14, 9, "<summary>");
+        expectError(13, "</table><table name=\"Columns\"></table>", 14, 31, "'Columns' has no columns");
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        CHECK(!"Exception");
+    }
+
+    remove(PATH);
+    return failures();
+}
@@ -0,0 +1,235 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "stdafx.h"
+#include "CabCache.h"
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+CabCache::CabCache(const tstring& cacheDir, ULONGLONG maxSize) :
+    m_dir(cacheDir),
+    m_maxSize(maxSize),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0),
+    m_entries(0),
+    m_size(0)
+{
+    if (!m_dir.empty() && m_dir[m_dir.length() - 1] != _T('\\') && m_dir[m_dir.length() - 1] != _T('/'))
+    {
+        m_dir += _T('\\');
+    }
+
+    if (!CreateDirectory(m_dir.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+        _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+}
+
+//------------------------------------------------------------------------------
+// Copy a cached cabinet
+//------------------------------------------------------------------------------
+bool CabCache::fetch(const tstring& key, const tstring& path)
+{
+    tstring entry = entryPath(key);
+    if (!CopyFile(entry.c_str(), path.c_str(), FALSE))
+    {
+        ++m_misses;
+        return false;
+    }
+
+    // mark entry as recently used
+    touch(entry);
+
+    ++m_hits;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Add a cabinet to the cache (runs on a worker thread)
+//------------------------------------------------------------------------------
+bool CabCache::store(const tstring& key, const tstring& name, const tstring& path, const std::string& manifest)
+{
+    // copy to a temporary file first, so that no other build sees a partial entry
+    _TCHAR tempPath[MAX_PATH];
+    if (GetTempFileName(m_dir.c_str(), _T("cab"), 0, tempPath) == 0)
+        return false;
+
+    tstring entry = entryPath(key);
+    if (!CopyFile(path.c_str(), tempPath, FALSE) 
+        || !MoveFileEx(tempPath, entry.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFile(tempPath);
+        return false;
+    }
+
+    // the copy keeps the time stamp of the source
+    touch(entry);
+
+    // manifest and name index for delta rebuilds
+    return writeFile(m_dir + key + _T(".lst"), manifest)
+        && writeFile(m_dir + name + _T(".last"), (const char*)_bstr_t(key.c_str()));
+}
+
+//------------------------------------------------------------------------------
+// Find the last cabinet stored under a name
+//------------------------------------------------------------------------------
+bool CabCache::previous(const tstring& name, tstring& path, std::string& manifest) const
+{
+    std::string key;
+    if (!readFile(m_dir + name + _T(".last"), key))
+        return false;
+
+    tstring keyT = (LPCTSTR)_bstr_t(key.c_str());
+    tstring entry = entryPath(keyT);
+    if (GetFileAttributes(entry.c_str()) == INVALID_FILE_ATTRIBUTES)
+        return false;
+
+    if (!readFile(m_dir + keyT + _T(".lst"), manifest))
+        return false;
+
+    path = entry;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Evict least recently used cabinets
+//------------------------------------------------------------------------------
+void CabCache::trim()
+{
+    struct Entry
+    {
+        ULONGLONG   lastUse;
+        ULONGLONG   size;
+        tstring     name;
+
+        bool operator<(const Entry& rhs) const { return lastUse < rhs.lastUse; }
+    };
+
+    // list entries
+    std::vector<Entry> entries;
+    m_size = 0;
+
+    tstring findMask = m_dir + _T("*.cab");
+    WIN32_FIND_DATA ffd;
+    HANDLE hFirst = FindFirstFile(findMask.c_str(), &ffd);
+    if (hFirst != INVALID_HANDLE_VALUE)
+    {
+        SmrtFindHandle hFind(hFirst);
+        do
+        {
+            if ((ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+            {
+                Entry entry;
+                entry.lastUse = (static_cast<ULONGLONG>(ffd.ftLastWriteTime.dwHighDateTime) << 32) | ffd.ftLastWriteTime.dwLowDateTime;
+                entry.size    = (static_cast<ULONGLONG>(ffd.nFileSizeHigh) << 32) | ffd.nFileSizeLow;
+                entry.name    = ffd.cFileName;
+                entries.push_back(entry);
+                m_size += entry.size;
+            }
+        } 
+        while (FindNextFile(hFind, &ffd));
+    }
+
+    // evict oldest first
+    std::sort(entries.begin(), entries.end());
+    std::vector<Entry>::const_iterator it = entries.begin();
+    for (; it != entries.end() && m_maxSize != 0 && m_size > m_maxSize; ++it)
+    {
+        tstring path = m_dir + it->name;
+        if (DeleteFile(path.c_str()))
+        {
+            path.replace(path.length() - 4, 4, _T(".lst"));
+            DeleteFile(path.c_str());
+
+            m_size -= it->size;
+            ++m_evictions;
+        }
+    }
+
+    m_entries = static_cast<unsigned>(entries.end() - it);
+}
+
+//------------------------------------------------------------------------------
+// Path of a cache entry
+//------------------------------------------------------------------------------
+tstring CabCache::entryPath(const tstring& key) const
+{
+    return m_dir + key + _T(".cab");
+}
+
+//------------------------------------------------------------------------------
+// Write a small file atomically
+//------------------------------------------------------------------------------
+bool CabCache::writeFile(const tstring& path, const std::string& text) const
+{
+    _TCHAR tempPath[MAX_PATH];
+    if (GetTempFileName(m_dir.c_str(), _T("lst"), 0, tempPath) == 0)
+        return false;
+
+    std::ofstream os(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+    os.write(text.data(), text.size());
+    os.close();
+
+    if (!os || !MoveFileEx(tempPath, path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFile(tempPath);
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Read a small file
+//------------------------------------------------------------------------------
+bool CabCache::readFile(const tstring& path, std::string& text)
+{
+    std::ifstream is(path.c_str(), std::ios::in | std::ios::binary);
+    if (!is)
+        return false;
+
+    std::ostringstream oss;
+    oss << is.rdbuf();
+    text = oss.str();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Set the last write time of a file to now
+//------------------------------------------------------------------------------
+void CabCache::touch(const tstring& path)
+{
+    SmrtFileHandle hFile(CreateFile(path.c_str(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, 0, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        hFile.release();
+        return;
+    }
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(hFile, NULL, NULL, &now);
+}
@@ -0,0 +1,101 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Cabinet cache
+//
+// Keeps cabinets of previous builds in a local directory, one file per
+// cabinet named after a key that identifies its contents (see
+// Xml2Msi::cabinetKey()). A cabinet whose key is found is copied from the
+// cache instead of being compressed again.
+//
+// Next to each cabinet, a manifest lists its files with size and MD5
+// digest, and the key of the last cabinet stored under a cabinet name is
+// remembered. On a miss, that cabinet serves as the base of a delta
+// rebuild: its folders with unchanged files are copied, not compressed.
+//
+// The last write time of an entry is its last use. trim() evicts the
+// least recently used entries until the cache fits its size limit.
+// fetch() and store() may be called concurrently from worker threads.
+//
+//------------------------------------------------------------------------------
+#ifndef CAB_CACHE_H_INCLUDED
+#define CAB_CACHE_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "tstring.h"
+#include <atomic>
+
+class CabCache
+{
+public:
+    // constructor (maxSize 0: no limit)
+    CabCache(const tstring& cacheDir, ULONGLONG maxSize);
+
+    // copy the cabinet stored under key to path (returns false on a miss)
+    bool                fetch(const tstring& key, const tstring& path);
+
+    // store a copy of the cabinet at path and its manifest under key
+    bool                store(const tstring& key, const tstring& name, const tstring& path, const std::string& manifest);
+
+    // find the last cabinet stored under name and its manifest (returns false if there is none)
+    bool                previous(const tstring& name, tstring& path, std::string& manifest) const;
+
+    // evict least recently used cabinets until the size limit is met
+    void                trim();
+
+    // statistics
+    unsigned            hits() const        { return m_hits; }
+    unsigned            misses() const      { return m_misses; }
+    unsigned            evictions() const   { return m_evictions; }
+    unsigned            entries() const     { return m_entries; }
+    ULONGLONG           size() const        { return m_size; }
+
+private:
+    // path of the cache entry for key
+    tstring             entryPath(const tstring& key) const;
+
+    // write a small file atomically
+    bool                writeFile(const tstring& path, const std::string& text) const;
+
+    // read a small file
+    static bool         readFile(const tstring& path, std::string& text);
+
+    // set the last write time of a file to now
+    static void         touch(const tstring& path);
+
+    tstring                 m_dir;          // cache directory (with trailing backslash)
+    ULONGLONG               m_maxSize;      // size limit in bytes (0: no limit)
+    std::atomic<unsigned>   m_hits;         // cabinets found in the cache
+    std::atomic<unsigned>   m_misses;       // cabinets not found in the cache
+    unsigned                m_evictions;    // entries removed by trim()
+    unsigned                m_entries;      // number of entries after trim()
+    ULONGLONG               m_size;         // total size of entries after trim()
+};
+
+#endif // CAB_CACHE_H_INCLUDED
@@ -0,0 +1,439 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "stdafx.h"
+#include "Fingerprint.h"
+#include "md5.h"
+#include <sstream>
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const char          HEADER[]            = "xml2msi fingerprint 1";
+
+    // directories holding at least this many inputs are listed at once
+    const size_t        LIST_THRESHOLD      = 16;
+
+    //--------------------------------------------------------------------------
+    // Convert to UTF-8
+    //--------------------------------------------------------------------------
+    std::string toUtf8(const tstring& text)
+    {
+#ifdef _UNICODE
+        int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), NULL, 0, NULL, NULL);
+        std::string str(len, '\0');
+        if (len > 0)
+            WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), &str[0], len, NULL, NULL);
+        return str;
+#else
+        return text;
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+    // Convert from UTF-8
+    //--------------------------------------------------------------------------
+    tstring fromUtf8(const std::string& text)
+    {
+#ifdef _UNICODE
+        int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), NULL, 0);
+        std::wstring str(len, L'\0');
+        if (len > 0)
+            MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), &str[0], len);
+        return str;
+#else
+        return text;
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+    // Hex string of an MD5 digest
+    //--------------------------------------------------------------------------
+    tstring hexDigest(const MD5_CTX& ctx)
+    {
+        _TCHAR szCtx[33];
+        for (int j = 0; j < 16; ++j) 
+        {
+            _stprintf_s(szCtx + 2 * j, ARRAYSIZE(szCtx) - 2 * j, _T("%02x"), ctx.digest[j]);
+        }
+        return szCtx;
+    }
+
+    //--------------------------------------------------------------------------
+    // Combine the two halves of a 64 bit value
+    //--------------------------------------------------------------------------
+    ULONGLONG makeULongLong(DWORD high, DWORD low)
+    {
+        return (static_cast<ULONGLONG>(high) << 32) | low;
+    }
+
+    //--------------------------------------------------------------------------
+    // Directory part of a path (with trailing separator)
+    //--------------------------------------------------------------------------
+    tstring directoryOf(const tstring& path)
+    {
+        tstring::size_type pos = path.find_last_of(_T("\\/"));
+        return pos == tstring::npos ? tstring() : path.substr(0, pos + 1);
+    }
+
+    //--------------------------------------------------------------------------
+    // Lower case copy of a string
+    //--------------------------------------------------------------------------
+    tstring lowerCase(tstring text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(), _totlower);
+        return text;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+Fingerprint::Fingerprint(const tstring& path) :
+    m_path(path),
+    m_volatile(false)
+{
+}
+
+//------------------------------------------------------------------------------
+// Set the settings that determine the output
+//------------------------------------------------------------------------------
+void Fingerprint::setSettings(const tstring& settings)
+{
+    std::string text = toUtf8(settings);
+
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+    MD5Update(&ctx, text.data(), static_cast<unsigned int>(text.size()));
+    MD5Final(&ctx);
+    m_settings = hexDigest(ctx);
+}
+
+//------------------------------------------------------------------------------
+// Add an input file
+//------------------------------------------------------------------------------
+void Fingerprint::addInput(const tstring& path, const tstring& md5)
+{
+    if (m_volatile || m_inputs.find(path) != m_inputs.end())
+        return;
+
+    Entry entry;
+    if (!fileStat(path, entry.size, entry.time))
+    {
+        m_volatile = true;
+        return;
+    }
+
+    entry.md5 = md5.empty() ? fileDigest(path) : lowerCase(md5);
+    if (entry.md5.empty())
+    {
+        m_volatile = true;
+        return;
+    }
+
+    m_inputs[path] = entry;
+}
+
+//------------------------------------------------------------------------------
+// Add an output file
+//------------------------------------------------------------------------------
+void Fingerprint::addOutput(const tstring& path)
+{
+    Entry entry = { 0, 0 };
+    m_outputs[path] = entry;
+}
+
+//------------------------------------------------------------------------------
+// Check the recorded files
+//------------------------------------------------------------------------------
+bool Fingerprint::upToDate() const
+{
+    if (m_volatile)
+        return false;
+
+    tstring settings;
+    Entries inputs, outputs;
+    if (!read(settings, inputs, outputs) || settings != m_settings)
+        return false;
+
+    bool touched = false;
+    if (!unchanged(outputs, false, touched) || !unchanged(inputs, true, touched))
+        return false;
+
+    // record the new time stamps of touched inputs, so that their digests
+    // are not computed again by the next check
+    if (touched)
+        save(inputs, outputs);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Write the fingerprint file
+//------------------------------------------------------------------------------
+bool Fingerprint::write()
+{
+    if (m_volatile)
+    {
+        remove();
+        return false;
+    }
+
+    for (Entries::iterator it = m_outputs.begin(); it != m_outputs.end(); ++it)
+    {
+        if (!fileStat(it->first, it->second.size, it->second.time))
+        {
+            remove();
+            return false;
+        }
+    }
+
+    return save(m_inputs, m_outputs);
+}
+
+//------------------------------------------------------------------------------
+// Write the fingerprint file from recorded entries
+//------------------------------------------------------------------------------
+bool Fingerprint::save(const Entries& inputs, const Entries& outputs) const
+{
+    std::ostringstream os;
+    os << HEADER << "\n";
+    os << "settings " << toUtf8(m_settings) << "\n";
+
+    for (Entries::const_iterator it = outputs.begin(); it != outputs.end(); ++it)
+    {
+        os << "output " << it->second.size << " " << it->second.time << " - " << toUtf8(it->first) << "\n";
+    }
+
+    for (Entries::const_iterator it = inputs.begin(); it != inputs.end(); ++it)
+    {
+        os << "input " << it->second.size << " " << it->second.time << " " 
+           << toUtf8(it->second.md5) << " " << toUtf8(it->first) << "\n";
+    }
+
+    // write to a temporary file first, so that a partial fingerprint is never seen
+    tstring tempPath = m_path + _T(".tmp");
+    std::string text = os.str();
+    std::ofstream file(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(text.data(), text.size());
+    file.close();
+
+    if (!file || !MoveFileEx(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFile(tempPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Delete the fingerprint file
+//------------------------------------------------------------------------------
+void Fingerprint::remove() const
+{
+    DeleteFile(m_path.c_str());
+}
+
+//------------------------------------------------------------------------------
+// Read the fingerprint file
+//------------------------------------------------------------------------------
+bool Fingerprint::read(tstring& settings, Entries& inputs, Entries& outputs) const
+{
+    std::ifstream is(m_path.c_str(), std::ios::in | std::ios::binary);
+    std::string line;
+    if (!is || !std::getline(is, line) || line != HEADER)
+        return false;
+
+    while (std::getline(is, line))
+    {
+        std::istringstream iss(line);
+        std::string kind, md5;
+        Entry entry;
+
+        if (!(iss >> kind))
+            return false;
+
+        if (kind == "settings")
+        {
+            iss >> md5;
+            settings = fromUtf8(md5);
+            continue;
+        }
+
+        if (!(iss >> entry.size >> entry.time >> md5) || iss.get() != ' ')
+            return false;
+
+        std::string path;
+        std::getline(iss, path);
+        if (path.empty())
+            return false;
+
+        if (kind == "input")
+        {
+            entry.md5 = fromUtf8(md5);
+            inputs[fromUtf8(path)] = entry;
+        }
+        else if (kind == "output")
+        {
+            outputs[fromUtf8(path)] = entry;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return !outputs.empty();
+}
+
+//------------------------------------------------------------------------------
+// Compare recorded files with the file system
+//------------------------------------------------------------------------------
+bool Fingerprint::unchanged(Entries& entries, bool inputs, bool& touched)
+{
+    // group by directory
+    typedef std::map<tstring, std::vector<Entries::iterator> > Directories;
+    Directories directories;
+    for (Entries::iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        directories[directoryOf(it->first)].push_back(it);
+    }
+
+    for (Directories::const_iterator dir = directories.begin(); dir != directories.end(); ++dir)
+    {
+        // list directories holding many inputs at once
+        typedef std::map<tstring, std::pair<ULONGLONG, ULONGLONG> > Listing;
+        Listing listing;
+        bool listed = false;
+
+        if (dir->second.size() >= LIST_THRESHOLD && !dir->first.empty())
+        {
+            tstring findMask = dir->first + _T("*");
+            WIN32_FIND_DATA ffd;
+            HANDLE hFirst = FindFirstFileEx(findMask.c_str(), FindExInfoBasic, &ffd, 
+                                            FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+            if (hFirst != INVALID_HANDLE_VALUE)
+            {
+                SmrtFindHandle hFind(hFirst);
+                do
+                {
+                    if ((ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+                    {
+                        listing[lowerCase(ffd.cFileName)] = std::make_pair(
+                            makeULongLong(ffd.nFileSizeHigh, ffd.nFileSizeLow),
+                            makeULongLong(ffd.ftLastWriteTime.dwHighDateTime, ffd.ftLastWriteTime.dwLowDateTime));
+                    }
+                } 
+                while (FindNextFile(hFind, &ffd));
+                listed = true;
+            }
+        }
+
+        for (size_t i = 0; i < dir->second.size(); ++i)
+        {
+            const tstring& path = dir->second[i]->first;
+            Entry& entry = dir->second[i]->second;
+
+            ULONGLONG size, time;
+            if (listed)
+            {
+                Listing::const_iterator it = listing.find(lowerCase(path.substr(dir->first.length())));
+                if (it == listing.end())
+                    return false;
+                size = it->second.first;
+                time = it->second.second;
+            }
+            else if (!fileStat(path, size, time))
+            {
+                return false;
+            }
+
+            if (size != entry.size)
+                return false;
+
+            // a touched input is unchanged if its content is
+            if (time != entry.time)
+            {
+                if (!inputs || fileDigest(path) != entry.md5)
+                    return false;
+                entry.time = time;
+                touched = true;
+            }
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Size and last write time of a file
+//------------------------------------------------------------------------------
+bool Fingerprint::fileStat(const tstring& path, ULONGLONG& size, ULONGLONG& time)
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &data)
+        || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+    {
+        return false;
+    }
+
+    size = makeULongLong(data.nFileSizeHigh, data.nFileSizeLow);
+    time = makeULongLong(data.ftLastWriteTime.dwHighDateTime, data.ftLastWriteTime.dwLowDateTime);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// MD5 digest of a file
+//------------------------------------------------------------------------------
+tstring Fingerprint::fileDigest(const tstring& path)
+{
+    SmrtFileHandle hFile(
+        CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        hFile.release();
+        return tstring();
+    }
+
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+
+    std::vector<BYTE> buf(1 << 20);
+    for (;;)
+    {
+        // a read error must not look like the end of an unchanged file
+        DWORD len;
+        if (!ReadFile(hFile, &buf[0], static_cast<DWORD>(buf.size()), &len, NULL))
+            return tstring();
+        if (len == 0)
+            break;
+        MD5Update(&ctx, &buf[0], len);
+    }
+
+    MD5Final(&ctx);
+    return hexDigest(ctx);
+}
@@ -0,0 +1,113 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Build fingerprint
+//
+// Records what a build of xml2msi depended on in a small text file next to
+// its output: a digest of the settings (command line options and program
+// version), and the size, last write time and MD5 digest of the XML file
+// and of every file referenced by an href. The size and last write time of
+// the outputs are recorded, too.
+//
+// upToDate() compares the recorded files with the file system. Size and
+// last write time are compared first; the MD5 digest of an input is only
+// computed if its time stamp changed but its size did not, and the new time
+// stamp is recorded if the content is the same. Directories holding many of
+// the inputs are listed with a single FindFirstFileEx enumeration instead of
+// querying every file, so that a product with tens of thousands of files is
+// checked in milliseconds.
+//
+//------------------------------------------------------------------------------
+#ifndef FINGERPRINT_H_INCLUDED
+#define FINGERPRINT_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "tstring.h"
+#include <map>
+
+class Fingerprint
+{
+public:
+    // constructor (path of the fingerprint file)
+    explicit Fingerprint(const tstring& path);
+
+    // set the settings that determine the output
+    void                setSettings(const tstring& settings);
+
+    // add an input file (digest empty: computed now)
+    void                addInput(const tstring& path, const tstring& md5 = tstring());
+
+    // add an output file (size and time stamp are read by write())
+    void                addOutput(const tstring& path);
+
+    // the build depends on something that cannot be recorded, e.g. a download
+    void                setVolatile()       { m_volatile = true; }
+
+    // true if the fingerprint file matches the settings and no input or output changed
+    bool                upToDate() const;
+
+    // write the fingerprint file (removes it if the build is volatile)
+    bool                write();
+
+    // delete the fingerprint file
+    void                remove() const;
+
+private:
+    struct Entry
+    {
+        ULONGLONG       size;           // file size
+        ULONGLONG       time;           // last write time
+        tstring         md5;            // MD5 digest (inputs only)
+    };
+    typedef std::map<tstring, Entry> Entries;   // by path
+
+    // read the fingerprint file (returns false if missing or invalid)
+    bool                read(tstring& settings, Entries& inputs, Entries& outputs) const;
+
+    // write the fingerprint file from recorded entries
+    bool                save(const Entries& inputs, const Entries& outputs) const;
+
+    // true if no file changed (inputs: compare digests of touched files and
+    // update their time stamps; touched is set if one was updated)
+    static bool         unchanged(Entries& entries, bool inputs, bool& touched);
+
+    // size and last write time of a file
+    static bool         fileStat(const tstring& path, ULONGLONG& size, ULONGLONG& time);
+
+    // MD5 digest of a file (empty if it cannot be read)
+    static tstring      fileDigest(const tstring& path);
+
+    tstring             m_path;         // fingerprint file
+    tstring             m_settings;     // digest of the settings
+    Entries             m_inputs;       // input files
+    Entries             m_outputs;      // output files
+    bool                m_volatile;     // build cannot be fingerprinted
+};
+
+#endif // FINGERPRINT_H_INCLUDED
@@ -0,0 +1,301 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+#include "stdafx.h"
+#include "RowIndex.h"
+#include "md5.h"
+#include <sstream>
+
+//------------------------------------------------------------------------------
+namespace
+{
+    const char          HEADER[]            = "xml2msi row index 1";
+
+    //--------------------------------------------------------------------------
+    // Convert to UTF-8
+    //--------------------------------------------------------------------------
+    std::string toUtf8(const tstring& text)
+    {
+#ifdef _UNICODE
+        int len = WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), NULL, 0, NULL, NULL);
+        std::string str(len, '\0');
+        if (len > 0)
+            WideCharToMultiByte(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), &str[0], len, NULL, NULL);
+        return str;
+#else
+        return text;
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+    // Convert from UTF-8
+    //--------------------------------------------------------------------------
+    tstring fromUtf8(const std::string& text)
+    {
+#ifdef _UNICODE
+        int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), NULL, 0);
+        std::wstring str(len, L'\0');
+        if (len > 0)
+            MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), &str[0], len);
+        return str;
+#else
+        return text;
+#endif
+    }
+
+    //--------------------------------------------------------------------------
+    // Hex string of an MD5 digest
+    //--------------------------------------------------------------------------
+    tstring hexDigest(const MD5_CTX& ctx)
+    {
+        _TCHAR szCtx[33];
+        for (int j = 0; j < 16; ++j) 
+        {
+            _stprintf_s(szCtx + 2 * j, ARRAYSIZE(szCtx) - 2 * j, _T("%02x"), ctx.digest[j]);
+        }
+        return szCtx;
+    }
+
+    //--------------------------------------------------------------------------
+    // Read a word and the rest of the line, separated by a single space
+    //--------------------------------------------------------------------------
+    bool readEntry(std::istringstream& iss, std::string& word, std::string& rest)
+    {
+        if (!(iss >> word) || iss.get() != ' ')
+            return false;
+
+        std::getline(iss, rest);
+        return true;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+RowIndex::RowIndex(const tstring& outputPath, const tstring& settings) :
+    m_outputPath(outputPath),
+    m_path(outputPath + _T(".rowindex"))
+{
+    std::string text = toUtf8(settings);
+
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+    MD5Update(&ctx, text.data(), static_cast<unsigned int>(text.size()));
+    MD5Final(&ctx);
+    m_settings = hexDigest(ctx);
+}
+
+//------------------------------------------------------------------------------
+// Read the index
+//------------------------------------------------------------------------------
+bool RowIndex::read()
+{
+    m_tables.clear();
+    m_cabinets.clear();
+
+    std::ifstream is(m_path.c_str(), std::ios::in | std::ios::binary);
+    std::string line;
+    if (!is || !std::getline(is, line) || line != HEADER)
+        return false;
+
+    bool settingsMatch = false, outputMatch = false;
+    Table* table = NULL;
+    while (std::getline(is, line))
+    {
+        std::istringstream iss(line);
+        std::string kind, word, rest;
+
+        if (!(iss >> kind) || iss.get() != ' ')
+            break;
+
+        if (kind == "settings")
+        {
+            iss >> word;
+            settingsMatch = fromUtf8(word) == m_settings;
+        }
+        else if (kind == "output")
+        {
+            ULONGLONG size, time, outputSize, outputTime;
+            outputMatch = (iss >> size >> time) && outputStat(outputSize, outputTime) 
+                       && size == outputSize && time == outputTime;
+        }
+        else if (kind == "cabinet" && readEntry(iss, word, rest))
+        {
+            m_cabinets[fromUtf8(rest)] = fromUtf8(word);
+        }
+        else if (kind == "table" && readEntry(iss, word, rest))
+        {
+            table = &m_tables[fromUtf8(rest)];
+            table->schema = fromUtf8(word);
+        }
+        else if (kind == "row" && table != NULL && readEntry(iss, word, rest))
+        {
+            table->rows[fromUtf8(rest)] = fromUtf8(word);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (!is.eof() || !settingsMatch || !outputMatch)
+    {
+        m_tables.clear();
+        m_cabinets.clear();
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Write the index
+//------------------------------------------------------------------------------
+bool RowIndex::write() const
+{
+    ULONGLONG size, time;
+    if (!outputStat(size, time))
+    {
+        remove();
+        return false;
+    }
+
+    // write to a temporary file first, so that a partial index is never seen
+    tstring tempPath = m_path + _T(".tmp");
+    std::ofstream os(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    os << HEADER << "\n";
+    os << "settings " << toUtf8(m_settings) << "\n";
+    os << "output " << size << " " << time << "\n";
+
+    for (Cabinets::const_iterator it = m_cabinets.begin(); it != m_cabinets.end(); ++it)
+    {
+        os << "cabinet " << toUtf8(it->second) << " " << toUtf8(it->first) << "\n";
+    }
+
+    for (Tables::const_iterator it = m_tables.begin(); it != m_tables.end(); ++it)
+    {
+        os << "table " << toUtf8(it->second.schema) << " " << toUtf8(it->first) << "\n";
+
+        const std::map<tstring, tstring>& rows = it->second.rows;
+        for (std::map<tstring, tstring>::const_iterator itRow = rows.begin(); itRow != rows.end(); ++itRow)
+        {
+            os << "row " << toUtf8(itRow->second) << " " << toUtf8(itRow->first) << "\n";
+        }
+    }
+    os.close();
+
+    if (!os || !MoveFileEx(tempPath.c_str(), m_path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFile(tempPath.c_str());
+        remove();
+        return false;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Delete the index file
+//------------------------------------------------------------------------------
+void RowIndex::remove() const
+{
+    DeleteFile(m_path.c_str());
+}
+
+//------------------------------------------------------------------------------
+// Primary key of a row
+//
+// The key fields are separated by tabs. Backslashes, tabs and line breaks
+// within a field are escaped, so that the key fits on a line of the index.
+//------------------------------------------------------------------------------
+tstring RowIndex::joinKey(const std::vector<tstring>& fields)
+{
+    tstring key;
+    for (size_t i = 0; i < fields.size(); ++i)
+    {
+        if (i > 0) key += _T('\t');
+
+        for (tstring::const_iterator it = fields[i].begin(); it != fields[i].end(); ++it)
+        {
+            switch (*it)
+            {
+            case _T('\\'):  key += _T("\\\\"); break;
+            case _T('\t'):  key += _T("\\t");  break;
+            case _T('\n'):  key += _T("\\n");  break;
+            case _T('\r'):  key += _T("\\r");  break;
+            default:        key += *it;        break;
+            }
+        }
+    }
+    return key;
+}
+
+//------------------------------------------------------------------------------
+// Key fields of a primary key
+//------------------------------------------------------------------------------
+std::vector<tstring> RowIndex::splitKey(const tstring& key)
+{
+    std::vector<tstring> fields(1);
+    for (tstring::const_iterator it = key.begin(); it != key.end(); ++it)
+    {
+        if (*it == _T('\t'))
+        {
+            fields.push_back(tstring());
+        }
+        else if (*it != _T('\\') || it + 1 == key.end())
+        {
+            fields.back() += *it;
+        }
+        else
+        {
+            switch (*++it)
+            {
+            case _T('t'):   fields.back() += _T('\t'); break;
+            case _T('n'):   fields.back() += _T('\n'); break;
+            case _T('r'):   fields.back() += _T('\r'); break;
+            default:        fields.back() += *it;      break;
+            }
+        }
+    }
+    return fields;
+}
+
+//------------------------------------------------------------------------------
+// Size and last write time of the output
+//------------------------------------------------------------------------------
+bool RowIndex::outputStat(ULONGLONG& size, ULONGLONG& time) const
+{
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesEx(m_outputPath.c_str(), GetFileExInfoStandard, &data)
+        || (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0)
+    {
+        return false;
+    }
+
+    size = (static_cast<ULONGLONG>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    time = (static_cast<ULONGLONG>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+    return true;
+}
@@ -0,0 +1,101 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Row index
+//
+// Records what an incremental build of xml2msi wrote to its output database
+// in a small text file next to it: a digest of the settings that affect
+// every table, the size and last write time of the output, the cache key of
+// every cabinet, and for every table a digest of its column definitions and
+// the primary key and digest of every row.
+//
+// The next incremental build compares the tables of the XML file with the
+// index of the previous output and only writes the rows that changed. The
+// index is only valid as long as the output was not modified by someone
+// else, which is checked by its size and last write time.
+//
+//------------------------------------------------------------------------------
+#ifndef ROW_INDEX_H_INCLUDED
+#define ROW_INDEX_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "tstring.h"
+#include <map>
+#include <vector>
+
+class RowIndex
+{
+public:
+    // rows of a table
+    struct Table
+    {
+        tstring             schema;         // digest of the column definitions
+        std::map<tstring, tstring> rows;    // primary key => row digest
+    };
+    typedef std::map<tstring, Table> Tables;        // by table name
+    typedef std::map<tstring, tstring> Cabinets;    // cabinet name => cache key
+
+    // constructor (path of the output database, the index is stored next to it)
+    RowIndex(const tstring& outputPath, const tstring& settings);
+
+    // read the index (false if missing, invalid, made with other settings or the output was modified)
+    bool                read();
+
+    // write the index, recording the size and time stamp of the output (false on failure)
+    bool                write() const;
+
+    // delete the index file
+    void                remove() const;
+
+    // tables
+    Tables&             tables()            { return m_tables; }
+    const Tables&       tables() const      { return m_tables; }
+
+    // cabinets
+    Cabinets&           cabinets()          { return m_cabinets; }
+    const Cabinets&     cabinets() const    { return m_cabinets; }
+
+    // primary key of a row from its key fields
+    static tstring      joinKey(const std::vector<tstring>& fields);
+
+    // key fields of a primary key
+    static std::vector<tstring> splitKey(const tstring& key);
+
+private:
+    // size and last write time of the output
+    bool                outputStat(ULONGLONG& size, ULONGLONG& time) const;
+
+    tstring             m_outputPath;   // output database
+    tstring             m_path;         // index file
+    tstring             m_settings;     // digest of the settings
+    Tables              m_tables;       // tables
+    Cabinets            m_cabinets;     // cabinets
+};
+
+#endif // ROW_INDEX_H_INCLUDED
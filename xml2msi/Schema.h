@@ -0,0 +1,373 @@
+//------------------------------------------------------------------------------
+//
+// $Id$
+//
+// Copyright (c) 2001-2007 Daniel Gehriger <gehriger at linkcad dot com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//------------------------------------------------------------------------------
+//
+// Schema registry
+//
+// The standard tables of coldefs.h, parsed at compile time. Each column
+// definition ("Ys72": primary key, string of up to 72 characters, not
+// nullable) becomes a ColumnSchema, and the tables are found through a
+// perfect hash of their names: the name selects a bucket, and the
+// displacement of the bucket moves each of its names to a slot of its
+// own. A lookup therefore costs two hashes and one string comparison.
+// A malformed definition or a failed hash construction stops the build.
+//
+// parseColumn() also parses the column definitions of XML documents at
+// run time ("s72", without the primary key flag).
+//
+//------------------------------------------------------------------------------
+#ifndef XML2MSI_SCHEMA_H_INCLUDED
+#define XML2MSI_SCHEMA_H_INCLUDED
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "tstring.h"
+#include "coldefs.h"
+
+// column definition, parsed
+struct ColumnSchema
+{
+    enum Type
+    {
+        typeString,
+        typeInteger,
+        typeBinary
+    };
+
+    enum Error
+    {
+        errNone,
+        errMissing,         // empty definition
+        errSyntax,          // unknown type or malformed size
+        errStringLength,    // string longer than 255 characters
+        errIntegerSize,     // integer neither 2 nor 4 bytes
+        errBinary           // binary stream with a size
+    };
+
+    Type                type;
+    int                 width;          // maximum string length (0: unlimited) or integer size in bytes
+    bool                nullable;       // upper case type letter
+    bool                localizable;    // 'l' or 'L'
+    bool                key;            // 'Y' flag (standard tables only)
+    Error               error;          // why the definition is invalid
+};
+
+//------------------------------------------------------------------------------
+// Parse a column definition of len characters (keyFlag: "Ys72", else "s72")
+//------------------------------------------------------------------------------
+constexpr ColumnSchema parseColumn(const _TCHAR* def, size_t len, bool keyFlag)
+{
+    ColumnSchema col = { ColumnSchema::typeString, 0, false, false, false, ColumnSchema::errNone };
+    if (len == 0)
+    {
+        col.error = ColumnSchema::errMissing;
+        return col;
+    }
+
+    size_t pos = 0;
+    if (keyFlag)
+    {
+        if (def[0] != _T('Y') && def[0] != _T('N'))
+        {
+            col.error = ColumnSchema::errSyntax;
+            return col;
+        }
+        col.key = def[pos++] == _T('Y');
+    }
+
+    // type letter and size
+    if (len - pos < 2)
+    {
+        col.error = ColumnSchema::errSyntax;
+        return col;
+    }
+
+    _TCHAR letter = def[pos++];
+    col.nullable = letter >= _T('A') && letter <= _T('Z');
+    if (col.nullable) letter = static_cast<_TCHAR>(letter - _T('A') + _T('a'));
+
+    for (; pos < len; ++pos)
+    {
+        if (def[pos] < _T('0') || def[pos] > _T('9'))
+        {
+            col.error = ColumnSchema::errSyntax;
+            return col;
+        }
+        if (col.width < 100000) col.width = col.width * 10 + (def[pos] - _T('0'));
+    }
+
+    switch (letter)
+    {
+    case _T('l'):
+        col.localizable = true;
+        // fall through !
+    case _T('s'):
+        col.type = ColumnSchema::typeString;
+        if (col.width > 255) col.error = ColumnSchema::errStringLength;
+        break;
+
+    case _T('i'):
+        col.type = ColumnSchema::typeInteger;
+        if (col.width != 2 && col.width != 4) col.error = ColumnSchema::errIntegerSize;
+        break;
+
+    case _T('v'):
+        col.type = ColumnSchema::typeBinary;
+        if (col.width != 0) col.error = ColumnSchema::errBinary;
+        break;
+
+    default:
+        col.error = ColumnSchema::errSyntax;
+        break;
+    }
+
+    return col;
+}
+
+//------------------------------------------------------------------------------
+// Parse a column definition of an XML document
+//------------------------------------------------------------------------------
+inline ColumnSchema parseColumn(const tstring& def)
+{
+    return parseColumn(def.c_str(), def.size(), false);
+}
+
+//------------------------------------------------------------------------------
+// Format a column definition ("s72")
+//------------------------------------------------------------------------------
+inline tstring formatColumn(const ColumnSchema& col)
+{
+    _TCHAR letter = col.type == ColumnSchema::typeInteger ? _T('i') 
+                  : col.type == ColumnSchema::typeBinary  ? _T('v') 
+                  : col.localizable                       ? _T('l') : _T('s');
+    if (col.nullable) letter = static_cast<_TCHAR>(letter - _T('a') + _T('A'));
+
+    tostringstream oss;
+    oss << letter << col.width;
+    return oss.str();
+}
+
+//------------------------------------------------------------------------------
+// Message for an invalid column definition
+//------------------------------------------------------------------------------
+inline const _TCHAR* columnError(ColumnSchema::Error error)
+{
+    switch (error)
+    {
+    case ColumnSchema::errMissing:      return _T("Missing column definition");
+    case ColumnSchema::errStringLength: return _T("Invalid string length specified");
+    case ColumnSchema::errIntegerSize:  return _T("Invalid integer size specified");
+    case ColumnSchema::errBinary:       return _T("Error in binary stream specification");
+    default:                            return _T("Invalid field definition");
+    }
+}
+
+// standard table
+struct TableSchema
+{
+    const _TCHAR*       name;           // table name
+    size_t              first;          // index of its first column in SchemaRegistry::columns
+    size_t              count;          // number of columns
+};
+
+//------------------------------------------------------------------------------
+// Length of a string (compile time)
+//------------------------------------------------------------------------------
+constexpr size_t schemaLength(const _TCHAR* str)
+{
+    size_t len = 0;
+    while (str[len] != 0) ++len;
+    return len;
+}
+
+//------------------------------------------------------------------------------
+// Number of columns of all standard tables
+//------------------------------------------------------------------------------
+constexpr size_t schemaColumnCount()
+{
+    size_t count = 0;
+    for (size_t t = 0; t < sizeof(colDefs) / sizeof(colDefs[0]); ++t)
+    {
+        ++count;
+        for (const _TCHAR* def = colDefs[t].szDef; *def != 0; ++def)
+        {
+            if (*def == _T(';')) ++count;
+        }
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------
+// Hash of a table name (FNV-1a with the given basis)
+//------------------------------------------------------------------------------
+constexpr unsigned schemaHash(const _TCHAR* name, size_t len, unsigned basis)
+{
+    unsigned hash = basis;
+    for (size_t i = 0; i < len; ++i)
+    {
+        // 64 bit product, as the compiler warns about unsigned wrap-around in constant expressions
+        hash ^= static_cast<unsigned>(name[i]);
+        hash = static_cast<unsigned>(static_cast<unsigned long long>(hash) * 16777619u & 0xffffffffu);
+    }
+    return hash;
+}
+
+class SchemaRegistry
+{
+public:
+    static const size_t TABLES  = sizeof(colDefs) / sizeof(colDefs[0]);
+    static const size_t COLUMNS = schemaColumnCount();
+    static const size_t BUCKETS = 32;
+    static const size_t SLOTS   = 256;
+
+    static_assert(TABLES < SLOTS, "SchemaRegistry::slots holds table indices in a byte");
+
+    // constructor (parses coldefs.h and builds the perfect hash)
+    constexpr SchemaRegistry() :
+        valid(true),
+        tables(),
+        columns(),
+        slots(),
+        displacements()
+    {
+        // parse column definitions
+        size_t col = 0;
+        for (size_t t = 0; t < TABLES; ++t)
+        {
+            const _TCHAR* def = colDefs[t].szDef;
+            tables[t].name = colDefs[t].szTable;
+            tables[t].first = col;
+            for (size_t start = 0; ; )
+            {
+                size_t end = start;
+                while (def[end] != 0 && def[end] != _T(';')) ++end;
+                columns[col] = parseColumn(def + start, end - start, true);
+                if (columns[col++].error != ColumnSchema::errNone) valid = false;
+                if (def[end] == 0) break;
+                start = end + 1;
+            }
+            tables[t].count = col - tables[t].first;
+        }
+
+        // hash the names once
+        unsigned bucketHash[TABLES] = {};
+        unsigned slotHash[TABLES] = {};
+        size_t bucketSize[BUCKETS] = {};
+        size_t largest = 0;
+        for (size_t t = 0; t < TABLES; ++t)
+        {
+            size_t len = schemaLength(tables[t].name);
+            bucketHash[t] = schemaHash(tables[t].name, len, BUCKET_BASIS);
+            slotHash[t] = schemaHash(tables[t].name, len, SLOT_BASIS);
+            size_t size = ++bucketSize[bucketHash[t] % BUCKETS];
+            if (size > largest) largest = size;
+        }
+
+        // place the largest buckets first, while most slots are free
+        for (size_t size = largest; size > 0; --size)
+        {
+            for (size_t b = 0; b < BUCKETS; ++b)
+            {
+                if (bucketSize[b] != size)
+                    continue;
+
+                size_t members[TABLES] = {};
+                size_t count = 0;
+                for (size_t t = 0; t < TABLES; ++t)
+                {
+                    if (bucketHash[t] % BUCKETS == b) members[count++] = t;
+                }
+
+                bool placed = false;
+                for (unsigned d = 0; d < 0x10000 && !placed; ++d)
+                {
+                    placed = true;
+                    for (size_t i = 0; i < count && placed; ++i)
+                    {
+                        size_t s = slot(bucketHash[members[i]], slotHash[members[i]], d);
+                        if (slots[s] != 0) placed = false;
+                        for (size_t j = 0; j < i && placed; ++j)
+                        {
+                            if (s == slot(bucketHash[members[j]], slotHash[members[j]], d)) placed = false;
+                        }
+                    }
+
+                    if (placed)
+                    {
+                        displacements[b] = static_cast<unsigned short>(d);
+                        for (size_t i = 0; i < count; ++i)
+                        {
+                            slots[slot(bucketHash[members[i]], slotHash[members[i]], d)] = static_cast<unsigned char>(members[i] + 1);
+                        }
+                    }
+                }
+
+                if (!placed) valid = false;
+            }
+        }
+    }
+
+    // find a standard table (NULL if name is not one)
+    const TableSchema*  find(const tstring& name) const
+    {
+        unsigned bucketHash = schemaHash(name.c_str(), name.size(), BUCKET_BASIS);
+        unsigned slotHash = schemaHash(name.c_str(), name.size(), SLOT_BASIS);
+        size_t index = slots[slot(bucketHash, slotHash, displacements[bucketHash % BUCKETS])];
+        if (index == 0 || name != tables[index - 1].name)
+            return NULL;
+        return &tables[index - 1];
+    }
+
+    // column of a standard table
+    const ColumnSchema& column(const TableSchema& table, size_t i) const
+    {
+        return columns[table.first + i];
+    }
+
+    bool                valid;                  // all definitions parsed and all names placed
+    TableSchema         tables[TABLES];         // standard tables, in coldefs.h order
+    ColumnSchema        columns[COLUMNS];       // columns of all tables
+    unsigned char       slots[SLOTS];           // table index + 1 (0: free)
+    unsigned short      displacements[BUCKETS]; // displacement of each bucket
+
+private:
+    static const unsigned BUCKET_BASIS = 2166136261u;
+    static const unsigned SLOT_BASIS   = 0x9e3779b9u;
+
+    // slot of a name, given its hashes and the displacement of its bucket
+    static constexpr size_t slot(unsigned bucketHash, unsigned slotHash, unsigned displacement)
+    {
+        return static_cast<size_t>((slotHash + static_cast<unsigned long long>(displacement) * (bucketHash | 1)) % SLOTS);
+    }
+};
+
+// the standard tables
+constexpr SchemaRegistry schemaRegistry;
+
+static_assert(schemaRegistry.valid, "coldefs.h contains an invalid column definition");
+
+#endif // XML2MSI_SCHEMA_H_INCLUDED
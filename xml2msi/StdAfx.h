@@ -114,6 +114,8 @@ typedef SmrtHandle<HMODULE, BOOL, FreeLibrary>              SmrtLibHandle;
 #include <utility>
 #include <functional>
 #include <map>
+#include <set>
+#include <memory>
 #include <string.h>
 #include <errno.h>
 
@@ -36,7 +36,7 @@ struct ColDef
   LPCTSTR szDef;
 };
 
-static const ColDef colDefs[] = 
+static constexpr ColDef colDefs[] = 
 {
     { _T("ActionText"),             _T("Ys72;NL64;NL128") },
     { _T("AdminExecuteSequence"),   _T("Ys72;NS255;NI2") },
@@ -75,7 +75,7 @@ static const ColDef colDefs[] =
     { _T("Feature"),                _T("Ys32;NS32;NL64;NL255;NI2;Ni2;NS72;Ni2") },
     { _T("FeatureComponents"),      _T("Ys32;Ys72") },
     { _T("File"),                   _T("Ys72;Ns72;Nl255;Ni4;NS72;NS20;NI2;Ni2") },
-    { _T("FileSFPCatalog"),         _T("Ys72;YNl255") },
+    { _T("FileSFPCatalog"),         _T("Ys72;Ys255") },
     { _T("Font"),                   _T("Ys72;NS128") },
     { _T("Icon"),                   _T("Ys72;Nv0") },
     { _T("IniFile"),                _T("Ys72;Nl255;NS72;Nl96;Nl128;Nl255;Ni2;Ns72") },
@@ -125,7 +125,7 @@ static const ColDef colDefs[] =
     { _T("SelfReg"),                _T("Ys72;NI2") },
     { _T("ServiceControl"),         _T("Ys72;Nl255;Ni2;NL255;NI2;Ns72") },
     { _T("ServiceInstall"),         _T("Ys72;Ns255;NL255;Ni4;Ni4;Ni4;NS255;NS255;NS255;NS255;NS255;Ns72;NL255") },
-    { _T("SFPCatalog"),             _T("Ysl255;Nv0;NL0") },
+    { _T("SFPCatalog"),             _T("Ys255;Nv0;NL0") },
     { _T("Shortcut"),               _T("Ys72;Ns72;Nl128;Ns72;Ns72;NS255;NL255;NI2;NS72;NI2;NI2;NS72") },
     { _T("Signature"),              _T("Ys72;Ns255;NS20;NS20;NI4;NI4;NI4;NI4;NS255") },
     { _T("TextStyle"),              _T("Ys72;Ns32;Ni2;NI4;NI2") },
@@ -26,14 +26,27 @@
 //------------------------------------------------------------------------------
 #include "stdafx.h"
 #include "xml2msi.h"
-#include "coldefs.h"
 #include "resource.h"
 #include "md5.h"
 #include "base64.h"
 #include "getopt.h"
 #include "consolecolor.h"
+#include "ThreadPool.h"
+#include "SpscQueue.h"
+#include "CabReader.h"
+#include "ScratchFile.h"
+#include "MsiStreamName.h"
+#include "MsiWriter.h"
+#include "PeVersion.h"
+#include "Idt.h"
+#include "TableIndex.h"
+#include "XmlReader.h"
+#include "XmlValidator.h"
 #include <atlcomcli.h>
 
+// characters of Base64 data decoded at once (a multiple of 4)
+static const size_t BASE64_CHUNK = 1 << 20;
+
 #if (_WIN32_MSI <  150)
 typedef struct _MSIFILEHASHINFO {
     ULONG dwFileHashInfoSize;
@@ -102,16 +115,18 @@ int __cdecl _tmain(int argc, _TCHAR* argv[], _TCHAR* envp[])
         }
         catch (const std::runtime_error& e)
         {
-            if (e.what() == "")
+            if (*e.what() == 0)
             {
-                tcerr << color::red << _T("Error: Failed to convert the MSI database!") 
+                tcerr << color::red << _T("Error: Failed to convert the MSI database!")
                     << color::base << std::endl;
             }
             else
             {
-                std::cerr << color::red << _T("Error: ") << e.what() 
+                tcerr << color::red << _T("Error: ") << (LPCTSTR)_bstr_t(e.what())
                     << color::base << std::endl;
             }
+
+            exitCode = 1;
         }
     }
 
@@ -123,17 +138,30 @@ int __cdecl _tmain(int argc, _TCHAR* argv[], _TCHAR* envp[])
 // Constructor
 //------------------------------------------------------------------------------
 Xml2Msi::Xml2Msi(int argc, _TCHAR* argv[]) :
+    m_db(0),
     m_currentCol(0),
     m_currentRow(0),
+    m_writerCol(0),
+    m_writerRow(0),
     m_compression(CabCompress::compMSZIP),
+    m_lzxWindow(21),
+    m_lzxEffort(CabCompress::lzxNormal),
     m_quiet(0),
     m_nologo(false),
     m_checkMD5(true),
     m_udpateXml(false),
+    m_xmlOnly(false),
     m_updateUpgradeVersion(false),
     m_mergeModule(false),
     m_fixExtension(false),
-	m_componentCode(false)
+	m_componentCode(false),
+    m_jobs(0),
+    m_folderFiles(-1),
+    m_native(false),
+    m_upToDateCheck(false),
+    m_incremental(false),
+    m_codepage(0),
+    m_cabCacheSize(static_cast<ULONGLONG>(1024) << 20)
 {
     HRESULT hr = m_doc.CreateInstance(__uuidof(xml::DOMDocument60));
     if (FAILED(hr))
@@ -166,28 +194,38 @@ Xml2Msi::Xml2Msi(int argc, _TCHAR* argv[]) :
 //------------------------------------------------------------------------------
 Xml2Msi::~Xml2Msi()
 {
+    // close databases referenced by msi-stream: hrefs
+    for (DatabaseMap::const_iterator it = m_sourceDatabases.begin(); it != m_sourceDatabases.end(); ++it)
+    {
+        MsiCloseHandle(it->second);
+    }
+
     // delete temporary file
     if (!m_tempPath.empty()) 
     {
         DeleteFile(m_tempPath.c_str());
     }
 
-    // delete temporary cabs
-    tstring findMask = m_tempCabDir + _T("*");
-    WIN32_FIND_DATA ffd;
-    SmrtFindHandle hFind(FindFirstFile(findMask.c_str(), &ffd));
-    while (!hFind.isNull())
+    // delete downloaded binary fields
+    for (std::vector<tstring>::const_iterator it = m_downloads.begin(); it != m_downloads.end(); ++it)
     {
-        tstring path = m_tempCabDir + ffd.cFileName;
-        DeleteFile(path.c_str());
+        DeleteFile(it->c_str());
+    }
 
-        if (!FindNextFile(hFind, &ffd))
-            break;
+    // delete placeholder for deferred streams
+    if (!m_emptyPath.empty()) 
+    {
+        DeleteFile(m_emptyPath.c_str());
+    }
+
+    // delete downloaded files
+    for (FileList::const_iterator it = m_files.begin(); it != m_files.end(); ++it)
+    {
+        if (!it->tempPath.empty()) DeleteFile(it->tempPath.c_str());
     }
-    FindClose(hFind.release());
 
-    // remove temporary cabinet folder
-    RemoveDirectory(m_tempCabDir.c_str());
+    // delete temporary cabs and IDT files
+    deleteTree(m_tempCabDir);
 }
 
 //------------------------------------------------------------------------------
@@ -195,9 +233,42 @@ Xml2Msi::~Xml2Msi()
 //------------------------------------------------------------------------------
 void Xml2Msi::create()
 {
-    // Load the XML file
+    // only stamp codes, versions and properties into the XML file
+    if (m_xmlOnly)
+    {
+        updateXml();
+        return;
+    }
+
+    // skip the build if neither the XML file, nor a referenced file, nor
+    // the options changed since the last build
+    if (m_upToDateCheck)
+    {
+        m_fingerprint.reset(new Fingerprint(m_outputPath + _T(".fingerprint")));
+        m_fingerprint->setSettings(buildSettings());
+
+        // new component codes are generated on every build
+        if (m_componentCode)
+            m_fingerprint->setVolatile();
+
+        if (m_fingerprint->upToDate())
+        {
+            if (!m_quiet)
+            {
+                tcerr << color::green << _T("'") << m_outputPath << _T("' is up to date") 
+                      << color::base << std::endl;
+            }
+            return;
+        }
+
+        m_fingerprint->remove();
+    }
+
+    // Load the XML file. The DTD only supplies default attributes: the 
+    // structure is checked by walking the loaded tree, which costs a small
+    // fraction of a validating parse.
     m_doc->async = VARIANT_FALSE;
-    m_doc->validateOnParse = VARIANT_TRUE;
+    m_doc->validateOnParse = VARIANT_FALSE;
     m_doc->preserveWhiteSpace = VARIANT_TRUE;
     m_doc->setProperty(L"ProhibitDTD", VARIANT_FALSE);
 
@@ -205,23 +276,22 @@ void Xml2Msi::create()
     {
         xml::IXMLDOMParseErrorPtr pErr = m_doc->parseError;
 
-        tcerr << color::red;
         if (pErr->errorCode == 0x800C0006)
         {
-            tcerr << _T("File not found: ") << m_inputPath;
-        }
-        else
-        {
-            tcerr << _T("Error while parsing ") << m_inputPath << _T(":") << std::endl;
-            if (pErr->line != 0) 
-            {
-                tcerr << _T("Line ") << pErr->line << _T("; Column ") << pErr->linepos << std::endl;
-            }
-            tcerr << (LPCTSTR)pErr->reason;
+            tcerr << color::red << _T("File not found: ") << m_inputPath << color::base << std::endl;
+            _com_issue_error(E_FAIL);
         }
 
-        tcerr << color::base << std::endl;
-        _com_issue_error(E_FAIL);
+        parseError(pErr->line, pErr->linepos, (LPCTSTR)pErr->reason);
+    }
+
+    tstring structureError;
+    if (!validateDocument(structureError))
+    {
+        // the tree has no positions: read the file again to find the error
+        unsigned line = 0, column = 0;
+        locateError(m_inputPath, line, column);
+        parseError(line, column, structureError);
     }
 
     // check version
@@ -263,13 +333,59 @@ void Xml2Msi::create()
         }
     }
 
+    // validate all tables
+    validateTables();
+
+    // open databases referenced by msi-stream: hrefs, before the output replaces one of them
+    openSourceDatabases();
+
+    // get database codepage
+    xml::IXMLDOMNodePtr codepageNode = msiNode->attributes->getNamedItem(L"codepage");
+    if (codepageNode != NULL)
+    {
+        m_codepage = _ttoi((LPCTSTR)codepageNode->text);
+    }
+
+    // an incremental build updates the previous output if it was written by an
+    // incremental build with the same settings and was not modified since
+    if (m_incremental && m_native)
+    {
+        tcerr << color::yellow << _T("Warning: incremental builds require the Windows Installer API, ")
+              << _T("rebuilding the database") << color::base << std::endl;
+    }
+    else if (m_incremental)
+    {
+        m_rowIndex.reset(new RowIndex(m_outputPath, indexSettings()));
+        m_baseIndex.reset(new RowIndex(m_outputPath, indexSettings()));
+        if (!m_baseIndex->read() 
+            || MsiOpenDatabase(m_outputPath.c_str(), MSIDBOPEN_TRANSACT, &m_db) != ERROR_SUCCESS)
+        {
+            m_baseIndex.reset();
+        }
+        else if (!m_quiet)
+        {
+            tcerr << _T("Updating '") << m_outputPath << _T("'") << std::endl;
+        }
+    }
+
     // create database
-    DeleteFile(m_outputPath.c_str());
-    OK(MsiOpenDatabase(m_outputPath.c_str(), MSIDBOPEN_CREATE, &m_db));
+    if (!m_baseIndex.get())
+    {
+        DeleteFile(m_outputPath.c_str());
+        if (m_native)
+            m_writer.reset(new MsiWriter);
+        else
+            OK(MsiOpenDatabase(m_outputPath.c_str(), MSIDBOPEN_CREATE, &m_db));
+    }
 
-    // set database codepage
-    if (xml::IXMLDOMNodePtr node = msiNode->attributes->getNamedItem(L"codepage")) 
+    // set database codepage (an updated database already has it)
+    if (codepageNode != NULL && m_writer.get())
+    {
+        m_writer->setCodepage(m_codepage);
+    }
+    else if (codepageNode != NULL && !m_baseIndex.get()) 
     {
+        xml::IXMLDOMNodePtr node = codepageNode;
         char szTmpDir[_MAX_PATH];
         char szTmpFile[_MAX_PATH];
         GetTempPathA(_MAX_PATH, szTmpDir);
@@ -288,14 +404,21 @@ void Xml2Msi::create()
         }
     }
 
-    // remember compression method
-    if (xml::IXMLDOMNodePtr node = msiNode->attributes->getNamedItem(L"compression"))
+    // remember compression method (the command line takes precedence)
+    if (!m_compressionOverride.empty())
+    {
+        parseCompression(m_compressionOverride);
+    }
+    else if (xml::IXMLDOMNodePtr node = msiNode->attributes->getNamedItem(L"compression"))
     {
         _bstr_t compr = node->nodeValue;
-        if      (wcscmp(compr, L"MSZIP") == 0)      m_compression = CabCompress::compMSZIP;
-        else if (wcscmp(compr, L"LZX") == 0)        m_compression = CabCompress::compLZX;
-        else if (wcscmp(compr, L"Quantum") == 0)    m_compression = CabCompress::compQuantum;
-        else if (wcscmp(compr, L"none") == 0)       m_compression = CabCompress::compNone;
+        if (!parseCompression((LPCTSTR)compr))
+        {
+            tcerr << color::red 
+                  << _T("Invalid compression method \"") 
+                  << (LPCTSTR)compr
+                  << _T("\", using default") << color::base << std::endl;
+        }
     }
 
 
@@ -306,18 +429,37 @@ void Xml2Msi::create()
     buildCabinets();
 
     // create and populate the tables
-    xml::IXMLDOMNodeListPtr pTables(m_doc->selectNodes(L"/msi/table"));
-    xml::IXMLDOMNodePtr table;
-    while ((table = pTables->nextNode()) != NULL) 
+    populateTables();
+    if (m_baseIndex.get())
     {
-        validateTable(table); // validate the table
-        createTable(table); // create the table
-        populateTable(table); // populate table
+        dropRemovedTables();
     }
 
     // create the summary information stream
     createSummaryInfo();
-    OK(MsiDatabaseCommit(m_db));
+    if (m_writer.get())
+    {
+        m_writer->write(m_outputPath);
+    }
+    else
+    {
+        OK(MsiDatabaseCommit(m_db));
+
+        // write binary data kept in memory
+        writePendingStreams();
+    }
+
+    // record the rows of this build for the next incremental build
+    if (m_rowIndex.get())
+    {
+        if (m_db != 0)
+        {
+            MsiCloseHandle(m_db);
+            m_db = 0;
+        }
+
+        m_rowIndex->write();
+    }
 
     // write modified XML
     if (m_udpateXml)
@@ -325,6 +467,16 @@ void Xml2Msi::create()
         OK(m_doc->save(m_xmlOutputPath.c_str()));
     }
 
+    // record the fingerprint of this build
+    if (m_fingerprint.get())
+    {
+        // the XML file is recorded after -u may have rewritten it
+        m_fingerprint->addInput(m_inputPath);
+        m_fingerprint->addOutput(m_outputPath);
+        if (m_udpateXml) 
+            m_fingerprint->addOutput(m_xmlOutputPath);
+        m_fingerprint->write();
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -498,6 +650,13 @@ void Xml2Msi::update()
                 rowNode->appendChild(valueNode);
                 propertyTable->appendChild(rowNode);
 
+                // keep the row count hint, if any
+                xml::IXMLDOMNodePtr rowsNode(propertyTable->attributes->getNamedItem(L"rows"));
+                if (rowsNode)
+                {
+                    rowsNode->text = _bstr_t(_variant_t(propertyTable->selectNodes(L"row")->length));
+                }
+
                 if (!m_quiet)
                 {
                     tcerr << color::green << _T("Set property ") << property 
@@ -509,875 +668,2984 @@ void Xml2Msi::update()
 }
 
 //------------------------------------------------------------------------------
-struct AscendingDiskId
+// Convert UTF-8 text returned by XmlReader
+//------------------------------------------------------------------------------
+static tstring fromUtf8(const std::string& text)
 {
-    bool operator()(const ATL::CAdapt<xml::IXMLDOMNodePtr>& lhs, 
-                    const ATL::CAdapt<xml::IXMLDOMNodePtr>& rhs) const
-    {
-        xml::IXMLDOMNodePtr diskIdLhs = lhs.m_T->selectSingleNode(L"td[1]");
-        xml::IXMLDOMNodePtr diskIdRhs = rhs.m_T->selectSingleNode(L"td[1]");
-        return diskIdLhs != NULL && diskIdRhs != NULL && (int)diskIdLhs->nodeTypedValue <= (int)diskIdRhs->nodeTypedValue;
-    }
-};
+    if (text.empty())
+        return tstring();
+
+    int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), NULL, 0);
+    std::vector<wchar_t> wide(len > 0 ? len : 1);
+    MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), &wide[0], len);
+    return (LPCTSTR)_bstr_t(std::wstring(&wide[0], len).c_str());
+}
 
 //------------------------------------------------------------------------------
-// Create cab file
+// Character data in ASCII, with markup, carriage returns and non-ASCII
+// characters written as references (valid whatever the document encoding)
 //------------------------------------------------------------------------------
-void Xml2Msi::buildCabinets()
+static std::string xmlText(const tstring& text)
 {
-    m_currentTable = _T("File");
-
-    // initial sequence numbers
-    int mediaLastSequencePrev = 0;
-
-    if (!m_mergeModule)
+    std::string out;
+    for (size_t i = 0; i < text.size(); ++i)
     {
-        // get all rows from media table
-        xml::IXMLDOMNodeListPtr mediaNodeList(m_doc->selectNodes(L"/msi/table[@name='Media']/row"));
-
-        // sort according to DiskId
-        typedef std::vector<ATL::CAdapt<xml::IXMLDOMNodePtr> > NodeList;
-        NodeList nodeList;
-        nodeList.reserve(mediaNodeList->length);
-        for (xml::IXMLDOMNodePtr mediaNode = mediaNodeList->nextNode(); mediaNode != NULL; mediaNode = mediaNodeList->nextNode()) 
+        unsigned long c = static_cast<unsigned long>(text[i]);
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < text.size() && text[i + 1] >= 0xDC00 && text[i + 1] < 0xE000)
         {
-            nodeList.push_back(mediaNode);
+            c = 0x10000 + ((c - 0xD800) << 10) + (text[++i] - 0xDC00);
         }
-        std::sort(nodeList.begin(), nodeList.end(), AscendingDiskId());
 
-        // iterate over medias
-        for (NodeList::iterator it = nodeList.begin(); it != nodeList.end(); ++it) 
+        if (c == '&')
         {
-            xml::IXMLDOMNode* mediaNode = it->m_T;
-            bool internal = false;
-
-            // obtain cabinet name
-            xml::IXMLDOMNodePtr mediaCabinetNode = mediaNode->selectSingleNode(L"td[4]");
-            tstring cabinetName = (_bstr_t)mediaCabinetNode->nodeTypedValue;
-            if (cabinetName.empty()) continue;
-            if (cabinetName[0] == _T('#'))
-            {
-                cabinetName = cabinetName.substr(1);
-                internal = true;
-            }
-
-            // determine LastSequence number
-            xml::IXMLDOMNodePtr mediaLastSequenceNode = mediaNode->selectSingleNode(L"td[2]");
-            int mediaLastSequence = mediaLastSequenceNode->nodeTypedValue;
-
-            // compress
-            if (compressFiles(cabinetName.c_str(), mediaLastSequencePrev+1, mediaLastSequence))
-            {
-                // copy all external cabinets to the output directory
-                if (!internal)
-                {
-                    tstring filePath = m_tempCabDir + cabinetName;
-                    CopyFile(filePath.c_str(), m_outputDir.c_str(), FALSE);
-                }
-            }
-
-            mediaLastSequencePrev = mediaLastSequence;
+            out += "&amp;";
         }
-    }
-    else
-    {
-        // determine range of sequence numbers
-        int firstSequence = -1, lastSequence = -1;
-        xml::IXMLDOMNodeListPtr fileNodeList(m_doc->selectNodes(L"/msi/table[@name='File']/row"));
-
-        for (xml::IXMLDOMNodePtr fileNode = fileNodeList->nextNode(); fileNode != NULL; fileNode = fileNodeList->nextNode()) 
+        else if (c == '<')
         {
-            xml::IXMLDOMNodePtr sequenceNode(fileNode->selectSingleNode(L"td[8]"));
-            int sequence = sequenceNode->nodeTypedValue;
-
-            if (firstSequence == -1 || sequence < firstSequence)
-            {
-                firstSequence = sequence;
-            }
-
-            if (lastSequence == -1 || sequence > lastSequence)
-            {
-                lastSequence = sequence;
-            }
+            out += "&lt;";
+        }
+        else if (c == '>')
+        {
+            out += "&gt;";
+        }
+        else if (c == '\r' || c >= 0x80)
+        {
+            char ref[16];
+            sprintf_s(ref, "&#%lu;", c);
+            out += ref;
+        }
+        else
+        {
+            out += static_cast<char>(c);
         }
-
-        // standard name
-        tstring cabinetName = L"MergeModule.CABinet";
-        compressFiles(cabinetName.c_str(), firstSequence, lastSequence);
     }
-}
 
+    return out;
+}
 
 //------------------------------------------------------------------------------
-bool Xml2Msi::compressFiles(LPCTSTR cabinetName, int firstSequence, int lastSequence)
+// Copy the input up to offset to the output
+//------------------------------------------------------------------------------
+static void copyUpTo(std::istream& in, std::ostream& out, unsigned long long& copied, unsigned long long offset)
 {
-    bool failed = false;
-
-    // create cab context
-    std::auto_ptr<CabCompress> cab(
-        new CabCompress(m_tempCabDir.c_str(), cabinetName, 0, 0, 1));
+    char buf[65536];
+    while (copied < offset)
+    {
+        size_t len = static_cast<size_t>(std::min<unsigned long long>(offset - copied, sizeof(buf)));
+        if (!in.read(buf, len))
+            throw std::runtime_error("Unexpected end of the XML file");
 
+        out.write(buf, len);
+        copied += len;
+    }
+}
 
-    // "Each source disk contains all the files whose sequence numbers (as 
-    // shown in the Sequence column of the File table) are less than or 
-    // equal to the value in the LastSequence column, and greater than the 
-    // LastSequence value of the previous disk (or greater than 0, for the 
-    // first entry in the Media table)."
-    for (int sequence = firstSequence; sequence <= lastSequence; ++sequence)
+//------------------------------------------------------------------------------
+// Replace the value of an attribute in a raw start tag (returns false if absent)
+//------------------------------------------------------------------------------
+static bool replaceAttribute(std::string& tag, const std::string& name, const std::string& value)
+{
+    for (size_t pos = tag.find(name); pos != std::string::npos; pos = tag.find(name, pos + 1))
     {
-        // select the file with corresponding Sequence number
-        tostringstream oss;
-        oss << _T("/msi/table[@name='File']/row[td[8] = ") << sequence << _T("]");
-        xml::IXMLDOMNodePtr fileNode(m_doc->selectSingleNode(oss.str().c_str()));
-        if (fileNode == NULL)
+        if (pos == 0 || !isspace(static_cast<unsigned char>(tag[pos - 1])))
             continue;
 
-        // get file name node
-        xml::IXMLDOMNodePtr fileNameNode(fileNode->selectSingleNode(L"td[1]"));
+        size_t p = pos + name.size();
+        while (p < tag.size() && isspace(static_cast<unsigned char>(tag[p])))
+            ++p;
+        if (p == tag.size() || tag[p++] != '=')
+            continue;
+        while (p < tag.size() && isspace(static_cast<unsigned char>(tag[p])))
+            ++p;
+        if (p == tag.size() || (tag[p] != '"' && tag[p] != '\''))
+            continue;
 
-        // determine file name
-        _bstr_t fileName =  fileNameNode->nodeTypedValue;
+        size_t end = tag.find(tag[p], p + 1);
+        if (end == std::string::npos)
+            return false;
 
-        // determine file href
-        xml::IXMLDOMNodePtr nodeHref(fileNameNode->attributes->getNamedItem(L"href"));
-        if (nodeHref == NULL) 
-        {
-            // finalize cabinet
-            delete cab.release();
+        tag.replace(p + 1, end - p - 1, value);
+        return true;
+    }
+    return false;
+}
 
-            // and delete it right away
-            tstring filePath = m_tempCabDir + cabinetName;
-            DeleteFile(filePath.c_str());
+//------------------------------------------------------------------------------
+// Read the 'Property' table with the streaming parser, skipping all others
+//------------------------------------------------------------------------------
+static void readProperties(const tstring& path, const TableIndex& index, std::map<tstring, tstring>& properties)
+{
+    XmlReader xml(path);
+    bool inTable = false;
+    int col = 0;
+    std::string name, value;
 
-            failed = true;
-            break;
-        }
-        _bstr_t href = nodeHref->nodeValue;
+    for (XmlReader::Event event = xml.next(); event != XmlReader::eventEof; event = xml.next())
+    {
+        if (event == XmlReader::eventStart && xml.depth() == 2)
+        {
+            const std::string* tableName = xml.attribute("name");
+            inTable = xml.name() == "table" && tableName != NULL && *tableName == "Property";
 
-        // compress file
-        tstring filePath = resolveHref(fileNode->selectSingleNode(L"td[1]"));
-        if (!m_quiet)
+            const TableIndex::Entry* entry = index.entryAt(xml.eventOffset());
+            if (!inTable && entry != NULL && !xml.emptyElement())
+            {
+                xml.skipTo(entry->endOffset, entry->endLine, entry->endColumn);
+            }
+        }
+        else if (!inTable)
         {
-            tcerr << _T("Compressing file '") << (LPCTSTR)fileName << _T("'") << std::endl;
+            continue;
         }
-
-        // validate MD5
-        if (fileNameNode->attributes->getNamedItem(L"md5") != NULL) 
+        else if (event == XmlReader::eventStart && xml.depth() == 3)
         {
-            // map file to memory
-            SmrtFileHandle hFile(
-                CreateFile(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, NULL, NULL));
-            if (hFile == INVALID_HANDLE_VALUE) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
-
-            SmrtFileMap pMap;
-
-            if (GetFileSize(hFile, NULL) > 0)
-            {
-                // create file mapping
-                SmrtFileHandle hMap(CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL));
-                if (hMap == NULL) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+            col = 0;
+            name.clear();
+            value.clear();
+        }
+        else if (event == XmlReader::eventStart && xml.depth() == 4)
+        {
+            ++col;
+        }
+        else if (event == XmlReader::eventText && xml.depth() == 4)
+        {
+            (col == 1 ? name : value) += xml.text();
+        }
+        else if (event == XmlReader::eventEnd && xml.depth() == 2)
+        {
+            properties[fromUtf8(name)] = fromUtf8(value);
+        }
+        else if (event == XmlReader::eventEnd && xml.depth() == 1)
+        {
+            return;
+        }
+    }
+}
 
-                // map file
-                pMap = SmrtFileMap(MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0));
-                if (pMap.isNull()) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
-            }
+//------------------------------------------------------------------------------
+//
+// Update the XML file without building the database
+//
+// Makes the changes of update() in a single pass of the streaming parser:
+// the content of the affected 'td' and 'revnumber' elements is replaced,
+// and new properties are appended to the 'Property' table. All other bytes
+// are copied unchanged, so the document is neither loaded into a DOM nor
+// reformatted. The upgrade code and product version are looked up in a
+// first pass only if the 'Upgrade' table precedes the 'Property' table.
+//
+// A table index built by a cheap first scan lets the parser skip the
+// tables that do not change, so that only 'Property', 'Upgrade' and
+// 'Component' are actually parsed; the Base64 data of 'Binary' and the
+// like is copied without being looked at.
+//
+//------------------------------------------------------------------------------
+void Xml2Msi::updateXml()
+{
+    // new property values (values set with -s take precedence, and are added if missing)
+    PropertyMap properties(m_propertyMap);
+    std::map<tstring, tstring> messages;
+    if (!m_productVersion.empty() 
+        && properties.insert(PropertyMap::value_type(_T("ProductVersion"), m_productVersion)).second)
+    {
+        messages[_T("ProductVersion")] = _T("Updated product version to ");
+    }
+    if (!m_productCode.empty() 
+        && properties.insert(PropertyMap::value_type(_T("ProductCode"), m_productCode)).second)
+    {
+        messages[_T("ProductCode")] = _T("Updated product code to ");
+    }
+    if (!m_upgradeCode.empty() 
+        && properties.insert(PropertyMap::value_type(_T("UpgradeCode"), m_upgradeCode)).second)
+    {
+        messages[_T("UpgradeCode")] = _T("Updated upgrade code to ");
+    }
 
-            // check MD5
-            checkMD5(fileNameNode, (LPCVOID)pMap, GetFileSize(hFile, NULL), sizeof(BYTE));
+    // original values of the 'Property' table needed for the 'Upgrade' table
+    PropertyMap originals;
+    bool propertiesRead = false;
+    tstring upgradeVersion;
 
+    tstring tempPath = m_xmlOutputPath + _T(".tmp");
+    std::set<tstring> found;
+    bool propertyTable = false;
+    bool revnumber = false;
+    try
+    {
+        TableIndex index(m_inputPath);
+        XmlReader xml(m_inputPath);
+        std::ifstream in(m_inputPath.c_str(), std::ios::in | std::ios::binary);
+        std::ofstream out(tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!in || !out)
+        {
+            tcerr << color::red << _T("Unable to write '") << m_xmlOutputPath << _T("'") 
+                  << color::base << std::endl;
+            _com_issue_error(E_FAIL);
         }
 
-        // compress file
-        cab->addFile(_bstr_t(filePath.c_str()), fileName, m_compression);
+        // line break of the document, for new rows
+        std::string newline = "\n";
+        {
+            char head[4096];
+            in.read(head, sizeof(head));
+            if (std::string(head, static_cast<size_t>(in.gcount())).find("\r\n") != std::string::npos)
+                newline = "\r\n";
+            in.clear();
+            in.seekg(0);
+        }
 
-        // update file size
+        unsigned long long copied = 0;      // bytes copied to the output
+        unsigned long long insertAt = 0;    // end of the last row or column of the 'Property' table
+        unsigned long long startOffset = 0; // start of the current 'td' or 'revnumber' element
+        unsigned long long contentOffset = 0; // end of its start tag
+        bool empty = false;                 // current element is empty
+        bool summary = false;               // inside 'summary'
+        tstring table;                      // current table
+        std::vector<std::string> fields;    // fields of the current row so far
+        std::string text;                   // content of the current element
+        bool upgradeRow = false;            // current row of the 'Upgrade' table matches the upgrade code
+
+        // replace the content of the element that just ended
+        auto replace = [&](const tstring& value)
         {
-            SmrtFileHandle hFile(CreateFile(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
-            LARGE_INTEGER size;
-            if (!GetFileSizeEx(hFile, &size))
+            if (empty)
             {
-                tcerr << color::red << _T("Error: unable to determine file size of '") 
-                    << (LPCTSTR)fileName << _T("'\n") << color::base << std::endl;
-                continue;
+                copyUpTo(in, out, copied, xml.offset() - 2);
+                out << ">" << xmlText(value) << "</" << (summary ? "revnumber" : "td") << ">";
+                copied = xml.offset();
             }
-
-            if (size.u.HighPart != 0)
+            else
             {
-                tcerr << color::red << _T("Error: file size of '") << (LPCTSTR)fileName 
-                    << _T("' too large.\n") << color::base << std::endl;
-                continue;
+                copyUpTo(in, out, copied, contentOffset);
+                out << xmlText(value);
+                copied = xml.eventOffset();
             }
+            in.seekg(static_cast<std::streamoff>(copied));
+        };
 
-            tostringstream oss;
-            oss << size.u.LowPart;
-            xml::IXMLDOMNodePtr oldnode = fileNode->selectSingleNode(L"td[4]");
-            if (oldnode->text != _bstr_t(oss.str().c_str()))
+        for (XmlReader::Event event = xml.next(); event != XmlReader::eventEof; event = xml.next())
+        {
+            size_t depth = xml.depth();
+            if (event == XmlReader::eventStart)
             {
-                xml::IXMLDOMElementPtr etd(m_doc->createElement(L"td"));
-                etd->appendChild(m_doc->createTextNode(oss.str().c_str()));
-                fileNode->replaceChild(etd, oldnode);
-
-                if (!m_quiet)
+                if (depth == 2)
                 {
-                    tcerr << color::green << _T("    updated file size in 'File' table ('") 
-                        << (LPCTSTR)oldnode->text << _T("'' => '") 
-                        << oss.str() << _T("')") << color::base << std::endl;
-                }
-            }
-        }
+                    const std::string* name = xml.attribute("name");
+                    table = xml.name() == "table" && name != NULL ? fromUtf8(*name) : tstring();
+                    summary = xml.name() == "summary";
 
+                    if (table == _T("Property"))
+                    {
+                        propertyTable = true;
+                        insertAt = xml.offset();
 
-        // set version
-        {
-            xml::IXMLDOMNodePtr oldnode = fileNode->selectSingleNode(L"td[5]");
+                        // keep the row count hint in step with the rows appended at the end
+                        const std::string* rows = xml.attribute("rows");
+                        if (rows != NULL && !xml.emptyElement())
+                        {
+                            if (!propertiesRead)
+                            {
+                                readProperties(m_inputPath, index, originals);
+                                propertiesRead = true;
+                            }
+
+                            long added = 0;
+                            for (PropertyMap::const_iterator it = properties.begin(); it != properties.end(); ++it)
+                            {
+                                if (!originals.count(it->first) && !messages.count(it->first))
+                                    ++added;
+                            }
+
+                            if (added > 0)
+                            {
+                                std::ostringstream tag, count;
+                                copyUpTo(in, out, copied, xml.eventOffset());
+                                copyUpTo(in, tag, copied, xml.offset());
+                                count << atol(rows->c_str()) + added;
+
+                                std::string start = tag.str();
+                                replaceAttribute(start, "rows", count.str());
+                                out << start;
+                            }
+                        }
+                    }
+                    else if (table == _T("Upgrade") && m_updateUpgradeVersion)
+                    {
+                        if (!propertiesRead)
+                        {
+                            readProperties(m_inputPath, index, originals);
+                            propertiesRead = true;
+                        }
 
-            // check if this is a companion file
-            std::wstring xpath = L"/msi/table[@name='File']/row[td[1]='" + (_bstr_t)oldnode->nodeTypedValue + L"']";
-            if (m_doc->selectNodes(xpath.c_str())->length == 0)
-            {
-                DWORD dw; 
-                DWORD len = GetFileVersionInfoSize(const_cast<LPTSTR>(filePath.c_str()), &dw);
-                tostringstream oss;
-                if (len > 0)
+                        // the product version as updated above, unless given
+                        upgradeVersion = m_upgradeVersion;
+                        if (upgradeVersion.empty())
+                            upgradeVersion = !m_productVersion.empty() ? m_productVersion : originals[_T("ProductVersion")];
+                    }
+
+                    // skip the tables that do not change
+                    const TableIndex::Entry* entry = index.entryAt(xml.eventOffset());
+                    bool changes = table == _T("Property") 
+                        || (table == _T("Upgrade") && m_updateUpgradeVersion)
+                        || (table == _T("Component") && m_componentCode);
+                    if (!table.empty() && !changes && entry != NULL && !xml.emptyElement())
+                    {
+                        xml.skipTo(entry->endOffset, entry->endLine, entry->endColumn);
+                    }
+                }
+                else if (depth == 3 && xml.name() == "row")
                 {
-                    std::vector<_TCHAR> buf(len);
-                    GetFileVersionInfo(const_cast<LPTSTR>(filePath.c_str()), 0, len, &buf[0]);
-                    UINT vlen;
-                    LPVOID lpvi;
-                    VerQueryValue(&buf[0], _T("\\"), &lpvi, &vlen);
-
-                    VS_FIXEDFILEINFO fileInfo;
-                    fileInfo = *reinterpret_cast<VS_FIXEDFILEINFO*>(lpvi);
-                    oss << static_cast<unsigned>(HIWORD(fileInfo.dwFileVersionMS)) << _T(".")
-                        << static_cast<unsigned>(LOWORD(fileInfo.dwFileVersionMS)) << _T(".")
-                        << static_cast<unsigned>(HIWORD(fileInfo.dwFileVersionLS)) << _T(".")
-                        << static_cast<unsigned>(LOWORD(fileInfo.dwFileVersionLS));
+                    fields.clear();
+                    upgradeRow = false;
                 }
 
-                if ((_bstr_t)oldnode->nodeTypedValue != _bstr_t(oss.str().c_str()))
+                startOffset = xml.eventOffset();
+                contentOffset = xml.offset();
+                empty = xml.emptyElement();
+                text.clear();
+            }
+            else if (event == XmlReader::eventText)
+            {
+                // keep the fields of the tables that may change (not Base64 data)
+                if ((depth == 4 && (table == _T("Property") || table == _T("Upgrade") || table == _T("Component")))
+                    || (depth == 3 && summary))
                 {
-                    xml::IXMLDOMElementPtr etd(m_doc->createElement(L"td"));
-                    etd->appendChild(m_doc->createTextNode(oss.str().c_str()));
-                    fileNode->replaceChild(etd, oldnode);
+                    text += xml.text();
+                }
+            }
+            else if (depth == 2 && summary && xml.name() == "revnumber")
+            {
+                revnumber = true;
+                if (!m_packageCode.empty())
+                {
+                    replace(m_packageCode);
 
                     if (!m_quiet)
                     {
-                        tcerr << color::green << _T("    updated version info in 'File' table ('") 
-                            << (LPCTSTR)(_bstr_t)oldnode->nodeTypedValue << _T("' => '") 
-                            << oss.str() << _T("')") << color::base << std::endl;
+                        tcerr << color::green << _T("Updated package code to ") 
+                            << m_packageCode << color::base << std::endl;
                     }
                 }
             }
-        }
-
-        // updating compression flag (msidbFileAttributesCompressed)
-        {
-            xml::IXMLDOMNodePtr oldnode = fileNode->selectSingleNode(L"td[7]");
-            UINT flags = nodeValue(oldnode);
-            UINT wordcount = (UINT)m_doc->selectSingleNode(L"/msi/summary/wordcount")->nodeTypedValue;
-
-            if (flags & msidbFileAttributesNoncompressed || (wordcount & msidbSumInfoSourceTypeCompressed) == 0)
+            else if (depth == 3 && xml.name() == "td")
             {
-                // turn off explicit non-compressed flag
-                flags &= ~msidbFileAttributesNoncompressed;
+                fields.push_back(text);
+                size_t col = fields.size();
+                tstring key = fromUtf8(fields[0]);
 
-                // force compression flag if word count specifies uncompressed
-                if ((wordcount & msidbSumInfoSourceTypeCompressed) == 0)
+                if (table == _T("Property") && col == 2)
                 {
-                    flags |= msidbFileAttributesCompressed;
-                }
+                    originals[key] = fromUtf8(text);
 
-                tostringstream oss;
-                oss << flags;
-                xml::IXMLDOMElementPtr etd(m_doc->createElement(L"td"));
-                etd->appendChild(m_doc->createTextNode(oss.str().c_str()));
-                fileNode->replaceChild(etd, oldnode);
+                    PropertyMap::const_iterator it = properties.find(key);
+                    if (it != properties.end())
+                    {
+                        found.insert(key);
+                        replace(it->second);
+
+                        if (!m_quiet && messages.count(key))
+                        {
+                            tcerr << color::green << messages[key] << it->second << color::base << std::endl;
+                        }
+                        else if (!m_quiet)
+                        {
+                            tcerr << color::green << _T("Updated property ") << key << _T(" = \"") 
+                                << it->second << _T("\"") << color::base << std::endl;
+                        }
+                    }
+                }
+                else if (table == _T("Component") && col == 2 && m_componentCode)
+                {
+                    tstring code = guid();
+                    replace(code);
 
+                    if (!m_quiet)
+                    {
+                        tcerr << color::green << _T("Updated component code to ") 
+                            << code << color::base << std::endl;
+                    }
+                }
+                else if (table == _T("Upgrade") && m_updateUpgradeVersion && col == 1)
+                {
+                    upgradeRow = key == originals[_T("UpgradeCode")];
+                }
+                else if (upgradeRow && col == 3)
+                {
+                    replace(upgradeVersion);
+                }
+                else if (upgradeRow && col == 5)
+                {
+                    // check that version number is excluding
+                    int attributes = atoi(text.c_str());
+                    if (attributes & msidbUpgradeAttributesVersionMaxInclusive)
+                    {
+                        tostringstream oss;
+                        oss << (attributes & ~msidbUpgradeAttributesVersionMaxInclusive);
+                        replace(oss.str());
+                    }
+                }
+            }
+            else if (depth == 2 && upgradeRow)
+            {
+                upgradeRow = false;
                 if (!m_quiet)
                 {
-                    tcerr << color::green << _T("    updated compression flags in 'File' table")
-                        << color::base << std::endl;
+                    tcerr << color::green << _T("Updated 'VersionMax' in 'Upgrade' table to ") 
+                        << upgradeVersion << _T(" (excluding)") << color::base << std::endl;
                 }
-
             }
-        }
-
-        // updating MsiFileHash table
-        {
-            // check if a FileHash table entry exists
-            std::wstring xpath = L"/msi/table[@name='MsiFileHash']/row[td[1]='" + fileName + L"']";
-            xml::IXMLDOMNodePtr fileHashNode(m_doc->selectSingleNode(xpath.c_str()));
-            if ((fileHashNode != NULL) && (MsiGetFileHash != NULL))
+            else if (depth == 2 && table == _T("Property"))
             {
-                MSIFILEHASHINFO fhi = { sizeof MSIFILEHASHINFO };
-                OK(MsiGetFileHash(filePath.c_str(), 0, &fhi));
-
-                xml::IXMLDOMNodePtr oldHash[4];
-                oldHash[0] = fileHashNode->selectSingleNode(L"td[3]");
-                oldHash[1] = fileHashNode->selectSingleNode(L"td[4]");
-                oldHash[2] = fileHashNode->selectSingleNode(L"td[5]");
-                oldHash[3] = fileHashNode->selectSingleNode(L"td[6]");
+                insertAt = xml.offset();
+            }
+            else if (depth == 1 && table == _T("Property"))
+            {
+                propertiesRead = true;
 
-                bool updated = false;
-                for (int i = 0; i < 4; ++i)
+                // append the properties set with -s that were not found
+                copyUpTo(in, out, copied, insertAt);
+                for (PropertyMap::const_iterator it = properties.begin(); it != properties.end(); ++it)
                 {
-                    if (static_cast<LONG>(oldHash[i]->nodeTypedValue) != static_cast<LONG>(fhi.dwData[i]))
-                    {
-                        tostringstream oss;
-                        oss << static_cast<LONG>(fhi.dwData[i]);
+                    if (found.count(it->first) || messages.count(it->first))
+                        continue;
 
-                        xml::IXMLDOMElementPtr etd(m_doc->createElement(L"td"));
-                        etd->appendChild(m_doc->createTextNode(oss.str().c_str()));
-                        fileHashNode->replaceChild(etd, oldHash[i]);
+                    out << newline << "\t\t<row>" 
+                        << newline << "\t\t\t<td>" << xmlText(it->first) << "</td>" 
+                        << newline << "\t\t\t<td>" << xmlText(it->second) << "</td>" 
+                        << newline << "\t\t</row>";
+                    found.insert(it->first);
 
-                        updated = true;
+                    if (!m_quiet)
+                    {
+                        tcerr << color::green << _T("Set property ") << it->first 
+                            << _T(" = \"") << it->second << _T("\"") << color::base << std::endl;
                     }
                 }
-
-                if (updated && !m_quiet)
-                {
-                    tcerr << color::green << _T("    updated hash in 'MsiFileHash' table") 
-                        << color::base << std::endl;
-                }
             }
         }
 
+        copyUpTo(in, out, copied, xml.offset());
+        out.close();
+        if (!out)
+        {
+            tcerr << color::red << _T("Unable to write '") << m_xmlOutputPath << _T("'") 
+                  << color::base << std::endl;
+            _com_issue_error(E_FAIL);
+        }
+    }
+    catch (...)
+    {
+        DeleteFile(tempPath.c_str());
+        throw;
+    }
+
+    // the values to update must exist, as with the DOM
+    tstring missing;
+    if (!properties.empty() && !propertyTable)
+        missing = _T("table 'Property'");
+    else if (!m_packageCode.empty() && !revnumber)
+        missing = _T("summary element 'revnumber'");
+    for (std::map<tstring, tstring>::const_iterator it = messages.begin(); it != messages.end() && missing.empty(); ++it)
+    {
+        if (!found.count(it->first))
+            missing = _T("property '") + it->first + _T("'");
     }
 
-    // finalize cabinet
-    delete cab.release();
+    if (!missing.empty())
+    {
+        DeleteFile(tempPath.c_str());
+        tcerr << color::red << _T("Unable to update the XML file: missing ") << missing 
+              << color::base << std::endl;
+        _com_issue_error(E_FAIL);
+    }
 
-    return !failed;
+    if (!MoveFileEx(tempPath.c_str(), m_xmlOutputPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        DeleteFile(tempPath.c_str());
+        tcerr << color::red << _T("Unable to write '") << m_xmlOutputPath << _T("'") 
+              << color::base << std::endl;
+        _com_issue_error(E_FAIL);
+    }
 }
 
+//------------------------------------------------------------------------------
+struct AscendingDiskId
+{
+    bool operator()(const ATL::CAdapt<xml::IXMLDOMNodePtr>& lhs, 
+                    const ATL::CAdapt<xml::IXMLDOMNodePtr>& rhs) const
+    {
+        xml::IXMLDOMNodePtr diskIdLhs = lhs.m_T->selectSingleNode(L"td[1]");
+        xml::IXMLDOMNodePtr diskIdRhs = rhs.m_T->selectSingleNode(L"td[1]");
+        return diskIdLhs != NULL && diskIdRhs != NULL && (int)diskIdLhs->nodeTypedValue <= (int)diskIdRhs->nodeTypedValue;
+    }
+};
 
 //------------------------------------------------------------------------------
-// Validate table
+//
+// Scan files
+//
+// Resolves the href of every row in the 'File' table, and determines MD5
+// digest, size, version and MSI file hash of the referenced files. The
+// files are scanned on a thread pool; the results are then checked and
+// written back to the 'File' and 'MsiFileHash' tables in document order.
+//
 //------------------------------------------------------------------------------
-void Xml2Msi::validateTable(xml::IXMLDOMNode* table)
+void Xml2Msi::ingestFiles()
 {
-    _bstr_t bstrTable = table->attributes->getNamedItem(L"name")->nodeValue;
-    m_currentTable = (LPCTSTR)bstrTable;
+    m_currentTable = _T("File");
+    m_files.clear();
+    m_fileSequences.clear();
 
-    // look up table in default table list
-    int tableCount;
-    for (tableCount = ARRAYSIZE(colDefs) - 1; tableCount >= 0 ; --tableCount) 
+    // collect rows of 'MsiFileHash' table
+    std::map<tstring, xml::IXMLDOMNodePtr> hashRows;
+    xml::IXMLDOMNodeListPtr hashNodeList(m_doc->selectNodes(L"/msi/table[@name='MsiFileHash']/row"));
+    for (xml::IXMLDOMNodePtr hashNode = hashNodeList->nextNode(); hashNode != NULL; hashNode = hashNodeList->nextNode())
     {
-        // compare table
-        if (m_currentTable == colDefs[tableCount].szTable)
-            break;
+        tstring key = (LPCTSTR)hashNode->selectSingleNode(L"td[1]")->text;
+        if (hashRows.find(key) == hashRows.end()) hashRows[key] = hashNode;
     }
-    if (tableCount < 0) 
+
+    // collect rows of 'File' table
+    std::set<tstring> fileKeys;
+    xml::IXMLDOMNodeListPtr fileNodeList(m_doc->selectNodes(L"/msi/table[@name='File']/row"));
+    m_files.reserve(fileNodeList->length);
+    for (xml::IXMLDOMNodePtr fileNode = fileNodeList->nextNode(); fileNode != NULL; fileNode = fileNodeList->nextNode())
     {
-#ifdef _DEBUG
-        if (!m_quiet) 
+        xml::IXMLDOMNodePtr fileNameNode(fileNode->selectSingleNode(L"td[1]"));
+        xml::IXMLDOMNodePtr sequenceNode(fileNode->selectSingleNode(L"td[8]"));
+
+        FileInfo file;
+        file.row        = fileNode;
+        file.name       = (LPCTSTR)(_bstr_t)fileNameNode->nodeTypedValue;
+        file.sequence   = nodeValue(sequenceNode);
+        file.checkMD5   = fileNameNode->attributes->getNamedItem(L"md5") != NULL;
+        file.getMD5     = file.checkMD5 || !m_cabCacheDir.empty() || m_fingerprint.get() != NULL 
+                       || m_rowIndex.get() != NULL;
+        file.getVersion = true;
+        file.getHash    = false;
+        file.resolved   = false;
+        file.sizeKnown  = false;
+        file.hr         = S_OK;
+        file.size.QuadPart = 0;
+        std::fill(file.hash, file.hash + 4, 0);
+
+        if (xml::IXMLDOMNodePtr hrefNode = fileNameNode->attributes->getNamedItem(L"href"))
+        {
+            file.href = (LPCTSTR)(_bstr_t)hrefNode->nodeValue;
+        }
+
+        std::map<tstring, xml::IXMLDOMNodePtr>::const_iterator itHash = hashRows.find(file.name);
+        if (itHash != hashRows.end() && MsiGetFileHash != NULL)
         {
-            tcerr << color::yellow << _T("Skipping validation of unknown table \"") 
-                << m_currentTable << _T("\"") << color::base << std::endl;
+            file.hashRow = itHash->second;
+            file.getHash = true;
         }
-#endif // _DEBUG
-        return; // not found
+
+        m_fileSequences.insert(std::make_pair(file.sequence, m_files.size()));
+        fileKeys.insert(file.name);
+        m_files.push_back(file);
     }
 
-    // iterate over column definitions
-    m_currentCol = 0;
-    xml::IXMLDOMNodeListPtr pCols(table->selectNodes(L"col"));
-    xml::IXMLDOMNodePtr pCol;
-    while ((pCol = pCols->nextNode()) != NULL) 
+    // companion files take their version from another file
+    for (FileList::iterator it = m_files.begin(); it != m_files.end(); ++it)
+    {
+        tstring version = (LPCTSTR)(_bstr_t)it->row->selectSingleNode(L"td[5]")->nodeTypedValue;
+        it->getVersion = fileKeys.find(version) == fileKeys.end();
+    }
+
+    // scan files
+    ThreadPool pool(m_jobs);
+    m_baseUrl = (LPCTSTR)m_doc->url;
+    pool.forEach(m_files.size(), [this](size_t i) { scanFile(m_files[i]); });
+
+    // apply results
+    for (size_t i = 0; i < m_files.size(); ++i)
     {
-        ++m_currentCol;
+        FileInfo& file = m_files[i];
+        if (file.href.empty())
+            continue;
+
+        if (m_fingerprint.get())
+        {
+            if (file.tempPath.empty())
+                m_fingerprint->addInput(file.path, file.md5);
+            else
+                m_fingerprint->setVolatile();
+        }
+
+        m_currentRow = static_cast<int>(i) + 1;
+        m_currentCol = 1;
+        xml::IXMLDOMNodePtr fileNode(file.row);
+
+        if (!file.resolved)
+        {
+            tcerr << color::red << _T("Invalid href to ") << file.href << color::base << std::endl;
+        }
+        if (FAILED(file.hr)) _com_issue_error(file.hr);
+
+        if (!m_quiet)
+        {
+            tcerr << _T("Checking file '") << file.name << _T("'") << std::endl;
+        }
 
-        tstring strDefs(colDefs[tableCount].szDef);
-        tstring::size_type nDef = 0;
-        for (int i = 1; i < m_currentCol; ++i) 
+        // validate MD5
+        if (file.checkMD5)
         {
-            nDef = strDefs.find(_T(';'), nDef);
-            if (nDef == tstring::npos) return;
+            checkMD5(fileNode->selectSingleNode(L"td[1]"), file.md5);
         }
-        tstring strDef(strDefs.substr(nDef, 3));
 
-        // check if column definition missing
-        xml::IXMLDOMElementPtr pEl(pCol);
-        if (pCol->attributes->getNamedItem(L"def") == NULL) 
+        // update file size
+        if (!file.sizeKnown)
         {
-            // missing, use default
-            pEl->setAttribute(_T("def"), &strDef[1]);
-            pEl->setAttribute(_T("key"), strDef[0] == _T('Y') ? L"yes" : L"no");
+            tcerr << color::red << _T("Error: unable to determine file size of '")
+                << file.name << _T("'\n") << color::base << std::endl;
+            continue;
         }
-        else 
+
+        if (file.size.u.HighPart != 0)
         {
-            // present, check against default
-            _bstr_t bstrColDef(pCol->attributes->getNamedItem(L"def")->nodeValue);
-            _TCHAR t = ((LPCTSTR)bstrColDef)[0];
+            tcerr << color::red << _T("Error: file size of '") << file.name
+                << _T("' too large.\n") << color::base << std::endl;
+            continue;
+        }
 
-            switch (tolower(strDef[1])) 
+        {
+            tostringstream oss;
+            oss << file.size.u.LowPart;
+            xml::IXMLDOMNodePtr oldnode = fileNode->selectSingleNode(L"td[4]");
+            if (oldnode->text != _bstr_t(oss.str().c_str()))
             {
-            case 's':
-            case 'l':
-                if (tolower(t) != 's' && tolower(t) != 'l') 
+                xml::IXMLDOMElementPtr etd(m_doc->createElement(L"td"));
+                etd->appendChild(m_doc->createTextNode(oss.str().c_str()));
+                fileNode->replaceChild(etd, oldnode);
+
+                if (!m_quiet)
                 {
-                    tcerr << color::red << _T("Column must be defined as string") << color::base << std::endl;
-                    _com_issue_error(E_FAIL);
+                    tcerr << color::green << _T("    updated file size in 'File' table ('")
+                        << (LPCTSTR)oldnode->text << _T("'' => '")
+                        << oss.str() << _T("')") << color::base << std::endl;
                 }
-                break;
+            }
+        }
+
+        // set version
+        if (file.getVersion)
+        {
+            xml::IXMLDOMNodePtr oldnode = fileNode->selectSingleNode(L"td[5]");
+            if ((_bstr_t)oldnode->nodeTypedValue != _bstr_t(file.version.c_str()))
+            {
+                xml::IXMLDOMElementPtr etd(m_doc->createElement(L"td"));
+                etd->appendChild(m_doc->createTextNode(file.version.c_str()));
+                fileNode->replaceChild(etd, oldnode);
 
-            case 'i':
-                if (tolower(t) != 'i') 
+                if (!m_quiet)
                 {
-                    tcerr << color::red << _T("Column must be defined as integer") << color::base << std::endl;
-                    _com_issue_error(E_FAIL);
+                    tcerr << color::green << _T("    updated version info in 'File' table ('")
+                        << (LPCTSTR)(_bstr_t)oldnode->nodeTypedValue << _T("' => '")
+                        << file.version << _T("')") << color::base << std::endl;
                 }
-                break;
+            }
+        }
 
-            case 'v':
-                if (tolower(t) != 'v') 
+        // updating MsiFileHash table
+        if (file.getHash)
+        {
+            xml::IXMLDOMNodePtr fileHashNode(file.hashRow);
+            xml::IXMLDOMNodePtr oldHash[4];
+            oldHash[0] = fileHashNode->selectSingleNode(L"td[3]");
+            oldHash[1] = fileHashNode->selectSingleNode(L"td[4]");
+            oldHash[2] = fileHashNode->selectSingleNode(L"td[5]");
+            oldHash[3] = fileHashNode->selectSingleNode(L"td[6]");
+
+            bool updated = false;
+            for (int j = 0; j < 4; ++j)
+            {
+                if (static_cast<LONG>(oldHash[j]->nodeTypedValue) != static_cast<LONG>(file.hash[j]))
                 {
-                    tcerr << color::red << _T("Column must be defined as binary stream") << color::base << std::endl;
-                    _com_issue_error(E_FAIL);
+                    tostringstream oss;
+                    oss << static_cast<LONG>(file.hash[j]);
+
+                    xml::IXMLDOMElementPtr etd(m_doc->createElement(L"td"));
+                    etd->appendChild(m_doc->createTextNode(oss.str().c_str()));
+                    fileHashNode->replaceChild(etd, oldHash[j]);
+
+                    updated = true;
                 }
-                break;
+            }
 
-            default:
-                break;
+            if (updated && !m_quiet)
+            {
+                tcerr << color::green << _T("    updated hash in 'MsiFileHash' table")
+                    << color::base << std::endl;
             }
         }
     }
 
-    m_currentTable.erase();
+    m_currentRow = 0;
     m_currentCol = 0;
 }
 
 //------------------------------------------------------------------------------
-// Create table
+// Scan file (runs on a worker thread)
 //------------------------------------------------------------------------------
-void Xml2Msi::createTable(xml::IXMLDOMNode* table)
+void Xml2Msi::scanFile(FileInfo& file) const
 {
-    _bstr_t bstrTable = table->attributes->getNamedItem(L"name")->nodeValue;
-    if (!m_quiet) 
-    {
-        tcerr << _T("Populating table '") << (LPTSTR)bstrTable << _T("'") << std::endl;
-    }
+    if (file.href.empty())
+        return;
 
-    m_currentTable = (LPCTSTR)bstrTable;
+    try
+    {
+        file.path = resolveHref(file.href, m_baseUrl, file.tempPath);
+        file.resolved = true;
 
-    if (bstrTable == _bstr_t(L"_Streams"))
-        return;
+        SmrtFileHandle hFile(
+            CreateFile(file.path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+        if (hFile == INVALID_HANDLE_VALUE) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
 
-    tostringstream ossSQL;
-    ossSQL << _T("CREATE TABLE `") << (LPCTSTR)bstrTable << _T("` (");
+        file.sizeKnown = GetFileSizeEx(hFile, &file.size) != FALSE;
 
-    // add key columns to SQL query string
-    xml::IXMLDOMNodeListPtr pColsKey(table->selectNodes(L"col[@key='yes' or @key='']"));
-    { 
-        if (pColsKey->length == 0) 
-        {
-            tcerr << color::red << _T("Missing primary key") << color::base << std::endl;
-            _com_issue_error(E_FAIL);
-        }
-        xml::IXMLDOMNodePtr pCol = pColsKey->nextNode();
-        while (pCol != NULL) 
+        // compute MD5
+        if (file.getMD5)
         {
-            ossSQL << buildSQLColSpec(pCol);
-            pCol = pColsKey->nextNode();
-            if (pCol) ossSQL << _T(", ");
+            SmrtFileMap pMap;
+
+            if (GetFileSize(hFile, NULL) > 0)
+            {
+                // create file mapping
+                SmrtFileHandle hMap(CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL));
+                if (hMap == NULL) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+
+                // map file
+                pMap = SmrtFileMap(MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0));
+                if (pMap.isNull()) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+            }
+
+            file.md5 = md5Digest((LPCVOID)pMap, GetFileSize(hFile, NULL), sizeof(BYTE));
         }
-    }
 
-    // add remaining columns to SQL query string
-    { 
-        xml::IXMLDOMNodeListPtr pCols(table->selectNodes(L"col[not(@key) or @key='no']"));
-        xml::IXMLDOMNodePtr pCol = pCols->nextNode();
-        while (pCol != NULL) 
+        // get version
+        if (file.getVersion)
         {
-            if (pCol) ossSQL << _T(", ");
-            ossSQL << buildSQLColSpec(pCol);
-            pCol = pCols->nextNode();
+            file.version = fileVersion(file.path);
         }
-    }
 
-    // add primary keys
-    { 
-        ossSQL << _T(" PRIMARY KEY ");
-        pColsKey->reset();
-        xml::IXMLDOMNodePtr pCol = pColsKey->nextNode();
-        while (pCol != NULL) 
+        // compute MSI file hash
+        if (file.getHash)
         {
-            ossSQL << _T("`") << (LPCTSTR)pCol->text << _T("`");
-            pCol = pColsKey->nextNode();
-            if (pCol) ossSQL << _T(", ");
+            MSIFILEHASHINFO fhi = { sizeof MSIFILEHASHINFO };
+            OK(MsiGetFileHash(file.path.c_str(), 0, &fhi));
+            std::copy(fhi.dwData, fhi.dwData + 4, file.hash);
         }
     }
-
-    ossSQL << _T(")");
-
-    SmrtMsiHandle hView;
-    OK(MsiDatabaseOpenView(m_db, ossSQL.str().c_str(), &hView));
-    OK(MsiViewExecute(hView, NULL));
-    OK(MsiViewClose(hView));
-
-    m_currentTable.erase();
+    catch (const _com_error& e)
+    {
+        file.hr = e.Error();
+    }
 }
 
 //------------------------------------------------------------------------------
-// Populate table
+// Create cab file
+//
+// The files of all cabinets are collected first, then the cabinets are
+// compressed concurrently, and finally the 'File' table is updated in
+// the same order as a serial build would.
 //------------------------------------------------------------------------------
-void Xml2Msi::populateTable(xml::IXMLDOMNode* table)
+void Xml2Msi::buildCabinets()
 {
-    _bstr_t bstrTable = table->attributes->getNamedItem(L"name")->nodeValue;
-    m_currentTable = (LPCTSTR)bstrTable;
-
-    // create the table view
-    SmrtMsiHandle hView;
-    tostringstream ossSQL;
-    ossSQL << _T("SELECT * FROM `") << (LPCTSTR)bstrTable << _T("`");
-    OK(MsiDatabaseOpenView(m_db, ossSQL.str().c_str(), &hView));
-    OK(MsiViewExecute(hView, NULL));
+    // resolve, check and update all referenced files
+    ingestFiles();
 
-    // copy column definitions into array
-    std::vector<std::wstring> vecColDef;
-    vecColDef.reserve(table->selectNodes(L"col")->length);
-    xml::IXMLDOMNodeListPtr pColList(table->selectNodes(L"col"));
-    xml::IXMLDOMNodePtr pCol;
+    m_currentTable = _T("File");
 
-    while ((pCol = pColList->nextNode()) != NULL) 
-    {
-        vecColDef.push_back((LPCWSTR)(_bstr_t)pCol->attributes->getNamedItem(L"def")->nodeValue);
-    }
+    std::vector<CabinetInfo> cabinets;
 
-    // add rows
-    xml::IXMLDOMNodeListPtr pRowList(table->selectNodes(L"row"));
-    xml::IXMLDOMNodePtr pRow;
-    while ((pRow = pRowList->nextNode()) != NULL) 
+    if (!m_mergeModule)
     {
-        ++m_currentRow;
-        m_currentCol = 0;
+        // initial sequence numbers
+        int mediaLastSequencePrev = 0;
 
-        // check column count
-        xml::IXMLDOMNodeListPtr pTdList(pRow->selectNodes(L"td"));
+        // get all rows from media table
+        xml::IXMLDOMNodeListPtr mediaNodeList(m_doc->selectNodes(L"/msi/table[@name='Media']/row"));
 
-        if ((size_t)pTdList->length != vecColDef.size()) 
+        // sort according to DiskId
+        typedef std::vector<ATL::CAdapt<xml::IXMLDOMNodePtr> > NodeList;
+        NodeList nodeList;
+        nodeList.reserve(mediaNodeList->length);
+        for (xml::IXMLDOMNodePtr mediaNode = mediaNodeList->nextNode(); mediaNode != NULL; mediaNode = mediaNodeList->nextNode())
         {
-            tcerr << color::red << _T("Invalid number of <td> elements") << color::base << std::endl;
-            _com_issue_error(E_FAIL);
+            nodeList.push_back(mediaNode);
         }
+        std::sort(nodeList.begin(), nodeList.end(), AscendingDiskId());
 
-        // create record
-        SmrtMsiHandle hRec(MsiCreateRecord(vecColDef.size()));
-        if (hRec.isNull()) _com_issue_error(E_OUTOFMEMORY);
-        OK(MsiRecordClearData(hRec));
-
-        // populate record
-        xml::IXMLDOMNodePtr pTd;
-        while ((pTd = pTdList->nextNode()) != NULL) 
+        // iterate over medias
+        for (NodeList::iterator it = nodeList.begin(); it != nodeList.end(); ++it)
         {
-            ++m_currentCol;
+            xml::IXMLDOMNode* mediaNode = it->m_T;
+            CabinetInfo cabinet;
+            cabinet.internal = false;
 
-            // check if NULL field
-            if (iswlower(vecColDef[m_currentCol-1][0]) 
-                && pTd->hasChildNodes() == VARIANT_FALSE 
-                && pTd->attributes->getNamedItem(L"href") == NULL) 
-            {
+            // obtain cabinet name
+            xml::IXMLDOMNodePtr mediaCabinetNode = mediaNode->selectSingleNode(L"td[4]");
+            cabinet.name = (_bstr_t)mediaCabinetNode->nodeTypedValue;
+            if (cabinet.name.empty()) continue;
+            if (cabinet.name[0] == _T('#'))
+            {
+                cabinet.name = cabinet.name.substr(1);
+                cabinet.internal = true;
+            }
+
+            // determine LastSequence number
+            xml::IXMLDOMNodePtr mediaLastSequenceNode = mediaNode->selectSingleNode(L"td[2]");
+            int mediaLastSequence = mediaLastSequenceNode->nodeTypedValue;
+
+            collectFiles(cabinet, mediaLastSequencePrev+1, mediaLastSequence);
+            cabinets.push_back(cabinet);
+
+            mediaLastSequencePrev = mediaLastSequence;
+        }
+    }
+    else
+    {
+        // determine range of sequence numbers
+        int firstSequence = -1, lastSequence = -1;
+        xml::IXMLDOMNodeListPtr fileNodeList(m_doc->selectNodes(L"/msi/table[@name='File']/row"));
+
+        for (xml::IXMLDOMNodePtr fileNode = fileNodeList->nextNode(); fileNode != NULL; fileNode = fileNodeList->nextNode())
+        {
+            xml::IXMLDOMNodePtr sequenceNode(fileNode->selectSingleNode(L"td[8]"));
+            int sequence = sequenceNode->nodeTypedValue;
+
+            if (firstSequence == -1 || sequence < firstSequence)
+            {
+                firstSequence = sequence;
+            }
+
+            if (lastSequence == -1 || sequence > lastSequence)
+            {
+                lastSequence = sequence;
+            }
+        }
+
+        // standard name
+        CabinetInfo cabinet;
+        cabinet.name = L"MergeModule.CABinet";
+        cabinet.internal = true;
+        collectFiles(cabinet, firstSequence, lastSequence);
+        cabinets.push_back(cabinet);
+    }
+
+    // a cabinet that is rebuilt by a later media entry is only built once, by
+    // the last entry that builds it: an entry whose cabinet is discarded (a
+    // file without href) does not replace the cabinet of an earlier one
+    for (size_t i = 0; i < cabinets.size(); ++i)
+    {
+        for (size_t j = i + 1; j < cabinets.size(); ++j)
+        {
+            if (cabinets[j].build && _tcsicmp(cabinets[i].name.c_str(), cabinets[j].name.c_str()) == 0)
+            {
+                cabinets[i].build = false;
+                break;
+            }
+        }
+    }
+
+    // reuse cached cabinets
+    std::unique_ptr<CabCache> cache;
+    if (!m_cabCacheDir.empty())
+    {
+        cache.reset(new CabCache(m_cabCacheDir, m_cabCacheSize));
+    }
+
+    // small folders let a delta rebuild copy most of the previous cabinet
+    if (m_folderFiles < 0)
+    {
+        m_folderFiles = cache.get() ? 64 : 0;
+    }
+
+    for (std::vector<CabinetInfo>::iterator it = cabinets.begin(); it != cabinets.end(); ++it)
+    {
+        if (!it->build)
+            continue;
+
+        // an incremental build keeps the cabinets of the previous output whose files did not change
+        if (m_rowIndex.get())
+        {
+            it->key = cabinetKey(*it);
+            m_cabinetKeys[it->name] = it->key;
+            m_rowIndex->cabinets()[it->name] = it->key;
+
+            if (m_baseIndex.get())
+            {
+                RowIndex::Cabinets::const_iterator itBase = m_baseIndex->cabinets().find(it->name);
+                it->kept = itBase != m_baseIndex->cabinets().end() && itBase->second == it->key
+                        && (it->internal || GetFileAttributes((m_outputDir + it->name).c_str()) != INVALID_FILE_ATTRIBUTES);
+                if (it->kept)
+                    m_keptCabinets.insert(it->name);
+            }
+        }
+
+        if (cache.get() && !it->kept)
+        {
+            if (it->key.empty())
+                it->key = cabinetKey(*it);
+            it->cached = cache->fetch(it->key, m_tempCabDir + it->name);
+            if (!it->cached)
+            {
+                cache->previous(it->name, it->basePath, it->baseManifest);
+            }
+        }
+
+        if (!m_quiet)
+        {
+            if (it->kept)
+            {
+                tcerr << _T("Keeping cabinet '") << it->name << _T("'") << std::endl;
+                continue;
+            }
+
+            if (it->cached)
+            {
+                tcerr << _T("Using cached cabinet '") << it->name << _T("'") << std::endl;
+                continue;
+            }
+
+            for (std::vector<size_t>::const_iterator itFile = it->files.begin(); itFile != it->files.end(); ++itFile)
+            {
+                tcerr << _T("Compressing file '") << m_files[*itFile].name << _T("'") << std::endl;
+            }
+        }
+    }
+
+    // internal cabinets are built in memory, unless the cache needs them as files
+    // or the cabinet API builds them (Quantum)
+    for (std::vector<CabinetInfo>::iterator it = cabinets.begin(); it != cabinets.end(); ++it)
+    {
+        if (it->build && !it->kept && it->internal && !cache.get() && m_compression != CabCompress::compQuantum)
+        {
+            it->stream.reset(new ScratchFile);
+        }
+    }
+
+    // compress cabinets; the jobs left over are used for MSZIP blocks within a cabinet
+    ThreadPool pool(m_jobs);
+    size_t building = std::count_if(cabinets.begin(), cabinets.end(), [](const CabinetInfo& c) { return c.build && !c.cached && !c.kept; });
+    unsigned blockJobs = (std::max)(1u, static_cast<unsigned>(pool.jobs() / (std::max)(size_t(1), (std::min)(building, size_t(pool.jobs())))));
+    CabCache* cachePtr = cache.get();
+    pool.forEach(cabinets.size(), [this, &cabinets, blockJobs, cachePtr](size_t i) { compressFiles(cabinets[i], blockJobs, cachePtr); });
+
+    // evict least recently used cabinets and report statistics
+    if (cache.get())
+    {
+        cache->trim();
+
+        if (!m_quiet)
+        {
+            tcerr << _T("Cabinet cache: ") << cache->hits() << _T(" hit(s), ") 
+                  << cache->misses() << _T(" miss(es), ") 
+                  << cache->evictions() << _T(" eviction(s), ")
+                  << cache->entries() << _T(" cabinet(s) using ") 
+                  << (cache->size() + (1 << 19)) / (1 << 20) << _T(" MB") << std::endl;
+        }
+    }
+
+    // update 'File' table
+    UINT wordcount = (UINT)m_doc->selectSingleNode(L"/msi/summary/wordcount")->nodeTypedValue;
+    for (std::vector<CabinetInfo>::const_iterator it = cabinets.begin(); it != cabinets.end(); ++it)
+    {
+        if (!it->error.empty())
+        {
+            tcerr << color::red << (LPCTSTR)_bstr_t(it->error.c_str()) << color::base << std::endl;
+            _com_issue_error(E_FAIL);
+        }
+
+        if (!it->warning.empty())
+        {
+            tcerr << color::yellow << (LPCTSTR)_bstr_t(it->warning.c_str()) << color::base << std::endl;
+        }
+
+        if (it->reused > 0 && !m_quiet)
+        {
+            tcerr << _T("Reused ") << it->reused << _T(" of ") << it->files.size() 
+                  << _T(" file(s) from previous cabinet '") << it->name << _T("'") << std::endl;
+        }
+
+        updateCompressionFlags(*it, wordcount);
+
+        if (it->stream)
+        {
+            m_cabinetStreams[it->name] = it->stream;
+        }
+
+        // copy all external cabinets to the output directory
+        if (it->build && !it->kept && !it->internal)
+        {
+            tstring filePath = m_tempCabDir + it->name;
+            CopyFile(filePath.c_str(), m_outputDir.c_str(), FALSE);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Collect files of a cabinet
+//------------------------------------------------------------------------------
+void Xml2Msi::collectFiles(CabinetInfo& cabinet, int firstSequence, int lastSequence)
+{
+    cabinet.build = true;
+    cabinet.cached = false;
+    cabinet.kept = false;
+    cabinet.reused = 0;
+
+    // "Each source disk contains all the files whose sequence numbers (as
+    // shown in the Sequence column of the File table) are less than or
+    // equal to the value in the LastSequence column, and greater than the
+    // LastSequence value of the previous disk (or greater than 0, for the
+    // first entry in the Media table)."
+    for (int sequence = firstSequence; sequence <= lastSequence; ++sequence)
+    {
+        // select the file with corresponding Sequence number
+        FileSequenceMap::const_iterator itFile = m_fileSequences.find(sequence);
+        if (itFile == m_fileSequences.end())
+            continue;
+
+        // a file without href discards the cabinet
+        const FileInfo& file = m_files[itFile->second];
+        if (file.href.empty())
+        {
+            cabinet.build = false;
+            break;
+        }
+
+        cabinet.files.push_back(itFile->second);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Compress files into cabinet (runs on a worker thread)
+//------------------------------------------------------------------------------
+void Xml2Msi::compressFiles(CabinetInfo& cabinet, unsigned jobs, CabCache* cache) const
+{
+    if (!cabinet.build || cabinet.cached || cabinet.kept)
+        return;
+
+    try
+    {
+        // create cab context
+        std::unique_ptr<CabCompress> cab(
+            new CabCompress(m_tempCabDir.c_str(), cabinet.name.c_str(), 0, 0, 1));
+        cab->setJobs(jobs);
+        cab->setLzx(m_lzxWindow, m_lzxEffort);
+        if (cabinet.stream)
+        {
+            cab->setOutput(cabinet.stream.get());
+        }
+
+        // file names as stored in the cabinet, and size and MD5 digest of each file
+        std::vector<std::string> names, digests;
+        std::string manifest;
+        for (std::vector<size_t>::const_iterator it = cabinet.files.begin(); it != cabinet.files.end(); ++it)
+        {
+            const FileInfo& file = m_files[*it];
+            std::ostringstream oss;
+            oss << file.size.QuadPart << '\t' << (const char*)_bstr_t(file.md5.c_str());
+            names.push_back((const char*)_bstr_t(file.name.c_str()));
+            digests.push_back(oss.str());
+            manifest += names.back() + '\t' + digests.back() + '\n';
+        }
+
+        // previous cabinet: folders are looked up by their first file
+        std::unique_ptr<CabReader> base;
+        std::map<std::string, size_t> baseFolders;
+        std::map<std::string, std::string> baseDigests;
+        if (!cabinet.basePath.empty())
+        {
+            try
+            {
+                base.reset(new CabReader(cabinet.basePath));
+            }
+            catch (const std::runtime_error& e)
+            {
+                // no delta rebuild, the cabinet is compressed from scratch
+                cabinet.warning = std::string("Warning: Cannot reuse previous cabinet: ") + e.what();
+            }
+        }
+
+        if (base.get())
+        {
+            for (size_t i = 0; i < base->folders().size(); ++i)
+            {
+                const CabReader::Folder& folder = base->folders()[i];
+                if (folder.complete && !folder.files.empty())
+                    baseFolders.insert(std::make_pair(folder.files.front().name, i));
+            }
+
+            std::istringstream iss(cabinet.baseManifest);
+            std::string line;
+            while (std::getline(iss, line))
+            {
+                std::string::size_type pos = line.find('\t');
+                if (pos != std::string::npos)
+                    baseDigests[line.substr(0, pos)] = line.substr(pos + 1);
+            }
+        }
+
+        unsigned inFolder = 0;
+        for (size_t i = 0; i < cabinet.files.size(); )
+        {
+            // copy a folder of the previous cabinet if all its files are unchanged
+            std::map<std::string, size_t>::const_iterator itFolder = baseFolders.find(names[i]);
+            if (itFolder != baseFolders.end())
+            {
+                const std::vector<CabReader::File>& baseFiles = base->folders()[itFolder->second].files;
+                bool unchanged = i + baseFiles.size() <= names.size();
+                for (size_t j = 0; unchanged && j < baseFiles.size(); ++j)
+                {
+                    std::map<std::string, std::string>::const_iterator itDigest = baseDigests.find(baseFiles[j].name);
+                    unchanged = baseFiles[j].name == names[i + j] 
+                             && itDigest != baseDigests.end() 
+                             && itDigest->second == digests[i + j];
+                }
+
+                if (unchanged && cab->copyFolder(*base, itFolder->second, m_compression))
+                {
+                    i += baseFiles.size();
+                    cabinet.reused += baseFiles.size();
+                    inFolder = 0;
+                    continue;
+                }
+            }
+
+            const FileInfo& file = m_files[cabinet.files[i]];
+            if (cab->addFile(file.path.c_str(), file.name.c_str(), m_compression) < 0)
+                throw std::runtime_error("Failed to compress file '" + names[i] + "'");
+            ++i;
+
+            // start a new folder every m_folderFiles files
+            if (m_folderFiles > 0 && ++inFolder == static_cast<unsigned>(m_folderFiles))
+            {
+                if (cab->flush() < 0)
+                    throw std::runtime_error("Failed to write cabinet '" + std::string((const char*)_bstr_t(cabinet.name.c_str())) + "'");
+                inFolder = 0;
+            }
+        }
+
+        // finalize cabinet
+        if (cab->flushCabinet() < 0)
+            throw std::runtime_error("Failed to write cabinet '" + std::string((const char*)_bstr_t(cabinet.name.c_str())) + "'");
+        delete cab.release();
+
+        // a failure to update the cache is not an error
+        if (cache != NULL)
+        {
+            cache->store(cabinet.key, cabinet.name, m_tempCabDir + cabinet.name, manifest);
+        }
+    }
+    catch (const std::runtime_error& e)
+    {
+        cabinet.error = e.what();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Compute cabinet cache key
+//
+// The key is the MD5 digest of the xml2msi version, the compression
+// settings and the ordered list of file keys, sizes and MD5 digests, i.e.
+// of everything that determines the contents of the cabinet.
+//------------------------------------------------------------------------------
+tstring Xml2Msi::cabinetKey(const CabinetInfo& cabinet) const
+{
+    tostringstream oss;
+    oss << _T("xml2msi ") << moduleVersion() << _T("\n");
+    oss << _T("compression ") << static_cast<int>(m_compression);
+    if (m_compression == CabCompress::compLZX)
+    {
+        oss << _T(" ") << m_lzxWindow << _T(" ") << static_cast<int>(m_lzxEffort);
+    }
+    oss << _T("\n");
+    oss << _T("folder ") << m_folderFiles << _T("\n");
+
+    for (std::vector<size_t>::const_iterator it = cabinet.files.begin(); it != cabinet.files.end(); ++it)
+    {
+        const FileInfo& file = m_files[*it];
+        oss << file.name << _T("\t") << file.size.QuadPart << _T("\t") << file.md5 << _T("\n");
+    }
+
+    tstring text = oss.str();
+    return md5Digest(text.c_str(), static_cast<int>(text.length()), sizeof(_TCHAR));
+}
+
+//------------------------------------------------------------------------------
+// Update compression flags of compressed files
+//------------------------------------------------------------------------------
+void Xml2Msi::updateCompressionFlags(const CabinetInfo& cabinet, UINT wordcount)
+{
+    for (std::vector<size_t>::const_iterator it = cabinet.files.begin(); it != cabinet.files.end(); ++it)
+    {
+        const FileInfo& file = m_files[*it];
+        if (!file.sizeKnown || file.size.u.HighPart != 0)
+            continue;
+
+        // updating compression flag (msidbFileAttributesCompressed)
+        xml::IXMLDOMNodePtr fileNode(file.row);
+        xml::IXMLDOMNodePtr oldnode = fileNode->selectSingleNode(L"td[7]");
+        UINT flags = nodeValue(oldnode);
+
+        if (flags & msidbFileAttributesNoncompressed || (wordcount & msidbSumInfoSourceTypeCompressed) == 0)
+        {
+            // turn off explicit non-compressed flag
+            flags &= ~msidbFileAttributesNoncompressed;
+
+            // force compression flag if word count specifies uncompressed
+            if ((wordcount & msidbSumInfoSourceTypeCompressed) == 0)
+            {
+                flags |= msidbFileAttributesCompressed;
+            }
+
+            tostringstream oss;
+            oss << flags;
+            xml::IXMLDOMElementPtr etd(m_doc->createElement(L"td"));
+            etd->appendChild(m_doc->createTextNode(oss.str().c_str()));
+            fileNode->replaceChild(etd, oldnode);
+
+            if (!m_quiet)
+            {
+                tcerr << color::green << _T("    updated compression flags in 'File' table ('")
+                    << file.name << _T("')") << color::base << std::endl;
+            }
+        }
+    }
+}
+
+
+//------------------------------------------------------------------------------
+//
+// Validate tables
+//
+// Checks the column definitions, the number of fields, NULL fields and
+// integer values of all tables before the database is created, so that a
+// build reports every error at once instead of failing table by table
+// after the cabinets were built. The tables are copied from the DOM in
+// document order, then checked on a thread pool.
+//
+//------------------------------------------------------------------------------
+void Xml2Msi::validateTables()
+{
+    std::vector<TableInfo> tables;
+    xml::IXMLDOMNodeListPtr pTables(m_doc->selectNodes(L"/msi/table"));
+    tables.resize(pTables->length);
+    for (size_t i = 0; i < tables.size(); ++i)
+    {
+        collectTable(pTables->nextNode(), tables[i]);
+    }
+
+    ThreadPool pool(m_jobs);
+    pool.forEach(tables.size(), [&tables](size_t i) { validateTable(tables[i]); });
+
+    // report errors in document order
+    size_t errors = 0;
+    for (std::vector<TableInfo>::const_iterator it = tables.begin(); it != tables.end(); ++it)
+    {
+        for (size_t j = 0; j < it->errors.size(); ++j, ++errors)
+        {
+            tcerr << color::red << it->errors[j] << color::base << std::endl;
+        }
+    }
+
+    if (errors > 0)
+    {
+        tcerr << color::red << errors << _T(" validation error(s), the database was not created") 
+              << color::base << std::endl;
+        _com_issue_error(E_FAIL);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Convert text of the DOM to UTF-8
+//------------------------------------------------------------------------------
+static std::string toUtf8(const _bstr_t& text)
+{
+    int wlen = static_cast<int>(text.length());
+    if (wlen == 0)
+        return std::string();
+
+    int len = WideCharToMultiByte(CP_UTF8, 0, text, wlen, NULL, 0, NULL, NULL);
+    std::string str(len, '\0');
+    if (len > 0)
+        WideCharToMultiByte(CP_UTF8, 0, text, wlen, &str[0], len, NULL, NULL);
+    return str;
+}
+
+//------------------------------------------------------------------------------
+// Check an element and its descendants
+//------------------------------------------------------------------------------
+static bool validateElement(XmlValidator& validator, xml::IXMLDOMNode* element)
+{
+    XmlValidator::Attributes attributes;
+    xml::IXMLDOMNamedNodeMapPtr attributeMap(element->attributes);
+    for (long i = 0; i < attributeMap->length; ++i)
+    {
+        xml::IXMLDOMNodePtr attribute(attributeMap->item[i]);
+        attributes.push_back(std::make_pair(toUtf8(attribute->nodeName), toUtf8(attribute->text)));
+    }
+
+    _bstr_t name(element->nodeName);
+    if (!validator.startElement(toUtf8(name), attributes))
+        return false;
+
+    // the character data of leaf elements such as 'td' is not looked at
+    bool elementContent = wcscmp(name, L"msi") == 0 || wcscmp(name, L"summary") == 0 
+        || wcscmp(name, L"table") == 0 || wcscmp(name, L"row") == 0;
+
+    for (xml::IXMLDOMNodePtr child(element->firstChild); child != NULL; child = child->nextSibling)
+    {
+        switch (child->nodeType)
+        {
+        case xml::NODE_ELEMENT:
+            if (!validateElement(validator, child))
+                return false;
+            break;
+        case xml::NODE_TEXT:
+        case xml::NODE_CDATA_SECTION:
+            if (elementContent && !validator.text(toUtf8(child->text)))
+                return false;
+            break;
+        default:
+            break;
+        }
+    }
+
+    return validator.endElement();
+}
+
+//------------------------------------------------------------------------------
+// Check the structure of the loaded document
+//
+// Runs the elements of the DOM through XmlValidator, which checks the
+// grammar of template_dt.xml. The recursion ends at the first element the
+// grammar does not allow, so it is only a few levels deep.
+//------------------------------------------------------------------------------
+bool Xml2Msi::validateDocument(tstring& error) const
+{
+    XmlValidator validator;
+    xml::IXMLDOMElementPtr root(m_doc->documentElement);
+    if (root != NULL && validateElement(validator, root) && validator.endDocument())
+        return true;
+
+    error = fromUtf8(validator.error());
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Locate a structural error with the streaming parser
+//
+// Only called once the DOM failed validation, so that valid documents are
+// parsed once. Returns false if the streaming parser cannot read the
+// document (e.g. a URL) or finds no error.
+//------------------------------------------------------------------------------
+bool Xml2Msi::locateError(const tstring& path, unsigned& line, unsigned& column)
+{
+    try
+    {
+        XmlReader xml(path);
+        XmlValidator validator;
+        bool valid = true;
+
+        for (bool more = true; more && valid; )
+        {
+            switch (xml.next())
+            {
+            case XmlReader::eventStart:
+                valid = validator.startElement(xml.name(), xml.attributes());
+                break;
+            case XmlReader::eventEnd:
+                valid = validator.endElement();
+                break;
+            case XmlReader::eventText:
+                valid = validator.text(xml.text());
+                break;
+            default:
+                valid = validator.endDocument();
+                more = false;
+                break;
+            }
+        }
+
+        if (!valid)
+        {
+            line = xml.line();
+            column = xml.column();
+            return true;
+        }
+    }
+    catch (const std::exception&)
+    {
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+// Print a parse or validation error
+//------------------------------------------------------------------------------
+void Xml2Msi::parseError(long line, long column, const tstring& reason) const
+{
+    tcerr << color::red << _T("Error while parsing ") << m_inputPath << _T(":") << std::endl;
+    if (line != 0) 
+    {
+        tcerr << _T("Line ") << line << _T("; Column ") << column << std::endl;
+    }
+    tcerr << reason << color::base << std::endl;
+    _com_issue_error(E_FAIL);
+}
+
+//------------------------------------------------------------------------------
+// Copy a table from the DOM
+//------------------------------------------------------------------------------
+void Xml2Msi::collectTable(xml::IXMLDOMNode* table, TableInfo& info)
+{
+    info.name = (LPCTSTR)(_bstr_t)table->attributes->getNamedItem(L"name")->nodeValue;
+
+    // look up table in the schema registry
+    const TableSchema* standard = schemaRegistry.find(info.name);
+
+    // column headers
+    xml::IXMLDOMNodeListPtr pCols(table->selectNodes(L"col"));
+    xml::IXMLDOMNodePtr pCol;
+    while ((pCol = pCols->nextNode()) != NULL) 
+    {
+        size_t col = info.columns.size();
+        info.columns.push_back((LPCTSTR)pCol->text);
+
+        const ColumnSchema* pStd = standard != NULL && col < standard->count ? &schemaRegistry.column(*standard, col) : NULL;
+
+        // supply missing definitions of standard columns
+        if (pCol->attributes->getNamedItem(L"def") == NULL && pStd != NULL) 
+        {
+            xml::IXMLDOMElementPtr pEl(pCol);
+            pEl->setAttribute(_T("def"), formatColumn(*pStd).c_str());
+            pEl->setAttribute(_T("key"), pStd->key ? L"yes" : L"no");
+        }
+
+        xml::IXMLDOMNodePtr pDef(pCol->attributes->getNamedItem(L"def"));
+        xml::IXMLDOMNodePtr pKey(pCol->attributes->getNamedItem(L"key"));
+        info.defs.push_back(pDef != NULL ? (LPCTSTR)(_bstr_t)pDef->nodeValue : _T(""));
+        info.schema.push_back(parseColumn(info.defs.back()));
+        info.keys.push_back(pKey != NULL && (pKey->text == _bstr_t(L"yes") || pKey->text.length() == 0));
+
+        // check against default (the type of a malformed definition is unknown)
+        const ColumnSchema& schema = info.schema.back();
+        if (pStd != NULL && schema.error != ColumnSchema::errMissing && schema.error != ColumnSchema::errSyntax)
+        {
+            LPCTSTR message = NULL;
+            if (schema.type != pStd->type)
+            {
+                switch (pStd->type) 
+                {
+                case ColumnSchema::typeString:
+                    message = _T("Column must be defined as string");
+                    break;
+
+                case ColumnSchema::typeInteger:
+                    message = _T("Column must be defined as integer");
+                    break;
+
+                case ColumnSchema::typeBinary:
+                    message = _T("Column must be defined as binary stream");
+                    break;
+                }
+            }
+
+            if (message != NULL)
+            {
+                tostringstream oss;
+                oss << _T("Table \"") << info.name << _T("\", column \"") << info.columns.back() 
+                    << _T("\": ") << message;
+                info.errors.push_back(oss.str());
+            }
+        }
+    }
+
+    // rows (only the text of integer fields is needed)
+    xml::IXMLDOMNodeListPtr pRows(table->selectNodes(L"row"));
+    info.rows.resize(pRows->length);
+    for (size_t row = 0; row < info.rows.size(); ++row)
+    {
+        xml::IXMLDOMNodeListPtr pTds(pRows->nextNode()->selectNodes(L"td"));
+        std::vector<CellInfo>& cells = info.rows[row];
+        cells.resize(pTds->length);
+        for (size_t col = 0; col < cells.size(); ++col)
+        {
+            xml::IXMLDOMNodePtr pTd(pTds->nextNode());
+            cells[col].empty = pTd->hasChildNodes() == VARIANT_FALSE;
+            cells[col].href = pTd->attributes->getNamedItem(L"href") != NULL;
+            if (col < info.schema.size() && info.schema[col].error == ColumnSchema::errNone 
+                && info.schema[col].type == ColumnSchema::typeInteger && !cells[col].empty)
+                cells[col].text = (LPCTSTR)pTd->text;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Validate a table
+//------------------------------------------------------------------------------
+void Xml2Msi::validateTable(TableInfo& info)
+{
+    // column definitions
+    bool valid = true;
+    for (size_t col = 0; col < info.schema.size(); ++col)
+    {
+        if (info.schema[col].error != ColumnSchema::errNone)
+        {
+            tostringstream oss;
+            oss << _T("Table \"") << info.name << _T("\", column \"") << info.columns[col] 
+                << _T("\": ") << columnError(info.schema[col].error) << _T(" '") << info.defs[col] << _T("'");
+            info.errors.push_back(oss.str());
+            valid = false;
+        }
+    }
+
+    if (info.name != _T("_Streams") && std::find(info.keys.begin(), info.keys.end(), true) == info.keys.end())
+    {
+        info.errors.push_back(_T("Table \"") + info.name + _T("\": Missing primary key"));
+    }
+
+    if (!valid)
+        return; // fields cannot be checked
+
+    // fields
+    for (size_t row = 0; row < info.rows.size(); ++row)
+    {
+        const std::vector<CellInfo>& cells = info.rows[row];
+        if (cells.size() != info.defs.size())
+        {
+            tostringstream oss;
+            oss << _T("Table \"") << info.name << _T("\", row ") << row + 1 
+                << _T(": Invalid number of <td> elements (") << cells.size() 
+                << _T(" instead of ") << info.defs.size() << _T(")");
+            info.errors.push_back(oss.str());
+            continue;
+        }
+
+        for (size_t col = 0; col < cells.size(); ++col)
+        {
+            const CellInfo& cell = cells[col];
+            const ColumnSchema& schema = info.schema[col];
+            LPCTSTR message = NULL;
+
+            if (cell.empty && !cell.href)
+            {
+                if (!schema.nullable)
+                    message = _T("Field cannot be NULL");
+            }
+            else if (schema.type == ColumnSchema::typeBinary)
+            {
+                if (cell.href && !cell.empty)
+                    message = _T("Field must be empty if href specified");
+            }
+            else if (schema.type == ColumnSchema::typeInteger && !cell.empty)
+            {
+                // MSI reserves the smallest value of each size for NULL
+                LPCTSTR text = cell.text.c_str();
+                _TCHAR* end;
+                errno = 0;
+                long value = _tcstol(text, &end, 10);
+                long limit = schema.width == 2 ? 32767 : 2147483647;
+                while (_istspace(*end)) ++end;
+                if (end == text || *end != 0 || errno == ERANGE || value < -limit || value > limit)
+                    message = _T("Invalid integer value");
+            }
+
+            if (message != NULL)
+            {
+                tostringstream oss;
+                oss << _T("Table \"") << info.name << _T("\", row ") << row + 1 
+                    << _T(", column ") << col + 1 << _T(": ") << message;
+                if (!cell.text.empty()) oss << _T(" '") << cell.text << _T("'");
+                info.errors.push_back(oss.str());
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// Create and populate all tables
+//
+// The tables pass through a pipeline of two stages. The main thread copies
+// a table from the DOM, which must not be used by other threads, and
+// decodes its binary fields on the thread pool. A writer thread creates
+// and populates the tables in the database, so table N+1 is parsed and
+// decoded while table N is written. The stages are connected by a bounded
+// queue: the main thread waits once it is PIPELINE_DEPTH tables ahead.
+//
+// Each stage keeps its own location (m_currentTable/Row/Col on the main
+// thread, m_writerTable/Row/Col on the writer thread). An error of the
+// writer stage concerns an earlier table and takes precedence; its
+// location becomes the current location for the error message.
+//------------------------------------------------------------------------------
+void Xml2Msi::populateTables()
+{
+    static const size_t PIPELINE_DEPTH = 2;
+
+    SpscQueue<std::shared_ptr<TableData> > queue(PIPELINE_DEPTH);
+
+    // writer stage
+    std::exception_ptr writerError;
+    std::thread writer([&]()
+    {
+        try
+        {
+            std::shared_ptr<TableData> data;
+            while (queue.pop(data))
+            {
+                writeTable(*data);
+                data.reset();
+            }
+        }
+        catch (...)
+        {
+            writerError = std::current_exception();
+            queue.close();
+        }
+    });
+
+    // parse-and-decode stage
+    std::exception_ptr parseError;
+    try
+    {
+        ThreadPool pool(m_jobs);
+        m_baseUrl = (LPCTSTR)m_doc->url;
+
+        xml::IXMLDOMNodeListPtr pTables(m_doc->selectNodes(L"/msi/table"));
+        xml::IXMLDOMNodePtr table;
+        while ((table = pTables->nextNode()) != NULL) 
+        {
+            std::shared_ptr<TableData> data(new TableData);
+            extractTable(table, *data);
+
+            std::vector<BinaryField*> fields;
+            for (size_t r = 0; r < data->rows.size(); ++r)
+            {
+                for (size_t c = 0; c < data->rows[r].size(); ++c)
+                {
+                    BinaryField* field = data->rows[r][c].binary.get();
+                    if (field != NULL && !field->stream && !field->kept) fields.push_back(field);
+                }
+            }
+
+            pool.forEach(fields.size(), [&](size_t i)
+            {
+                decodeField(*fields[i]);
+            });
+
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                if (!fields[i]->tempPath.empty()) m_downloads.push_back(fields[i]->tempPath);
+
+                // cabinets (media: hrefs) are built from the files of the 'File' table
+                if (m_fingerprint.get() && !fields[i]->href.empty() && SUCCEEDED(fields[i]->hr)
+                    && _tcsnicmp(fields[i]->href.c_str(), _T("media:"), 6) != 0)
+                {
+                    if (fields[i]->tempPath.empty())
+                        m_fingerprint->addInput(fields[i]->path, fields[i]->digest);
+                    else
+                        m_fingerprint->setVolatile();
+                }
+            }
+
+            checkFields(table, *data);
+            m_currentTable.erase();
+
+            // false: the writer stage failed
+            if (!queue.push(data))
+                break;
+        }
+    }
+    catch (...)
+    {
+        parseError = std::current_exception();
+    }
+
+    // let the writer finish the tables already queued
+    queue.close();
+    writer.join();
+
+    for (std::vector<tstring>::const_iterator it = m_writerWarnings.begin(); it != m_writerWarnings.end(); ++it)
+    {
+        tcerr << color::yellow << *it << color::base << std::endl;
+    }
+    m_writerWarnings.clear();
+
+    if (writerError)
+    {
+        m_currentTable = m_writerTable;
+        m_currentRow = m_writerRow;
+        m_currentCol = m_writerCol;
+
+        try
+        {
+            std::rethrow_exception(writerError);
+        }
+        catch (const WriteError& e)
+        {
+            tcerr << color::red << e.message << color::base << std::endl;
+            _com_issue_error(E_FAIL);
+        }
+    }
+
+    if (parseError)
+        std::rethrow_exception(parseError);
+}
+
+//------------------------------------------------------------------------------
+// Copy a table from the DOM
+//
+// Text fields are copied with their typed value. Inline binary data is
+// copied as base64 text and decoded by decodeField() on the thread pool.
+//------------------------------------------------------------------------------
+void Xml2Msi::extractTable(xml::IXMLDOMNode* table, TableData& data)
+{
+    data.name = (LPCTSTR)(_bstr_t)table->attributes->getNamedItem(L"name")->nodeValue;
+    if (!m_quiet) 
+    {
+        tcerr << _T("Populating table '") << data.name << _T("'") << std::endl;
+    }
+
+    m_currentTable = data.name;
+
+    // column names, definitions and primary keys
+    xml::IXMLDOMNodeListPtr pCols(table->selectNodes(L"col"));
+    for (xml::IXMLDOMNodePtr pCol = pCols->nextNode(); pCol != NULL; pCol = pCols->nextNode())
+    {
+        xml::IXMLDOMNodePtr pDef(pCol->attributes->getNamedItem(L"def"));
+        if (pDef == NULL)
+        {
+            tcerr << color::red << _T("Missing column definition for column \"") << (LPCTSTR)pCol->text << _T("\"") << color::base << std::endl;
+            _com_issue_error(E_FAIL);
+        }
+
+        xml::IXMLDOMNodePtr pKey(pCol->attributes->getNamedItem(L"key"));
+        data.columns.push_back((LPCTSTR)pCol->text);
+        data.defs.push_back((LPCTSTR)(_bstr_t)pDef->nodeValue);
+        data.schema.push_back(parseColumn(data.defs.back()));
+        data.keys.push_back(pKey != NULL && (pKey->text == _bstr_t(L"yes") || pKey->text.length() == 0));
+    }
+
+    // copy rows
+    xml::IXMLDOMNodeListPtr pRowList(table->selectNodes(L"row"));
+    data.rows.reserve(pRowList->length);
+    for (xml::IXMLDOMNodePtr pRow = pRowList->nextNode(); pRow != NULL; pRow = pRowList->nextNode())
+    {
+        ++m_currentRow;
+        m_currentCol = 0;
+
+        // check column count
+        xml::IXMLDOMNodeListPtr pTdList(pRow->selectNodes(L"td"));
+
+        if ((size_t)pTdList->length != data.defs.size()) 
+        {
+            tcerr << color::red << _T("Invalid number of <td> elements") << color::base << std::endl;
+            _com_issue_error(E_FAIL);
+        }
+
+        data.rows.push_back(std::vector<FieldData>(data.defs.size()));
+        std::vector<FieldData>& row = data.rows.back();
+
+        for (xml::IXMLDOMNodePtr pTd = pTdList->nextNode(); pTd != NULL; pTd = pTdList->nextNode())
+        {
+            ++m_currentCol;
+            const ColumnSchema& schema = data.schema[m_currentCol-1];
+            FieldData& field = row[m_currentCol-1];
+            xml::IXMLDOMNodePtr pHref(pTd->attributes->getNamedItem(L"href"));
+
+            // check if NULL field
+            if (!schema.nullable && pTd->hasChildNodes() == VARIANT_FALSE && pHref == NULL) 
+            {
                 tcerr << color::red << _T("Field cannot be NULL") << color::base << std::endl;
                 _com_issue_error(E_FAIL);
             }
 
-            // case 1: text field
-            if (towlower(vecColDef[m_currentCol-1][0]) != L'v') 
-            {               
-                _bstr_t bstrData(pTd->nodeTypedValue);
-                OK(MsiRecordSetString(hRec, m_currentCol, (LPCTSTR)bstrData));
+            // case 1: text field
+            if (schema.type != ColumnSchema::typeBinary) 
+            {               
+                _bstr_t bstrData(pTd->nodeTypedValue);
+                if (bstrData.length() > 0) field.text = (LPCTSTR)bstrData;
+                continue;
+            }
+
+            // case 2a: local binary data (base64 encoded)
+            if (pHref == NULL)
+            {
+                if (pTd->hasChildNodes() == VARIANT_FALSE)
+                    continue;
+
+                // we only support base64 encoded data
+                _variant_t dataType(pTd->GetdataType());
+                if (dataType.vt != VT_BSTR || _bstr_t(dataType) != _bstr_t(L"bin.base64")) 
+                {
+                    tcerr << color::red << _T("Unsupported datatype") << color::base << std::endl;
+                    _com_issue_error(E_FAIL);
+                }
+
+                _bstr_t bstrData(pTd->text);
+                field.binary.reset(new BinaryField);
+                if (bstrData.length() > 0) field.binary->base64 = (const char*)bstrData;
+            }
+            // case 2b: cabinet built in memory
+            else if (std::shared_ptr<ScratchFile> stream = cabinetStream(pTd))
+            {
+                field.binary.reset(new BinaryField);
+                field.binary->stream = stream;
+            }
+            // case 2c: stream of another database
+            else if (pTd->hasChildNodes() == VARIANT_FALSE 
+                     && _tcsnicmp((LPCTSTR)(_bstr_t)pHref->nodeValue, _T("msi-stream:"), 11) == 0)
+            {
+                field.binary.reset(new BinaryField);
+                field.binary->href = (LPCTSTR)(_bstr_t)pHref->nodeValue;
+                field.binary->stream = sourceStream(field.binary->href, field.binary->digest);
+            }
+            // case 2d: external binary data
+            else if (pTd->hasChildNodes() == VARIANT_FALSE)
+            {
+                field.binary.reset(new BinaryField);
+                field.binary->href = (LPCTSTR)(_bstr_t)pHref->nodeValue;
+            }
+            else 
+            {
+                tcerr << color::red << _T("Field must be empty if href specified") << color::base << std::endl;
+                _com_issue_error(E_FAIL);
+            }
+
+            field.binary->hr = S_OK;
+            field.binary->kept = false;
+
+            // size of inline data, if msi2xml gave it
+            xml::IXMLDOMNodePtr pSize(pTd->attributes->getNamedItem(L"size"));
+            field.binary->size = pHref == NULL && pSize != NULL 
+                ? static_cast<size_t>(_ttoi64((LPCTSTR)(_bstr_t)pSize->nodeValue)) : 0;
+
+            // the row index identifies cabinets by their cache key
+            if (m_rowIndex.get() && pHref != NULL)
+            {
+                tstring href = (LPCTSTR)(_bstr_t)pHref->nodeValue;
+                CabinetKeyMap::const_iterator itKey = m_cabinetKeys.end();
+                if (_tcsnicmp(href.c_str(), _T("media:"), 6) == 0)
+                    itKey = m_cabinetKeys.find(href.substr(6));
+
+                if (itKey != m_cabinetKeys.end())
+                {
+                    field.binary->cabinetKey = itKey->second;
+                    field.binary->kept = m_keptCabinets.find(itKey->first) != m_keptCabinets.end();
+                }
+            }
+
+            if (xml::IXMLDOMNodePtr pMd5 = pTd->attributes->getNamedItem(L"md5"))
+            {
+                field.binary->md5 = (LPCTSTR)(_bstr_t)pMd5->nodeValue;
+
+                // cabinets may be referenced more than once, so they are not read on the thread pool
+                if (field.binary->stream && field.binary->digest.empty())
+                    field.binary->digest = md5Digest(*field.binary->stream);
+            }
+        }
+    }
+
+    m_currentRow = 0;
+    m_currentCol = 0;
+}
+
+//------------------------------------------------------------------------------
+// Decode a binary field and compute its MD5 digest
+//
+// Inline data is decoded into a scratch file, and hrefs are resolved to
+// local files. Errors are kept in the field and reported by checkFields().
+//
+//  case 2a: local binary data, decoded at once
+//  case 2b: local binary data of known size, decoded in chunks
+//  case 2d: external binary data, hashed if a digest is needed
+//------------------------------------------------------------------------------
+void Xml2Msi::decodeField(BinaryField& field) const
+{
+    try
+    {
+        // case 2d: external binary data
+        if (!field.href.empty())
+        {
+            try
+            {
+                field.path = resolveHref(field.href, m_baseUrl, field.tempPath);
+            }
+            catch (const _com_error&)
+            {
+                field.error = _T("Invalid href to ") + field.href;
+                throw;
+            }
+
+            if (field.md5.empty() && !m_fingerprint.get() && !m_rowIndex.get())
+                return;
+
+            // map file to memory
+            SmrtFileHandle hFile(
+                CreateFile(field.path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, NULL, NULL));
+            if (hFile == INVALID_HANDLE_VALUE) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+
+            SmrtFileMap pMap;
+
+            if (GetFileSize(hFile, NULL) > 0)
+            {
+                // create file mapping
+                SmrtFileHandle hMap(CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL));
+                if (hMap == NULL) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+
+                // map file
+                pMap = SmrtFileMap(MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0));
+                if (pMap.isNull()) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
             }
-            // case 2: binary stream   
-            else            
+
+            field.digest = md5Digest((LPCVOID)pMap, GetFileSize(hFile, NULL), sizeof(BYTE));
+            return;
+        }
+
+        // case 2b: local binary data of known size, decoded in chunks straight
+        // into a scratch file that takes the memory at once, or goes to disk if
+        // the data exceed the memory budget
+        if (field.size > 0)
+        {
+            field.stream.reset(new ScratchFile);
+            if (!field.stream->preallocate(field.size))
+                _com_issue_error(E_OUTOFMEMORY);
+
+            std::string& text = field.base64;
+            std::vector<BYTE> buf(BASE64_CHUNK / 4 * 3);
+            for (size_t pos = 0; pos < text.size(); )
             {
-                // case 2a: local binary data (possibly encoded)
-                if (pTd->attributes->getNamedItem(L"href") == NULL)
+                // end the chunk after a whole number of 4 character groups
+                size_t end = pos;
+                for (size_t chars = 0; end < text.size() && chars < BASE64_CHUNK; ++end)
                 {
-                    if (pTd->hasChildNodes() == VARIANT_FALSE)
-                        continue;
+                    if (!isspace(static_cast<unsigned char>(text[end]))) ++chars;
+                }
+
+                std::string chunk(text, pos, end - pos);
+                int len = b64_pton(chunk.c_str(), &buf[0], buf.size());
+                if (len < 0)
+                {
+                    field.error = _T("Invalid base64 data");
+                    _com_issue_error(E_FAIL);
+                }
+
+                if (field.stream->write(&buf[0], len) != static_cast<size_t>(len))
+                    _com_issue_error(E_OUTOFMEMORY);
+                pos = end;
+            }
+            std::string().swap(field.base64);
+
+            if (!field.md5.empty() || m_rowIndex.get())
+                field.digest = md5Digest(*field.stream);
+            return;
+        }
+
+        // case 2a: local binary data
+        std::vector<BYTE> buf(field.base64.size() / 4 * 3 + 3);
+        int len = b64_pton(field.base64.c_str(), &buf[0], buf.size());
+        if (len < 0)
+        {
+            field.error = _T("Invalid base64 data");
+            _com_issue_error(E_FAIL);
+        }
+        std::string().swap(field.base64);
+
+        if (!field.md5.empty() || m_rowIndex.get())
+            field.digest = md5Digest(&buf[0], len, sizeof(BYTE));
+
+        // keep data in memory until the commit
+        field.stream.reset(new ScratchFile);
+        if (field.stream->write(&buf[0], len) != static_cast<size_t>(len))
+            _com_issue_error(E_OUTOFMEMORY);
+    }
+    catch (const _com_error& e)
+    {
+        field.hr = e.Error();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Report decode errors and check the MD5 digests of a table
+//
+// The fields are checked in document order, so that the first error is
+// reported at the same location as when the table is read serially.
+//------------------------------------------------------------------------------
+void Xml2Msi::checkFields(xml::IXMLDOMNode* table, const TableData& data)
+{
+    xml::IXMLDOMNodeListPtr pRowList;
+    for (size_t r = 0; r < data.rows.size(); ++r)
+    {
+        for (size_t c = 0; c < data.rows[r].size(); ++c)
+        {
+            const BinaryField* field = data.rows[r][c].binary.get();
+            if (field == NULL)
+                continue;
+
+            m_currentRow = static_cast<int>(r) + 1;
+            m_currentCol = static_cast<int>(c) + 1;
+
+            if (FAILED(field->hr))
+            {
+                if (!field->error.empty())
+                {
+                    tcerr << color::red << field->error << color::base << std::endl;
+                }
+                _com_issue_error(field->hr);
+            }
+
+            // a cabinet kept in the previous output is not read again
+            if (!field->md5.empty() && !field->kept && _tcsicmp(field->digest.c_str(), field->md5.c_str()) != 0)
+            {
+                if (pRowList == NULL) pRowList = table->selectNodes(L"row");
+                xml::IXMLDOMNodeListPtr pTdList(pRowList->item[static_cast<long>(r)]->selectNodes(L"td"));
+                checkMD5(pTdList->item[static_cast<long>(c)], field->digest);
+            }
+        }
+    }
+
+    m_currentRow = 0;
+    m_currentCol = 0;
+}
+
+//------------------------------------------------------------------------------
+// Create and populate a table (writer stage)
+//------------------------------------------------------------------------------
+void Xml2Msi::writeTable(const TableData& data)
+{
+    if (m_rowIndex.get())
+    {
+        updateTable(data);
+    }
+    else
+    {
+        createTable(data);
+        populateTable(data);
+    }
+    m_writerTable.erase();
+}
+
+//------------------------------------------------------------------------------
+// Write the rows of a table that changed since the previous output
+//
+// The rows are compared with the row index of the previous output by their
+// primary keys and digests. Rows that were removed or changed are deleted,
+// then rows that were added or changed are inserted. A new table, or a 
+// table whose columns changed, is written from scratch. So is a table of
+// which most rows changed, or one where a row with a NULL key field must be
+// deleted, unless it references a cabinet that was kept in the previous
+// output.
+//------------------------------------------------------------------------------
+void Xml2Msi::updateTable(const TableData& data)
+{
+    m_writerTable = data.name;
+
+    // record the rows of this build
+    RowIndex::Table& table = m_rowIndex->tables()[data.name];
+    table.schema = schemaDigest(data);
+
+    std::vector<tstring> keys(data.rows.size());
+    std::vector<tstring> digests(data.rows.size());
+    bool kept = false;
+    for (size_t r = 0; r < data.rows.size(); ++r)
+    {
+        keys[r] = rowKey(data, data.rows[r]);
+        digests[r] = rowDigest(data.rows[r]);
+        table.rows[keys[r]] = digests[r];
+
+        for (size_t c = 0; c < data.rows[r].size(); ++c)
+        {
+            kept |= data.rows[r][c].binary && data.rows[r][c].binary->kept;
+        }
+    }
+
+    const RowIndex::Table* base = NULL;
+    if (m_baseIndex.get())
+    {
+        RowIndex::Tables::const_iterator it = m_baseIndex->tables().find(data.name);
+        if (it != m_baseIndex->tables().end())
+            base = &it->second;
+    }
+
+    // the columns of the '_Streams' table are fixed
+    bool isStreams = data.name == _T("_Streams");
+    if (base == NULL || (base->schema != table.schema && !isStreams))
+    {
+        if (base != NULL)
+            dropTable(data.name);
+
+        createTable(data);
+        populateTable(data);
+        return;
+    }
+
+    // rows that were removed or changed
+    std::vector<tstring> removed;
+    bool nullKey = false;
+    for (std::map<tstring, tstring>::const_iterator it = base->rows.begin(); it != base->rows.end(); ++it)
+    {
+        std::map<tstring, tstring>::const_iterator itRow = table.rows.find(it->first);
+        if (itRow != table.rows.end() && itRow->second == it->second)
+            continue;
+
+        removed.push_back(it->first);
+
+        std::vector<tstring> fields = RowIndex::splitKey(it->first);
+        nullKey |= std::find(fields.begin(), fields.end(), tstring()) != fields.end();
+    }
+
+    // rows that were added or changed
+    TableData changed;
+    changed.name    = data.name;
+    changed.columns = data.columns;
+    changed.defs    = data.defs;
+    changed.schema  = data.schema;
+    changed.keys    = data.keys;
+    for (size_t r = 0; r < data.rows.size(); ++r)
+    {
+        std::map<tstring, tstring>::const_iterator it = base->rows.find(keys[r]);
+        if (it == base->rows.end() || it->second != digests[r])
+            changed.rows.push_back(data.rows[r]);
+    }
+
+    if (removed.empty() && changed.rows.empty())
+        return;
+
+    // a cabinet kept in the previous output cannot be written again
+    bool rewrite = nullKey || (removed.size() + changed.rows.size()) * 2 > base->rows.size() + data.rows.size();
+    if (rewrite && !isStreams && !kept)
+    {
+        populateTable(data);
+        return;
+    }
 
-                    // access data w/o going through the wrapper functions
-                    VARIANT var;
-                    void* pArrayData = NULL;
+    deleteRows(data, removed);
+    insertRows(changed, NULL);
+}
+
+//------------------------------------------------------------------------------
+// Delete rows by their primary keys
+//------------------------------------------------------------------------------
+void Xml2Msi::deleteRows(const TableData& data, const std::vector<tstring>& keys)
+{
+    if (keys.empty())
+        return;
+
+    std::vector<size_t> columns = keyColumns(data);
+
+    tostringstream ossSQL;
+    ossSQL << _T("SELECT * FROM `") << data.name << _T("` WHERE ");
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        if (i > 0) ossSQL << _T(" AND ");
+        ossSQL << _T("`") << data.columns[columns[i]] << _T("` = ?");
+    }
+
+    SmrtMsiHandle hView;
+    OK(MsiDatabaseOpenView(m_db, ossSQL.str().c_str(), &hView));
+
+    for (std::vector<tstring>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+        std::vector<tstring> fields = RowIndex::splitKey(*it);
+        if (fields.size() != columns.size())
+            throw WriteError(_T("Invalid row index, rebuild without the '-I' option"));
+
+        SmrtMsiHandle hParams(MsiCreateRecord(static_cast<UINT>(fields.size())));
+        if (hParams.isNull()) _com_issue_error(E_OUTOFMEMORY);
+
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            UINT field = static_cast<UINT>(i) + 1;
+            if (data.schema[columns[i]].type == ColumnSchema::typeInteger)
+                OK(MsiRecordSetInteger(hParams, field, _ttoi(fields[i].c_str())));
+            else
+                OK(MsiRecordSetString(hParams, field, fields[i].c_str()));
+        }
+
+        OK(MsiViewExecute(hView, hParams));
+
+        SmrtMsiHandle hRec;
+        while (MsiViewFetch(hView, &hRec) == ERROR_SUCCESS)
+        {
+            OK(MsiViewModify(hView, MSIMODIFY_DELETE, hRec));
+        }
+
+        OK(MsiViewClose(hView));
+    }
+}
+
+//------------------------------------------------------------------------------
+// Drop the tables of the previous output that are no longer in the XML file
+//------------------------------------------------------------------------------
+void Xml2Msi::dropRemovedTables()
+{
+    const RowIndex::Tables& tables = m_baseIndex->tables();
+    for (RowIndex::Tables::const_iterator it = tables.begin(); it != tables.end(); ++it)
+    {
+        if (m_rowIndex->tables().find(it->first) != m_rowIndex->tables().end())
+            continue;
+
+        if (it->first != _T("_Streams"))
+        {
+            dropTable(it->first);
+            continue;
+        }
+
+        // the '_Streams' table cannot be dropped, so its rows are deleted
+        TableData streams;
+        streams.name = it->first;
+        streams.columns.push_back(_T("Name"));
+        streams.defs.push_back(_T("s62"));
+        streams.schema.push_back(parseColumn(streams.defs.back()));
+        streams.keys.push_back(true);
+
+        std::vector<tstring> keys;
+        for (std::map<tstring, tstring>::const_iterator itRow = it->second.rows.begin(); itRow != it->second.rows.end(); ++itRow)
+        {
+            keys.push_back(itRow->first);
+        }
+
+        deleteRows(streams, keys);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Create table
+//------------------------------------------------------------------------------
+void Xml2Msi::createTable(const TableData& data)
+{
+    m_writerTable = data.name;
+
+    if (data.name == _T("_Streams"))
+        return;
+
+    if (m_writer.get())
+    {
+        try
+        {
+            std::vector<MsiWriter::Column> columns(data.columns.size());
+            for (size_t i = 0; i < columns.size(); ++i)
+            {
+                columns[i].name = (const char*)_bstr_t(data.columns[i].c_str());
+                columns[i].type = MsiWriter::columnType((const char*)_bstr_t(data.defs[i].c_str()), data.keys[i]);
+            }
+
+            m_writer->createTable((const char*)_bstr_t(data.name.c_str()), columns);
+        }
+        catch (const std::runtime_error& e)
+        {
+            throw WriteError((LPCTSTR)_bstr_t(e.what()));
+        }
+
+        return;
+    }
+
+    // key columns come first
+    std::vector<size_t> order;
+    for (size_t i = 0; i < data.keys.size(); ++i)
+    {
+        if (data.keys[i]) order.push_back(i);
+    }
+
+    size_t keyCount = order.size();
+    if (keyCount == 0) 
+        throw WriteError(_T("Missing primary key"));
+
+    for (size_t i = 0; i < data.keys.size(); ++i)
+    {
+        if (!data.keys[i]) order.push_back(i);
+    }
+
+    tostringstream ossSQL;
+    ossSQL << _T("CREATE TABLE `") << data.name << _T("` (");
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (i > 0) ossSQL << _T(", ");
+        ossSQL << buildSQLColSpec(data.columns[order[i]], data.defs[order[i]], data.schema[order[i]]);
+    }
+
+    // add primary keys
+    ossSQL << _T(" PRIMARY KEY ");
+    for (size_t i = 0; i < keyCount; ++i)
+    {
+        if (i > 0) ossSQL << _T(", ");
+        ossSQL << _T("`") << data.columns[order[i]] << _T("`");
+    }
+
+    ossSQL << _T(")");
+
+    SmrtMsiHandle hView;
+    OK(MsiDatabaseOpenView(m_db, ossSQL.str().c_str(), &hView));
+    OK(MsiViewExecute(hView, NULL));
+    OK(MsiViewClose(hView));
+}
+
+//------------------------------------------------------------------------------
+// Populate table
+//
+// With the Windows Installer API, the rows are written to an IDT file that
+// is imported with MsiDatabaseImport, which is much faster than inserting
+// them one by one. The '_Streams' table cannot be imported. If the import
+// fails, the table is created again and the rows are inserted one by one,
+// which locates the offending row.
+//------------------------------------------------------------------------------
+void Xml2Msi::populateTable(const TableData& data)
+{
+    if (!m_writer.get() && data.name != _T("_Streams"))
+    {
+        if (importTable(data))
+            return;
+
+        m_writerWarnings.push_back(_T("Warning: Failed to import table '") + data.name + _T("', inserting rows one by one"));
+
+        dropTable(data.name);
+        createTable(data);
+    }
+
+    insertRows(data, NULL);
+}
+
+//------------------------------------------------------------------------------
+// Write the rows of a table to an IDT file and import it
+//------------------------------------------------------------------------------
+bool Xml2Msi::importTable(const TableData& data)
+{
+    m_writerTable = data.name;
+
+    // column names, definitions and primary keys
+    std::vector<std::string> columns;
+    std::vector<std::string> defs;
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < data.columns.size(); ++i)
+    {
+        columns.push_back(encodeString(data.columns[i]));
+        defs.push_back((const char*)_bstr_t(data.defs[i].c_str()));
+        if (data.keys[i])
+            keys.push_back(columns.back());
+    }
+
+    tstring dir = m_tempCabDir + _T("idt\\");
+    CreateDirectory(dir.c_str(), NULL);
+
+    bool imported = false;
+    try
+    {
+        IdtWriter idt(dir, encodeString(data.name), columns, defs, keys);
+        insertRows(data, &idt);
+        idt.close();
+
+        // the import creates the table
+        dropTable(data.name);
+        imported = MsiDatabaseImport(m_db, dir.c_str(), (LPCTSTR)_bstr_t(idt.fileName().c_str())) == ERROR_SUCCESS;
+    }
+    catch (const std::runtime_error& e)
+    {
+        throw WriteError((LPCTSTR)_bstr_t(e.what()));
+    }
+
+    deleteTree(dir);
+    return imported;
+}
+
+//------------------------------------------------------------------------------
+// Drop a table, if it exists
+//------------------------------------------------------------------------------
+void Xml2Msi::dropTable(const tstring& name)
+{
+    tostringstream ossSQL;
+    ossSQL << _T("DROP TABLE `") << name << _T("`");
+
+    SmrtMsiHandle hView;
+    if (MsiDatabaseOpenView(m_db, ossSQL.str().c_str(), &hView) == ERROR_SUCCESS)
+    {
+        MsiViewExecute(hView, NULL);
+        MsiViewClose(hView);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Insert the rows of a table
+//------------------------------------------------------------------------------
+void Xml2Msi::insertRows(const TableData& data, IdtWriter* idt)
+{
+    m_writerTable = data.name;
 
-                    try 
-                    {
-                        VariantInit(&var);
-                        HRESULT hr = pTd->get_nodeTypedValue(&var);
+    // create the table view
+    SmrtMsiHandle hView;
+    if (!m_writer.get() && idt == NULL)
+    {
+        tostringstream ossSQL;
+        ossSQL << _T("SELECT * FROM `") << data.name << _T("`");
+        OK(MsiDatabaseOpenView(m_db, ossSQL.str().c_str(), &hView));
+        OK(MsiViewExecute(hView, NULL));
+    }
 
-                        if (FAILED(hr))
-                            _com_issue_error(hr);
+    int binaryCols = 0;
+    for (size_t i = 0; i < data.schema.size(); ++i)
+    {
+        if (data.schema[i].type == ColumnSchema::typeBinary) ++binaryCols;
+    }
 
-                        // we only support single-byte safe arrays
-                        if (var.vt != (VT_ARRAY | VT_UI1)) 
-                        {
-                            tcerr << color::red << _T("Unsupported datatype") << color::base << std::endl;
-                            _com_issue_error(E_FAIL);
-                        }
+    // the stream of a row is named after its keys, so with a single binary
+    // column the data can be written to the storage after the commit
+    bool isStreams = data.name == _T("_Streams");
+    bool deferBinary = binaryCols == 1;
 
-                        //Get a safe pointer to the array
-                        OK(SafeArrayAccessData(var.parray, &pArrayData));
+    // binary fields of an IDT file are files in a folder named after the table
+    std::string emptyFile;
+    int binaryFiles = 0;
 
-                        // get size
-                        long lLBound, lUBound, lElements;
-                        OK(SafeArrayGetLBound(var.parray, 1, &lLBound));
-                        OK(SafeArrayGetUBound(var.parray, 1, &lUBound));
-                        lElements = lUBound - lLBound + 1;
-                        checkMD5(pTd, pArrayData, lElements, sizeof(BYTE));
+    // add rows
+    for (size_t r = 0; r < data.rows.size(); ++r)
+    {
+        const std::vector<FieldData>& rowData = data.rows[r];
+        m_writerRow = static_cast<int>(r) + 1;
+        m_writerCol = 0;
 
-                        // copy data to temporary file
-                        if (!m_tempPath.empty()) 
-                        {
-                            DeleteFile(m_tempPath.c_str()); // delete previous temporary file
-                        }
+        // create record
+        SmrtMsiHandle hRec;
+        MsiWriter::Row row;
+        std::vector<std::string> fields;
+        if (m_writer.get())
+        {
+            row.resize(rowData.size());
+        }
+        else if (idt)
+        {
+            fields.resize(rowData.size());
+        }
+        else
+        {
+            hRec = SmrtMsiHandle(MsiCreateRecord(static_cast<UINT>(rowData.size())));
+            if (hRec.isNull()) _com_issue_error(E_OUTOFMEMORY);
+            OK(MsiRecordClearData(hRec));
+        }
+        bool deferred = false;
 
-                        _TCHAR strTmpDir[_MAX_PATH];
-                        _TCHAR strTmpFile[_MAX_PATH];
-                        GetTempPath(_MAX_PATH, strTmpDir);
-                        GetTempFileName(strTmpDir, _T("bin"), 0, strTmpFile);
-                        m_tempPath = strTmpFile;
-                        SmrtFileHandle hFile(
-                            CreateFile(m_tempPath.c_str(),
-                            GENERIC_WRITE,
-                            FILE_SHARE_READ,
-                            NULL,
-                            OPEN_EXISTING,
-                            FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN,
-                            NULL));
-                        if (hFile == INVALID_HANDLE_VALUE)
-                            _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
-
-                        DWORD dwLen;
-                        if (WriteFile(hFile, (LPCSTR)pArrayData, lElements, &dwLen, NULL) == 0)
-                            _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
-
-                        // need to close hFile by hand, or MsiRecordSetStream won't accept it...
-                        CloseHandle(hFile.release());
-
-                        // feed to stream
-                        OK(MsiRecordSetStream(hRec, m_currentCol, m_tempPath.c_str()));
-
-                        // free VARIANT
-                        OK(SafeArrayUnaccessData(var.parray));
-                        OK(VariantClear(&var));
-                    }
-                    catch (...) 
-                    {
-                        if (pArrayData) OK(SafeArrayUnaccessData(var.parray));
-                        OK(VariantClear(&var));
-                        throw;
-                    }
-                }
-                // case 2b: external binary data
-                else if (pTd->hasChildNodes() == VARIANT_FALSE)
-                {
-                    xml::IXMLDOMNodePtr pHref(pTd->attributes->getNamedItem(L"href"));
+        // hand binary data kept in memory to the database (false: it must go through a file)
+        auto setStream = [&](const std::shared_ptr<ScratchFile>& stream) -> bool
+        {
+            if (m_writer.get())
+            {
+                row[m_writerCol-1].null = false;
+                row[m_writerCol-1].stream = stream;
+                return true;
+            }
 
-                    // store data in local file
-                    tstring filePath = resolveHref(pTd);
+            // written directly to the storage after the commit
+            tstring streamName = deferBinary ? binaryStreamName(data, rowData) : tstring();
+            if (streamName.empty())
+                return false;
 
-                    // check MD5
-                    if (pTd->attributes->getNamedItem(L"md5") != NULL) 
-                    {
-                        // map file to memory
-                        SmrtFileHandle hFile(
-                            CreateFile(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, NULL, NULL));
-                        if (hFile == INVALID_HANDLE_VALUE) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+            m_pendingStreams[streamName] = stream;
+            if (isStreams)
+            {
+                deferred = true;
+            }
+            else if (idt)
+            {
+                if (emptyFile.empty())
+                {
+                    ScratchFile empty;
+                    emptyFile = "empty.ibd";
+                    saveStream(empty, idt->wideBinaryPath(emptyFile));
+                }
+                fields[m_writerCol-1] = emptyFile;
+            }
+            else
+            {
+                OK(MsiRecordSetStream(hRec, m_writerCol, emptyStreamPath().c_str()));
+            }
+            return true;
+        };
 
-                        SmrtFileMap pMap;
+        // name and path of the IDT file of the current binary field
+        auto binaryFile = [&]() -> tstring
+        {
+            char name[32];
+            sprintf_s(name, ARRAYSIZE(name), "%d.ibd", ++binaryFiles);
+            fields[m_writerCol-1] = name;
+            return idt->wideBinaryPath(name);
+        };
+
+        // hand binary data kept in memory to the database through a file, if necessary
+        auto putStream = [&](const std::shared_ptr<ScratchFile>& stream)
+        {
+            if (setStream(stream))
+                return;
 
-                        if (GetFileSize(hFile, NULL) > 0)
-                        {
-                            // create file mapping
-                            SmrtFileHandle hMap(CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL));
-                            if (hMap == NULL) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+            if (idt)
+                saveStream(*stream, binaryFile());
+            else
+                OK(MsiRecordSetStream(hRec, m_writerCol, spillStream(*stream).c_str()));
+        };
 
-                            // map file
-                            pMap = SmrtFileMap(MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0));
-                            if (pMap.isNull()) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
-                        }
+        // populate record
+        for (size_t c = 0; c < rowData.size(); ++c)
+        {
+            m_writerCol = static_cast<int>(c) + 1;
+            const FieldData& field = rowData[c];
 
-                        // check MD5
-                        checkMD5(pTd, (LPCVOID)pMap, GetFileSize(hFile, NULL), sizeof(BYTE));
-                    }
+            // case 1: text field
+            if (data.schema[c].type != ColumnSchema::typeBinary) 
+            {               
+                if (m_writer.get())
+                {
+                    MsiWriter::Field& value = row[c];
+                    value.null = field.text.empty();
+                    if (data.schema[c].type == ColumnSchema::typeInteger)
+                        value.value = _ttol(field.text.c_str());
+                    else
+                        value.text = encodeString(field.text);
+                }
+                else if (idt)
+                {
+                    fields[c] = encodeString(field.text);
+                }
+                else
+                {
+                    OK(MsiRecordSetString(hRec, m_writerCol, field.text.c_str()));
+                }
+            }
+            // case 2: binary stream   
+            else if (const BinaryField* binary = field.binary.get())
+            {
+                // cabinet of the previous output that was not built again
+                if (binary->kept)
+                {
+                    throw WriteError(_T("The cabinet referenced by '") + binary->href 
+                                     + _T("' was not built, rebuild without the '-I' option"));
+                }
 
-                    // feed to stream
-                    OK(MsiRecordSetStream(hRec, m_currentCol, filePath.c_str()));
+                // data kept in memory
+                if (binary->stream)
+                {
+                    putStream(binary->stream);
                 }
-                else 
+                // external file
+                else if (m_writer.get())
                 {
-                    tcerr << color::red << _T("Field must be empty if href specified") << color::base << std::endl;
-                    _com_issue_error(E_FAIL);
+                    setStream(loadStream(binary->path));
+                }
+                else if (idt)
+                {
+                    if (!CopyFile(binary->path.c_str(), binaryFile().c_str(), FALSE))
+                        _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+                }
+                else
+                {
+                    OK(MsiRecordSetStream(hRec, m_writerCol, binary->path.c_str()));
                 }
             }
         }
 
-        m_currentCol = 0;
-        UINT res = MsiViewModify(hView, MSIMODIFY_INSERT, hRec);
-        if (res == ERROR_FUNCTION_FAILED) 
+        m_writerCol = 0;
+        if (deferred)
+            continue;
+
+        if (m_writer.get())
         {
-            tcerr << color::red << _T("The table contains non-unique primary keys") 
-                << color::base << std::endl;
-            _com_issue_error(E_FAIL);
+            try
+            {
+                if (!isStreams)
+                    m_writer->insertRow((const char*)_bstr_t(data.name.c_str()), row);
+                else if (row.size() == 2 && row[1].stream)
+                    m_writer->addStream(row[0].text, row[1].stream);
+            }
+            catch (const std::runtime_error& e)
+            {
+                throw WriteError((LPCTSTR)_bstr_t(e.what()));
+            }
+            continue;
         }
+
+        if (idt)
+        {
+            idt->writeRow(fields);
+            continue;
+        }
+
+        UINT res = MsiViewModify(hView, MSIMODIFY_INSERT, hRec);
+        if (res == ERROR_FUNCTION_FAILED) 
+            throw WriteError(_T("The table contains non-unique primary keys"));
         OK (res);
     }
 
-    m_currentRow = 0;
-    OK(MsiViewClose(hView));
+    m_writerRow = 0;
+    if (!m_writer.get() && idt == NULL)
+    {
+        OK(MsiViewClose(hView));
+    }
 }
 
 //------------------------------------------------------------------------------
-//
-// Resolve HREF
-//
-// Parameters:
-//
-//  pTd               - XMLDOMNode pointer to <td>
-//
-// Returns:
-//
-//  Local file path. If the href points to a local file, this
-//  is the full path to the file. If the href points to an
-//  external file, the path points to a temporary local file.
-//  The temporary local file is deleted the next time resolveHref
-//  is called, or when the application terminates.
-//
+// In-memory cabinet referenced by a media: href (NULL if none)
 //------------------------------------------------------------------------------
-tstring Xml2Msi::resolveHref(xml::IXMLDOMNode* hrefNode)
+std::shared_ptr<ScratchFile> Xml2Msi::cabinetStream(xml::IXMLDOMNode* hrefNode) const
 {
-    static _TCHAR szLocalPath[_MAX_PATH];
+    xml::IXMLDOMNodePtr pHref(hrefNode->attributes->getNamedItem(L"href"));
+    if (pHref == NULL || hrefNode->hasChildNodes() != VARIANT_FALSE)
+        return std::shared_ptr<ScratchFile>();
 
-    // delete previous temporary file
+    tstring href = (LPCTSTR)(_bstr_t)pHref->nodeValue;
+    if (_tcsnicmp(href.c_str(), _T("media:"), 6) != 0)
+        return std::shared_ptr<ScratchFile>();
+
+    StreamMap::const_iterator it = m_cabinetStreams.find(href.substr(6));
+    return it != m_cabinetStreams.end() ? it->second : std::shared_ptr<ScratchFile>();
+}
+
+//------------------------------------------------------------------------------
+// Write a scratch file to the temporary file (deleted with the next href)
+//------------------------------------------------------------------------------
+tstring Xml2Msi::spillStream(ScratchFile& stream)
+{
     if (!m_tempPath.empty()) 
     {
         DeleteFile(m_tempPath.c_str());
+        m_tempPath.erase();
     }
 
-    // pointer to href attribute
-    xml::IXMLDOMNodePtr pHref(hrefNode->attributes->getNamedItem(L"href"));
+    _TCHAR strTmpDir[_MAX_PATH];
+    _TCHAR strTmpFile[_MAX_PATH];
+    GetTempPath(_MAX_PATH, strTmpDir);
+    GetTempFileName(strTmpDir, _T("cab"), 0, strTmpFile);
+    m_tempPath = strTmpFile;
 
-    try 
-    {
-        // build path name
-        _tcscpy_s(szLocalPath, ARRAYSIZE(szLocalPath), (LPCTSTR)(_bstr_t)pHref->nodeValue);
-        if (_tcscspn(szLocalPath, _T(":")) == _tcslen(szLocalPath)) 
-        {
-            _TCHAR drive[_MAX_DRIVE];
-            _TCHAR dir[_MAX_DIR];
-            _TCHAR fname[_MAX_FNAME];
-            _TCHAR ext[_MAX_EXT];
-            _tsplitpath_s(szLocalPath, 
-                          drive, ARRAYSIZE(drive), 
-                          dir, ARRAYSIZE(dir), 
-                          fname, ARRAYSIZE(fname), 
-                          ext, ARRAYSIZE(ext));
-            if (drive[0] == _T('\0') && dir[0] != _T('\\') && m_hrefPrefix[0] != _T('\0')) 
-            {
-                // prepend path prefix
-                _TCHAR dir2[_MAX_DIR];
-                _TCHAR buf[_MAX_PATH];
-                _tcscpy_s(buf, ARRAYSIZE(buf), m_hrefPrefix.c_str());
-                _tcscat_s(buf, ARRAYSIZE(buf), _T("\\"));
-                _tsplitpath_s(buf, drive, ARRAYSIZE(drive), dir2, ARRAYSIZE(dir2), NULL, 0, NULL, 0);
-                _tcscat_s(dir2, ARRAYSIZE(dir2), dir);
-                _tmakepath_s(szLocalPath, ARRAYSIZE(szLocalPath), drive, dir2, fname, ext);
-            }
-        }
+    saveStream(stream, m_tempPath);
+    return m_tempPath;
+}
 
-        URL_COMPONENTS urlComp;
-        ZeroMemory((PVOID)&urlComp, sizeof(URL_COMPONENTS));
-        urlComp.dwStructSize = sizeof(URL_COMPONENTS);
-        urlComp.dwSchemeLength = 1;
-        urlComp.dwUrlPathLength = 1;
+//------------------------------------------------------------------------------
+// Write a scratch file to a file
+//------------------------------------------------------------------------------
+void Xml2Msi::saveStream(ScratchFile& stream, const tstring& path)
+{
+    SmrtFileHandle hFile(
+        CreateFile(path.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+        _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
 
-        _TCHAR strUrl[1024];
+    std::vector<BYTE> buf(1 << 20);
+    stream.seek(0, SEEK_SET);
+    for (size_t n; (n = stream.read(&buf[0], buf.size())) > 0; )
+    {
         DWORD dwLen;
-        if (!InternetCombineUrl((LPCTSTR)(_bstr_t)pHref->ownerDocument->url, szLocalPath,
-                                strUrl, &(dwLen = ARRAYSIZE(strUrl)), ICU_DECODE) ||
-            !InternetCrackUrl(strUrl, 0, 0, &urlComp)) 
-        {
+        if (WriteFile(hFile, &buf[0], static_cast<DWORD>(n), &dwLen, NULL) == 0)
             _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
-        }
+    }
 
-        if (urlComp.nScheme == INTERNET_SCHEME_FILE)
-        {
-            // decode file path
-            InternetCombineUrl((LPCTSTR)(_bstr_t)pHref->ownerDocument->url, szLocalPath,
-                strUrl, &(dwLen = ARRAYSIZE(strUrl)), ICU_DECODE|ICU_NO_ENCODE|ICU_NO_META);
+    // MsiRecordSetStream needs the file to be closed
+    CloseHandle(hFile.release());
+}
 
-            // check if the file is accessible
-            SmrtFileHandle hFile(
-                CreateFile(urlComp.lpszUrlPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL));
-            if (hFile == INVALID_HANDLE_VALUE)
-                _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
-            return urlComp.lpszUrlPath;
-        }
-        else if (urlComp.nScheme != INTERNET_SCHEME_UNKNOWN)
+//------------------------------------------------------------------------------
+// Delete a folder (path ends with a backslash) and its contents
+//------------------------------------------------------------------------------
+void Xml2Msi::deleteTree(const tstring& dir)
+{
+    tstring findMask = dir + _T("*");
+    WIN32_FIND_DATA ffd;
+    SmrtFindHandle hFind(FindFirstFile(findMask.c_str(), &ffd));
+    while (!hFind.isNull())
+    {
+        tstring path = dir + ffd.cFileName;
+        if ((ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+            DeleteFile(path.c_str());
+        else if (_tcscmp(ffd.cFileName, _T(".")) != 0 && _tcscmp(ffd.cFileName, _T("..")) != 0)
+            deleteTree(path + _T("\\"));
+
+        if (!FindNextFile(hFind, &ffd))
+            break;
+    }
+    FindClose(hFind.release());
+
+    RemoveDirectory(dir.c_str());
+}
+
+//------------------------------------------------------------------------------
+// Stream name of the binary field of a row (empty if it cannot be deferred)
+//------------------------------------------------------------------------------
+tstring Xml2Msi::binaryStreamName(const TableData& data, const std::vector<FieldData>& row)
+{
+    // MSDN: "Binary data is stored with an index name created by 
+    //        concatenating the table name and the values of the 
+    //        record's primary keys using a period delimiter."
+    tstring name;
+    if (data.name == _T("_Streams"))
+    {
+        name = row[0].text;
+    }
+    else
+    {
+        name = data.name;
+        for (size_t i = 0; i < data.keys.size(); ++i)
         {
-            // need to download to temporary file
-            _TCHAR strTempDir[_MAX_PATH];
-            _TCHAR strTempFile[_MAX_PATH];
-            GetTempPath(_MAX_PATH, strTempDir);
-            GetTempFileName(strTempDir, _T("bin"), 0, strTempFile);
-            m_tempPath = strTempFile;
-            SmrtFileHandle hFile(
-                CreateFile(m_tempPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+            if (data.keys[i]) name += _T(".") + row[i].text;
+        }
+    }
 
-            if (hFile == INVALID_HANDLE_VALUE)
-                _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+    // compound file stream names are limited to 31 characters
+    if (encodeStreamName((LPCWSTR)_bstr_t(name.c_str())).size() > 31)
+        return tstring();
 
-            // open internet connection
-            SmrtHInternet hInet(
-                InternetOpen(_T("xml2msi"), INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0));
-            if (hInet.isNull()) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+    return name;
+}
 
-            SmrtHInternet hInetFile(
-                InternetOpenUrl(hInet, strUrl, NULL, 0, INTERNET_FLAG_EXISTING_CONNECT, 0));
-            if (hInetFile.isNull()) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+//------------------------------------------------------------------------------
+// Empty file standing in for a stream that is written after the commit
+//------------------------------------------------------------------------------
+tstring Xml2Msi::emptyStreamPath()
+{
+    if (m_emptyPath.empty())
+    {
+        _TCHAR strTmpDir[_MAX_PATH];
+        _TCHAR strTmpFile[_MAX_PATH];
+        GetTempPath(_MAX_PATH, strTmpDir);
+        GetTempFileName(strTmpDir, _T("bin"), 0, strTmpFile);
+        m_emptyPath = strTmpFile;
+    }
 
+    return m_emptyPath;
+}
 
-            // Read data
-            for (;;) 
-            {
-                BYTE buf[1024];
-                DWORD dwLen = sizeof(buf);
-                if (!InternetReadFile(hInetFile, (LPVOID)buf, dwLen, &dwLen))
-                    _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
-                if (dwLen == 0) break;
+//------------------------------------------------------------------------------
+// Read a file into a scratch file (native writer)
+//------------------------------------------------------------------------------
+std::shared_ptr<ScratchFile> Xml2Msi::loadStream(const tstring& path)
+{
+    SmrtFileHandle hFile(
+        CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    if (hFile == INVALID_HANDLE_VALUE)
+        _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
 
-                // save to temporary file
-                if (WriteFile(hFile, (LPVOID)buf, dwLen, &dwLen, NULL) == 0)
-                    _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
-            }
+    std::shared_ptr<ScratchFile> stream(new ScratchFile);
+    std::vector<BYTE> buf(1 << 20);
+    for (;;)
+    {
+        DWORD dwLen;
+        if (!ReadFile(hFile, &buf[0], static_cast<DWORD>(buf.size()), &dwLen, NULL))
+            _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+        if (dwLen == 0) break;
+
+        if (stream->write(&buf[0], dwLen) != dwLen)
+            _com_issue_error(E_OUTOFMEMORY);
+    }
+
+    return stream;
+}
+
+//------------------------------------------------------------------------------
+// Convert a string to the database codepage
+//------------------------------------------------------------------------------
+std::string Xml2Msi::encodeString(const tstring& text) const
+{
+#ifdef _UNICODE
+    UINT codepage = m_codepage ? m_codepage : CP_ACP;
+    int len = WideCharToMultiByte(codepage, 0, text.c_str(), static_cast<int>(text.size()), NULL, 0, NULL, NULL);
+    std::string str(len, '\0');
+    if (len > 0)
+        WideCharToMultiByte(codepage, 0, text.c_str(), static_cast<int>(text.size()), &str[0], len, NULL, NULL);
+    return str;
+#else
+    return text;
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Close the database and write the deferred streams to its storage
+//
+// MsiRecordSetStream only accepts file names. Binary fields kept in memory
+// are therefore inserted with an empty stream, and the data is written to
+// the streams of the compound file afterwards, under the encoded names
+// Windows Installer uses for these rows. '_Streams' rows are not inserted
+// at all, as they only list the streams of the storage.
+//------------------------------------------------------------------------------
+void Xml2Msi::writePendingStreams()
+{
+    if (m_pendingStreams.empty())
+        return;
+
+    // the storage cannot be opened while the database is open
+    MsiCloseHandle(m_db);
+    m_db = 0;
+
+    IStoragePtr storage;
+    HRESULT hr = StgOpenStorageEx(m_outputPath.c_str(), 
+                                  STGM_READWRITE | STGM_SHARE_EXCLUSIVE | STGM_TRANSACTED, 
+                                  STGFMT_STORAGE, 0, NULL, NULL, IID_IStorage, 
+                                  reinterpret_cast<void**>(&storage));
+    if (FAILED(hr)) _com_issue_error(hr);
 
-            return m_tempPath.c_str();
+    std::vector<BYTE> buf(1 << 20);
+    for (StreamMap::const_iterator it = m_pendingStreams.begin(); it != m_pendingStreams.end(); ++it)
+    {
+        std::wstring name = encodeStreamName((LPCWSTR)_bstr_t(it->first.c_str()));
+        IStreamPtr stream;
+        hr = storage->CreateStream(name.c_str(), STGM_CREATE | STGM_WRITE | STGM_SHARE_EXCLUSIVE, 0, 0, &stream);
+        if (FAILED(hr)) _com_issue_error(hr);
+
+        ScratchFile& data = *it->second;
+        ULARGE_INTEGER size;
+        size.QuadPart = data.size();
+        hr = stream->SetSize(size);
+        if (FAILED(hr)) _com_issue_error(hr);
+
+        data.seek(0, SEEK_SET);
+        for (size_t n; (n = data.read(&buf[0], buf.size())) > 0; )
+        {
+            ULONG written;
+            hr = stream->Write(&buf[0], static_cast<ULONG>(n), &written);
+            if (FAILED(hr)) _com_issue_error(hr);
+            if (written != n) _com_issue_error(STG_E_MEDIUMFULL);
         }
-        else
+    }
+
+    hr = storage->Commit(STGC_DEFAULT);
+    if (FAILED(hr)) _com_issue_error(hr);
+
+    m_pendingStreams.clear();
+}
+
+//------------------------------------------------------------------------------
+//
+// Resolve HREF relative to base URL
+//
+// Parameters:
+//
+//  href              - href attribute value
+//
+//  baseUrl           - URL of the XML document
+//
+//  tempPath          - receives the path of the temporary local file, 
+//                      if the href points to an external file
+//
+// Returns:
+//
+//  Local file path. Does not access the DOM and may be called from 
+//  worker threads.
+//
+//------------------------------------------------------------------------------
+tstring Xml2Msi::resolveHref(const tstring& href, const tstring& baseUrl, tstring& tempPath) const
+{
+    _TCHAR szLocalPath[_MAX_PATH];
+
+    // build path name
+    _tcscpy_s(szLocalPath, ARRAYSIZE(szLocalPath), href.c_str());
+    if (_tcscspn(szLocalPath, _T(":")) == _tcslen(szLocalPath)) 
+    {
+        _TCHAR drive[_MAX_DRIVE];
+        _TCHAR dir[_MAX_DIR];
+        _TCHAR fname[_MAX_FNAME];
+        _TCHAR ext[_MAX_EXT];
+        _tsplitpath_s(szLocalPath, 
+                      drive, ARRAYSIZE(drive), 
+                      dir, ARRAYSIZE(dir), 
+                      fname, ARRAYSIZE(fname), 
+                      ext, ARRAYSIZE(ext));
+        if (drive[0] == _T('\0') && dir[0] != _T('\\') && m_hrefPrefix[0] != _T('\0')) 
         {
-            if (_tcsncmp(urlComp.lpszScheme, _T("media:"), 6) != 0)
-                _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+            // prepend path prefix
+            _TCHAR dir2[_MAX_DIR];
+            _TCHAR buf[_MAX_PATH];
+            _tcscpy_s(buf, ARRAYSIZE(buf), m_hrefPrefix.c_str());
+            _tcscat_s(buf, ARRAYSIZE(buf), _T("\\"));
+            _tsplitpath_s(buf, drive, ARRAYSIZE(drive), dir2, ARRAYSIZE(dir2), NULL, 0, NULL, 0);
+            _tcscat_s(dir2, ARRAYSIZE(dir2), dir);
+            _tmakepath_s(szLocalPath, ARRAYSIZE(szLocalPath), drive, dir2, fname, ext);
+        }
+    }
+
+    URL_COMPONENTS urlComp;
+    ZeroMemory((PVOID)&urlComp, sizeof(URL_COMPONENTS));
+    urlComp.dwStructSize = sizeof(URL_COMPONENTS);
+    urlComp.dwSchemeLength = 1;
+    urlComp.dwUrlPathLength = 1;
+
+    _TCHAR strUrl[1024];
+    DWORD dwLen;
+    if (!InternetCombineUrl(baseUrl.c_str(), szLocalPath,
+                            strUrl, &(dwLen = ARRAYSIZE(strUrl)), ICU_DECODE) ||
+        !InternetCrackUrl(strUrl, 0, 0, &urlComp)) 
+    {
+        _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    if (urlComp.nScheme == INTERNET_SCHEME_FILE)
+    {
+        // decode file path
+        InternetCombineUrl(baseUrl.c_str(), szLocalPath,
+            strUrl, &(dwLen = ARRAYSIZE(strUrl)), ICU_DECODE|ICU_NO_ENCODE|ICU_NO_META);
+
+        // check if the file is accessible
+        SmrtFileHandle hFile(
+            CreateFile(urlComp.lpszUrlPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL));
+        if (hFile == INVALID_HANDLE_VALUE)
+            _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+        return urlComp.lpszUrlPath;
+    }
+    else if (urlComp.nScheme != INTERNET_SCHEME_UNKNOWN)
+    {
+        // need to download to temporary file
+        _TCHAR strTempDir[_MAX_PATH];
+        _TCHAR strTempFile[_MAX_PATH];
+        GetTempPath(_MAX_PATH, strTempDir);
+        GetTempFileName(strTempDir, _T("bin"), 0, strTempFile);
+        tempPath = strTempFile;
+        SmrtFileHandle hFile(
+            CreateFile(tempPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+
+        if (hFile == INVALID_HANDLE_VALUE)
+            _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
 
-            // decode file path
-            InternetCombineUrl((LPCTSTR)(_bstr_t)pHref->ownerDocument->url, szLocalPath,
-                strUrl, &(dwLen = ARRAYSIZE(strUrl)), ICU_DECODE|ICU_NO_ENCODE|ICU_NO_META);
+        // open internet connection
+        SmrtHInternet hInet(
+            InternetOpen(_T("xml2msi"), INTERNET_OPEN_TYPE_PRECONFIG, NULL, NULL, 0));
+        if (hInet.isNull()) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
 
-            _bstr_t dir(m_tempCabDir.c_str());
-            dir += urlComp.lpszUrlPath;
+        SmrtHInternet hInetFile(
+            InternetOpenUrl(hInet, strUrl, NULL, 0, INTERNET_FLAG_EXISTING_CONNECT, 0));
+        if (hInetFile.isNull()) _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
 
-            SmrtFileHandle hFile(
-                CreateFile(dir, GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
 
-            if (hFile == INVALID_HANDLE_VALUE)
+        // Read data
+        for (;;) 
+        {
+            BYTE buf[1024];
+            DWORD dwLen = sizeof(buf);
+            if (!InternetReadFile(hInetFile, (LPVOID)buf, dwLen, &dwLen))
                 _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+            if (dwLen == 0) break;
 
-            return (LPCTSTR)dir;
+            // save to temporary file
+            if (WriteFile(hFile, (LPVOID)buf, dwLen, &dwLen, NULL) == 0)
+                _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
         }
+
+        return tempPath;
     }
-    catch (...) 
+    else
     {
-        tcerr << color::red << _T("Invalid href to ") << (LPCTSTR)(_bstr_t)pHref->nodeValue << color::base << std::endl;
-        throw;
+        if (_tcsncmp(urlComp.lpszScheme, _T("media:"), 6) != 0)
+            _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+
+        // decode file path
+        InternetCombineUrl(baseUrl.c_str(), szLocalPath,
+            strUrl, &(dwLen = ARRAYSIZE(strUrl)), ICU_DECODE|ICU_NO_ENCODE|ICU_NO_META);
+
+        _bstr_t dir(m_tempCabDir.c_str());
+        dir += urlComp.lpszUrlPath;
+
+        SmrtFileHandle hFile(
+            CreateFile(dir, GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+
+        if (hFile == INVALID_HANDLE_VALUE)
+            _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+
+        return (LPCTSTR)dir;
     }
 }
 
@@ -1387,71 +3655,36 @@ tstring Xml2Msi::resolveHref(xml::IXMLDOMNode* hrefNode)
 // Format SQL column specification
 //
 //------------------------------------------------------------------------------
-tstring Xml2Msi::buildSQLColSpec(xml::IXMLDOMNode* columnNode)
+tstring Xml2Msi::buildSQLColSpec(const tstring& column, const tstring& def, const ColumnSchema& schema)
 {
-    tostringstream ossSQL;
-
-    if (columnNode->attributes->getNamedItem(L"def") == NULL) 
-    {
-        tcerr << color::red << _T("Missing column definition for column \"") << (LPCTSTR)columnNode->text << _T("\"") << color::base << std::endl;
-        _com_issue_error(E_FAIL);
-    }
-
-    ossSQL << _T("`") << (LPCTSTR)columnNode->text << _T("` ");
-
-    tstring str((LPCTSTR)(bstr_t)columnNode->attributes->getNamedItem(L"def")->nodeValue);
+    if (schema.error != ColumnSchema::errNone)
+        throw WriteError(tstring(columnError(schema.error)) + _T(": ") + def);
 
-    int lLen;
-    tistringstream iss(str);
-    iss.ignore(1) >> lLen;
+    tostringstream ossSQL;
+    ossSQL << _T("`") << column << _T("` ");
 
-    switch (tolower(str[0])) 
+    switch (schema.type) 
     {
-    case 's':  // string
-        // fall through !
-    case 'l':  // string (localizable)
-        if (lLen == 0) 
+    case ColumnSchema::typeString:
+        if (schema.width == 0) 
             ossSQL << _T("LONGCHAR");
-        else if (lLen > 0 && lLen < 256)
-            ossSQL << _T("CHAR(") << lLen << _T(")");
-        else 
-        {
-            tcerr << color::red << _T("Invalid string length specified: ") << str << color::base << std::endl;
-            _com_issue_error(E_FAIL);
-        }
+        else
+            ossSQL << _T("CHAR(") << schema.width << _T(")");
         break;
 
-    case 'i':  // integer
-        if (lLen == 2)
-            ossSQL << _T("SHORT");
-        else if (lLen == 4)
-            ossSQL << _T("LONG");
-        else 
-        {
-            tcerr << color::red << _T("Invalid integer size specified: ") << str << color::base << std::endl;
-            _com_issue_error(E_FAIL);
-        }
+    case ColumnSchema::typeInteger:
+        ossSQL << (schema.width == 2 ? _T("SHORT") : _T("LONG"));
         break;
 
-    case 'v':  // binary stream
-        if (lLen != 0) 
-        {
-            tcerr << color::red << _T("Error in binary stream specification: ") << str << color::base << std::endl;
-            _com_issue_error(E_FAIL);
-        }
+    case ColumnSchema::typeBinary:
         ossSQL << _T("OBJECT");
-        break;;
-
-    default:
-        tcerr << color::red << _T("Invalid field definition: ") << str << color::base << std::endl;
-        _com_issue_error(E_FAIL);
         break;
     }
 
-    if (_istlower(str[0]))
+    if (!schema.nullable)
         ossSQL << _T(" NOT NULL");
 
-    if (tolower(str[0]) == 'l')
+    if (schema.localizable)
         ossSQL << _T(" LOCALIZABLE");
 
     return ossSQL.str();
@@ -1497,7 +3730,10 @@ void Xml2Msi::createSummaryInfo()
     m_currentTable.erase();
 
     SmrtMsiHandle hSumInfo;
-    OK(MsiGetSummaryInformation(m_db, NULL, 17, &hSumInfo));
+    if (!m_writer.get())
+    {
+        OK(MsiGetSummaryInformation(m_db, NULL, 17, &hSumInfo));
+    }
 
     xml::IXMLDOMNodeListPtr pSumInfoNodes(m_doc->selectNodes(L"/msi/summary/*"));
     xml::IXMLDOMNodePtr pSumInfoNode;
@@ -1526,12 +3762,25 @@ void Xml2Msi::createSummaryInfo()
         case VT_I2:        // 2 byte signed int
             // fall through !
         case VT_I4:        // 4 byte signed int
+            if (m_writer.get())
+            {
+                m_writer->setSummaryInteger(i, szSumInfoTags[i - 1].nType == VT_I2 ? MsiWriter::propI2 : MsiWriter::propI4,
+                                            _ttoi((LPCTSTR)pSumInfoNode->text));
+                break;
+            }
+
             OK(MsiSummaryInfoSetProperty(hSumInfo, i, szSumInfoTags[i - 1].nType,
                 _ttoi((LPCTSTR)pSumInfoNode->text),
                 NULL, NULL));
             break;
 
         case VT_LPSTR:     // null terminated string
+            if (m_writer.get())
+            {
+                m_writer->setSummaryString(i, encodeString((LPCTSTR)pSumInfoNode->text));
+                break;
+            }
+
             OK(MsiSummaryInfoSetProperty(hSumInfo, i, szSumInfoTags[i - 1].nType,
                 NULL, NULL, (LPCTSTR)pSumInfoNode->text));
             break;
@@ -1565,6 +3814,12 @@ void Xml2Msi::createSummaryInfo()
                     _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
                 }
 
+                if (m_writer.get())
+                {
+                    m_writer->setSummaryTime(i, (static_cast<ULONGLONG>(ftValue.dwHighDateTime) << 32) | ftValue.dwLowDateTime);
+                    break;
+                }
+
                 OK(MsiSummaryInfoSetProperty(hSumInfo, i, szSumInfoTags[i - 1].nType,
                     NULL, &ftValue, NULL));
             }
@@ -1576,7 +3831,10 @@ void Xml2Msi::createSummaryInfo()
         }
     }
 
-    OK(MsiSummaryInfoPersist(hSumInfo));
+    if (!m_writer.get())
+    {
+        OK(MsiSummaryInfoPersist(hSumInfo));
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -1585,35 +3843,21 @@ void Xml2Msi::createSummaryInfo()
 //
 // Parameters:
 //
-//  pData             - Pointer to data
+//  md5Node           - XMLDOMNode pointer to <td> element
 //
-//  nLen              - Length of data.
-//
-//  pTd               - XMLDOMNode pointer to <td> element
+//  digest            - MD5 digest of the data
 //
 //  m_currentRow, m_currentCol         - location of node for error reporting
 //
 //------------------------------------------------------------------------------
-void Xml2Msi::checkMD5(xml::IXMLDOMNode* md5Node, const void* data, int len, int size)
+void Xml2Msi::checkMD5(xml::IXMLDOMNode* md5Node, const tstring& digest)
 {
     if (md5Node->attributes->getNamedItem(L"md5") == NULL)
         return ;
 
-    MD5_CTX ctx;
-    MD5Init(&ctx);
-    MD5Update(&ctx, data, len, size);
-    MD5Final(&ctx);
-
     _bstr_t bstrMD5(md5Node->attributes->getNamedItem(L"md5")->nodeValue);
 
-    _TCHAR szCtx[33];
-    int j;
-    for (j = 0; j < 16; ++j) 
-    {
-        _stprintf_s(szCtx + 2 * j, ARRAYSIZE(szCtx) - 2 * j, _T("%02x"), ctx.digest[j]);
-    }
-
-    szCtx[2*j] = _T('\0');
+    LPCTSTR szCtx = digest.c_str();
     if (_tcsicmp(szCtx, (LPCTSTR)bstrMD5) != 0) 
     {
         _bstr_t bstrTable(md5Node->parentNode->parentNode->attributes->getNamedItem(L"name")->nodeValue);
@@ -1641,6 +3885,268 @@ void Xml2Msi::checkMD5(xml::IXMLDOMNode* md5Node, const void* data, int len, int
     }
 }
 
+//------------------------------------------------------------------------------
+// Format an MD5 digest as hex string
+//------------------------------------------------------------------------------
+static tstring hexDigest(const MD5_CTX& ctx)
+{
+    _TCHAR szCtx[33];
+    int j;
+    for (j = 0; j < 16; ++j) 
+    {
+        _stprintf_s(szCtx + 2 * j, ARRAYSIZE(szCtx) - 2 * j, _T("%02x"), ctx.digest[j]);
+    }
+
+    szCtx[2*j] = _T('\0');
+    return szCtx;
+}
+
+//------------------------------------------------------------------------------
+// Compute MD5 digest (hex string)
+//------------------------------------------------------------------------------
+tstring Xml2Msi::md5Digest(const void* data, int len, int size)
+{
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+    MD5Update(&ctx, data, len, size);
+    MD5Final(&ctx);
+    return hexDigest(ctx);
+}
+
+//------------------------------------------------------------------------------
+tstring Xml2Msi::md5Digest(ScratchFile& stream)
+{
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+
+    std::vector<BYTE> buf(1 << 20);
+    stream.seek(0, SEEK_SET);
+    for (size_t n; (n = stream.read(&buf[0], buf.size())) > 0; )
+    {
+        MD5Update(&ctx, &buf[0], static_cast<int>(n), sizeof(BYTE));
+    }
+
+    MD5Final(&ctx);
+    return hexDigest(ctx);
+}
+
+//------------------------------------------------------------------------------
+// Open the databases referenced by msi-stream: hrefs
+//
+// They are opened before the output is created, since the output may
+// replace one of them.
+//------------------------------------------------------------------------------
+void Xml2Msi::openSourceDatabases()
+{
+    xml::IXMLDOMNodeListPtr hrefs(m_doc->selectNodes(L"/msi/table/row/td/@href[starts-with(., 'msi-stream:')]"));
+    for (xml::IXMLDOMNodePtr node = hrefs->nextNode(); node != NULL; node = hrefs->nextNode())
+    {
+        tstring href = (LPCTSTR)(_bstr_t)node->nodeValue;
+
+        // an invalid href is reported with its location by sourceStream()
+        tstring::size_type pos = href.rfind(_T('#'));
+        if (pos != tstring::npos && pos > 11)
+            sourceDatabase(href.substr(11, pos - 11), href);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Open a database referenced by msi-stream: hrefs (once)
+//
+// If the output replaces the database, a copy of it is opened instead.
+//------------------------------------------------------------------------------
+MSIHANDLE Xml2Msi::sourceDatabase(const tstring& database, const tstring& href)
+{
+    DatabaseMap::const_iterator itDb = m_sourceDatabases.find(database);
+    if (itDb != m_sourceDatabases.end())
+        return itDb->second;
+
+    tstring path, tempPath;
+    try
+    {
+        path = resolveHref(database, (LPCTSTR)m_doc->url, tempPath);
+    }
+    catch (const _com_error&)
+    {
+        tcerr << color::red << _T("Invalid href to ") << href << color::base << std::endl;
+        throw;
+    }
+
+    if (!tempPath.empty()) 
+    {
+        // a downloaded database cannot be fingerprinted
+        m_downloads.push_back(tempPath);
+        if (m_fingerprint.get())
+            m_fingerprint->setVolatile();
+    }
+    else if (_tcsicmp(path.c_str(), m_outputPath.c_str()) == 0)
+    {
+        tempPath = m_tempCabDir + _T("source.msi");
+        if (!CopyFile(path.c_str(), tempPath.c_str(), FALSE))
+            _com_issue_error(HRESULT_FROM_WIN32(GetLastError()));
+        path = tempPath;
+    }
+    else if (m_fingerprint.get())
+    {
+        // the output depends on the whole database
+        m_fingerprint->addInput(path);
+    }
+
+    MSIHANDLE hDb = 0;
+    UINT res = MsiOpenDatabase(path.c_str(), MSIDBOPEN_READONLY, &hDb);
+    if (res != ERROR_SUCCESS)
+    {
+        tcerr << color::red << _T("Unable to open database \"") << path << _T("\"") << color::base << std::endl;
+        _com_issue_error(HRESULT_FROM_WIN32(res));
+    }
+
+    m_sourceDatabases[database] = hDb;
+    return hDb;
+}
+
+//------------------------------------------------------------------------------
+// Copy a stream of another database
+//
+// The href names the database, relative to the XML file, and the stream,
+// e.g. "msi-stream:source.msi#Binary.Foo". The stream is copied into a
+// scratch file as it is, and its MD5 digest is computed on the way, so its
+// data never passes through the XML document. Each database is opened once.
+//------------------------------------------------------------------------------
+std::shared_ptr<ScratchFile> Xml2Msi::sourceStream(const tstring& href, tstring& digest)
+{
+    tstring::size_type pos = href.rfind(_T('#'));
+    if (pos == tstring::npos || pos <= 11)
+    {
+        tcerr << color::red << _T("Invalid href to ") << href << color::base << std::endl;
+        _com_issue_error(E_FAIL);
+    }
+
+    tstring database = href.substr(11, pos - 11);
+    tstring name = href.substr(pos + 1);
+
+    SmrtMsiHandle hView;
+    OK(MsiDatabaseOpenView(sourceDatabase(database, href), _T("SELECT `Data` FROM `_Streams` WHERE `Name` = ?"), &hView));
+
+    SmrtMsiHandle hParams(MsiCreateRecord(1));
+    if (hParams.isNull()) _com_issue_error(E_OUTOFMEMORY);
+    OK(MsiRecordSetString(hParams, 1, name.c_str()));
+    OK(MsiViewExecute(hView, hParams));
+
+    SmrtMsiHandle hRec;
+    if (MsiViewFetch(hView, &hRec) != ERROR_SUCCESS)
+    {
+        tcerr << color::red << _T("Stream \"") << name << _T("\" not found in ") << database << color::base << std::endl;
+        _com_issue_error(E_FAIL);
+    }
+
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+
+    std::shared_ptr<ScratchFile> stream(new ScratchFile);
+    std::vector<char> buf(1 << 20);
+    DWORD len;
+    do
+    {
+        len = static_cast<DWORD>(buf.size());
+        OK(MsiRecordReadStream(hRec, 1, &buf[0], &len));
+        MD5Update(&ctx, &buf[0], len);
+        if (stream->write(&buf[0], len) != len)
+            _com_issue_error(E_OUTOFMEMORY);
+    }
+    while (len == buf.size());
+
+    MD5Final(&ctx);
+    digest = hexDigest(ctx);
+    return stream;
+}
+
+//------------------------------------------------------------------------------
+// Key columns of a table (the stream name, for the '_Streams' table)
+//------------------------------------------------------------------------------
+std::vector<size_t> Xml2Msi::keyColumns(const TableData& data)
+{
+    std::vector<size_t> columns;
+    if (data.name == _T("_Streams"))
+    {
+        columns.push_back(0);
+        return columns;
+    }
+
+    for (size_t i = 0; i < data.keys.size(); ++i)
+    {
+        if (data.keys[i]) columns.push_back(i);
+    }
+    return columns;
+}
+
+//------------------------------------------------------------------------------
+// Primary key of a row for the row index
+//------------------------------------------------------------------------------
+tstring Xml2Msi::rowKey(const TableData& data, const std::vector<FieldData>& row)
+{
+    std::vector<size_t> columns = keyColumns(data);
+    std::vector<tstring> fields;
+    for (size_t i = 0; i < columns.size(); ++i)
+    {
+        fields.push_back(row[columns[i]].text);
+    }
+    return RowIndex::joinKey(fields);
+}
+
+//------------------------------------------------------------------------------
+// Digest of the fields of a row
+//
+// Binary fields are represented by the MD5 digest of their data, or by the
+// cache key of the cabinet they reference.
+//------------------------------------------------------------------------------
+tstring Xml2Msi::rowDigest(const std::vector<FieldData>& row)
+{
+    MD5_CTX ctx;
+    MD5Init(&ctx);
+
+    for (std::vector<FieldData>::const_iterator it = row.begin(); it != row.end(); ++it)
+    {
+        const BinaryField* binary = it->binary.get();
+        const tstring& text = binary == NULL ? it->text 
+                            : !binary->cabinetKey.empty() ? binary->cabinetKey : binary->digest;
+
+        // field type and terminating zero separate the fields
+        _TCHAR type = binary == NULL ? _T('t') : _T('b');
+        MD5Update(&ctx, &type, 1, sizeof(_TCHAR));
+        MD5Update(&ctx, text.c_str(), static_cast<unsigned int>(text.length() + 1), sizeof(_TCHAR));
+    }
+
+    MD5Final(&ctx);
+    return hexDigest(ctx);
+}
+
+//------------------------------------------------------------------------------
+// Digest of the column definitions of a table
+//------------------------------------------------------------------------------
+tstring Xml2Msi::schemaDigest(const TableData& data)
+{
+    tostringstream oss;
+    for (size_t i = 0; i < data.columns.size(); ++i)
+    {
+        oss << data.columns[i] << _T("\t") << data.defs[i] << _T("\t") << data.keys[i] << _T("\n");
+    }
+
+    tstring text = oss.str();
+    return md5Digest(text.c_str(), static_cast<int>(text.length()), sizeof(_TCHAR));
+}
+
+//------------------------------------------------------------------------------
+// Get file version (empty if the file has no version resource)
+//------------------------------------------------------------------------------
+tstring Xml2Msi::fileVersion(const tstring& path)
+{
+    PeVersion version;
+    if (!readPeVersion(path, version))
+        return tstring();
+
+    return (LPCTSTR)_bstr_t(formatVersion(version.fileVersion).c_str());
+}
+
 //------------------------------------------------------------------------------
 // Print banner message
 //------------------------------------------------------------------------------
@@ -1665,7 +4171,8 @@ void Xml2Msi::printBanner() const
 void Xml2Msi::printUsage()
 {
     tcerr << _T("\nUsage: xml2msi [-m] [-p PREFIX] [-c [GUID]] [-d [GUID]] [-e] [-g [GUID]]") << std::endl;
-    tcerr << _T("               [-v VERSION] [-r [VERSION]] [-u [XMLFILE]] [-o MSIFILE] XMLFILE") << std::endl;
+    tcerr << _T("               [-v VERSION] [-r [VERSION]] [-u [XMLFILE]] [-j N] [-z METHOD]") << std::endl;
+    tcerr << _T("               [-k DIR [-K MB]] [-n N] [-t MB] [-N] [-U] [-I] [-X] [-o MSIFILE] XMLFILE") << std::endl;
     tcerr << _T(" -Q --nologo               don't print banner message") << std::endl;
     tcerr << _T(" -q --quiet                quiet processing") << std::endl;
     tcerr << _T(" -m --ignore-md5           treat failed MD5 checks as warnings") << std::endl;
@@ -1677,11 +4184,133 @@ void Xml2Msi::printUsage()
     tcerr << _T(" -v --product-version=VER  update product version with VER") << std::endl;
     tcerr << _T(" -r --upgrade-version=VER  update 'Upgrade' table entry 'VersionMax'") << std::endl;
     tcerr << _T(" -u --update-xml=FILE      write updated XML to FILE") << std::endl;
+    tcerr << _T(" -X --xml-only             only write the updated XML (see -u), without building") << std::endl;
+    tcerr << _T("                           the database") << std::endl;
     tcerr << _T(" -s --set=\"property=value\" set/update property to 'value'") << std::endl;
     tcerr << _T(" -o --output=FILE          write MSI file to FILE") << std::endl;
+    tcerr << _T(" -j --jobs=N               use N worker threads (default: one per processor)") << std::endl;
+    tcerr << _T(" -z --compression=METHOD   compress cabinets with MSZIP, LZX[:WINDOW[:EFFORT]],") << std::endl;
+    tcerr << _T("                           Quantum or none (WINDOW: 15..21, EFFORT: fast, normal,") << std::endl;
+    tcerr << _T("                           max); Quantum cabinets are built in temporary files, and") << std::endl;
+    tcerr << _T("                           -k reuses them whole but never rebuilds them in part") << std::endl;
+    tcerr << _T(" -k --cab-cache=DIR        reuse unchanged cabinets from cache folder DIR") << std::endl;
+    tcerr << _T(" -K --cab-cache-size=MB    limit cabinet cache to MB megabytes (default: 1024, 0: no limit)") << std::endl;
+    tcerr << _T(" -n --folder-files=N       start a new cabinet folder every N files (0: no limit,") << std::endl;
+    tcerr << _T("                           default: 64 with a cabinet cache, no limit otherwise)") << std::endl;
+    tcerr << _T(" -t --scratch-memory=MB    keep up to MB megabytes of temporary cabinet data in") << std::endl;
+    tcerr << _T("                           memory before using temporary files (default: 512)") << std::endl;
+    tcerr << _T(" -N --native               write the database with the built-in writer instead") << std::endl;
+    tcerr << _T("                           of the Windows Installer API") << std::endl;
+    tcerr << _T(" -U --up-to-date           skip the build if neither the XML file, nor a referenced") << std::endl;
+    tcerr << _T("                           file, nor the options changed since the last build") << std::endl;
+    tcerr << _T(" -I --incremental          update the output of the previous incremental build,") << std::endl;
+    tcerr << _T("                           writing only the rows and cabinets that changed") << std::endl;
     tcerr << std::endl;
 }
 
+//------------------------------------------------------------------------------
+// Parse compression method
+//------------------------------------------------------------------------------
+bool Xml2Msi::parseCompression(const tstring& method)
+{
+    // split METHOD[:WINDOW[:EFFORT]]
+    tstring name = method, window, effort;
+    tstring::size_type pos = name.find(_T(':'));
+    bool hasOptions = pos != tstring::npos;
+    if (hasOptions)
+    {
+        window = name.substr(pos + 1);
+        name.erase(pos);
+
+        pos = window.find(_T(':'));
+        if (pos != tstring::npos)
+        {
+            effort = window.substr(pos + 1);
+            window.erase(pos);
+        }
+    }
+
+    if (name != _T("LZX"))
+    {
+        if (hasOptions)
+            return false;
+
+        if      (name == _T("MSZIP"))   m_compression = CabCompress::compMSZIP;
+        else if (name == _T("Quantum")) m_compression = CabCompress::compQuantum;
+        else if (name == _T("none"))    m_compression = CabCompress::compNone;
+        else return false;
+
+        return true;
+    }
+
+    int lzxWindow = 21;
+    if (!window.empty())
+    {
+        _TCHAR* end = NULL;
+        lzxWindow = _tcstol(window.c_str(), &end, 10);
+        if (*end != 0 || lzxWindow < 15 || lzxWindow > 21)
+            return false;
+    }
+
+    CabCompress::LzxEffort lzxEffort = CabCompress::lzxNormal;
+    if      (effort == _T("fast"))                      lzxEffort = CabCompress::lzxFast;
+    else if (effort == _T("max"))                       lzxEffort = CabCompress::lzxMax;
+    else if (effort != _T("normal") && !effort.empty()) return false;
+
+    m_compression = CabCompress::compLZX;
+    m_lzxWindow = lzxWindow;
+    m_lzxEffort = lzxEffort;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Settings that determine the output
+//
+// Options that only affect speed or console output (jobs, cache size,
+// scratch memory, quiet) are left out. GUIDs generated for options given
+// without an argument differ on every run, so such builds never match.
+//------------------------------------------------------------------------------
+tstring Xml2Msi::buildSettings() const
+{
+    tostringstream oss;
+    oss << _T("version=") << moduleVersion() << _T('\n')
+        << _T("input=") << m_inputPath << _T('\n')
+        << _T("output=") << m_outputPath << _T('\n')
+        << _T("xml-output=") << (m_udpateXml ? m_xmlOutputPath : tstring()) << _T('\n')
+        << _T("href-prefix=") << m_hrefPrefix << _T('\n')
+        << _T("check-md5=") << m_checkMD5 << _T('\n')
+        << _T("package-code=") << m_packageCode << _T('\n')
+        << _T("product-code=") << m_productCode << _T('\n')
+        << _T("upgrade-code=") << m_upgradeCode << _T('\n')
+        << _T("product-version=") << m_productVersion << _T('\n')
+        << _T("upgrade-version=") << m_updateUpgradeVersion << _T(",") << m_upgradeVersion << _T('\n')
+        << _T("compression=") << m_compressionOverride << _T('\n')
+        << _T("folder-files=") << m_folderFiles << _T(",") << !m_cabCacheDir.empty() << _T('\n')
+        << _T("native=") << m_native << _T('\n');
+
+    for (PropertyMap::const_iterator it = m_propertyMap.begin(); it != m_propertyMap.end(); ++it)
+    {
+        oss << _T("set=") << it->first << _T("=") << it->second << _T('\n');
+    }
+
+    return oss.str();
+}
+
+//------------------------------------------------------------------------------
+// Settings that affect every table
+//
+// Everything else that determines the output shows up in the rows of the
+// tables, in the cabinet keys, or in the summary information, which is
+// written by every build.
+//------------------------------------------------------------------------------
+tstring Xml2Msi::indexSettings() const
+{
+    tostringstream oss;
+    oss << _T("version=") << moduleVersion() << _T('\n')
+        << _T("codepage=") << m_codepage << _T('\n');
+    return oss.str();
+}
+
 //------------------------------------------------------------------------------
 // Parse command line
 //------------------------------------------------------------------------------
@@ -1693,7 +4322,7 @@ void Xml2Msi::parseCommandLine(int argc, _TCHAR* argv[])
     _TCHAR ext[_MAX_EXT];
 
     // short option string (option letters followed by a colon ':' require an argument)
-    static const _TCHAR optstring[] = _T("lqQmp:o:u:c:d:ev:g:r:s:");
+    static const _TCHAR optstring[] = _T("lqQmNUIXp:o:u:c:d:ev:g:r:s:j:z:k:K:n:t:");
 
     // mapping of long to short arguments
     static const Option longopts[] = 
@@ -1713,6 +4342,16 @@ void Xml2Msi::parseCommandLine(int argc, _TCHAR* argv[])
         { _T("upgrade-version"),    required_argument,  NULL,   _T('r') },
         { _T("set"),                required_argument,  NULL,   _T('s') },
         { _T("output"),             required_argument,  NULL,   _T('o') },
+        { _T("jobs"),               required_argument,  NULL,   _T('j') },
+        { _T("compression"),        required_argument,  NULL,   _T('z') },
+        { _T("cab-cache"),          required_argument,  NULL,   _T('k') },
+        { _T("cab-cache-size"),     required_argument,  NULL,   _T('K') },
+        { _T("folder-files"),       required_argument,  NULL,   _T('n') },
+        { _T("scratch-memory"),     required_argument,  NULL,   _T('t') },
+        { _T("native"),             no_argument,        NULL,   _T('N') },
+        { _T("up-to-date"),         no_argument,        NULL,   _T('U') },
+        { _T("incremental"),        no_argument,        NULL,   _T('I') },
+        { _T("xml-only"),           no_argument,        NULL,   _T('X') },
         { NULL,                     0,                  NULL,   0       }
     };
 
@@ -1754,6 +4393,69 @@ void Xml2Msi::parseCommandLine(int argc, _TCHAR* argv[])
             }
             break;
 
+        case _T('j'):  // number of worker threads
+            if (optarg) 
+            {
+                m_jobs = _tcstoul(optarg, NULL, 10);
+            }
+            break;
+
+        case _T('z'):  // compression method
+            if (optarg == NULL || !parseCompression(optarg))
+            {
+                printBanner();
+                tcerr << color::red << _T("Invalid compression method") << color::base << std::endl << std::endl;
+                printUsage();
+                exit(2);
+            }
+            m_compressionOverride = optarg;
+            break;
+
+        case _T('k'):  // cabinet cache directory
+            if (optarg) 
+            {
+                m_cabCacheDir = optarg;
+            }
+            break;
+
+        case _T('K'):  // cabinet cache size limit (MB)
+            if (optarg) 
+            {
+                m_cabCacheSize = static_cast<ULONGLONG>(_tcstoul(optarg, NULL, 10)) << 20;
+            }
+            break;
+
+        case _T('n'):  // files per cabinet folder
+            if (optarg) 
+            {
+                m_folderFiles = static_cast<int>(_tcstoul(optarg, NULL, 10));
+            }
+            break;
+
+        case _T('t'):  // memory for temporary cabinet data (MB)
+            if (optarg) 
+            {
+                ScratchFile::setMemoryLimit(static_cast<unsigned long long>(_tcstoul(optarg, NULL, 10)) << 20);
+            }
+            break;
+
+        case _T('N'):  // write database without msi.dll
+            m_native = true;
+            break;
+
+        case _T('U'):  // skip unchanged builds
+            m_upToDateCheck = true;
+            break;
+
+        case _T('I'):  // update the previous output
+            m_incremental = true;
+            break;
+
+        case _T('X'):  // update the XML file only
+            m_xmlOnly = true;
+            m_udpateXml = true;
+            break;
+
         case _T('u'): // xml output file
             m_udpateXml = true;
             if (optarg) m_xmlOutputPath = optarg;
@@ -1988,28 +4690,14 @@ tstring Xml2Msi::parseVersion(LPCTSTR argument)
         versionFile = currentDir + tstring(_T("\\")) + versionFile;
     }
     
-    DWORD dw; 
-    DWORD len = GetFileVersionInfoSize(const_cast<LPTSTR>(versionFile.c_str()), &dw);
-    if (len == 0)
+    PeVersion version;
+    if (!readPeVersion(versionFile, version))
     {
         tcerr << color::red << _T("Invalid version argument '") << argument << _T("'") << color::base << std::endl;
         exit(2);
     }
 
-    std::vector<_TCHAR> buf(len);
-    GetFileVersionInfo(const_cast<LPTSTR>(versionFile.c_str()), 0, len, &buf[0]);
-    unsigned int vlen;
-    LPVOID lpvi;
-    VerQueryValue(&buf[0], _T("\\"), &lpvi, &vlen);
-
-    VS_FIXEDFILEINFO fileInfo;
-    fileInfo = *reinterpret_cast<VS_FIXEDFILEINFO*>(lpvi);
-    tostringstream s;
-    s << (unsigned)HIWORD(fileInfo.dwFileVersionMS) << _T(".")
-      << (unsigned)LOWORD(fileInfo.dwFileVersionMS) << _T(".")
-      << (unsigned)HIWORD(fileInfo.dwFileVersionLS) << _T(".")
-      << (unsigned)LOWORD(fileInfo.dwFileVersionLS);
-    return s.str();
+    return (LPCTSTR)_bstr_t(formatVersion(version.fileVersion).c_str());
 }
 
 //------------------------------------------------------------------------------
@@ -31,6 +31,14 @@
 #endif // _MSC_VER > 1000
 
 #include "CabCompress.h"
+#include "CabCache.h"
+#include "Fingerprint.h"
+#include "MsiWriter.h"
+#include "RowIndex.h"
+#include "Schema.h"
+
+class ScratchFile;
+class IdtWriter;
 
 class Xml2Msi
 {
@@ -47,14 +55,17 @@ public:
     // update info from command line
     void                        update();
 
-    // validate table
-    void                        validateTable(xml::IXMLDOMNode* table);
+    // update the XML file from command line, without building the database
+    void                        updateXml();
+
+    // validate all tables before the database is written
+    void                        validateTables();
 
-    // create table
-    void                        createTable(xml::IXMLDOMNode* table);
+    // create and populate all tables
+    void                        populateTables();
 
-    // populate table
-    void                        populateTable(xml::IXMLDOMNode* table);
+    // drop a table, if it exists
+    void                        dropTable(const tstring& name);
 
     // create summary information stream
     void                        createSummaryInfo();
@@ -62,11 +73,11 @@ public:
     // create CABs
     void                        buildCabinets();
 
-    // compress files into cabinet
-    bool                        compressFiles(LPCTSTR cabinetName, int firstSequence, int lastSequence);
+    // scan all files referenced by the 'File' table
+    void                        ingestFiles();
 
-    // check MD5 finger print
-    void                        checkMD5(xml::IXMLDOMNode* md5Node, const void* data, int len, int size);
+    // check MD5 finger print against a precomputed digest
+    void                        checkMD5(xml::IXMLDOMNode* md5Node, const tstring& digest);
 
     // get current table
     tstring                     currentTable() const { return m_currentTable; }
@@ -78,11 +89,242 @@ public:
     int                         currentColumn() const { return m_currentCol; }
 
 private:
-    // resolve hrefs
-    tstring                     resolveHref(xml::IXMLDOMNode* hrefNode);
+    // information gathered about a file referenced by the 'File' table
+    struct FileInfo
+    {
+        xml::IXMLDOMNodePtr     row;        // row in 'File' table
+        xml::IXMLDOMNodePtr     hashRow;    // row in 'MsiFileHash' table (if any)
+        tstring                 name;       // file key
+        tstring                 href;       // file reference
+        tstring                 path;       // resolved local path
+        tstring                 tempPath;   // downloaded temporary file (if any)
+        tstring                 md5;        // MD5 digest
+        tstring                 version;    // file version
+        LARGE_INTEGER           size;       // file size
+        ULONG                   hash[4];    // MSI file hash
+        int                     sequence;   // sequence number
+        bool                    checkMD5;   // validate MD5 digest
+        bool                    getMD5;     // compute MD5 digest
+        bool                    getVersion; // determine file version (not a companion file)
+        bool                    getHash;    // compute MSI file hash
+        bool                    resolved;   // href was resolved
+        bool                    sizeKnown;  // size was determined
+        HRESULT                 hr;         // scan result
+    };
+
+    // cabinet built from a range of the 'File' table
+    struct CabinetInfo
+    {
+        tstring                 name;       // cabinet name
+        bool                    internal;   // cabinet is stored in the database
+        bool                    build;      // cabinet is to be built
+        bool                    cached;     // cabinet was taken from the cabinet cache
+        bool                    kept;       // cabinet of the previous output is current (incremental build)
+        std::vector<size_t>     files;      // indices into m_files
+        tstring                 key;        // cabinet cache key
+        tstring                 basePath;   // previous cabinet for a delta rebuild (if any)
+        std::string             baseManifest; // files of previous cabinet (name, size and MD5 per line)
+        size_t                  reused;     // number of files copied from the previous cabinet
+        std::shared_ptr<ScratchFile> stream; // cabinet data (internal cabinets built in memory)
+        std::string             error;      // compression error
+        std::string             warning;    // reason the previous cabinet was not reused (if any)
+    };
+
+    // field of a row, as far as validation is concerned
+    struct CellInfo
+    {
+        tstring                 text;       // content of integer fields
+        bool                    empty;      // no content
+        bool                    href;       // href attribute present
+    };
+
+    // table copied from the DOM for validation
+    struct TableInfo
+    {
+        tstring                 name;       // table name
+        std::vector<tstring>    columns;    // column names
+        std::vector<tstring>    defs;       // column definitions (empty if missing)
+        std::vector<ColumnSchema> schema;   // parsed column definitions
+        std::vector<bool>       keys;       // primary key columns
+        std::vector<std::vector<CellInfo> > rows; // fields of each row
+        std::vector<tstring>    errors;     // validation errors
+    };
+
+    // binary field copied from the DOM, decoded before it is written
+    struct BinaryField
+    {
+        std::string             base64;     // inline data, until decoded
+        std::shared_ptr<ScratchFile> stream;// data kept in memory (NULL: external file)
+        tstring                 href;       // href of external data
+        tstring                 path;       // local file of external data
+        tstring                 tempPath;   // downloaded temporary file (if any)
+        size_t                  size;       // size of inline data from the "size" attribute (0: unknown)
+        tstring                 md5;        // expected MD5 digest (empty: none)
+        tstring                 digest;     // computed MD5 digest
+        tstring                 cabinetKey; // cache key of a cabinet referenced by media: (incremental build)
+        bool                    kept;       // cabinet of the previous output, not written again
+        tstring                 error;      // decode error message (if any)
+        HRESULT                 hr;         // decode result
+    };
+
+    // field of a row handed to the writer stage
+    struct FieldData
+    {
+        tstring                 text;       // content of text fields
+        std::shared_ptr<BinaryField> binary;// binary data (NULL: text field or empty)
+    };
+
+    // table handed from the parse-and-decode stage to the writer stage
+    struct TableData
+    {
+        tstring                 name;       // table name
+        std::vector<tstring>    columns;    // column names
+        std::vector<tstring>    defs;       // column definitions
+        std::vector<ColumnSchema> schema;   // parsed column definitions
+        std::vector<bool>       keys;       // primary key columns
+        std::vector<std::vector<FieldData> > rows; // fields of each row
+    };
+
+    // error of the writer stage, printed by the main thread
+    struct WriteError
+    {
+        explicit WriteError(const tstring& message) : message(message) {}
+
+        tstring                 message;
+    };
+
+    // check the structure of the loaded document (false: error set)
+    bool                        validateDocument(tstring& error) const;
+
+    // find the line and column of a structural error with the streaming parser
+    // (false if the document cannot be read that way)
+    static bool                 locateError(const tstring& path, unsigned& line, unsigned& column);
+
+    // print a parse or validation error and fail
+    void                        parseError(long line, long column, const tstring& reason) const;
+
+    // copy a table from the DOM
+    void                        extractTable(xml::IXMLDOMNode* table, TableData& data);
+
+    // decode a binary field and compute its MD5 digest (thread safe, no DOM access)
+    void                        decodeField(BinaryField& field) const;
+
+    // report decode errors and check the MD5 digests of a table
+    void                        checkFields(xml::IXMLDOMNode* table, const TableData& data);
+
+    // create and populate a table (writer stage)
+    void                        writeTable(const TableData& data);
+
+    // write the rows of a table that changed since the previous output (writer stage)
+    void                        updateTable(const TableData& data);
+
+    // delete rows by their primary keys, as recorded in the row index (writer stage)
+    void                        deleteRows(const TableData& data, const std::vector<tstring>& keys);
+
+    // drop the tables of the previous output that are no longer in the XML file
+    void                        dropRemovedTables();
+
+    // create table (writer stage)
+    void                        createTable(const TableData& data);
+
+    // populate table (writer stage)
+    void                        populateTable(const TableData& data);
+
+    // write the rows of a table to an IDT file and import it (false: the import failed)
+    bool                        importTable(const TableData& data);
+
+    // insert the rows of a table (into idt, if given)
+    void                        insertRows(const TableData& data, IdtWriter* idt);
+
+    // copy a table from the DOM, supplying missing standard column definitions
+    void                        collectTable(xml::IXMLDOMNode* table, TableInfo& info);
+
+    // validate a table (thread safe, no DOM access)
+    static void                 validateTable(TableInfo& info);
+
+    // scan a single file (thread safe, no DOM access)
+    void                        scanFile(FileInfo& file) const;
+
+    // collect files of a cabinet
+    void                        collectFiles(CabinetInfo& cabinet, int firstSequence, int lastSequence);
+
+    // compress files into cabinet (thread safe, no DOM access)
+    void                        compressFiles(CabinetInfo& cabinet, unsigned jobs, CabCache* cache) const;
+
+    // compute the cabinet cache key from the files and compression settings
+    tstring                     cabinetKey(const CabinetInfo& cabinet) const;
+
+    // update compression flags of the files in a cabinet
+    void                        updateCompressionFlags(const CabinetInfo& cabinet, UINT wordcount);
+
+    // in-memory cabinet referenced by a media: href (NULL if none)
+    std::shared_ptr<ScratchFile> cabinetStream(xml::IXMLDOMNode* hrefNode) const;
+
+    // open the databases referenced by msi-stream: hrefs
+    void                        openSourceDatabases();
+
+    // open a database referenced by msi-stream: hrefs, unless it is open
+    MSIHANDLE                   sourceDatabase(const tstring& database, const tstring& href);
+
+    // copy a stream of another database referenced by an msi-stream: href, and compute its MD5 digest
+    std::shared_ptr<ScratchFile> sourceStream(const tstring& href, tstring& digest);
+
+    // write a scratch file to the temporary file and return its path
+    tstring                     spillStream(ScratchFile& stream);
+
+    // write a scratch file to a file
+    static void                 saveStream(ScratchFile& stream, const tstring& path);
+
+    // delete a folder and its contents
+    static void                 deleteTree(const tstring& dir);
+
+    // compute MD5 digest of a scratch file
+    static tstring              md5Digest(ScratchFile& stream);
+
+    // stream name of the binary field of a row (empty if it cannot be deferred)
+    static tstring              binaryStreamName(const TableData& data, const std::vector<FieldData>& row);
+
+    // key columns of a table, in the order of the row index
+    static std::vector<size_t>  keyColumns(const TableData& data);
+
+    // primary key of a row for the row index
+    static tstring              rowKey(const TableData& data, const std::vector<FieldData>& row);
+
+    // digest of the fields of a row for the row index
+    static tstring              rowDigest(const std::vector<FieldData>& row);
+
+    // digest of the column definitions of a table for the row index
+    static tstring              schemaDigest(const TableData& data);
+
+    // empty file standing in for a stream that is written after the commit
+    tstring                     emptyStreamPath();
+
+    // read a file into a scratch file (native writer)
+    static std::shared_ptr<ScratchFile> loadStream(const tstring& path);
+
+    // convert a string to the database codepage
+    std::string                 encodeString(const tstring& text) const;
+
+    // close the database and write the deferred streams to its storage
+    void                        writePendingStreams();
+
+    // resolve an href relative to a base URL (thread safe, no DOM access)
+    tstring                     resolveHref(const tstring& href, const tstring& baseUrl, tstring& tempPath) const;
+
+    // compute MD5 digest
+    static tstring              md5Digest(const void* data, int len, int size);
+
+    // get version of a file
+    static tstring              fileVersion(const tstring& path);
 
     // build an SQL column specification
-    tstring                     buildSQLColSpec(xml::IXMLDOMNode* columnNode);
+    static tstring              buildSQLColSpec(const tstring& column, const tstring& def, const ColumnSchema& schema);
+
+    // settings that determine the output, for the build fingerprint
+    tstring                     buildSettings() const;
+
+    // settings that affect every table, for the row index
+    tstring                     indexSettings() const;
 
     // parse command line
     void                        parseCommandLine(int argc, _TCHAR* argv[]);
@@ -96,6 +338,9 @@ private:
     // resolve a version argument
     static tstring              parseVersion(LPCTSTR argument);
 
+    // parse a compression method: MSZIP, LZX[:WINDOW[:EFFORT]], Quantum or none
+    bool                        parseCompression(const tstring& method);
+
     // print banner
     void                        printBanner() const;
 
@@ -110,12 +355,19 @@ private:
 
 private:
     typedef std::map<tstring, tstring> PropertyMap;
+    typedef std::vector<FileInfo> FileList;
+    typedef std::map<int, size_t> FileSequenceMap;
+    typedef std::map<tstring, std::shared_ptr<ScratchFile> > StreamMap;
+    typedef std::map<tstring, tstring> CabinetKeyMap;
+    typedef std::map<tstring, MSIHANDLE> DatabaseMap;
 
     MSIHANDLE                   m_db;
     xml::IXMLDOMDocument2Ptr    m_doc;
     tstring                     m_tempCabDir;   // temporary directory for cabinets
     tstring                     m_tempPath;     // temporary file name (will be deleted upon program exit)
+    tstring                     m_emptyPath;    // empty file for deferred streams (will be deleted upon program exit)
     tstring                     m_hrefPrefix;   // href path prefix
+    tstring                     m_baseUrl;      // base URL for hrefs
     tstring                     m_currentTable; // current table
     tstring                     m_inputPath;    // input file
     tstring                     m_outputPath;   // output file
@@ -130,14 +382,42 @@ private:
     PropertyMap                 m_propertyMap;  // property map
     int                         m_currentCol;   // current column
     int                         m_currentRow;   // current row
+    tstring                     m_writerTable;  // current table of the writer stage
+    int                         m_writerCol;    // current column of the writer stage
+    int                         m_writerRow;    // current row of the writer stage
+    std::vector<tstring>        m_writerWarnings; // warnings of the writer stage
+    std::vector<tstring>        m_downloads;    // downloaded binary fields (deleted upon program exit)
     int                         m_quiet;        // quiet level
     CabCompress::Compression    m_compression;  // used compression
+    int                         m_lzxWindow;    // LZX window size (bits)
+    CabCompress::LzxEffort      m_lzxEffort;    // LZX match finder effort
+    tstring                     m_compressionOverride; // compression method from command line
     bool                        m_nologo;       // don't print banner message
     bool                        m_checkMD5;     // check MD5 checksum
     bool                        m_udpateXml;    // write updated XML
+    bool                        m_xmlOnly;      // only update the XML file (no database)
     bool                        m_updateUpgradeVersion;
     bool                        m_mergeModule;  // create MSM merge module
     bool                        m_fixExtension; // need to fix file extension
+    unsigned                    m_jobs;         // number of worker threads (0 = one per processor)
+    tstring                     m_cabCacheDir;  // cabinet cache directory (empty: no cache)
+    int                         m_folderFiles;  // files per cabinet folder (0: no limit, -1: automatic)
+    ULONGLONG                   m_cabCacheSize; // cabinet cache size limit in bytes (0: no limit)
+    bool                        m_native;       // write the database with MsiWriter
+    bool                        m_upToDateCheck;// skip the build if the fingerprint is current
+    std::unique_ptr<Fingerprint> m_fingerprint; // inputs of this build (NULL: no up-to-date check)
+    bool                        m_incremental;  // update the previous output where possible
+    std::unique_ptr<RowIndex>   m_rowIndex;     // rows written by this build (NULL: not incremental)
+    std::unique_ptr<RowIndex>   m_baseIndex;    // rows of the previous output (NULL: full build)
+    std::unique_ptr<MsiWriter>  m_writer;       // native database writer (NULL: Windows Installer API)
+    int                         m_codepage;     // database codepage
+    FileList                    m_files;        // files referenced by the 'File' table
+    FileSequenceMap             m_fileSequences;// sequence number => index into m_files
+    StreamMap                   m_cabinetStreams;// cabinet name => cabinet built in memory
+    CabinetKeyMap               m_cabinetKeys;  // cabinet name => cache key (incremental build)
+    std::set<tstring>           m_keptCabinets; // cabinets left in the previous output
+    StreamMap                   m_pendingStreams;// stream name => data written after commit
+    DatabaseMap                 m_sourceDatabases;// href => database referenced by msi-stream: hrefs
 };
 
 #endif // XML2MSI_H_INCLUDED